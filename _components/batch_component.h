@@ -0,0 +1,90 @@
+#ifndef ESP32_CSI_BATCH_COMPONENT_H
+#define ESP32_CSI_BATCH_COMPONENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Packs several serialized CSI records into one UDP datagram.
+ * A batch is sent when the next record of the same size would push it past the MTU,
+ * or when its oldest record has waited CSI_BATCH_DEADLINE_US, whichever comes first.
+ * Records are self-delimiting (binary records carry their length, text records start
+ * with a "CSI_DATA" line), so the datagram needs no extra framing.
+ */
+#ifdef CONFIG_CSI_BATCH_ENABLE
+#define CSI_BATCH_MTU           CONFIG_CSI_BATCH_MTU
+#define CSI_BATCH_DEADLINE_US   (CONFIG_CSI_BATCH_DEADLINE_MS * 1000)
+#else
+#define CSI_BATCH_MTU           0 // every record is sent on its own
+#define CSI_BATCH_DEADLINE_US   0
+#endif
+
+typedef struct {
+    char *buf;
+    size_t cap;             // buffer size, a single record larger than the MTU still fits
+    size_t mtu;             // max datagram size once the batch holds more than one record
+    size_t len;
+    size_t last_rec_len;
+    int count;
+    int64_t opened_us;      // time the first record was added
+} csi_batch_t;
+
+void batch_init(csi_batch_t *b, char *buf, size_t cap, size_t mtu) {
+    b->buf = buf;
+    b->cap = cap;
+    b->mtu = mtu;
+    b->len = 0;
+    b->last_rec_len = 0;
+    b->count = 0;
+    b->opened_us = 0;
+}
+
+void batch_reset(csi_batch_t *b) {
+    b->len = 0;
+    b->count = 0;
+}
+
+/* Where the next record is serialized. */
+char *batch_tail(csi_batch_t *b) {
+    return b->buf + b->len;
+}
+
+/* Room for the next record, the whole buffer when empty, otherwise up to the MTU. */
+size_t batch_room(const csi_batch_t *b) {
+    if (b->count == 0) {
+        return b->cap;
+    }
+    return b->len < b->mtu ? b->mtu - b->len : 0;
+}
+
+/* Account for a record of n bytes just serialized at batch_tail(). */
+void batch_add(csi_batch_t *b, size_t n, int64_t now_us) {
+    if (b->count == 0) {
+        b->opened_us = now_us;
+    }
+    b->len += n;
+    b->last_rec_len = n;
+    b->count++;
+}
+
+/* True when another record like the last one would not fit, so waiting longer gains nothing. */
+bool batch_full(const csi_batch_t *b) {
+    return b->count > 0 && b->len + b->last_rec_len > b->mtu;
+}
+
+/* True when the oldest record in the batch has waited long enough. */
+bool batch_due(const csi_batch_t *b, int64_t now_us, int64_t deadline_us) {
+    return b->count > 0 && now_us - b->opened_us >= deadline_us;
+}
+
+/* Microseconds until the batch is due, 0 if it already is, -1 if the batch is empty. */
+int64_t batch_time_left(const csi_batch_t *b, int64_t now_us, int64_t deadline_us) {
+    if (b->count == 0) {
+        return -1;
+    }
+    int64_t left = b->opened_us + deadline_us - now_us;
+    return left > 0 ? left : 0;
+}
+
+#endif //ESP32_CSI_BATCH_COMPONENT_H
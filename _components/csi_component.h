@@ -2,7 +2,13 @@
 #define ESP32_CSI_CSI_COMPONENT_H
 
 #include "time_component.h"
-#include "math.h"
+#include "writer_component.h"
+#include "dsp_component.h"
+#include "record_component.h"
+#include "pool_component.h"
+#include "seq_component.h"
+#include "task_component.h"
+#include "serial_component.h"
 
 char *project_type;
 
@@ -12,74 +18,230 @@ char *project_type;
 
 #define CSI_TYPE CSI_RAW
 
-void _wifi_csi_cb(void *ctx, wifi_csi_info_t *data) {
+// one line of the default callback, the raw format needs about 1 KB.
+#define CSI_LINE_BUF_SIZE 1536
+static char csi_line_buf[CSI_LINE_BUF_SIZE];
+
+/*
+ * The CSV line of the default callback for one frame, in the columns of _print_csi_csv_header().
+ * Returns the line length, or -1 if it does not fit into cap bytes.
+ */
+int csi_line(const wifi_csi_info_t *data, char *buf, size_t cap) {
     wifi_csi_info_t d = data[0];
-    char mac[20] = {0};
-    sprintf(mac, "%02X:%02X:%02X:%02X:%02X:%02X", d.mac[0], d.mac[1], d.mac[2], d.mac[3], d.mac[4], d.mac[5]);
+    csi_writer_t w;
+    writer_init(&w, buf, cap);
 
-    printf("CSI_DATA,");
-    printf("%s,", project_type);
-    printf("%s,", mac);
+    writer_str(&w, "CSI_DATA,");
+    writer_str(&w, project_type);
+    writer_char(&w, ',');
+    writer_mac(&w, d.mac, true);
+    writer_char(&w, ',');
 
     // https://github.com/espressif/esp-idf/blob/9d0ca60398481a44861542638cfdc1949bb6f312/components/esp_wifi/include/esp_wifi_types.h#L314
-    printf("%d,", d.rx_ctrl.rssi);
-    printf("%d,", d.rx_ctrl.rate);
-    printf("%d,", d.rx_ctrl.sig_mode);
-    printf("%d,", d.rx_ctrl.mcs);
-    printf("%d,", d.rx_ctrl.cwb);
-    printf("%d,", d.rx_ctrl.smoothing);
-    printf("%d,", d.rx_ctrl.not_sounding);
-    printf("%d,", d.rx_ctrl.aggregation);
-    printf("%d,", d.rx_ctrl.stbc);
-    printf("%d,", d.rx_ctrl.fec_coding);
-    printf("%d,", d.rx_ctrl.sgi);
-    printf("%d,", d.rx_ctrl.noise_floor);
-    printf("%d,", d.rx_ctrl.ampdu_cnt);
-    printf("%d,", d.rx_ctrl.channel);
-    printf("%d,", d.rx_ctrl.secondary_channel);
-    printf("%d,", d.rx_ctrl.timestamp);
-    printf("%d,", d.rx_ctrl.ant);
-    printf("%d,", d.rx_ctrl.sig_len);
-    printf("%d,", d.rx_ctrl.rx_state);
-
-    char *resp = time_string_get();
-    printf("%d,", real_time_set);
-    printf("%s,", resp);
-    free(resp);
+    writer_int(&w, d.rx_ctrl.rssi); writer_char(&w, ',');
+    writer_int(&w, d.rx_ctrl.rate); writer_char(&w, ',');
+    writer_int(&w, d.rx_ctrl.sig_mode); writer_char(&w, ',');
+    writer_int(&w, d.rx_ctrl.mcs); writer_char(&w, ',');
+    writer_int(&w, d.rx_ctrl.cwb); writer_char(&w, ',');
+    writer_int(&w, d.rx_ctrl.smoothing); writer_char(&w, ',');
+    writer_int(&w, d.rx_ctrl.not_sounding); writer_char(&w, ',');
+    writer_int(&w, d.rx_ctrl.aggregation); writer_char(&w, ',');
+    writer_int(&w, d.rx_ctrl.stbc); writer_char(&w, ',');
+    writer_int(&w, d.rx_ctrl.fec_coding); writer_char(&w, ',');
+    writer_int(&w, d.rx_ctrl.sgi); writer_char(&w, ',');
+    writer_int(&w, d.rx_ctrl.noise_floor); writer_char(&w, ',');
+    writer_int(&w, d.rx_ctrl.ampdu_cnt); writer_char(&w, ',');
+    writer_int(&w, d.rx_ctrl.channel); writer_char(&w, ',');
+    writer_int(&w, d.rx_ctrl.secondary_channel); writer_char(&w, ',');
+    writer_int(&w, (int32_t)d.rx_ctrl.timestamp); writer_char(&w, ',');
+    writer_int(&w, d.rx_ctrl.ant); writer_char(&w, ',');
+    writer_int(&w, d.rx_ctrl.sig_len); writer_char(&w, ',');
+    writer_int(&w, d.rx_ctrl.rx_state); writer_char(&w, ',');
+
+    // same "%li.%li" as time_string_get(), without the malloc and two snprintf per frame
+    int64_t now_us = time_us_get();
+    writer_int(&w, real_time_set);
+    writer_char(&w, ',');
+    writer_u64(&w, now_us / 1000000);
+    writer_char(&w, '.');
+    writer_uint(&w, now_us % 1000000);
+    writer_char(&w, ',');
 
     int8_t *my_ptr;
 
 #if CSI_RAW
-    printf("%d,[", data->len);
+    writer_int(&w, data->len);
+    writer_str(&w, ",[");
     my_ptr = data->buf;
 
     for (int i = 0; i < 128; i++) {
-        printf("%d ", my_ptr[i]);
+        writer_i8_sep(&w, my_ptr[i], ' ');
     }
-    printf("]");
+    writer_char(&w, ']');
 #endif
 #if CSI_AMPLITUDE
-    printf("%d,[", data->len);
+    writer_int(&w, data->len);
+    writer_str(&w, ",[");
     my_ptr = data->buf;
 
     for (int i = 0; i < 64; i++) {
-        printf("%.4f ", sqrt(pow(my_ptr[i * 2], 2) + pow(my_ptr[(i * 2) + 1], 2)));
+        writer_e4(&w, dsp_amplitude_e4(my_ptr[i * 2], my_ptr[(i * 2) + 1]));
+        writer_char(&w, ' ');
     }
-    printf("]");
+    writer_char(&w, ']');
 #endif
 #if CSI_PHASE
-    printf("%d,[", data->len);
+    writer_int(&w, data->len);
+    writer_str(&w, ",[");
     my_ptr = data->buf;
 
     for (int i = 0; i < 64; i++) {
-                printf("%.4f ", atan2(my_ptr[i*2], my_ptr[(i*2)+1]));
-            }
-    printf("]");
+        writer_e4(&w, dsp_phase_e4(my_ptr[i*2], my_ptr[(i*2)+1]));
+        writer_char(&w, ' ');
+    }
+    writer_char(&w, ']');
 #endif
-    printf("\n");
+    writer_char(&w, '\n');
+    return writer_finish(&w);
+}
+
+#ifdef CONFIG_CSI_SERIAL_FRAMED
+#define CSI_SERIAL_QUEUE_SIZE 16 // a power of two
+
+// frames of the default callback on their way to csi_serial_task
+static csi_slot_t csi_serial_slots[CSI_SERIAL_QUEUE_SIZE];
+static csi_ring_t csi_serial_ring;
+static TaskHandle_t csi_serial_handle = NULL;
+static csi_seq_t csi_serial_seq;
+
+/*
+ * Framed serial output: the wifi task only copies the frame into a slot of csi_serial_ring, which
+ * never blocks, a full ring drops the frame and counts it in csi_serial_ring.dropped.
+ * csi_serial_task writes it as a raw binary record in one COBS frame (serial_component.h) to the
+ * UART driver's ring buffer, and is the one that waits while the link is slower than the frames.
+ */
+void _wifi_csi_cb(void *ctx, wifi_csi_info_t *data) {
+    if (csi_serial_handle != NULL && csi_ring_push(&csi_serial_ring, data, esp_timer_get_time())) {
+        xTaskNotifyGive(csi_serial_handle);
+    }
+}
+
+static void csi_serial_task(void *pvParameter) {
+    static uint8_t rec[sizeof(csi_record_hdr_t) + CSI_MAX_BUF_LEN];
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        csi_slot_t *slot;
+        while ((slot = csi_ring_peek(&csi_serial_ring)) != NULL) {
+            size_t len = csi_record_pack(&slot->info, rec, sizeof(rec));
+            if (len > 0) {
+                csi_record_stamp(rec, seq_next(&csi_serial_seq, slot->info.mac), slot->push_us, esp_timer_get_time());
+            }
+            csi_ring_release(&csi_serial_ring);
+            if (len > 0) {
+                serial_send(rec, len);
+            }
+        }
+    }
+}
+#else
+void _wifi_csi_cb(void *ctx, wifi_csi_info_t *data) {
+    // only called from the wifi task, so the static line buffer is never shared.
+    int len = csi_line(data, csi_line_buf, sizeof(csi_line_buf));
+    if (len > 0) {
+        // one write per frame instead of ~160 printf calls
+        fwrite(csi_line_buf, 1, len, stdout);
+    }
     // sd_flush();
     vTaskDelay(0);
 }
+#endif
+
+/*
+ * Text payload sent to the host computer, one frame per datagram.
+ * seq is the per source mac sequence number (see seq_component.h), rx_us and handler_us the device time
+ * in us when the callback got the frame and when the handler serialized it. They trail the mac as
+ * ", seq = N, rx_us = R, handler_us = T", so the lines are those of firmware without them and
+ * readers that split the mac line at commas still find the mac in the first field.
+ * Returns the payload length, or -1 if it does not fit into cap bytes.
+ */
+int parse_csi (wifi_csi_info_t *data, uint16_t seq, uint64_t rx_us, uint32_t handler_us, char* payload, size_t cap) {
+    wifi_csi_info_t d = *data;
+    csi_writer_t w;
+    writer_init(&w, payload, cap);
+
+    // data description
+    writer_str(&w, "CSI_DATA from Soft-AP\n");
+    // src mac addr
+    writer_str(&w, "src mac = ");
+    writer_mac(&w, d.mac, false);
+    // sequence number and device times
+    writer_str(&w, ", seq = ");
+    writer_uint(&w, seq);
+    writer_str(&w, ", rx_us = ");
+    writer_u64(&w, rx_us);
+    writer_str(&w, ", handler_us = ");
+    writer_uint(&w, handler_us);
+    writer_char(&w, '\n');
+
+    // https://github.com/espressif/esp-idf/blob/9d0ca60398481a44861542638cfdc1949bb6f312/components/esp_wifi/include/esp_wifi_types.h#L314
+    // rx_ctrl info
+    writer_str(&w, "rx_ctrl info, len = 19\n");
+    writer_int(&w, d.rx_ctrl.rssi); writer_char(&w, ',');           /**< Received Signal Strength Indicator(RSSI) of packet. unit: dBm */
+    writer_int(&w, d.rx_ctrl.rate); writer_char(&w, ',');           /**< PHY rate encoding of the packet. Only valid for non HT(11bg) packet */
+    writer_int(&w, d.rx_ctrl.sig_mode); writer_char(&w, ',');       /**< 0: non HT(11bg) packet; 1: HT(11n) packet; 3: VHT(11ac) packet */
+    writer_int(&w, d.rx_ctrl.mcs); writer_char(&w, ',');            /**< Modulation Coding Scheme. If is HT(11n) packet, shows the modulation, range from 0 to 76(MSC0 ~ MCS76) */
+    writer_int(&w, d.rx_ctrl.cwb); writer_char(&w, ',');            /**< Channel Bandwidth of the packet. 0: 20MHz; 1: 40MHz */
+    writer_int(&w, d.rx_ctrl.smoothing); writer_char(&w, ',');
+    writer_int(&w, d.rx_ctrl.not_sounding); writer_char(&w, ',');
+    writer_int(&w, d.rx_ctrl.aggregation); writer_char(&w, ',');
+    writer_int(&w, d.rx_ctrl.stbc); writer_char(&w, ',');
+    writer_int(&w, d.rx_ctrl.fec_coding); writer_char(&w, ',');
+    writer_int(&w, d.rx_ctrl.sgi); writer_char(&w, ',');
+    writer_int(&w, d.rx_ctrl.noise_floor); writer_char(&w, ',');    /**< noise floor of Radio Frequency Module(RF). unit: 0.25dBm*/
+    writer_int(&w, d.rx_ctrl.ampdu_cnt); writer_char(&w, ',');
+    writer_int(&w, d.rx_ctrl.channel); writer_char(&w, ',');
+    writer_int(&w, d.rx_ctrl.secondary_channel); writer_char(&w, ',');
+    writer_int(&w, (int32_t)d.rx_ctrl.timestamp); writer_char(&w, ',');
+    writer_int(&w, d.rx_ctrl.ant); writer_char(&w, ',');
+    writer_int(&w, d.rx_ctrl.sig_len); writer_char(&w, ',');
+    writer_int(&w, d.rx_ctrl.rx_state); writer_str(&w, ",\n");
+    // new line
+
+    int8_t *my_ptr;
+
+#if CSI_RAW
+    writer_str(&w, "RAW, len = ");
+    writer_int(&w, data->len);
+    writer_char(&w, '\n');
+    my_ptr = data->buf;
+
+    for (int i = 0; i < data->len; i++) {
+        writer_i8_sep(&w, my_ptr[i], ',');
+    }
+    writer_char(&w, '\n'); // new line
+#endif
+#if CSI_AMPLITUDE
+    writer_printf(&w, "AMP len = %d \n", data->len/2);
+    my_ptr = data->buf;
+
+    for (int i = 0; i < data->len/2; i++) {
+        writer_e4(&w, dsp_amplitude_e4(my_ptr[i * 2], my_ptr[(i * 2) + 1]));
+        writer_str(&w, ", ");
+    }
+    writer_char(&w, '\n');
+#endif
+#if CSI_PHASE
+    writer_printf(&w, "PHASE len = %d \n", data->len/2);
+    my_ptr = data->buf;
+
+    for (int i = 0; i < data->len/2; i++) {
+        writer_e4(&w, dsp_phase_e4(my_ptr[i*2], my_ptr[(i*2)+1]));
+        writer_str(&w, ", ");
+    }
+    writer_char(&w, '\n');
+#endif
+    return writer_finish(&w);
+}
 
 void _print_csi_csv_header() {
     char *header_str = "type,role,mac,rssi,rate,sig_mode,mcs,bandwidth,smoothing,not_sounding,aggregation,stbc,fec_coding,sgi,noise_floor,ampdu_cnt,channel,secondary_channel,local_timestamp,ant,sig_len,rx_state,real_time_set,real_timestamp,len,CSI_DATA\n";
@@ -101,6 +263,15 @@ void csi_init(char *type, wifi_csi_cb_t cb_func_ptr) {
     configuration_csi.manu_scale = 0;
 
     ESP_ERROR_CHECK(esp_wifi_set_csi_config(&configuration_csi));
+#ifdef CONFIG_CSI_SERIAL_FRAMED
+    // binary frames on the console instead of text lines, before the first frame arrives
+    serial_init();
+    if ( (void*)cb_func_ptr == NULL ) {
+        csi_ring_init(&csi_serial_ring, csi_serial_slots, CSI_SERIAL_QUEUE_SIZE);
+        seq_init(&csi_serial_seq);
+        task_create(csi_serial_task, "csi_serial_task", 4096, CSI_HANDLER_PRIORITY, CSI_HANDLER_CORE, &csi_serial_handle);
+    }
+#endif
     if ( (void*)cb_func_ptr == NULL ) {
         // default callback, works but not optimal
         ESP_ERROR_CHECK(esp_wifi_set_csi_rx_cb(&_wifi_csi_cb, NULL));
@@ -108,7 +279,9 @@ void csi_init(char *type, wifi_csi_cb_t cb_func_ptr) {
         ESP_ERROR_CHECK(esp_wifi_set_csi_rx_cb(cb_func_ptr, NULL));
     }
 
+#ifndef CONFIG_CSI_SERIAL_FRAMED
     _print_csi_csv_header();
+#endif
 }
 
 #endif //ESP32_CSI_CSI_COMPONENT_H
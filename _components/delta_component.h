@@ -0,0 +1,251 @@
+#ifndef ESP32_CSI_DELTA_COMPONENT_H
+#define ESP32_CSI_DELTA_COMPONENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "peer_component.h"
+#include "record_component.h"
+
+/*
+ * Per-peer delta compression of binary CSI records.
+ * Consecutive frames of a static link differ little, so a record payload is sent as the
+ * difference to the previous record of the same mac. The differences are zigzag coded and
+ * bit packed in blocks of DELTA_BLOCK values, each block led by one byte holding its bit width.
+ *
+ * A record is sent as is (a keyframe) every CSI_DELTA_KEYFRAME_INTERVAL records of a mac,
+ * when its payload type or length changes, or when the delta would not be smaller.
+ * delta_seq counts all records of a mac, so the receiver notices when the record a delta refers
+ * to was lost and drops the rest of the chain up to the next keyframe instead of decoding garbage.
+ *
+ * The host decoder is DeltaDecoder in active_ap/csi_record.py, delta_decode_record() is the
+ * same in C for host_tools. Both sides must see the same records in the same order, so nothing
+ * may drop a record between delta_encode_record() and the socket.
+ */
+#ifdef CONFIG_CSI_DELTA_ENABLE
+#define CSI_DELTA_KEYFRAME_INTERVAL CONFIG_CSI_DELTA_KEYFRAME_INTERVAL
+#else
+#define CSI_DELTA_KEYFRAME_INTERVAL 16
+#endif
+
+#define DELTA_MAX_PAYLOAD   612     // CSI_MAX_BUF_LEN, the largest raw payload
+#define DELTA_BLOCK         16
+
+typedef struct {
+    uint8_t type;                   // payload type of the last record, 0 if there is none to refer to
+    uint8_t seq;                    // delta_seq of the last record
+    uint8_t run;                    // delta records since the last keyframe
+    uint16_t len;                   // payload length of the last record
+    uint8_t prev[DELTA_MAX_PAYLOAD]; // payload of the last record, uncompressed
+} delta_peer_t;
+
+typedef struct {
+    csi_peers_t peers;              // a peer that loses its slot restarts with a keyframe
+    delta_peer_t state[PEER_MAX_PEERS];
+    int keyframe_interval;          // at most 255, delta_seq is a byte
+    uint8_t scratch[DELTA_MAX_PAYLOAD];
+} csi_delta_t;
+
+void delta_init(csi_delta_t *z, int keyframe_interval) {
+    memset(z, 0, sizeof(*z));
+    peers_init(&z->peers);
+    z->keyframe_interval = keyframe_interval < 1 ? 1 : (keyframe_interval > 255 ? 255 : keyframe_interval);
+}
+
+/* Bytes per value of a payload type, the differences are taken per value. */
+static inline int delta_value_size(uint8_t type) {
+    return (type == CSI_RECORD_TYPE_RAW || type == CSI_RECORD_TYPE_SUBCARRIERS) ? 1 : 2;
+}
+
+static delta_peer_t *_delta_peer(csi_delta_t *z, const uint8_t mac[6]) {
+    bool fresh;
+    delta_peer_t *p = &z->state[peers_slot(&z->peers, mac, &fresh)];
+    if (fresh) {
+        p->type = 0;
+        p->seq = 0;
+        p->run = 0;
+        p->len = 0;
+    }
+    return p;
+}
+
+// value i of a payload, little-endian
+static inline uint32_t _delta_value(const uint8_t *v, int i, int size) {
+    return size == 1 ? v[i] : (uint32_t)v[i * 2] | ((uint32_t)v[i * 2 + 1] << 8);
+}
+
+static inline void _delta_set_value(uint8_t *v, int i, int size, uint32_t x) {
+    if (size == 1) {
+        v[i] = x;
+    } else {
+        v[i * 2] = x;
+        v[i * 2 + 1] = x >> 8;
+    }
+}
+
+// zigzag code of cur - prev, wrapping at the value size: 0, -1, 1, -2, ... map to 0, 1, 2, 3, ...
+static inline uint32_t _delta_zigzag(uint32_t cur, uint32_t prev, int size) {
+    int bits = size * 8;
+    uint32_t mask = (1u << bits) - 1;
+    uint32_t d = (cur - prev) & mask;
+    uint32_t sign = d >> (bits - 1);
+    return ((d << 1) ^ (0u - sign)) & mask;
+}
+
+static inline uint32_t _delta_unzigzag(uint32_t z, uint32_t prev, int size) {
+    uint32_t mask = (1u << (size * 8)) - 1;
+    uint32_t d = (z >> 1) ^ (0u - (z & 1));
+    return (prev + d) & mask;
+}
+
+/* Pack the differences of n values. Returns the packed length, 0 if it would exceed cap. */
+static size_t _delta_pack(const uint8_t *cur, const uint8_t *prev, int n, int size, uint8_t *out, size_t cap) {
+    size_t pos = 0;
+    uint32_t z[DELTA_BLOCK];
+    for (int b = 0; b < n; b += DELTA_BLOCK) {
+        int cnt = n - b < DELTA_BLOCK ? n - b : DELTA_BLOCK;
+        uint32_t all = 0;
+        for (int i = 0; i < cnt; i++) {
+            z[i] = _delta_zigzag(_delta_value(cur, b + i, size), _delta_value(prev, b + i, size), size);
+            all |= z[i];
+        }
+        int width = all == 0 ? 0 : 32 - __builtin_clz(all);
+        if (pos + 1 + (cnt * width + 7) / 8 > cap) {
+            return 0;
+        }
+        out[pos++] = width;
+        uint32_t acc = 0;
+        int nbits = 0;
+        for (int i = 0; i < cnt; i++) {
+            acc |= z[i] << nbits;
+            nbits += width;
+            while (nbits >= 8) {
+                out[pos++] = acc;
+                acc >>= 8;
+                nbits -= 8;
+            }
+        }
+        if (nbits > 0) {
+            out[pos++] = acc;
+        }
+    }
+    return pos;
+}
+
+/* Undo _delta_pack() into out. Returns false if in is not exactly n values long. */
+static bool _delta_unpack(const uint8_t *in, size_t in_len, const uint8_t *prev, int n, int size, uint8_t *out) {
+    size_t pos = 0;
+    for (int b = 0; b < n; b += DELTA_BLOCK) {
+        int cnt = n - b < DELTA_BLOCK ? n - b : DELTA_BLOCK;
+        if (pos >= in_len) {
+            return false;
+        }
+        int width = in[pos++];
+        if (width > size * 8 || pos + (cnt * width + 7) / 8 > in_len) {
+            return false;
+        }
+        uint32_t acc = 0;
+        int nbits = 0;
+        uint32_t mask = (1u << width) - 1;
+        for (int i = 0; i < cnt; i++) {
+            while (nbits < width) {
+                acc |= (uint32_t)in[pos++] << nbits;
+                nbits += 8;
+            }
+            uint32_t z = acc & mask;
+            acc >>= width;
+            nbits -= width;
+            _delta_set_value(out, b + i, size, _delta_unzigzag(z, _delta_value(prev, b + i, size), size));
+        }
+    }
+    return pos == in_len;
+}
+
+/*
+ * Delta code a record written by csi_record_pack_type(), in place.
+ * Returns the new record length, which is rec_len when the record goes out as a keyframe.
+ */
+size_t delta_encode_record(csi_delta_t *z, uint8_t *rec, size_t rec_len) {
+    csi_record_hdr_t hdr;
+    memcpy(&hdr, rec, sizeof(hdr));
+    const uint8_t *payload = rec + sizeof(hdr);
+    if (hdr.csi_len > DELTA_MAX_PAYLOAD) {
+        return rec_len;
+    }
+
+    delta_peer_t *p = _delta_peer(z, hdr.mac);
+    int size = delta_value_size(hdr.type);
+    size_t packed_len = 0;
+    if (p->type == hdr.type && p->len == hdr.csi_len && p->run + 1 < z->keyframe_interval) {
+        // only worth it when smaller than the payload itself
+        packed_len = _delta_pack(payload, p->prev, hdr.csi_len / size, size, z->scratch, hdr.csi_len - 1);
+    }
+    memcpy(p->prev, payload, hdr.csi_len);
+    p->type = hdr.type;
+    p->len = hdr.csi_len;
+    p->seq++;
+    hdr.delta_seq = p->seq;
+
+    if (packed_len == 0) {
+        p->run = 0;
+        memcpy(rec, &hdr, sizeof(hdr));
+        return rec_len;
+    }
+    p->run++;
+    hdr.flags |= CSI_RECORD_FLAG_DELTA;
+    hdr.csi_len = packed_len;
+    hdr.len = sizeof(hdr) + packed_len;
+    memcpy(rec, &hdr, sizeof(hdr));
+    memcpy(rec + sizeof(hdr), z->scratch, packed_len);
+    return hdr.len;
+}
+
+/*
+ * Receiver side of delta_encode_record(): write the record as it was before encoding into out.
+ * Returns its length, or 0 if it can not be decoded because a record before it in the chain
+ * was lost, or if it does not fit into cap bytes.
+ */
+size_t delta_decode_record(csi_delta_t *z, const uint8_t *rec, uint8_t *out, size_t cap) {
+    csi_record_hdr_t hdr;
+    memcpy(&hdr, rec, sizeof(hdr));
+    const uint8_t *payload = rec + sizeof(hdr);
+    delta_peer_t *p = _delta_peer(z, hdr.mac);
+
+    if (!(hdr.flags & CSI_RECORD_FLAG_DELTA)) {
+        if (hdr.len > cap) {
+            return 0;
+        }
+        // too large to be delta coded, nothing can refer to it
+        if (hdr.csi_len > DELTA_MAX_PAYLOAD) {
+            p->type = 0;
+            memcpy(out, rec, hdr.len);
+            return hdr.len;
+        }
+        memcpy(p->prev, payload, hdr.csi_len);
+        p->type = hdr.type;
+        p->len = hdr.csi_len;
+        p->seq = hdr.delta_seq;
+        memcpy(out, rec, hdr.len);
+        return hdr.len;
+    }
+
+    int size = delta_value_size(hdr.type);
+    size_t rec_len = sizeof(hdr) + p->len;
+    if (p->type != hdr.type || hdr.delta_seq != (uint8_t)(p->seq + 1) || rec_len > cap ||
+        !_delta_unpack(payload, hdr.csi_len, p->prev, p->len / size, size, out + sizeof(hdr))) {
+        // chain broken, wait for the next keyframe
+        p->type = 0;
+        return 0;
+    }
+    memcpy(p->prev, out + sizeof(hdr), p->len);
+    p->seq = hdr.delta_seq;
+
+    hdr.flags &= ~CSI_RECORD_FLAG_DELTA;
+    hdr.csi_len = p->len;
+    hdr.len = rec_len;
+    memcpy(out, &hdr, sizeof(hdr));
+    return rec_len;
+}
+
+#endif //ESP32_CSI_DELTA_COMPONENT_H
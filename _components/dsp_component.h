@@ -0,0 +1,218 @@
+#ifndef ESP32_CSI_DSP_COMPONENT_H
+#define ESP32_CSI_DSP_COMPONENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Device side CSI preprocessing, integer only (the ESP32 has no double precision FPU).
+ *
+ * Subcarrier selection keeps only the HT-LTF data and pilot subcarriers the host uses,
+ * e.g. -58..-2 and 2..58 of a HT40 frame, in that order, like cook_csi_data() on the host.
+ * Each subcarrier is two int8 values, the imaginary part first, then the real part.
+ *
+ * Kernels, checked exhaustively against double precision in host_tools/dsp_check.c:
+ *   amplitude as Q4 (1/16 units), |error| <= 1/32, or Q8 for the text formats
+ *   phase as a binary angle (32768 = pi, range [-pi, pi)), |error| <= 2 units, about 0.0002 rad
+ */
+#define DSP_MAX_SUBCARRIERS 114
+
+typedef struct {
+    int offset;     // first complex entry of the HT-LTF block in buf
+    int n_fft;      // HT-LTF entries, stored as subcarrier 0..n_fft/2-1 then -n_fft/2..-1
+    int k_min;      // used subcarriers are k_min..k_max and -k_max..-k_min
+    int k_max;
+} dsp_layout_t;
+
+/*
+ * Where the useful subcarriers are, for the CSI config set by csi_init() (LLTF + HT-LTF).
+ * https://docs.espressif.com/projects/esp-idf/en/stable/esp32/api-guides/wifi.html#wi-fi-channel-state-information
+ * Returns false for frames without HT-LTF (non-HT) or with a buffer too short for the layout.
+ */
+bool dsp_get_layout(const wifi_csi_info_t *d, dsp_layout_t *l) {
+    if (d->rx_ctrl.sig_mode == 0) {
+        return false;
+    }
+    l->offset = 64;             // after the 64 LLTF subcarriers
+    if (d->rx_ctrl.cwb == 0) {
+        // HT20, data and pilots on -28..-1 and 1..28
+        l->n_fft = 64;
+        l->k_min = 1;
+        l->k_max = 28;
+    } else {
+        // HT40, data and pilots on -58..-2 and 2..58
+        l->n_fft = 128;
+        l->k_min = 2;
+        l->k_max = 58;
+    }
+    return d->len >= (l->offset + l->n_fft) * 2;
+}
+
+/*
+ * Copy the useful subcarriers of a frame into out, negative ones first.
+ * out must hold 2 * DSP_MAX_SUBCARRIERS bytes. Returns the number of subcarriers, 0 if the layout is unsupported.
+ */
+int dsp_select_subcarriers(const wifi_csi_info_t *d, int8_t *out) {
+    dsp_layout_t l;
+    if (!dsp_get_layout(d, &l)) {
+        return 0;
+    }
+    int n_side = l.k_max - l.k_min + 1;
+    const int8_t *ltf = d->buf + l.offset * 2;
+    // -k_max..-k_min are stored at n_fft-k_max..n_fft-k_min, k_min..k_max at k_min..k_max
+    memcpy(out, ltf + (l.n_fft - l.k_max) * 2, n_side * 2);
+    memcpy(out + n_side * 2, ltf + l.k_min * 2, n_side * 2);
+    return n_side * 2;
+}
+
+// sqrt(i) in Q4 for i = 64..255, rounded down, the seed of dsp_isqrt()
+static const uint8_t DSP_SQRT_LUT[192] = {
+    128, 128, 129, 130, 131, 132, 133, 134, 135, 136, 137, 138,
+    139, 140, 141, 142, 143, 144, 144, 145, 146, 147, 148, 149,
+    150, 150, 151, 152, 153, 154, 155, 155, 156, 157, 158, 159,
+    160, 160, 161, 162, 163, 163, 164, 165, 166, 167, 167, 168,
+    169, 170, 170, 171, 172, 173, 173, 174, 175, 176, 176, 177,
+    178, 178, 179, 180, 181, 181, 182, 183, 183, 184, 185, 185,
+    186, 187, 187, 188, 189, 189, 190, 191, 192, 192, 193, 193,
+    194, 195, 195, 196, 197, 197, 198, 199, 199, 200, 201, 201,
+    202, 203, 203, 204, 204, 205, 206, 206, 207, 208, 208, 209,
+    209, 210, 211, 211, 212, 212, 213, 214, 214, 215, 215, 216,
+    217, 217, 218, 218, 219, 219, 220, 221, 221, 222, 222, 223,
+    224, 224, 225, 225, 226, 226, 227, 227, 228, 229, 229, 230,
+    230, 231, 231, 232, 232, 233, 234, 234, 235, 235, 236, 236,
+    237, 237, 238, 238, 239, 240, 240, 241, 241, 242, 242, 243,
+    243, 244, 244, 245, 245, 246, 246, 247, 247, 248, 248, 249,
+    249, 250, 250, 251, 251, 252, 252, 253, 253, 254, 254, 255
+};
+
+/*
+ * floor(sqrt(x)): a seed from the top 8 bits of x, good to about 1%, one Newton step, then a
+ * step or two to the exact result. Five times faster than one iteration per result bit on the host.
+ */
+static inline uint32_t dsp_isqrt(uint32_t x) {
+    if (x == 0) {
+        return 0;
+    }
+    // x = top * 2^e with top in 64..255 and e even, clz is a single NSAU instruction on the ESP32
+    int e = ((31 - __builtin_clz(x)) & ~1) - 6;
+    uint32_t top = e >= 0 ? x >> e : x << -e;
+    // sqrt(x) = sqrt(top) * 2^(e/2), the LUT holds sqrt(top) * 2^4
+    int shift = e / 2 - 4;
+    uint32_t r = shift >= 0 ? (uint32_t)DSP_SQRT_LUT[top - 64] << shift : (uint32_t)DSP_SQRT_LUT[top - 64] >> -shift;
+    if (r == 0) {
+        r = 1;
+    }
+    r = (r + x / r) >> 1;
+    // r * r must not overflow, floor(sqrt(2^32 - 1)) = 0xFFFF
+    if (r > 0xFFFF) {
+        r = 0xFFFF;
+    }
+    while (r * r > x) {
+        r--;
+    }
+    // (r + 1)^2 <= x
+    while (x - r * r > 2 * r) {
+        r++;
+    }
+    return r;
+}
+
+/*
+ * |h| with frac_bits fractional bits, rounded to nearest, |error| <= 2^-(frac_bits+1).
+ * frac_bits <= 8, so (im^2 + re^2) << frac_bits * 2 stays within 32 bits.
+ */
+static inline uint32_t dsp_amplitude_fixed(int8_t im, int8_t re, int frac_bits) {
+    uint32_t x = (uint32_t)((int32_t)im * im + (int32_t)re * re) << (frac_bits * 2);
+    uint32_t r = dsp_isqrt(x);
+    // round: x > r^2 + r means sqrt(x) > r + 0.5
+    if (x - r * r > r) {
+        r++;
+    }
+    return r;
+}
+
+/* |h| in Q4, at most 2896 (181.02) for int8 inputs. */
+static inline int16_t dsp_amplitude_q4(int8_t im, int8_t re) {
+    return dsp_amplitude_fixed(im, re, 4);
+}
+
+// atan(i / 128) for i = 0..128 as binary angle, 8192 = pi / 4
+static const int16_t DSP_ATAN_LUT[129] = {
+       0,   81,  163,  244,  326,  407,  489,  570,  651,  732,  813,  894,
+     975, 1056, 1136, 1217, 1297, 1377, 1457, 1537, 1617, 1696, 1775, 1854,
+    1933, 2012, 2090, 2168, 2246, 2324, 2401, 2478, 2555, 2632, 2708, 2784,
+    2860, 2935, 3010, 3085, 3159, 3233, 3307, 3380, 3453, 3526, 3599, 3670,
+    3742, 3813, 3884, 3955, 4025, 4095, 4164, 4233, 4302, 4370, 4438, 4505,
+    4572, 4639, 4705, 4771, 4836, 4901, 4966, 5030, 5094, 5157, 5220, 5282,
+    5344, 5406, 5467, 5528, 5589, 5649, 5708, 5768, 5826, 5885, 5943, 6000,
+    6058, 6114, 6171, 6227, 6282, 6337, 6392, 6446, 6500, 6554, 6607, 6660,
+    6712, 6764, 6815, 6867, 6917, 6968, 7018, 7068, 7117, 7166, 7214, 7262,
+    7310, 7358, 7405, 7451, 7498, 7544, 7589, 7635, 7679, 7724, 7768, 7812,
+    7856, 7899, 7942, 7984, 8026, 8068, 8110, 8151, 8192,
+};
+
+/* atan2(im, re) as binary angle, 32768 = pi. Octant reduction and a linearly interpolated LUT. */
+static inline int16_t dsp_phase_q15(int8_t im, int8_t re) {
+    int32_t ax = re < 0 ? -re : re;
+    int32_t ay = im < 0 ? -im : im;
+    if (ax == 0 && ay == 0) {
+        return 0;
+    }
+    int32_t num = ay <= ax ? ay : ax;
+    int32_t den = ay <= ax ? ax : ay;
+    uint32_t t = ((uint32_t)num << 16) / den;       // Q16 in [0, 1]
+    uint32_t idx = t >> 9;                          // 128 LUT steps
+    int32_t frac = t & 0x1FF;
+    int32_t a = DSP_ATAN_LUT[idx];
+    if (idx < 128) {
+        a += ((DSP_ATAN_LUT[idx + 1] - a) * frac + 256) >> 9;
+    }
+    if (ay > ax) {
+        a = 16384 - a;          // pi/2 - atan(x/y)
+    }
+    if (re < 0) {
+        a = 32768 - a;
+    }
+    if (im < 0) {
+        a = -a;
+    }
+    return (int16_t)a;          // +pi wraps to -pi
+}
+
+/* Amplitudes of n subcarriers, iq as (imaginary, real) pairs. */
+void dsp_amplitude(const int8_t *iq, int n, int16_t *out) {
+    for (int i = 0; i < n; i++) {
+        out[i] = dsp_amplitude_q4(iq[i * 2], iq[i * 2 + 1]);
+    }
+}
+
+/* Phases of n subcarriers, iq as (imaginary, real) pairs. */
+void dsp_phase(const int8_t *iq, int n, int16_t *out) {
+    for (int i = 0; i < n; i++) {
+        out[i] = dsp_phase_q15(iq[i * 2], iq[i * 2 + 1]);
+    }
+}
+
+/* |h| in 1e-4 units, for printing with 4 decimals without floating point. |error| <= 0.002 */
+static inline int32_t dsp_amplitude_e4(int8_t im, int8_t re) {
+    return (dsp_amplitude_fixed(im, re, 8) * 10000 + 128) >> 8;
+}
+
+/* Binary angle to 1e-4 rad units, for printing with 4 decimals without floating point. */
+static inline int32_t dsp_phase_to_e4(int16_t phase) {
+    // pi * 1e4 = 31415.9
+    int32_t v = (int32_t)phase * 31416;
+    return v >= 0 ? (v + 16384) >> 15 : -((-v + 16384) >> 15);
+}
+
+/*
+ * atan2(im, re) in 1e-4 rad units, in (-pi, pi] like atan2(): a phase of pi (im == 0, re < 0) is
+ * 31416 as the text formats always printed it, not the -31416 dsp_phase_q15() wraps it to.
+ */
+static inline int32_t dsp_phase_e4(int8_t im, int8_t re) {
+    int16_t p = dsp_phase_q15(im, re);
+    return p == -32768 ? 31416 : dsp_phase_to_e4(p);
+}
+
+#endif //ESP32_CSI_DSP_COMPONENT_H
@@ -0,0 +1,130 @@
+#ifndef ESP32_CSI_GUARD_COMPONENT_H
+#define ESP32_CSI_GUARD_COMPONENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "peer_component.h"
+
+/*
+ * What csi_handler_task of the client keeps of the frames it takes from the ring.
+ * Every datagram the client sends to the host goes out through the AP, and what the AP sends
+ * back because of it (the datagram relayed to a host on the same wifi, block acks, ...) gives
+ * the client CSI frames too, which it reports, which makes more frames: a loop that grows
+ * until the ring is full. It used to be broken by keeping one frame in four, which threw away
+ * three quarters of the stimulus replies as well, depending on what else came in.
+ *
+ * Instead two checks, each with a counter in the stats records:
+ *  - guard window: a frame from the AP received within window_us after one of our own reports
+ *    went out, and at least as long as that report (the relayed copy carries it whole), is taken
+ *    to be caused by it and dropped as drop_self. The short stimulus replies in that window, and
+ *    the frames of other sources, are kept.
+ *  - token bucket per source mac: every source may deliver rate_hz frames per second with
+ *    bursts of up to burst frames, the rest is dropped as drop_rate. This caps whatever loop the
+ *    guard window misses at a known rate, and a source never starves the others. The buckets are
+ *    kept per csi_peers_t slot of peer_component.h; a source that lost its slot starts over with
+ *    a full bucket, which takes more than PEER_MAX_PEERS active sources.
+ * Frames dropped as drop_self take no token.
+ *
+ * Only used by csi_handler_task: guard_set_ap() once connected, guard_sent() after every
+ * datagram to the host, guard_check() for every frame in rx order. Checked on the host by host_tools/guard_check.
+ */
+#define GUARD_TX_HISTORY    8       // reports whose window can still be open, a power of two
+
+#if defined(CONFIG_CSI_SOURCE_RATE_HZ) && CONFIG_CSI_SOURCE_RATE_HZ > 0
+#define CSI_SOURCE_BURST    CONFIG_CSI_SOURCE_BURST
+#else
+#define CSI_SOURCE_BURST    1       // no token buckets
+#endif
+
+typedef enum {
+    GUARD_KEEP = 0,
+    GUARD_SELF,                     // caused by one of our own reports
+    GUARD_RATE,                     // over the rate of its source
+} guard_verdict_t;
+
+typedef struct {
+    int64_t us;
+    uint16_t len;
+} guard_tx_t;
+
+typedef struct {
+    int64_t last_us;                // rx time of the last frame the bucket was filled up to
+    uint64_t tokens;                // in millionths of a frame
+} guard_bucket_t;
+
+typedef struct {
+    guard_tx_t tx[GUARD_TX_HISTORY];
+    uint32_t tx_head;
+    uint64_t ap_key;                // mac the reports come back from, 0 for any
+    uint32_t window_us;             // 0 turns the guard window off
+    uint32_t rate_hz;               // 0 turns the token buckets off
+    uint64_t capacity;              // burst in millionths of a frame
+    csi_peers_t peers;
+    guard_bucket_t buckets[PEER_MAX_PEERS];
+} csi_guard_t;
+
+void guard_init(csi_guard_t *g, uint32_t window_us, uint32_t rate_hz, uint32_t burst) {
+    memset(g, 0, sizeof(*g));
+    peers_init(&g->peers);
+    g->window_us = window_us;
+    g->rate_hz = rate_hz;
+    g->capacity = (uint64_t)(burst < 1 ? 1 : burst) * 1000000;
+}
+
+/* The reports go out through the AP with this bssid, the frames they cause come from it. */
+void guard_set_ap(csi_guard_t *g, const uint8_t bssid[6]) {
+    g->ap_key = mac_to_key(bssid);
+}
+
+/* A datagram of len bytes went to the host at now_us. */
+void guard_sent(csi_guard_t *g, int64_t now_us, size_t len) {
+    guard_tx_t *t = &g->tx[g->tx_head++ % GUARD_TX_HISTORY];
+    t->us = now_us;
+    t->len = len > UINT16_MAX ? UINT16_MAX : (uint16_t)len;
+}
+
+// the frame came in the window of a report and could carry it
+static bool _guard_self(const csi_guard_t *g, int64_t rx_us, uint16_t sig_len) {
+    for (int i = 0; i < GUARD_TX_HISTORY; i++) {
+        const guard_tx_t *t = &g->tx[i];
+        if (t->us != 0 && rx_us >= t->us && rx_us - t->us <= g->window_us && sig_len >= t->len) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static guard_bucket_t *_guard_bucket(csi_guard_t *g, const uint8_t mac[6], int64_t rx_us) {
+    bool fresh;
+    guard_bucket_t *b = &g->buckets[peers_slot(&g->peers, mac, &fresh)];
+    if (fresh) {
+        b->last_us = rx_us;
+        b->tokens = g->capacity;
+    }
+    return b;
+}
+
+/* Whether to keep the frame from mac, received at rx_us with sig_len bytes. */
+guard_verdict_t guard_check(csi_guard_t *g, const uint8_t mac[6], int64_t rx_us, uint16_t sig_len) {
+    if (g->window_us > 0 && (g->ap_key == 0 || mac_to_key(mac) == g->ap_key) && _guard_self(g, rx_us, sig_len)) {
+        return GUARD_SELF;
+    }
+    if (g->rate_hz == 0) {
+        return GUARD_KEEP;
+    }
+    guard_bucket_t *b = _guard_bucket(g, mac, rx_us);
+    if (rx_us > b->last_us) {
+        uint64_t tokens = b->tokens + (uint64_t)(rx_us - b->last_us) * g->rate_hz;
+        b->tokens = tokens > g->capacity ? g->capacity : tokens;
+        b->last_us = rx_us;
+    }
+    if (b->tokens < 1000000) {
+        return GUARD_RATE;
+    }
+    b->tokens -= 1000000;
+    return GUARD_KEEP;
+}
+
+#endif //ESP32_CSI_GUARD_COMPONENT_H
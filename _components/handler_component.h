@@ -0,0 +1,460 @@
+#ifndef ESP32_CSI_HANDLER_COMPONENT_H
+#define ESP32_CSI_HANDLER_COMPONENT_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "mdns.h"
+#include "lwip/sockets.h"
+
+#include "csi_component.h"
+#include "record_component.h"
+#include "pool_component.h"
+#include "batch_component.h"
+#include "delta_component.h"
+#include "stats_component.h"
+#include "seq_component.h"
+#include "task_component.h"
+#include "sdlog_component.h"
+#include "serial_component.h"
+
+/*
+ * The CSI pipeline of a device, the same in active_ap and active_client:
+ * the wifi callback copies every frame into a ring, csi_handler_task takes them out, stamps them with
+ * their sequence number and device times, logs them to the SD card or frames them on the serial
+ * port, serializes them into batches and sends those to the host found by mDNS, with a stats record
+ * every CSI_STATS_INTERVAL_US. host_task finds the host meanwhile, so frames are logged before there is one.
+ *
+ * What differs between the apps comes in through csi_handler_hooks_t: the AP only takes frames from
+ * its peers, the client drops the frames its own reports caused (guard_component.h).
+ * An app calls csi_handler_init() once wifi is up and csi_handler_start() once it is ready for frames.
+ */
+#define CSI_QUEUE_SIZE             32 // number of frame slots, a power of two
+#define CSI_PAYLOAD_SIZE           2048 // a text frame of 384 CSI bytes is about 1.5 KB
+#define HOST_UDP_PORT              8848
+#ifndef TARGET_HOSTNAME
+#define TARGET_HOSTNAME            "RuichunMacBook-Pro" // put your computer mDNS name here.
+#endif
+
+typedef struct {
+    const char *type;                           // passed on to csi_init()
+    wifi_interface_t stats_if;                  // mac addr in the stats records
+    // wifi task: false drops the frame as drop_filter, before anything else. NULL takes all.
+    bool (*accept)(const wifi_csi_info_t *data);
+    // csi_handler_task, once before the first frame
+    void (*start)(void);
+    // csi_handler_task: false drops a frame taken from the ring before it is serialized, the hook counts why
+    bool (*keep)(const csi_slot_t *slot);
+    // csi_handler_task: a datagram of len bytes went to the host at now_us
+    void (*sent)(int64_t now_us, size_t len);
+} csi_handler_hooks_t;
+
+static const char *HANDLER_TAG = "csi_handler";
+
+/*
+ * Log lines per frame or per datagram. With framed serial output they would go out on the UART
+ * between the frames and take the bandwidth the framing saves, so they are left out; the stats
+ * records count the same events (send_errors, drop_serialize, drop_ring_full, datagrams_sent).
+ */
+#ifdef CONFIG_CSI_SERIAL_FRAMED
+#define HANDLER_LOGE(...)   do { } while (0)
+#define HANDLER_LOGW(...)   do { } while (0)
+#define HANDLER_LOGI(...)   do { } while (0)
+#else
+#define HANDLER_LOGE(...)   ESP_LOGE(HANDLER_TAG, __VA_ARGS__)
+#define HANDLER_LOGW(...)   ESP_LOGW(HANDLER_TAG, __VA_ARGS__)
+#define HANDLER_LOGI(...)   ESP_LOGI(HANDLER_TAG, __VA_ARGS__)
+#endif
+static const csi_handler_hooks_t *csi_hooks;
+
+static char *target_host_ipv4 = NULL;
+// published by host_task once the host is found, csi_handler_task sends nothing before
+static int host_sock = -1;
+static struct sockaddr_in host_addr;
+#ifdef CONFIG_CSI_SD_LOG
+// the card is mounted, every frame is logged whether there is a host or not
+static bool sd_logging = false;
+#endif
+
+// frames are handed from the wifi task to csi_handler_task through this ring
+static csi_slot_t csi_slots[CSI_QUEUE_SIZE];
+static csi_ring_t csi_ring;
+static TaskHandle_t csi_handler_handle = NULL;
+// where frames go, sent to the host as stats records
+static csi_stats_t csi_stats;
+// next record sequence number of each peer, only used by csi_handler_task
+static csi_seq_t csi_seq;
+#ifdef CONFIG_CSI_DELTA_ENABLE
+// last record of each peer, only used by csi_handler_task
+static csi_delta_t csi_delta;
+#endif
+
+// frames are kept without a host: logged to the SD card, or framed on the serial port
+static bool local_output(void) {
+#if defined(CONFIG_CSI_SERIAL_FRAMED)
+    return true;
+#elif defined(CONFIG_CSI_SD_LOG)
+    return sd_logging;
+#else
+    return false;
+#endif
+}
+
+/* Callback function is called in WiFi task.
+ * Users should not do lengthy operations from this task. Instead, post
+ * necessary data to a queue and handle it from a lower priority task.
+ * According to ESPNOW example. Makes sense. */
+static void queue_csi(wifi_csi_info_t *data) {
+    if (data == NULL) {
+        ESP_LOGE(HANDLER_TAG, "Receive csi cb arg error");
+        return;
+    }
+    csi_stats.cb_calls++;
+    if (csi_hooks->accept != NULL && !csi_hooks->accept(data)) {
+        csi_stats.drop_filter++;
+        return;
+    }
+    // also need to drop non-HT packets to prevent queue from overflowing
+    if (data->rx_ctrl.sig_mode == 0) {
+        csi_stats.drop_non_ht++;
+        return;
+    }
+
+    // if the host is not ready, and the frames go neither to the SD card nor to the serial port.
+    if (csi_handler_handle == NULL || (target_host_ipv4 == NULL && !local_output())) {
+        csi_stats.drop_no_host++;
+        return;
+    }
+
+    // copy the frame into a preallocated slot, never blocks. A full ring drops the frame.
+    if (csi_ring_push(&csi_ring, data, esp_timer_get_time())) {
+        xTaskNotifyGive(csi_handler_handle);
+    }
+}
+
+// the wifi callback, its cycles go into the stats records
+static void handler_wifi_cb(void *ctx, wifi_csi_info_t *data) {
+    uint32_t start = stats_ccount();
+    queue_csi(data);
+    stats_cb_done(&csi_stats, start);
+}
+
+static int query_mdns_host(const char * host_name)
+{
+    ESP_LOGI(HANDLER_TAG, "Query A: %s.local", host_name);
+
+    struct esp_ip4_addr addr;
+    addr.addr = 0;
+
+    esp_err_t err = mdns_query_a(host_name, 4000,  &addr);
+    if(err){
+        if(err == ESP_ERR_NOT_FOUND){
+            ESP_LOGW(HANDLER_TAG, "%s: Host was not found!", esp_err_to_name(err));
+            return -1;
+        }
+        ESP_LOGE(HANDLER_TAG, "Query Failed: %s", esp_err_to_name(err));
+        return -1;
+    }
+
+    ESP_LOGI(HANDLER_TAG, "Query A: %s.local resolved to: " IPSTR, host_name, IP2STR(&addr));
+    if (-1 == asprintf(&target_host_ipv4, IPSTR, IP2STR(&addr))) {
+        abort();
+    }
+    return 0;
+}
+
+int setup_udp_socket (struct sockaddr_in *dest_addr) {
+    int addr_family = 0;
+    int ip_protocol = 0;
+
+    if (target_host_ipv4 == NULL) {
+        while ( query_mdns_host(TARGET_HOSTNAME) < 0) {
+            ESP_LOGW(HANDLER_TAG, "No target host found, try again ...");
+        }
+    }
+
+    dest_addr->sin_addr.s_addr = inet_addr(target_host_ipv4);
+    dest_addr->sin_family = AF_INET;
+    dest_addr->sin_port = htons(HOST_UDP_PORT);
+    addr_family = AF_INET;
+    ip_protocol = IPPROTO_IP;
+
+    int sock = socket(addr_family, SOCK_DGRAM, ip_protocol);
+    if (sock < 0) {
+        ESP_LOGE(HANDLER_TAG, "Unable to create socket: errno %d", errno);
+        return sock;
+    }
+    ESP_LOGI(HANDLER_TAG, "Socket created, sending to %s:%d", target_host_ipv4, HOST_UDP_PORT);
+    return sock;
+}
+
+// serialize one frame in the configured output format, stamped with its sequence number, receive and handler time.
+// returns its length, or <= 0 if it does not fit into cap bytes.
+static int serialize_csi(wifi_csi_info_t *csi, uint16_t seq, uint64_t rx_us, uint32_t handler_us, char *out, size_t cap) {
+#ifdef CONFIG_CSI_OUTPUT_BINARY
+    size_t len = csi_record_pack_type(csi, CSI_RECORD_PAYLOAD_TYPE, (uint8_t *)out, cap);
+    if (len > 0) {
+        csi_record_stamp((uint8_t *)out, seq, rx_us, handler_us);
+#ifdef CONFIG_CSI_DELTA_ENABLE
+        len = delta_encode_record(&csi_delta, (uint8_t *)out, len);
+#endif
+    }
+    return len;
+#else
+    return parse_csi(csi, seq, rx_us, handler_us, out, cap);
+#endif
+}
+
+// send out udp packet
+static bool send_payload(int sock, struct sockaddr_in *dest_addr, const char *payload, int payload_len) {
+    int err = sendto(sock, payload, payload_len, 0, (struct sockaddr *)dest_addr, sizeof(*dest_addr));
+    if (err < 0) {
+        HANDLER_LOGE("Error occurred during sending: errno %d", errno);
+        vTaskDelay(100  / portTICK_PERIOD_MS);
+        return false;
+    }
+    HANDLER_LOGI("CSI message sent, payload len = %d", payload_len);
+    if (csi_hooks->sent != NULL) {
+        csi_hooks->sent(esp_timer_get_time(), payload_len);
+    }
+    return true;
+}
+
+// send the records collected in the batch and start a new one
+static void send_batch(int sock, struct sockaddr_in *dest_addr, csi_batch_t *batch) {
+    bool ok = send_payload(sock, dest_addr, batch->buf, batch->len);
+    stats_sent(&csi_stats, batch->count, batch->len, ok);
+    batch_reset(batch);
+}
+
+// send a stats or task record to the host in a datagram of its own, and log it with the frames
+static void send_record(int sock, struct sockaddr_in *dest_addr, const uint8_t *rec, size_t len) {
+    if (sock >= 0) {
+        if (sendto(sock, rec, len, 0, (struct sockaddr *)dest_addr, sizeof(*dest_addr)) < 0) {
+            csi_stats.send_errors++;
+        } else if (csi_hooks->sent != NULL) {
+            csi_hooks->sent(esp_timer_get_time(), len);
+        }
+    }
+#ifdef CONFIG_CSI_SD_LOG
+    if (sd_logging) {
+        sdlog_record(rec, len);
+    }
+#endif
+#ifdef CONFIG_CSI_SERIAL_FRAMED
+    serial_send(rec, len);
+#endif
+}
+
+// send the stats record of this device
+static void send_stats(int sock, struct sockaddr_in *dest_addr) {
+    static csi_stats_t prev;
+    uint8_t rec[sizeof(csi_stats_record_t)];
+    uint8_t mac[6];
+    esp_wifi_get_mac(csi_hooks->stats_if, mac);
+    csi_stats.peer_evictions = csi_seq.peers.evictions;
+    size_t len = stats_pack(&csi_stats, &prev, &csi_ring, mac, esp_timer_get_time() / 1000, rec, sizeof(rec));
+    send_record(sock, dest_addr, rec, len);
+#ifdef CONFIG_CSI_TASK_STATS
+    // and where the CPU time went since the previous one
+    static csi_task_stats_t tasks;
+    static uint8_t task_rec[TASK_RECORD_MAX_LEN];
+    len = task_stats_sample(&tasks, mac, esp_timer_get_time() / 1000, task_rec, sizeof(task_rec));
+    if (len > 0) {
+        send_record(sock, dest_addr, task_rec, len);
+    }
+#endif
+}
+
+#ifdef CONFIG_CSI_SD_LOG
+// append the frame to the SD log as a binary record, never delta coded so every file reads on its own.
+// the buffer goes to the writer first if the record does not fit behind it, with both at the writer it is dropped.
+static void log_csi(wifi_csi_info_t *csi, uint16_t seq, uint64_t rx_us, uint32_t handler_us) {
+    uint8_t *tail = sdlog_tail(&sdlog);
+    size_t len = tail == NULL ? 0 : csi_record_pack_type(csi, CSI_RECORD_PAYLOAD_TYPE, tail, sdlog_room(&sdlog));
+    if (len == 0 && tail != NULL) {
+        sdlog_send(esp_timer_get_time(), false);
+        tail = sdlog_tail(&sdlog);
+        len = tail == NULL ? 0 : csi_record_pack_type(csi, CSI_RECORD_PAYLOAD_TYPE, tail, sdlog_room(&sdlog));
+    }
+    if (len == 0) {
+        sdlog.dropped++;
+        return;
+    }
+    csi_record_stamp(tail, seq, rx_us, handler_us);
+    sdlog_add(&sdlog, len, esp_timer_get_time());
+}
+#endif
+
+#ifdef CONFIG_CSI_SERIAL_FRAMED
+// send the frame as a binary record in a serial frame, not delta coded either: a frame lost to a
+// line error takes no other with it. Blocks while the UART ring buffer is full, the ring drops then.
+static void serial_csi(wifi_csi_info_t *csi, uint16_t seq, uint64_t rx_us, uint32_t handler_us) {
+    static uint8_t rec[CSI_PAYLOAD_SIZE];
+    size_t len = csi_record_pack_type(csi, CSI_RECORD_PAYLOAD_TYPE, rec, sizeof(rec));
+    if (len > 0) {
+        csi_record_stamp(rec, seq, rx_us, handler_us);
+        serial_send(rec, len);
+    }
+}
+#endif
+
+static void host_task(void *pvParameter) {
+    // resolving the host blocks until it is found
+    int sock = setup_udp_socket(&host_addr);
+    __atomic_store_n(&host_sock, sock, __ATOMIC_RELEASE);
+    vTaskDelete(NULL);
+}
+
+static void csi_handler_task(void *pvParameter) {
+    wifi_csi_info_t *local_csi;
+    // only used by this task, kept off the heap and the task stack
+    static char payload[CSI_PAYLOAD_SIZE];
+    csi_batch_t batch;
+    uint32_t last_dropped = 0;
+    int sock = -1;
+    batch_init(&batch, payload, CSI_PAYLOAD_SIZE, CSI_BATCH_MTU);
+    int64_t next_stats_us = esp_timer_get_time() + CSI_STATS_INTERVAL_US;
+    seq_init(&csi_seq);
+#ifdef CONFIG_CSI_DELTA_ENABLE
+    delta_init(&csi_delta, CSI_DELTA_KEYFRAME_INTERVAL);
+#endif
+    if (csi_hooks->start != NULL) {
+        csi_hooks->start();
+    }
+
+    while (1) {
+        // sleep until the csi callback signals new frames, or until a pending batch or the stats are due.
+        TickType_t wait = portMAX_DELAY;
+        int64_t now = esp_timer_get_time();
+        int64_t time_left = batch_time_left(&batch, now, CSI_BATCH_DEADLINE_US);
+        if (CSI_STATS_INTERVAL_US > 0 && (time_left < 0 || next_stats_us - now < time_left)) {
+            time_left = next_stats_us > now ? next_stats_us - now : 0;
+        }
+#ifdef CONFIG_CSI_SD_LOG
+        int64_t sd_left = sd_logging ? sdlog_time_left(&sdlog, now, SDLOG_FLUSH_US) : -1;
+        if (sd_left >= 0 && (time_left < 0 || sd_left < time_left)) {
+            time_left = sd_left;
+        }
+#endif
+        if (time_left >= 0) {
+            wait = (time_left + portTICK_PERIOD_MS * 1000 - 1) / (portTICK_PERIOD_MS * 1000);
+        }
+        ulTaskNotifyTake(pdTRUE, wait);
+        if (sock < 0) {
+            sock = __atomic_load_n(&host_sock, __ATOMIC_ACQUIRE);
+        }
+
+        csi_slot_t *slot;
+        while ((slot = csi_ring_peek(&csi_ring)) != NULL) {
+            // NOTE: Even not connect to a computer, esp32 is still sending serial data of ESP_LOG.
+            //       so turn them off to speed up.
+            // ESP_LOGI(HANDLER_TAG, "New CSI Info Recv!");
+            uint32_t start = stats_ccount();
+            local_csi = &slot->info;
+
+            // the app's own drops (the client's self traffic guard), before serializing so delta chains
+            // only see the frames that are sent.
+            if (csi_hooks->keep != NULL && !csi_hooks->keep(slot)) {
+                csi_ring_release(&csi_ring);
+                continue;
+            }
+
+            // show some info on monitor
+            HANDLER_LOGI("CSI from "MACSTR", buf_len = %d, rssi = %d, rate = %d, sig_mode = %d, mcs = %d, cwb = %d", \
+                            MAC2STR(local_csi->mac), local_csi->len, local_csi->rx_ctrl.rssi, local_csi->rx_ctrl.rate, \
+                            local_csi->rx_ctrl.sig_mode, local_csi->rx_ctrl.mcs, local_csi->rx_ctrl.cwb);
+
+            // append the record to the batch, send the batch first if the record does not fit behind it.
+            // a record dropped here still uses up its sequence number, the host counts it as lost.
+            uint16_t seq = seq_next(&csi_seq, local_csi->mac);
+            uint32_t handler_us = esp_timer_get_time();
+#ifdef CONFIG_CSI_SD_LOG
+            if (sd_logging) {
+                log_csi(local_csi, seq, slot->push_us, handler_us);
+            }
+#endif
+#ifdef CONFIG_CSI_SERIAL_FRAMED
+            serial_csi(local_csi, seq, slot->push_us, handler_us);
+#endif
+            int payload_len = 0;
+            if (sock >= 0) {
+                payload_len = serialize_csi(local_csi, seq, slot->push_us, handler_us, batch_tail(&batch), batch_room(&batch));
+                if (payload_len <= 0 && batch.count > 0) {
+                    send_batch(sock, &host_addr, &batch);
+                    payload_len = serialize_csi(local_csi, seq, slot->push_us, handler_us, batch_tail(&batch), batch_room(&batch));
+                }
+            }
+            // the frame is serialized, give the slot back to the callback.
+            int64_t queued_us = esp_timer_get_time() - slot->push_us;
+            csi_ring_release(&csi_ring);
+            stats_handled(&csi_stats, stats_ccount() - start, queued_us);
+            if (sock < 0) {
+                // logged or framed only, the host is not found yet
+                csi_stats.local_only++;
+                continue;
+            }
+            if (payload_len <= 0) {
+                csi_stats.drop_serialize++;
+                HANDLER_LOGW("CSI payload does not fit in %d bytes, frame dropped", CSI_PAYLOAD_SIZE);
+                continue;
+            }
+            batch_add(&batch, payload_len, esp_timer_get_time());
+
+            if (batch_full(&batch)) {
+                send_batch(sock, &host_addr, &batch);
+            }
+            if (csi_ring.dropped != last_dropped) {
+                last_dropped = csi_ring.dropped;
+                HANDLER_LOGW("CSI ring full, %u frames dropped so far", last_dropped);
+            }
+#ifndef CONFIG_CSI_BATCH_ENABLE
+            vTaskDelay(10 / portTICK_PERIOD_MS);
+#endif
+        }
+
+        if (batch_due(&batch, esp_timer_get_time(), CSI_BATCH_DEADLINE_US)) {
+            send_batch(sock, &host_addr, &batch);
+        }
+#ifdef CONFIG_CSI_SD_LOG
+        // records at a low rate go to the card partly filled, not only once a buffer is full
+        if (sd_logging && sdlog_due(&sdlog, esp_timer_get_time(), SDLOG_FLUSH_US)) {
+            sdlog_send(esp_timer_get_time(), true);
+        }
+#endif
+        if (CSI_STATS_INTERVAL_US > 0 && esp_timer_get_time() >= next_stats_us) {
+            send_stats(sock, &host_addr);
+            next_stats_us = esp_timer_get_time() + CSI_STATS_INTERVAL_US;
+        }
+    }
+    vTaskDelete(NULL);
+}
+
+/* Set up the frame ring and register the wifi callback that fills it. hooks must stay valid. */
+void csi_handler_init(const csi_handler_hooks_t *hooks) {
+    csi_hooks = hooks;
+    csi_ring_init(&csi_ring, csi_slots, CSI_QUEUE_SIZE);
+    csi_init((char *)hooks->type, &handler_wifi_cb);
+}
+
+/* Start the SD log if configured, host_task and csi_handler_task. Frames are taken from then on. */
+void csi_handler_start(void) {
+#ifdef CONFIG_CSI_SD_LOG
+    // log to the SD card, if there is one, with a writer task next to the network stack
+    sd_logging = sdlog_start(CSI_NET_CORE);
+#endif
+
+    // find the host without holding up the handler, so frames are logged before there is one
+    task_create(host_task, "host_task", 4096, 1, CSI_NET_CORE, NULL);
+
+    // start another task to handle CSI data, on a core of its own (Task layout in menuconfig)
+    task_create(csi_handler_task, "csi_handler_task", CSI_HANDLER_STACK, CSI_HANDLER_PRIORITY, CSI_HANDLER_CORE,
+                &csi_handler_handle);
+}
+
+#endif //ESP32_CSI_HANDLER_COMPONENT_H
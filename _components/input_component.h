@@ -2,6 +2,7 @@
 #define ESP32_CSI_INPUT_COMPONENT_H
 
 #include "csi_component.h"
+#include "mac_filter_component.h"
 
 char input_buffer[256];
 int input_buffer_pointer = 0;
@@ -10,6 +11,8 @@ void _handle_input() {
     if (match_set_timestamp_template(input_buffer)) {
         printf("Setting local time to %s\n", input_buffer);
         time_set(input_buffer);
+    } else if (match_peer_command(input_buffer)) {
+        peer_command(&peer_filter, input_buffer);
     } else {
         printf("Unable to handle input %s\n", input_buffer);
     }
@@ -0,0 +1,266 @@
+#ifndef ESP32_CSI_MAC_FILTER_COMPONENT_H
+#define ESP32_CSI_MAC_FILTER_COMPONENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "peer_component.h"
+
+/*
+ * Set of peer mac addrs, checked for every CSI callback in the wifi task.
+ * MACs are stored as 48-bit integers (mac_to_key() of peer_component.h) in an open-addressing hash table with linear probing,
+ * kept at most half full, so a lookup is a hash and one or two compares.
+ *
+ * Updates never touch the table readers are using: the writer copies it into the spare
+ * table, modifies the copy and then publishes it with a single pointer store.
+ * Updates come from user commands, far apart compared to a lookup, so the old table is
+ * never reused while a lookup is still running on it. Only one writer at a time.
+ */
+#define MAC_FILTER_SLOTS        MAC_HASH_SLOTS
+#define MAC_FILTER_MAX_PEERS    (MAC_FILTER_SLOTS / 2)
+
+typedef struct {
+    uint64_t keys[MAC_FILTER_SLOTS]; // 0 marks an empty slot, 00:00:00:00:00:00 is not a valid peer
+    int count;
+} mac_table_t;
+
+typedef struct {
+    mac_table_t tables[2];
+    mac_table_t *active;
+} mac_filter_t;
+
+_Static_assert(MAC_FILTER_MAX_PEERS == PEER_MAX_PEERS, "a slot in csi_peers_t for every peer");
+
+void mac_filter_init(mac_filter_t *f) {
+    memset(f, 0, sizeof(*f));
+    f->active = &f->tables[0];
+}
+
+/* True if mac is in the set. Safe to call from the wifi task while another task updates the set. */
+static inline bool mac_filter_contains(const mac_filter_t *f, const uint8_t mac[6]) {
+    const mac_table_t *t = __atomic_load_n(&f->active, __ATOMIC_ACQUIRE);
+    uint64_t key = mac_to_key(mac);
+    uint32_t i = mac_hash(key);
+    while (1) {
+        uint64_t k = t->keys[i];
+        if (k == key) {
+            return true;
+        }
+        if (k == 0) {
+            return false;
+        }
+        i = (i + 1) & (MAC_FILTER_SLOTS - 1);
+    }
+}
+
+static bool _mac_table_insert(mac_table_t *t, uint64_t key) {
+    uint32_t i = mac_hash(key);
+    while (t->keys[i] != 0) {
+        if (t->keys[i] == key) {
+            return true;
+        }
+        i = (i + 1) & (MAC_FILTER_SLOTS - 1);
+    }
+    if (t->count >= MAC_FILTER_MAX_PEERS) {
+        return false;
+    }
+    t->keys[i] = key;
+    t->count++;
+    return true;
+}
+
+// backward shift deletion, keeps probe chains intact without tombstones
+static bool _mac_table_remove(mac_table_t *t, uint64_t key) {
+    uint32_t i = mac_hash(key);
+    while (t->keys[i] != key) {
+        if (t->keys[i] == 0) {
+            return false;
+        }
+        i = (i + 1) & (MAC_FILTER_SLOTS - 1);
+    }
+    uint32_t hole = i;
+    uint32_t j = i;
+    while (1) {
+        j = (j + 1) & (MAC_FILTER_SLOTS - 1);
+        if (t->keys[j] == 0) {
+            break;
+        }
+        uint32_t home = mac_hash(t->keys[j]);
+        // move keys[j] into the hole unless its home slot lies cyclically in (hole, j]
+        if (((j - home) & (MAC_FILTER_SLOTS - 1)) >= ((j - hole) & (MAC_FILTER_SLOTS - 1))) {
+            t->keys[hole] = t->keys[j];
+            hole = j;
+        }
+    }
+    t->keys[hole] = 0;
+    t->count--;
+    return true;
+}
+
+// copy the active table into the spare one, which the caller then modifies and publishes.
+static mac_table_t *_mac_filter_begin(mac_filter_t *f) {
+    mac_table_t *spare = (f->active == &f->tables[0]) ? &f->tables[1] : &f->tables[0];
+    memcpy(spare, f->active, sizeof(mac_table_t));
+    return spare;
+}
+
+static void _mac_filter_publish(mac_filter_t *f, mac_table_t *t) {
+    __atomic_store_n(&f->active, t, __ATOMIC_RELEASE);
+}
+
+/* Add a peer. Returns false if the set already holds MAC_FILTER_MAX_PEERS peers. */
+bool mac_filter_add(mac_filter_t *f, const uint8_t mac[6]) {
+    uint64_t key = mac_to_key(mac);
+    if (key == 0) {
+        return false;
+    }
+    mac_table_t *t = _mac_filter_begin(f);
+    if (!_mac_table_insert(t, key)) {
+        return false;
+    }
+    _mac_filter_publish(f, t);
+    return true;
+}
+
+/* Remove a peer. Returns false if it was not in the set. */
+bool mac_filter_remove(mac_filter_t *f, const uint8_t mac[6]) {
+    mac_table_t *t = _mac_filter_begin(f);
+    if (!_mac_table_remove(t, mac_to_key(mac))) {
+        return false;
+    }
+    _mac_filter_publish(f, t);
+    return true;
+}
+
+void mac_filter_clear(mac_filter_t *f) {
+    mac_table_t *t = _mac_filter_begin(f);
+    memset(t, 0, sizeof(mac_table_t));
+    _mac_filter_publish(f, t);
+}
+
+int mac_filter_count(const mac_filter_t *f) {
+    return f->active->count;
+}
+
+/* Copy the peers into macs, at most max of them. Returns how many were copied. */
+int mac_filter_list(const mac_filter_t *f, uint8_t (*macs)[6], int max) {
+    const mac_table_t *t = f->active;
+    int n = 0;
+    for (int i = 0; i < MAC_FILTER_SLOTS && n < max; i++) {
+        if (t->keys[i] != 0) {
+            key_to_mac(t->keys[i], macs[n++]);
+        }
+    }
+    return n;
+}
+
+/* Parse "aa:bb:cc:dd:ee:ff", upper or lower case. */
+bool mac_parse(const char *str, uint8_t mac[6]) {
+    unsigned int b[6];
+    if (sscanf(str, "%2x:%2x:%2x:%2x:%2x:%2x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != 6) {
+        return false;
+    }
+    for (int i = 0; i < 6; i++) {
+        mac[i] = b[i];
+    }
+    return true;
+}
+
+#ifdef ESP_PLATFORM
+#include "nvs.h"
+
+#define MAC_FILTER_NVS_NAMESPACE    "csi"
+#define MAC_FILTER_NVS_KEY          "peer_macs"
+
+/* Load the peer set saved by mac_filter_save(). Returns false if nothing was saved yet. */
+bool mac_filter_load(mac_filter_t *f) {
+    nvs_handle_t handle;
+    if (nvs_open(MAC_FILTER_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+    static uint8_t macs[MAC_FILTER_MAX_PEERS][6];
+    size_t size = sizeof(macs);
+    esp_err_t err = nvs_get_blob(handle, MAC_FILTER_NVS_KEY, macs, &size);
+    nvs_close(handle);
+    if (err != ESP_OK) {
+        return false;
+    }
+
+    mac_filter_clear(f);
+    for (int i = 0; i < size / 6; i++) {
+        mac_filter_add(f, macs[i]);
+    }
+    return true;
+}
+
+/* Persist the peer set, so it survives a reboot without reflashing. */
+esp_err_t mac_filter_save(const mac_filter_t *f) {
+    static uint8_t macs[MAC_FILTER_MAX_PEERS][6];
+    int n = mac_filter_list(f, macs, MAC_FILTER_MAX_PEERS);
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(MAC_FILTER_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_blob(handle, MAC_FILTER_NVS_KEY, macs, n * 6);
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err;
+}
+#endif
+
+// the set of peers the CSI callback accepts frames from
+mac_filter_t peer_filter;
+
+bool match_peer_command(const char *candidate_string) {
+    return strncmp(candidate_string, "PEER ", 5) == 0;
+}
+
+/*
+ * Update the peer set at runtime, commands are read from the serial console:
+ *   PEER ADD aa:bb:cc:dd:ee:ff
+ *   PEER DEL aa:bb:cc:dd:ee:ff
+ *   PEER LIST
+ *   PEER CLEAR
+ * Changes are saved to NVS on the device.
+ */
+void peer_command(mac_filter_t *f, const char *command) {
+    const char *arg = command + 5;
+    uint8_t mac[6];
+    bool changed = false;
+
+    if (strncmp(arg, "ADD ", 4) == 0 && mac_parse(arg + 4, mac)) {
+        changed = mac_filter_add(f, mac);
+        printf(changed ? "Peer added\n" : "Peer list full\n");
+    } else if (strncmp(arg, "DEL ", 4) == 0 && mac_parse(arg + 4, mac)) {
+        changed = mac_filter_remove(f, mac);
+        printf(changed ? "Peer removed\n" : "Not a peer\n");
+    } else if (strncmp(arg, "CLEAR", 5) == 0) {
+        mac_filter_clear(f);
+        changed = true;
+        printf("Peer list cleared\n");
+    } else if (strncmp(arg, "LIST", 4) != 0) {
+        printf("Unknown peer command %s\n", command);
+        return;
+    }
+
+    uint8_t macs[MAC_FILTER_MAX_PEERS][6];
+    int n = mac_filter_list(f, macs, MAC_FILTER_MAX_PEERS);
+    printf("%d peer(s):\n", n);
+    for (int i = 0; i < n; i++) {
+        printf("  %02x:%02x:%02x:%02x:%02x:%02x\n", macs[i][0], macs[i][1], macs[i][2], macs[i][3], macs[i][4], macs[i][5]);
+    }
+
+#ifdef ESP_PLATFORM
+    if (changed && mac_filter_save(f) != ESP_OK) {
+        printf("Failed to save the peer list\n");
+    }
+#endif
+}
+
+#endif //ESP32_CSI_MAC_FILTER_COMPONENT_H
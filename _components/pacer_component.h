@@ -0,0 +1,230 @@
+#ifndef ESP32_CSI_PACER_COMPONENT_H
+#define ESP32_CSI_PACER_COMPONENT_H
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#endif
+
+/*
+ * Pacing of the stimulus traffic that makes the CSI frames: a link gives a frame per packet, so
+ * its frame rate is the rate the packets are sent at, and the detectors on the host assume that
+ * rate is uniform.
+ *
+ * Sends are due on a fixed grid from the start, send k at start + k * 1e6 / rate us, so timing
+ * errors never add up to a drift. With dither every send moves by up to dither_us either way
+ * around its grid point (to keep clear of other periodic traffic), the mean rate stays.
+ * The sending task sleeps until the due time less a lead, woken by an esp_timer instead of a
+ * tick delay and a busy wait, and then reports when the send went out and whether it worked:
+ *  - the lead follows the lateness of the sends (timer dispatch, wake up, the send call), so the
+ *    sends leave on the grid and not one wake up latency behind it,
+ *  - a failed send (no buffer in lwIP or the wifi driver) is tried again PACER_RETRY_US later,
+ *    and given up only when the next one is due,
+ *  - after a stall the grid points missed are skipped, not sent in a burst.
+ * pacer_report() gives the achieved rate and the jitter since the previous report.
+ *
+ * Checked on the host by host_tools/pacer_check.
+ */
+#define PACER_MAX_HZ        2000
+#define PACER_RETRY_US      500         // after a failed send
+#define PACER_LEAD_SHIFT    3           // the lead follows the lateness with a weight of 1/8
+
+typedef struct {
+    int64_t start_us;
+    uint32_t rate_hz;
+    uint32_t dither_us;
+    uint64_t slot;                  // grid point of the next send
+    int64_t due_us;                 // of the next send, dither included
+    int64_t retry_us;               // of a failed send tried again, 0 for none
+    int32_t lead_acc;               // lead << PACER_LEAD_SHIFT
+    uint32_t rand;
+    int64_t last_us;                // of the last send that worked
+    // since the previous report
+    int64_t window_us;
+    uint32_t sent;
+    uint32_t failed;                // send calls that failed, tried again or not
+    uint32_t given_up;              // sends that failed until the next one was due
+    uint32_t skipped;               // grid points missed in a stall
+    uint32_t intervals;
+    int64_t interval_sum;
+    int64_t interval_sq;            // us^2
+    int64_t late_sum;
+    int32_t late_max;               // most a send was off its due time, either way
+#ifdef ESP_PLATFORM
+    esp_timer_handle_t timer;
+#endif
+} csi_pacer_t;
+
+typedef struct {
+    double rate_hz;                 // sends that worked per second
+    double interval_us;             // mean time between two of them
+    double jitter_us;               // standard deviation of that time
+    double late_us;                 // mean time a send left after it was due
+    int32_t late_max_us;
+    int32_t lead_us;
+    uint32_t sent;
+    uint32_t failed;
+    uint32_t given_up;
+    uint32_t skipped;
+} pacer_report_t;
+
+// grid point k
+static inline int64_t _pacer_grid(const csi_pacer_t *p, uint64_t k) {
+    return p->start_us + (int64_t)(k * 1000000 / p->rate_hz);
+}
+
+// xorshift32, for the dither
+static inline uint32_t _pacer_rand(csi_pacer_t *p) {
+    uint32_t x = p->rand;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return p->rand = x;
+}
+
+static void _pacer_schedule(csi_pacer_t *p) {
+    p->due_us = _pacer_grid(p, p->slot);
+    if (p->dither_us > 0) {
+        p->due_us += (int64_t)(_pacer_rand(p) % (2 * p->dither_us + 1)) - p->dither_us;
+    }
+    p->retry_us = 0;
+}
+
+/*
+ * Start pacing at rate_hz (1 to PACER_MAX_HZ) from now_us, the first send is due at once.
+ * dither_us is limited to a quarter period, so sends keep their order. seed must not be 0.
+ */
+void pacer_init(csi_pacer_t *p, uint32_t rate_hz, uint32_t dither_us, int64_t now_us, uint32_t seed) {
+    memset(p, 0, sizeof(*p));
+    p->rate_hz = rate_hz < 1 ? 1 : (rate_hz > PACER_MAX_HZ ? PACER_MAX_HZ : rate_hz);
+    uint32_t max_dither = 1000000 / p->rate_hz / 4;
+    p->dither_us = dither_us > max_dither ? max_dither : dither_us;
+    p->start_us = now_us + p->dither_us;
+    p->rand = seed == 0 ? 1 : seed;
+    p->window_us = now_us;
+    _pacer_schedule(p);
+}
+
+/* When the sending task should wake up for the next send. */
+int64_t pacer_wake_us(const csi_pacer_t *p) {
+    if (p->retry_us != 0) {
+        return p->retry_us;
+    }
+    return p->due_us - (p->lead_acc >> PACER_LEAD_SHIFT);
+}
+
+/* The next send after the one at now_us, skipping the grid points a stall has passed. */
+static void _pacer_next(csi_pacer_t *p, int64_t now_us) {
+    p->slot++;
+    if (_pacer_grid(p, p->slot) < now_us) {
+        // this send was a period or more late: go on at the first grid point at least half a
+        // period from now, and skip the ones in between
+        int64_t from = now_us + 500000 / p->rate_hz - p->start_us;
+        uint64_t next = (uint64_t)((from * (int64_t)p->rate_hz + 999999) / 1000000);
+        p->skipped += next - p->slot;
+        p->slot = next;
+    }
+    _pacer_schedule(p);
+}
+
+/* The send woken up for by pacer_wake_us() returned at now_us, ok if it worked. */
+void pacer_result(csi_pacer_t *p, int64_t now_us, bool ok) {
+    bool retry = p->retry_us != 0;
+    if (!ok) {
+        p->failed++;
+        // try again in this period, the next send is due soon enough otherwise
+        if (now_us + PACER_RETRY_US < _pacer_grid(p, p->slot + 1)) {
+            p->retry_us = now_us + PACER_RETRY_US;
+            return;
+        }
+        p->given_up++;
+        _pacer_next(p, now_us);
+        return;
+    }
+    int64_t late = now_us - p->due_us;
+    if (!retry) {
+        // integral control: wake up earlier by a fraction of how late this one was
+        int64_t lead = p->lead_acc + late;
+        int64_t max_lead = (int64_t)(1000000 / p->rate_hz / 2) << PACER_LEAD_SHIFT;
+        p->lead_acc = lead < 0 ? 0 : (lead > max_lead ? max_lead : lead);
+    }
+    p->sent++;
+    p->late_sum += late;
+    int32_t off = late < 0 ? -late : late;
+    if (off > p->late_max) {
+        p->late_max = off;
+    }
+    if (p->last_us != 0) {
+        int64_t interval = now_us - p->last_us;
+        p->intervals++;
+        p->interval_sum += interval;
+        p->interval_sq += interval * interval;
+    }
+    p->last_us = now_us;
+    _pacer_next(p, now_us);
+}
+
+/* The achieved rate and jitter since the previous report at now_us, and start a new one. */
+void pacer_report(csi_pacer_t *p, int64_t now_us, pacer_report_t *r) {
+    memset(r, 0, sizeof(*r));
+    int64_t window = now_us - p->window_us;
+    r->rate_hz = window > 0 ? p->sent * 1e6 / window : 0;
+    if (p->intervals > 0) {
+        double mean = (double)p->interval_sum / p->intervals;
+        double var = (double)p->interval_sq / p->intervals - mean * mean;
+        r->interval_us = mean;
+        r->jitter_us = var > 0 ? sqrt(var) : 0;
+    }
+    r->late_us = p->sent > 0 ? (double)p->late_sum / p->sent : 0;
+    r->late_max_us = p->late_max;
+    r->lead_us = p->lead_acc >> PACER_LEAD_SHIFT;
+    r->sent = p->sent;
+    r->failed = p->failed;
+    r->given_up = p->given_up;
+    r->skipped = p->skipped;
+    p->window_us = now_us;
+    p->sent = p->failed = p->given_up = p->skipped = p->intervals = 0;
+    p->interval_sum = p->interval_sq = p->late_sum = 0;
+    p->late_max = 0;
+}
+
+#ifdef ESP_PLATFORM
+static void _pacer_fire(void *arg) {
+    xTaskNotifyGive((TaskHandle_t)arg);
+}
+
+/* pacer_init() for the calling task, which then sends with pacer_wait() and pacer_result(). */
+void pacer_start(csi_pacer_t *p, uint32_t rate_hz, uint32_t dither_us) {
+    pacer_init(p, rate_hz, dither_us, esp_timer_get_time(), esp_random());
+    esp_timer_create_args_t args = {
+        .callback = _pacer_fire,
+        .arg = xTaskGetCurrentTaskHandle(),
+        .name = "pacer",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&args, &p->timer));
+}
+
+/*
+ * Sleep until the next send, the esp_timer task wakes the caller with a notification.
+ * Returns the time woken up.
+ */
+int64_t pacer_wait(csi_pacer_t *p) {
+    int64_t now = esp_timer_get_time();
+    int64_t wake = pacer_wake_us(p);
+    if (wake > now) {
+        esp_timer_start_once(p->timer, wake - now);
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        now = esp_timer_get_time();
+    }
+    return now;
+}
+#endif
+
+#endif //ESP32_CSI_PACER_COMPONENT_H
@@ -0,0 +1,122 @@
+#ifndef ESP32_CSI_PEER_COMPONENT_H
+#define ESP32_CSI_PEER_COMPONENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * MACs as 48-bit integers and the per peer state of the handler.
+ * The sequence numbers (seq_component.h), the delta references (delta_component.h) and the token
+ * buckets of the guard (guard_component.h) are kept in arrays indexed by the slot a csi_peers_t
+ * gives a mac. There are as many slots as the peer filter of mac_filter_component.h holds peers,
+ * so with the filter on every peer keeps its slot. Without it (the client takes frames from any
+ * source) the least recently seen peer gives up its slot once all are taken: its sequence restarts
+ * at 0 and its delta chain with a keyframe. That is counted in evictions, which go to the host as
+ * peer_evictions of the stats records.
+ *
+ * Lookup is the hash of mac_filter_component.h on a table at most half full, a hash and one or
+ * two compares. Only the task that owns a csi_peers_t may use it.
+ */
+#define MAC_HASH_BITS       7
+#define MAC_HASH_SLOTS      (1 << MAC_HASH_BITS)
+#define PEER_MAX_PEERS      (MAC_HASH_SLOTS / 2) // MAC_FILTER_MAX_PEERS
+#define PEER_EMPTY          0xFF
+
+static inline uint64_t mac_to_key(const uint8_t mac[6]) {
+    return ((uint64_t)mac[0] << 40) | ((uint64_t)mac[1] << 32) |
+           ((uint32_t)mac[2] << 24) | ((uint32_t)mac[3] << 16) | ((uint32_t)mac[4] << 8) | mac[5];
+}
+
+static inline void key_to_mac(uint64_t key, uint8_t mac[6]) {
+    for (int i = 5; i >= 0; i--) {
+        mac[i] = key & 0xFF;
+        key >>= 8;
+    }
+}
+
+// multiplicative hash of the low 32 bits, the vendor specific part of the addr. 32-bit math is cheap on the ESP32.
+static inline uint32_t mac_hash(uint64_t key) {
+    return ((uint32_t)key * 2654435761u) >> (32 - MAC_HASH_BITS);
+}
+
+typedef struct {
+    uint8_t index[MAC_HASH_SLOTS];  // slot of the key hashed here, PEER_EMPTY if none
+    uint64_t keys[PEER_MAX_PEERS];  // 48-bit mac of each slot
+    uint32_t last_use[PEER_MAX_PEERS];
+    uint32_t clock;
+    int count;                      // slots given out, they are never given back
+    uint32_t evictions;             // peers that lost their slot to another
+} csi_peers_t;
+
+_Static_assert(PEER_MAX_PEERS < PEER_EMPTY, "slots must fit index[]");
+
+void peers_init(csi_peers_t *t) {
+    memset(t, 0, sizeof(*t));
+    memset(t->index, PEER_EMPTY, sizeof(t->index));
+}
+
+// backward shift deletion like _mac_table_remove(), the slots move along with their keys
+static void _peers_unindex(csi_peers_t *t, uint64_t key) {
+    uint32_t i = mac_hash(key);
+    while (t->keys[t->index[i]] != key) {
+        i = (i + 1) & (MAC_HASH_SLOTS - 1);
+    }
+    uint32_t hole = i;
+    uint32_t j = i;
+    while (1) {
+        j = (j + 1) & (MAC_HASH_SLOTS - 1);
+        if (t->index[j] == PEER_EMPTY) {
+            break;
+        }
+        uint32_t home = mac_hash(t->keys[t->index[j]]);
+        if (((j - home) & (MAC_HASH_SLOTS - 1)) >= ((j - hole) & (MAC_HASH_SLOTS - 1))) {
+            t->index[hole] = t->index[j];
+            hole = j;
+        }
+    }
+    t->index[hole] = PEER_EMPTY;
+}
+
+/*
+ * Slot of mac, in [0, PEER_MAX_PEERS). fresh is set if the slot was just given to mac,
+ * the caller then resets the state it keeps in that slot.
+ */
+int peers_slot(csi_peers_t *t, const uint8_t mac[6], bool *fresh) {
+    uint64_t key = mac_to_key(mac);
+    uint32_t i = mac_hash(key);
+    t->clock++;
+    for (uint8_t s; (s = t->index[i]) != PEER_EMPTY; i = (i + 1) & (MAC_HASH_SLOTS - 1)) {
+        if (t->keys[s] == key) {
+            t->last_use[s] = t->clock;
+            *fresh = false;
+            return s;
+        }
+    }
+
+    int slot;
+    if (t->count < PEER_MAX_PEERS) {
+        slot = t->count++;
+    } else {
+        slot = 0;
+        for (int j = 1; j < PEER_MAX_PEERS; j++) {
+            if (t->last_use[j] < t->last_use[slot]) {
+                slot = j;
+            }
+        }
+        _peers_unindex(t, t->keys[slot]);
+        t->evictions++;
+        // the shift may have moved the free slot of the probe chain
+        i = mac_hash(key);
+        while (t->index[i] != PEER_EMPTY) {
+            i = (i + 1) & (MAC_HASH_SLOTS - 1);
+        }
+    }
+    t->index[i] = slot;
+    t->keys[slot] = key;
+    t->last_use[slot] = t->clock;
+    *fresh = true;
+    return slot;
+}
+
+#endif //ESP32_CSI_PEER_COMPONENT_H
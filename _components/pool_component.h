@@ -0,0 +1,95 @@
+#ifndef ESP32_CSI_POOL_COMPONENT_H
+#define ESP32_CSI_POOL_COMPONENT_H
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Fixed pool of CSI frame slots used as a single-producer/single-consumer ring.
+ * The producer is the CSI callback in the wifi task, the consumer is the CSI handler task.
+ * Nothing here allocates or blocks: a full ring drops the frame and counts it,
+ * so a slow consumer can never stall the wifi task.
+ */
+
+// LLTF + HT-LTF + STBC-HT-LTF, the largest CSI buffer the wifi driver reports.
+#define CSI_MAX_BUF_LEN 612
+
+typedef struct {
+    wifi_csi_info_t info;           // info.buf points at data
+    int64_t push_us;                // when the callback queued the frame, esp_timer_get_time(). Sent as rx_us
+    int8_t data[CSI_MAX_BUF_LEN];
+} csi_slot_t;
+
+typedef struct {
+    csi_slot_t *slots;
+    uint32_t size;                  // number of slots, a power of two
+    uint32_t head;                  // next slot to fill, only written by the producer
+    uint32_t tail;                  // next slot to consume, only written by the consumer
+    uint32_t dropped;               // frames dropped because the ring was full
+    uint32_t oversized;             // frames dropped because len > CSI_MAX_BUF_LEN
+    uint32_t high_water;            // most frames ever queued at once
+} csi_ring_t;
+
+/* slots must hold size entries and size must be a power of two. */
+void csi_ring_init(csi_ring_t *r, csi_slot_t *slots, uint32_t size) {
+    assert(size > 0 && (size & (size - 1)) == 0);
+    r->slots = slots;
+    r->size = size;
+    r->head = 0;
+    r->tail = 0;
+    r->dropped = 0;
+    r->oversized = 0;
+    r->high_water = 0;
+}
+
+uint32_t csi_ring_count(const csi_ring_t *r) {
+    return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Producer side: copy a frame from the wifi driver into the next free slot, now_us is the time it arrived.
+ * Returns false if the frame was dropped.
+ */
+bool csi_ring_push(csi_ring_t *r, const wifi_csi_info_t *data, int64_t now_us) {
+    if (data->len > CSI_MAX_BUF_LEN) {
+        r->oversized++;
+        return false;
+    }
+    uint32_t head = r->head;
+    uint32_t used = head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    if (used == r->size) {
+        r->dropped++;
+        return false;
+    }
+    if (used + 1 > r->high_water) {
+        r->high_water = used + 1;
+    }
+
+    csi_slot_t *slot = &r->slots[head & (r->size - 1)];
+    memcpy(&slot->info, data, sizeof(wifi_csi_info_t));
+    memcpy(slot->data, data->buf, data->len);
+    slot->info.buf = slot->data;
+    slot->push_us = now_us;
+
+    // publish the slot only after its content is written
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/* Consumer side: the oldest frame, or NULL if the ring is empty. The slot stays valid until csi_ring_release(). */
+csi_slot_t *csi_ring_peek(csi_ring_t *r) {
+    uint32_t tail = r->tail;
+    if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail) {
+        return NULL;
+    }
+    return &r->slots[tail & (r->size - 1)];
+}
+
+/* Consumer side: hand the slot returned by csi_ring_peek() back to the producer. */
+void csi_ring_release(csi_ring_t *r) {
+    __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+}
+
+#endif //ESP32_CSI_POOL_COMPONENT_H
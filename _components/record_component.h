@@ -0,0 +1,188 @@
+#ifndef ESP32_CSI_RECORD_COMPONENT_H
+#define ESP32_CSI_RECORD_COMPONENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dsp_component.h"
+
+/*
+ * Packed binary CSI record, a compact alternative to the text payload of parse_csi().
+ * All multi-byte fields are little-endian, which is native on both ESP32 and x86 hosts.
+ * The host side decoder is active_ap/csi_record.py, keep it in sync with this layout
+ * and bump CSI_RECORD_VERSION whenever the layout changes.
+ */
+#define CSI_RECORD_MAGIC            0xC5
+#define CSI_RECORD_VERSION          4 // 2: flags and delta_seq, see delta_component.h. 3: seq and handler_us. 4: rx_us
+
+#define CSI_RECORD_FLAG_DELTA       0x01 // payload is delta coded against the previous record of the same mac
+
+#define CSI_RECORD_TYPE_RAW         1 // buf holds the raw int8 CSI as delivered by the wifi driver
+// payloads preprocessed on the device, see dsp_component.h. n is the number of selected subcarriers.
+#define CSI_RECORD_TYPE_SUBCARRIERS 2 // n (imaginary, real) int8 pairs, negative subcarriers first
+#define CSI_RECORD_TYPE_AMPLITUDE   3 // n int16 amplitudes, Q4
+#define CSI_RECORD_TYPE_PHASE       4 // n int16 phases, 32768 = pi
+#define CSI_RECORD_TYPE_AMP_PHASE   5 // n int16 amplitudes followed by n int16 phases
+
+// payload of the records sent to the host, picked in menuconfig
+#if defined(CONFIG_CSI_PAYLOAD_SUBCARRIERS)
+#define CSI_RECORD_PAYLOAD_TYPE     CSI_RECORD_TYPE_SUBCARRIERS
+#elif defined(CONFIG_CSI_PAYLOAD_AMPLITUDE)
+#define CSI_RECORD_PAYLOAD_TYPE     CSI_RECORD_TYPE_AMPLITUDE
+#elif defined(CONFIG_CSI_PAYLOAD_PHASE)
+#define CSI_RECORD_PAYLOAD_TYPE     CSI_RECORD_TYPE_PHASE
+#elif defined(CONFIG_CSI_PAYLOAD_AMP_PHASE)
+#define CSI_RECORD_PAYLOAD_TYPE     CSI_RECORD_TYPE_AMP_PHASE
+#else
+#define CSI_RECORD_PAYLOAD_TYPE     CSI_RECORD_TYPE_RAW
+#endif
+
+typedef struct __attribute__((packed)) {
+    uint8_t  magic;             // CSI_RECORD_MAGIC, never a printable char so text and binary can be told apart
+    uint8_t  version;           // CSI_RECORD_VERSION
+    uint8_t  type;              // CSI_RECORD_TYPE_*
+    uint8_t  flags;             // CSI_RECORD_FLAG_*
+    uint16_t len;               // length of the whole record in bytes, header included
+    uint8_t  mac[6];            // source mac addr
+    // https://github.com/espressif/esp-idf/blob/9d0ca60398481a44861542638cfdc1949bb6f312/components/esp_wifi/include/esp_wifi_types.h#L314
+    int8_t   rssi;
+    uint8_t  rate;
+    uint8_t  sig_mode;
+    uint8_t  mcs;
+    uint8_t  cwb;
+    uint8_t  smoothing;
+    uint8_t  not_sounding;
+    uint8_t  aggregation;
+    uint8_t  stbc;
+    uint8_t  fec_coding;
+    uint8_t  sgi;
+    int8_t   noise_floor;
+    uint8_t  ampdu_cnt;
+    uint8_t  channel;
+    uint8_t  secondary_channel;
+    uint8_t  ant;
+    uint32_t timestamp;         // rx_ctrl.timestamp, local time in us
+    uint16_t sig_len;
+    uint8_t  rx_state;
+    uint8_t  delta_seq;         // records of this mac so far, mod 256, when delta coding is on. Otherwise 0
+    uint16_t seq;               // per source mac sequence number, see seq_component.h
+    uint32_t handler_us;        // device time when csi_handler_task serialized the record, in us, wraps
+    uint64_t rx_us;             // device time when the CSI callback got the frame, in us since boot
+    uint16_t csi_len;           // number of payload bytes following the header
+} csi_record_hdr_t;
+
+_Static_assert(sizeof(csi_record_hdr_t) == 52, "csi_record_hdr_t layout changed, update csi_record.py");
+
+/* Fill the record header with everything except the payload description (type, len and csi_len). */
+void csi_record_fill_hdr(csi_record_hdr_t *hdr, const wifi_csi_info_t *d) {
+    hdr->magic = CSI_RECORD_MAGIC;
+    hdr->version = CSI_RECORD_VERSION;
+    hdr->flags = 0;
+    memcpy(hdr->mac, d->mac, 6);
+    hdr->rssi = d->rx_ctrl.rssi;
+    hdr->rate = d->rx_ctrl.rate;
+    hdr->sig_mode = d->rx_ctrl.sig_mode;
+    hdr->mcs = d->rx_ctrl.mcs;
+    hdr->cwb = d->rx_ctrl.cwb;
+    hdr->smoothing = d->rx_ctrl.smoothing;
+    hdr->not_sounding = d->rx_ctrl.not_sounding;
+    hdr->aggregation = d->rx_ctrl.aggregation;
+    hdr->stbc = d->rx_ctrl.stbc;
+    hdr->fec_coding = d->rx_ctrl.fec_coding;
+    hdr->sgi = d->rx_ctrl.sgi;
+    hdr->noise_floor = d->rx_ctrl.noise_floor;
+    hdr->ampdu_cnt = d->rx_ctrl.ampdu_cnt;
+    hdr->channel = d->rx_ctrl.channel;
+    hdr->secondary_channel = d->rx_ctrl.secondary_channel;
+    hdr->ant = d->rx_ctrl.ant;
+    hdr->timestamp = d->rx_ctrl.timestamp;
+    hdr->sig_len = d->rx_ctrl.sig_len;
+    hdr->rx_state = d->rx_ctrl.rx_state;
+    hdr->delta_seq = 0;
+    hdr->seq = 0;
+    hdr->handler_us = 0;
+    hdr->rx_us = 0;
+}
+
+/* Set the times and seq of a record written by csi_record_pack*(), before it is delta coded. */
+void csi_record_stamp(uint8_t *rec, uint16_t seq, uint64_t rx_us, uint32_t handler_us) {
+    memcpy(rec + offsetof(csi_record_hdr_t, seq), &seq, sizeof(seq));
+    memcpy(rec + offsetof(csi_record_hdr_t, handler_us), &handler_us, sizeof(handler_us));
+    memcpy(rec + offsetof(csi_record_hdr_t, rx_us), &rx_us, sizeof(rx_us));
+}
+
+/*
+ * Serialize one CSI frame as a CSI_RECORD_TYPE_RAW record into out.
+ * Returns the record length in bytes, or 0 if it does not fit into cap bytes.
+ */
+size_t csi_record_pack(const wifi_csi_info_t *d, uint8_t *out, size_t cap) {
+    size_t rec_len = sizeof(csi_record_hdr_t) + d->len;
+    if (rec_len > cap) {
+        return 0;
+    }
+
+    csi_record_hdr_t hdr;
+    csi_record_fill_hdr(&hdr, d);
+    hdr.type = CSI_RECORD_TYPE_RAW;
+    hdr.len = rec_len;
+    hdr.csi_len = d->len;
+
+    memcpy(out, &hdr, sizeof(hdr));
+    memcpy(out + sizeof(hdr), d->buf, d->len);
+    return rec_len;
+}
+
+/*
+ * Serialize one CSI frame as a record of the given CSI_RECORD_TYPE_*.
+ * Frames without a known subcarrier layout are sent as CSI_RECORD_TYPE_RAW.
+ * Returns the record length in bytes, or 0 if it does not fit into cap bytes.
+ */
+size_t csi_record_pack_type(const wifi_csi_info_t *d, uint8_t type, uint8_t *out, size_t cap) {
+    int8_t iq[DSP_MAX_SUBCARRIERS * 2];
+    int n = type == CSI_RECORD_TYPE_RAW ? 0 : dsp_select_subcarriers(d, iq);
+    if (n == 0) {
+        return csi_record_pack(d, out, cap);
+    }
+
+    // out has no alignment guarantee inside a batch, so int16 values are built here and copied
+    int16_t values[DSP_MAX_SUBCARRIERS * 2];
+    const void *payload = values;
+    size_t payload_len = n * sizeof(int16_t);
+    switch (type) {
+        case CSI_RECORD_TYPE_SUBCARRIERS:
+            payload = iq;
+            payload_len = n * 2;
+            break;
+        case CSI_RECORD_TYPE_AMPLITUDE:
+            dsp_amplitude(iq, n, values);
+            break;
+        case CSI_RECORD_TYPE_PHASE:
+            dsp_phase(iq, n, values);
+            break;
+        case CSI_RECORD_TYPE_AMP_PHASE:
+            dsp_amplitude(iq, n, values);
+            dsp_phase(iq, n, values + n);
+            payload_len *= 2;
+            break;
+        default:
+            return csi_record_pack(d, out, cap);
+    }
+
+    size_t rec_len = sizeof(csi_record_hdr_t) + payload_len;
+    if (rec_len > cap) {
+        return 0;
+    }
+
+    csi_record_hdr_t hdr;
+    csi_record_fill_hdr(&hdr, d);
+    hdr.type = type;
+    hdr.len = rec_len;
+    hdr.csi_len = payload_len;
+
+    memcpy(out, &hdr, sizeof(hdr));
+    memcpy(out + sizeof(hdr), payload, payload_len);
+    return rec_len;
+}
+
+#endif //ESP32_CSI_RECORD_COMPONENT_H
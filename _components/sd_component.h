@@ -1,6 +1,7 @@
 #ifndef ESP32_CSI_SD_COMPONENT_H
 #define ESP32_CSI_SD_COMPONENT_H
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/unistd.h>
@@ -36,8 +37,11 @@ void _sd_pick_next_file() {
     }
 }
 
-void sd_init() {
-#ifdef CONFIG_SEND_CSI_TO_SD
+/*
+ * Mount the card on /sdcard. The allocation unit is the one files are written in by
+ * sdlog_component.h, a card formatted with another one still mounts.
+ */
+bool sd_mount() {
     sdmmc_host_t host = SDSPI_HOST_DEFAULT();
     sdspi_slot_config_t slot_config = SDSPI_SLOT_CONFIG_DEFAULT();
     slot_config.gpio_miso = PIN_NUM_MISO;
@@ -66,10 +70,15 @@ void sd_init() {
                      "  If you do not have an SD card attached, please ignore this message."
                      "  Make sure SD card lines have pull-up resistors in place.", esp_err_to_name(ret));
         }
-        return;
-    } else {
-        sdmmc_card_print_info(stdout, card);
+        return false;
+    }
+    sdmmc_card_print_info(stdout, card);
+    return true;
+}
 
+void sd_init() {
+#ifdef CONFIG_SEND_CSI_TO_SD
+    if (sd_mount()) {
         _sd_pick_next_file();
         f = fopen(filename, "a");
     }
@@ -96,9 +105,11 @@ void outprintf(const char *format, ...) {
 
 void sd_flush() {
 #ifdef CONFIG_SEND_CSI_TO_SD
-    fflush(f);
-    fclose(f);
-    f = fopen(filename, "a");
+    // the file stays open, fsync() updates its size on the card
+    if (f != NULL) {
+        fflush(f);
+        fsync(fileno(f));
+    }
 #endif
 }
 
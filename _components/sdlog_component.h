@@ -0,0 +1,338 @@
+#ifndef ESP32_CSI_SDLOG_COMPONENT_H
+#define ESP32_CSI_SDLOG_COMPONENT_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Stand-alone logging of binary records to the SD card, at the full CSI rate.
+ *
+ * csi_handler_task serializes the records straight into one of two buffers. When the next record
+ * does not fit, the rest of the buffer is zero filled and the buffer goes to sd_writer_task, which
+ * writes it with one write() of whole FAT allocation units while the handler fills the other one.
+ * The handler never waits for the card: with both buffers taken the record is dropped and counted,
+ * the host sees the gap in its sequence numbers.
+ *
+ * Files are <dir>/<n>.bin, a new one is started once the current one would pass the size limit or
+ * is older than the time limit. Files only change at a buffer boundary and a buffer holds whole
+ * records, so every file reads on its own: records back to back, and where a record would start
+ * with a zero byte, padding up to the next SDLOG_UNIT. The next n is kept in NVS, so boot does not
+ * scan the card, and a file that is already there is skipped, never written over. Read back by log_records() in active_ap/csi_record.py.
+ */
+#define SDLOG_UNIT              (16 * 1024) // FAT allocation unit, see sd_mount()
+#define SDLOG_BUFS              2
+#define SDLOG_PRODUCER          0 // buffer owned by the handler, free or being filled
+#define SDLOG_WRITER            1 // handed to the writer task
+
+#ifdef CONFIG_CSI_SD_LOG
+#define SDLOG_BUF_SIZE          (CONFIG_CSI_SD_LOG_BUFFER_UNITS * SDLOG_UNIT)
+#define SDLOG_ROTATE_BYTES      ((int64_t)CONFIG_CSI_SD_LOG_ROTATE_MB << 20)
+#define SDLOG_ROTATE_US         ((int64_t)CONFIG_CSI_SD_LOG_ROTATE_MIN * 60 * 1000000)
+#define SDLOG_FLUSH_US          ((int64_t)CONFIG_CSI_SD_LOG_FLUSH_S * 1000000)
+#else
+#define SDLOG_BUF_SIZE          (2 * SDLOG_UNIT)
+#define SDLOG_ROTATE_BYTES      ((int64_t)256 << 20)
+#define SDLOG_ROTATE_US         0 // no time limit
+#define SDLOG_FLUSH_US          ((int64_t)5 * 1000000)
+#endif
+
+typedef struct {
+    uint8_t *data;
+    uint32_t len;                   // bytes to write, whole units
+    bool rotate;                    // start a new file with this buffer
+    bool sync;                      // flush the file to the card after it, a partly filled buffer
+    uint32_t owner;                 // SDLOG_PRODUCER or SDLOG_WRITER, the handoff between the tasks
+} sdlog_buf_t;
+
+typedef struct {
+    sdlog_buf_t bufs[SDLOG_BUFS];
+    uint32_t size;                  // of each buffer, whole units
+    int64_t rotate_bytes;
+    int64_t rotate_us;              // 0 for no time limit
+
+    // only used by the handler
+    int active;                     // buffer being filled, -1 while all of them are with the writer
+    int next_fill;                  // buffer to fill after the active one
+    uint32_t fill;                  // bytes in the active buffer
+    int64_t opened_us;              // first record in the active buffer
+    int64_t file_bytes;             // handed to the writer since the file was started
+    int64_t file_start_us;
+    uint32_t records;
+    uint32_t dropped;               // records that found both buffers with the writer
+
+    // only used by the writer
+    const char *dir;
+    int next_write;
+    int fd;
+    uint32_t index;                 // of the next file
+    uint32_t files;
+    uint32_t buffers;
+    uint64_t bytes;
+    uint32_t write_errors;
+    uint32_t lost_buffers;          // not written, no file or a failed write
+} csi_sdlog_t;
+
+/* mem holds SDLOG_BUFS buffers of size bytes, a multiple of SDLOG_UNIT. The first file is <dir>/<index>.bin. */
+void sdlog_init(csi_sdlog_t *l, uint8_t *mem, uint32_t size, const char *dir, uint32_t index,
+                int64_t rotate_bytes, int64_t rotate_us) {
+    memset(l, 0, sizeof(*l));
+    for (int i = 0; i < SDLOG_BUFS; i++) {
+        l->bufs[i].data = mem + (size_t)i * size;
+        l->bufs[i].owner = SDLOG_PRODUCER;
+    }
+    l->size = size;
+    l->rotate_bytes = rotate_bytes;
+    l->rotate_us = rotate_us;
+    l->active = 0;
+    l->next_fill = 1;
+    l->file_start_us = -1;
+    l->dir = dir;
+    l->fd = -1;
+    l->index = index;
+}
+
+/* Handler side: the active buffer, taking the next one if the writer gave it back. NULL if there is none. */
+static sdlog_buf_t *_sdlog_active(csi_sdlog_t *l) {
+    if (l->active < 0) {
+        if (__atomic_load_n(&l->bufs[l->next_fill].owner, __ATOMIC_ACQUIRE) != SDLOG_PRODUCER) {
+            return NULL;
+        }
+        l->active = l->next_fill;
+        l->next_fill = (l->next_fill + 1) % SDLOG_BUFS;
+        l->fill = 0;
+    }
+    return &l->bufs[l->active];
+}
+
+/* Where the next record is serialized, NULL while the writer has all the buffers. */
+uint8_t *sdlog_tail(csi_sdlog_t *l) {
+    sdlog_buf_t *b = _sdlog_active(l);
+    return b == NULL ? NULL : b->data + l->fill;
+}
+
+/* Room for the next record behind sdlog_tail(). */
+size_t sdlog_room(csi_sdlog_t *l) {
+    return _sdlog_active(l) == NULL ? 0 : l->size - l->fill;
+}
+
+/* Account for a record of n bytes just serialized at sdlog_tail(). */
+void sdlog_add(csi_sdlog_t *l, size_t n, int64_t now_us) {
+    if (l->fill == 0) {
+        l->opened_us = now_us;
+    }
+    l->fill += n;
+    l->records++;
+}
+
+/*
+ * Hand the active buffer to the writer, padded to whole units, and start filling the next one if it
+ * is free. sync when the buffer goes out partly filled, so the data is on the card soon.
+ * Returns true if a buffer was handed over, then wake the writer.
+ */
+bool sdlog_handoff(csi_sdlog_t *l, int64_t now_us, bool sync) {
+    if (l->active < 0 || l->fill == 0) {
+        return false;
+    }
+    sdlog_buf_t *b = &l->bufs[l->active];
+    uint32_t len = (l->fill + SDLOG_UNIT - 1) / SDLOG_UNIT * SDLOG_UNIT;
+    memset(b->data + l->fill, 0, len - l->fill);
+    // a new file when this one would get too large or too old, never one of no buffer
+    b->rotate = l->file_start_us < 0 ||
+                (l->file_bytes > 0 && (l->file_bytes + len > l->rotate_bytes ||
+                                       (l->rotate_us > 0 && now_us - l->file_start_us >= l->rotate_us)));
+    if (b->rotate) {
+        l->file_bytes = 0;
+        l->file_start_us = now_us;
+    }
+    l->file_bytes += len;
+    b->len = len;
+    b->sync = sync;
+    __atomic_store_n(&b->owner, SDLOG_WRITER, __ATOMIC_RELEASE);
+    l->active = -1;
+    l->fill = 0;
+    _sdlog_active(l);
+    return true;
+}
+
+/* True when the records in the active buffer have waited long enough for a partial write. */
+bool sdlog_due(const csi_sdlog_t *l, int64_t now_us, int64_t flush_us) {
+    return l->active >= 0 && l->fill > 0 && now_us - l->opened_us >= flush_us;
+}
+
+/* Microseconds until the active buffer is due, 0 if it already is, -1 if it is empty. */
+int64_t sdlog_time_left(const csi_sdlog_t *l, int64_t now_us, int64_t flush_us) {
+    if (l->active < 0 || l->fill == 0) {
+        return -1;
+    }
+    int64_t left = l->opened_us + flush_us - now_us;
+    return left > 0 ? left : 0;
+}
+
+/*
+ * Writer side: close the current file and create the next one. A file that is already there is
+ * never written over, it is skipped for the next free name: the index in NVS is saved only after
+ * the file is created, so a reset in between boots with an index that is taken.
+ */
+static bool _sdlog_open_next(csi_sdlog_t *l) {
+    char path[64];
+    if (l->fd >= 0) {
+        close(l->fd);
+        l->fd = -1;
+    }
+    while (1) {
+        snprintf(path, sizeof(path), "%s/%u.bin", l->dir, (unsigned)l->index);
+        l->fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (l->fd >= 0) {
+            break;
+        }
+        if (errno != EEXIST) {
+            return false;
+        }
+        l->index++;
+    }
+    l->index++;
+    l->files++;
+    return true;
+}
+
+/*
+ * Writer side: write the buffers handed over, in order, and give them back.
+ * Returns how many were taken, 0 if none was waiting.
+ */
+int sdlog_write_ready(csi_sdlog_t *l) {
+    int n = 0;
+    sdlog_buf_t *b;
+    while (__atomic_load_n(&(b = &l->bufs[l->next_write])->owner, __ATOMIC_ACQUIRE) == SDLOG_WRITER) {
+        if (b->rotate || l->fd < 0) {
+            _sdlog_open_next(l);
+        }
+        if (l->fd >= 0 && write(l->fd, b->data, b->len) == (ssize_t)b->len) {
+            l->buffers++;
+            l->bytes += b->len;
+            if (b->sync) {
+                fsync(l->fd);
+            }
+        } else {
+            l->write_errors++;
+            l->lost_buffers++;
+            // a failed write leaves the file at an unknown length, continue in a new one
+            if (l->fd >= 0) {
+                close(l->fd);
+                l->fd = -1;
+            }
+        }
+        __atomic_store_n(&b->owner, SDLOG_PRODUCER, __ATOMIC_RELEASE);
+        l->next_write = (l->next_write + 1) % SDLOG_BUFS;
+        n++;
+    }
+    return n;
+}
+
+/* Writer side: close the file, after sdlog_write_ready() took the last buffer. */
+void sdlog_close(csi_sdlog_t *l) {
+    if (l->fd >= 0) {
+        fsync(l->fd);
+        close(l->fd);
+        l->fd = -1;
+    }
+}
+
+#if defined(ESP_PLATFORM) && defined(CONFIG_CSI_SD_LOG)
+#include "nvs.h"
+#include "sd_component.h"
+
+#define SDLOG_DIR               "/sdcard"
+#define SDLOG_NVS_KEY           "sd_next"   // in the "csi" namespace, next to the peer list
+
+/* The index of the next file, from NVS. Without one, the first free <n>.bin on the card, found once. */
+uint32_t sdlog_load_index(void) {
+    nvs_handle_t h;
+    uint32_t index = 0;
+    if (nvs_open("csi", NVS_READONLY, &h) == ESP_OK) {
+        esp_err_t err = nvs_get_u32(h, SDLOG_NVS_KEY, &index);
+        nvs_close(h);
+        if (err == ESP_OK) {
+            return index;
+        }
+    }
+    char path[32];
+    struct stat st;
+    for (index = 0; ; index++) {
+        snprintf(path, sizeof(path), SDLOG_DIR "/%u.bin", (unsigned)index);
+        if (stat(path, &st) != 0) {
+            return index;
+        }
+    }
+}
+
+bool sdlog_save_index(uint32_t index) {
+    nvs_handle_t h;
+    if (nvs_open("csi", NVS_READWRITE, &h) != ESP_OK) {
+        return false;
+    }
+    esp_err_t err = nvs_set_u32(h, SDLOG_NVS_KEY, index);
+    if (err == ESP_OK) {
+        err = nvs_commit(h);
+    }
+    nvs_close(h);
+    return err == ESP_OK;
+}
+
+static csi_sdlog_t sdlog;
+static TaskHandle_t sdlog_writer_handle = NULL;
+// internal RAM, DMA capable, so the SD driver writes from the buffers without copying them
+static uint8_t sdlog_mem[SDLOG_BUFS * SDLOG_BUF_SIZE] __attribute__((aligned(4)));
+
+static void sdlog_writer_task(void *pvParameter) {
+    uint32_t saved = sdlog.index;
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        sdlog_write_ready(&sdlog);
+        // each new file moves the index on, so a reboot does not write over it
+        if (sdlog.index != saved && sdlog_save_index(sdlog.index)) {
+            saved = sdlog.index;
+        }
+    }
+}
+
+/* Mount the card and start the writer task on core. False if there is no card, then nothing is logged. */
+bool sdlog_start(int core) {
+    if (!sd_mount()) {
+        return false;
+    }
+    uint32_t index = sdlog_load_index();
+    sdlog_init(&sdlog, sdlog_mem, SDLOG_BUF_SIZE, SDLOG_DIR, index, SDLOG_ROTATE_BYTES, SDLOG_ROTATE_US);
+    ESP_LOGI("sdlog", "logging to " SDLOG_DIR "/%u.bin, %d x %d KB buffers", (unsigned)index, SDLOG_BUFS,
+             SDLOG_BUF_SIZE / 1024);
+    return task_create(sdlog_writer_task, "sd_writer_task", 4096, 2, core, &sdlog_writer_handle) == pdPASS;
+}
+
+/* Handler side: sdlog_handoff(), waking the writer. */
+void sdlog_send(int64_t now_us, bool sync) {
+    if (sdlog_handoff(&sdlog, now_us, sync)) {
+        xTaskNotifyGive(sdlog_writer_handle);
+    }
+}
+
+/* Handler side: copy a record serialized elsewhere into the log, false if it was dropped. */
+bool sdlog_record(const uint8_t *rec, size_t len) {
+    if (sdlog_room(&sdlog) < len) {
+        sdlog_send(esp_timer_get_time(), false);
+    }
+    uint8_t *tail = sdlog_tail(&sdlog);
+    if (tail == NULL || sdlog_room(&sdlog) < len) {
+        sdlog.dropped++;
+        return false;
+    }
+    memcpy(tail, rec, len);
+    sdlog_add(&sdlog, len, esp_timer_get_time());
+    return true;
+}
+#endif
+
+#endif //ESP32_CSI_SDLOG_COMPONENT_H
@@ -0,0 +1,40 @@
+#ifndef ESP32_CSI_SEQ_COMPONENT_H
+#define ESP32_CSI_SEQ_COMPONENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "peer_component.h"
+
+/*
+ * Per source mac sequence numbers of the records sent to the host.
+ * csi_handler_task takes the next number of a frame's mac right before serializing it, so a gap
+ * the host sees in the sequence of a mac is a record lost after the handler: dropped because it was
+ * too large (counted as drop_serialize in the stats records), a failed sendto(), or lost in UDP.
+ * Frames dropped before that (ring full, the guard of guard_component.h) are counted in the stats records instead.
+ *
+ * A peer that loses its slot (see peer_component.h) restarts at 0, which the host takes for a reboot;
+ * the stats records count those in peer_evictions.
+ *
+ * The host side is LinkStats in active_ap/link_stats.py.
+ */
+typedef struct {
+    csi_peers_t peers;
+    uint16_t next[PEER_MAX_PEERS];  // sequence number of the next record
+} csi_seq_t;
+
+void seq_init(csi_seq_t *s) {
+    peers_init(&s->peers);
+}
+
+/* Returns the sequence number of the next record from mac. */
+uint16_t seq_next(csi_seq_t *s, const uint8_t mac[6]) {
+    bool fresh;
+    int slot = peers_slot(&s->peers, mac, &fresh);
+    if (fresh) {
+        s->next[slot] = 0;
+    }
+    return s->next[slot]++;
+}
+
+#endif //ESP32_CSI_SEQ_COMPONENT_H
@@ -0,0 +1,220 @@
+#ifndef ESP32_CSI_SERIAL_COMPONENT_H
+#define ESP32_CSI_SERIAL_COMPONENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Binary records over the serial console, for wired capture where wifi to the host does not work.
+ *
+ * Every record goes out as one frame: a zero byte, the record followed by its CRC-32 (the one of
+ * zlib, little endian), COBS encoded so they hold no zero byte, and another zero byte. A reader
+ * that starts anywhere, or loses or garbles bytes, is back in step at the next zero byte, and a
+ * frame hit by an error fails its CRC and is dropped on its own. Console text (boot messages,
+ * ESP_LOG lines) has no zero bytes, it lands between two frames and is counted as text.
+ * COBS adds a byte per 254, a raw HT40 record of 436 bytes is 444 bytes on the wire, where the
+ * text line of _wifi_csi_cb() is about 580 with only the first 128 of its 384 values.
+ *
+ * Decoded by serial_decode() here (csi_ingest -t), and by active_ap/csi_serial.py.
+ */
+#define SERIAL_CRC_LEN          4
+#define SERIAL_MAX_RECORD       2048    // CSI_PAYLOAD_SIZE, the largest record sent
+#define SERIAL_FRAME_LEN(n)     ((n) + SERIAL_CRC_LEN + ((n) + SERIAL_CRC_LEN) / 254 + 3)
+#define SERIAL_FRAME_MAX        SERIAL_FRAME_LEN(SERIAL_MAX_RECORD)
+
+#ifdef CONFIG_CSI_SERIAL_BAUD
+#define SERIAL_BAUD             CONFIG_CSI_SERIAL_BAUD
+#else
+#define SERIAL_BAUD             2000000
+#endif
+
+// CRC-32 a nibble at a time, 64 bytes of table instead of 1 KB
+static const uint32_t _serial_crc_table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+};
+
+/* zlib's crc32(crc, p, n), start with crc = 0. */
+uint32_t serial_crc32(uint32_t crc, const uint8_t *p, size_t n) {
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++) {
+        crc ^= p[i];
+        crc = (crc >> 4) ^ _serial_crc_table[crc & 0x0F];
+        crc = (crc >> 4) ^ _serial_crc_table[crc & 0x0F];
+    }
+    return ~crc;
+}
+
+/*
+ * Frame the record of len bytes into out.
+ * Returns the frame length, at most SERIAL_FRAME_LEN(len), or 0 if it does not fit into cap bytes.
+ */
+size_t serial_frame(const uint8_t *rec, size_t len, uint8_t *out, size_t cap) {
+    if (cap < SERIAL_FRAME_LEN(len)) {
+        return 0;
+    }
+    uint32_t crc = serial_crc32(0, rec, len);
+    uint8_t tail[SERIAL_CRC_LEN] = {crc, crc >> 8, crc >> 16, crc >> 24};
+    size_t o = 0;
+    out[o++] = 0;
+    // each block is a code byte, the offset of the next zero, and up to 254 bytes that are not zero
+    size_t code_at = o++;
+    uint8_t code = 1;
+    for (size_t i = 0; i < len + SERIAL_CRC_LEN; i++) {
+        uint8_t b = i < len ? rec[i] : tail[i - len];
+        if (b == 0) {
+            out[code_at] = code;
+            code_at = o++;
+            code = 1;
+            continue;
+        }
+        out[o++] = b;
+        if (++code == 0xFF) {
+            out[code_at] = code;
+            code_at = o++;
+            code = 1;
+        }
+    }
+    out[code_at] = code;
+    out[o++] = 0;
+    return o;
+}
+
+/* Called with each record that passed its CRC. */
+typedef void (*serial_record_cb_t)(void *ctx, const uint8_t *rec, size_t len);
+
+typedef struct {
+    uint8_t buf[SERIAL_FRAME_MAX];  // the encoded bytes since the last zero
+    size_t len;
+    bool overflow;                  // more than a frame since the last zero, dropped up to the next one
+    uint64_t bytes;
+    uint64_t frames;                // records passed on
+    uint64_t text_bytes;            // console text between the frames
+    uint64_t crc_errors;
+    uint64_t cobs_errors;           // not valid COBS, or too short for a CRC
+    uint64_t overflows;
+} serial_decoder_t;
+
+void serial_decoder_init(serial_decoder_t *d) {
+    memset(d, 0, sizeof(*d));
+}
+
+// console text: printable, tabs and line ends, and the escape sequences of the colored log
+static bool _serial_is_text(const uint8_t *p, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if ((p[i] < 0x20 || p[i] > 0x7E) && p[i] != '\n' && p[i] != '\r' && p[i] != '\t' && p[i] != 0x1B) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// the bytes between two zeros: decode in place, check the CRC and pass the record on.
+// A frame is never all text, every record starts with CSI_RECORD_MAGIC.
+static void _serial_chunk(serial_decoder_t *d, serial_record_cb_t cb, void *ctx) {
+    if (_serial_is_text(d->buf, d->len)) {
+        d->text_bytes += d->len;
+        return;
+    }
+    uint8_t *p = d->buf;
+    size_t n = d->len;
+    size_t o = 0;
+    size_t i = 0;
+    bool valid = true;
+    while (i < n) {
+        uint8_t code = p[i++];
+        if (i + code - 1 > n) {
+            valid = false;
+            break;
+        }
+        // o never passes i, the decoded bytes overwrite the ones already read
+        memmove(p + o, p + i, code - 1);
+        o += code - 1;
+        i += code - 1;
+        if (code != 0xFF && i < n) {
+            p[o++] = 0;
+        }
+    }
+    if (!valid || o < SERIAL_CRC_LEN) {
+        d->cobs_errors++;
+        return;
+    }
+    size_t len = o - SERIAL_CRC_LEN;
+    uint32_t crc = p[len] | (uint32_t)p[len + 1] << 8 | (uint32_t)p[len + 2] << 16 | (uint32_t)p[len + 3] << 24;
+    if (serial_crc32(0, p, len) != crc) {
+        d->crc_errors++;
+        return;
+    }
+    d->frames++;
+    cb(ctx, p, len);
+}
+
+/*
+ * Feed n bytes read from the serial port, in any pieces. cb gets every record that arrived
+ * intact, the decoder resynchronizes at the next zero byte after anything else.
+ * Returns the number of records passed to cb.
+ */
+size_t serial_decode(serial_decoder_t *d, const uint8_t *p, size_t n, serial_record_cb_t cb, void *ctx) {
+    uint64_t frames = d->frames;
+    d->bytes += n;
+    while (n > 0) {
+        const uint8_t *zero = memchr(p, 0, n);
+        size_t take = zero == NULL ? n : (size_t)(zero - p);
+        if (!d->overflow && d->len + take > sizeof(d->buf)) {
+            d->overflow = true;
+            d->overflows++;
+        }
+        if (!d->overflow) {
+            memcpy(d->buf + d->len, p, take);
+            d->len += take;
+        }
+        if (zero == NULL) {
+            break;
+        }
+        if (!d->overflow && d->len > 0) {
+            // the zero between two frames gives an empty chunk, nothing to do
+            _serial_chunk(d, cb, ctx);
+        }
+        d->len = 0;
+        d->overflow = false;
+        p += take + 1;
+        n -= take + 1;
+    }
+    return d->frames - frames;
+}
+
+#if defined(ESP_PLATFORM) && defined(CONFIG_CSI_SERIAL_FRAMED)
+#include "driver/uart.h"
+#include "esp_vfs_dev.h"
+
+#define SERIAL_UART             CONFIG_ESP_CONSOLE_UART_NUM
+#define SERIAL_TX_BUFFER        (16 * 1024) // ~80 ms at 2 Mbaud, ~35 raw records
+#define SERIAL_RX_BUFFER        512         // console commands
+
+/*
+ * Run the console UART through the driver, with a TX ring buffer the frames are copied into and
+ * sent from by the UART interrupt, at SERIAL_BAUD. stdout and stdin go through the driver too, so
+ * printf() and the log never write into the middle of a frame. The boot log before this is at
+ * CONFIG_ESP_CONSOLE_UART_BAUDRATE, the decoder skips it as noise.
+ */
+void serial_init() {
+    ESP_ERROR_CHECK(uart_driver_install(SERIAL_UART, SERIAL_RX_BUFFER, SERIAL_TX_BUFFER, 0, NULL, 0));
+    ESP_ERROR_CHECK(uart_set_baudrate(SERIAL_UART, SERIAL_BAUD));
+    esp_vfs_dev_uart_use_driver(SERIAL_UART);
+}
+
+/*
+ * Send one record as a frame. Copies it into the TX ring buffer in a single write, and blocks only
+ * while the ring buffer is full, that is while the link is slower than the frames.
+ * The frame buffer is static, only one task may call this.
+ */
+bool serial_send(const uint8_t *rec, size_t len) {
+    static uint8_t frame[SERIAL_FRAME_MAX];
+    size_t n = serial_frame(rec, len, frame, sizeof(frame));
+    return n > 0 && uart_write_bytes(SERIAL_UART, (const char *)frame, n) == n;
+}
+#endif
+
+#endif //ESP32_CSI_SERIAL_COMPONENT_H
@@ -13,14 +13,22 @@
 #include "esp_wifi.h"
 #include "esp_event_loop.h"
 #include <esp_http_server.h>
-#include "rom/ets_sys.h"
+#include "esp_timer.h"
 
+#include "pacer_component.h"
+
+#ifndef CONFIG_PACKET_RATE
 #define CONFIG_PACKET_RATE 350
+#endif
 
 char *data = "1\n";
 
 void socket_transmitter_sta_loop(bool (*is_wifi_connected)()) {
     int socket_fd = -1;
+    // CONFIG_PACKET_RATE packets per second on an esp_timer, instead of tick delays and a busy wait
+    csi_pacer_t pacer;
+    pacer_start(&pacer, CONFIG_PACKET_RATE, 0);
+    int64_t next_report_us = esp_timer_get_time() + 10000000;
     while (1) {
         close(socket_fd);
         char *ip = "192.168.4.1";
@@ -53,19 +61,19 @@ void socket_transmitter_sta_loop(bool (*is_wifi_connected)()) {
                 break;
             }
 
-            if (sendto(socket_fd, &data, strlen(data), 0, (const struct sockaddr *) &caddr, sizeof(caddr)) !=
-                strlen(data)) {
-                vTaskDelay(1);
-                continue;
-            }
-            vTaskDelay(2);
+            pacer_wait(&pacer);
+            bool ok = sendto(socket_fd, data, strlen(data), 0, (const struct sockaddr *) &caddr, sizeof(caddr)) ==
+                      strlen(data);
+            int64_t now = esp_timer_get_time();
+            pacer_result(&pacer, now, ok);
 
-#ifdef CONFIG_PACKET_RATE
-            vTaskDelay(CONFIG_PACKET_RATE != 0 ? floor(1000 / CONFIG_PACKET_RATE) : 0);
-            ets_delay_us(((1000.0 / CONFIG_PACKET_RATE) - floor(1000 / CONFIG_PACKET_RATE)) * 1000);
-#else
-            vTaskDelay(10); // This limits TX to approximately 100 per second.
-#endif
+            if (now >= next_report_us) {
+                pacer_report_t r;
+                pacer_report(&pacer, now, &r);
+                printf("%.1f packets/s of %d, jitter %.0f us, %u failed, %u skipped\n", r.rate_hz, CONFIG_PACKET_RATE,
+                       r.jitter_us, r.failed, r.skipped);
+                next_report_us = now + 10000000;
+            }
         }
     }
 }
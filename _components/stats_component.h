@@ -0,0 +1,193 @@
+#ifndef ESP32_CSI_STATS_COMPONENT_H
+#define ESP32_CSI_STATS_COMPONENT_H
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include "xtensa/hal.h"
+#endif
+
+#include "record_component.h"
+#include "pool_component.h"
+
+/*
+ * Where frames go on a device: a counter per pipeline stage, sent to the host as a stats record
+ * every CSI_STATS_INTERVAL_US, in its own datagram next to the CSI datagrams.
+ *
+ * Every field has exactly one writer, either the CSI callback (wifi task) or the CSI handler
+ * task, and is a plain aligned 32-bit store, so counting costs an increment and no lock.
+ * Counters only ever grow (and wrap), the host takes differences to get rates.
+ * Cycle and queue time sums also wrap, the averages are taken over the differences since the
+ * last stats record. The maxima are reset by the handler after each record; a new maximum
+ * the callback stores at that very moment can get lost.
+ */
+#ifdef CONFIG_CSI_STATS_INTERVAL_S
+#define CSI_STATS_INTERVAL_US   ((int64_t)CONFIG_CSI_STATS_INTERVAL_S * 1000000)
+#else
+#define CSI_STATS_INTERVAL_US   0 // no stats records
+#endif
+
+#define CSI_RECORD_TYPE_STATS   0x10
+
+typedef struct {
+    // written by the CSI callback
+    uint32_t cb_calls;              // frames the wifi driver reported
+    uint32_t drop_filter;           // not from a peer
+    uint32_t drop_non_ht;           // non-HT (11bg) frames
+    uint32_t drop_no_host;          // no host to send to yet
+    uint32_t cb_cycles;             // CPU cycles spent in the callback, summed
+    uint32_t cb_cycles_max;
+    // written by the CSI handler task
+    uint32_t drop_self;             // caused by our own reports, see guard_component.h
+    uint32_t drop_rate;             // over the rate limit of its source
+    uint32_t handled;               // taken from the ring and not dropped by the guard
+    uint32_t drop_serialize;        // serialized record does not fit the payload buffer
+    uint32_t records_sent;
+    uint32_t datagrams_sent;
+    uint32_t bytes_sent;
+    uint32_t send_errors;           // sendto() failed, the datagram is lost
+    uint32_t peer_evictions;        // evictions of the sequence table, see peer_component.h
+    uint32_t local_only;            // handled before there was a host, only logged to the SD card or framed
+    uint32_t handler_cycles;        // CPU cycles per handled frame, summed
+    uint32_t handler_cycles_max;
+    uint32_t queue_us;              // time frames waited in the ring, summed
+    uint32_t queue_us_max;
+} csi_stats_t;
+
+/* What goes to the host. Same first 12 bytes as csi_record_hdr_t, decoded by parse_stats() in active_ap/csi_record.py */
+typedef struct __attribute__((packed)) {
+    uint8_t  magic;                 // CSI_RECORD_MAGIC
+    uint8_t  version;               // CSI_RECORD_VERSION
+    uint8_t  type;                  // CSI_RECORD_TYPE_STATS
+    uint8_t  flags;
+    uint16_t len;
+    uint8_t  mac[6];                // the device itself
+    uint32_t uptime_ms;
+    // counters since boot
+    uint32_t cb_calls;
+    uint32_t drop_filter;
+    uint32_t drop_non_ht;
+    uint32_t drop_no_host;
+    uint32_t drop_ring_full;
+    uint32_t drop_oversized;
+    uint32_t drop_thinned;          // drop_self + drop_rate
+    uint32_t drop_serialize;
+    uint32_t records_sent;
+    uint32_t datagrams_sent;
+    uint32_t bytes_sent;
+    uint32_t send_errors;
+    uint16_t ring_size;
+    uint16_t ring_high_water;       // since boot
+    // since the previous stats record
+    uint32_t cb_cycles_avg;
+    uint32_t cb_cycles_max;
+    uint32_t handler_cycles_avg;
+    uint32_t handler_cycles_max;
+    uint32_t queue_us_avg;
+    uint32_t queue_us_max;
+    // counters since boot, added later: records of 92 bytes have none, of 100 bytes no peer_evictions,
+    // of 104 bytes no local_only
+    uint32_t drop_self;
+    uint32_t drop_rate;
+    uint32_t peer_evictions;
+    uint32_t local_only;
+} csi_stats_record_t;
+
+_Static_assert(sizeof(csi_stats_record_t) == 108, "csi_stats_record_t layout changed, update csi_record.py");
+
+static inline uint32_t stats_ccount(void) {
+    return xthal_get_ccount();
+}
+
+/* Callback side: account the cycles since start, taken with stats_ccount() on entry. */
+static inline void stats_cb_done(csi_stats_t *s, uint32_t start) {
+    uint32_t c = stats_ccount() - start;
+    s->cb_cycles += c;
+    if (c > s->cb_cycles_max) {
+        s->cb_cycles_max = c;
+    }
+}
+
+/* Handler side: account one frame taken from the ring. */
+static inline void stats_handled(csi_stats_t *s, uint32_t cycles, int64_t queued_us) {
+    s->handled++;
+    s->handler_cycles += cycles;
+    if (cycles > s->handler_cycles_max) {
+        s->handler_cycles_max = cycles;
+    }
+    uint32_t q = queued_us > 0 ? (uint32_t)queued_us : 0;
+    s->queue_us += q;
+    if (q > s->queue_us_max) {
+        s->queue_us_max = q;
+    }
+}
+
+static inline void stats_sent(csi_stats_t *s, int records, int bytes, bool ok) {
+    if (ok) {
+        s->records_sent += records;
+        s->datagrams_sent++;
+        s->bytes_sent += bytes;
+    } else {
+        s->send_errors++;
+    }
+}
+
+static inline uint32_t _stats_avg(uint32_t sum, uint32_t prev_sum, uint32_t n, uint32_t prev_n) {
+    uint32_t count = n - prev_n;
+    return count == 0 ? 0 : (sum - prev_sum) / count;
+}
+
+/*
+ * Handler side: build the stats record in out, prev holds the counters at the previous record
+ * and is updated. Returns the record length, 0 if it does not fit into cap bytes.
+ */
+size_t stats_pack(csi_stats_t *s, csi_stats_t *prev, const csi_ring_t *ring, const uint8_t mac[6],
+                  uint32_t uptime_ms, uint8_t *out, size_t cap) {
+    if (sizeof(csi_stats_record_t) > cap) {
+        return 0;
+    }
+    csi_stats_t now = *s;
+    csi_stats_record_t rec;
+    rec.magic = CSI_RECORD_MAGIC;
+    rec.version = CSI_RECORD_VERSION;
+    rec.type = CSI_RECORD_TYPE_STATS;
+    rec.flags = 0;
+    rec.len = sizeof(rec);
+    memcpy(rec.mac, mac, 6);
+    rec.uptime_ms = uptime_ms;
+    rec.cb_calls = now.cb_calls;
+    rec.drop_filter = now.drop_filter;
+    rec.drop_non_ht = now.drop_non_ht;
+    rec.drop_no_host = now.drop_no_host;
+    rec.drop_ring_full = ring->dropped;
+    rec.drop_oversized = ring->oversized;
+    rec.drop_thinned = now.drop_self + now.drop_rate;
+    rec.drop_serialize = now.drop_serialize;
+    rec.records_sent = now.records_sent;
+    rec.datagrams_sent = now.datagrams_sent;
+    rec.bytes_sent = now.bytes_sent;
+    rec.send_errors = now.send_errors;
+    rec.ring_size = ring->size;
+    rec.ring_high_water = ring->high_water;
+    rec.cb_cycles_avg = _stats_avg(now.cb_cycles, prev->cb_cycles, now.cb_calls, prev->cb_calls);
+    rec.cb_cycles_max = now.cb_cycles_max;
+    rec.handler_cycles_avg = _stats_avg(now.handler_cycles, prev->handler_cycles, now.handled, prev->handled);
+    rec.handler_cycles_max = now.handler_cycles_max;
+    rec.queue_us_avg = _stats_avg(now.queue_us, prev->queue_us, now.handled, prev->handled);
+    rec.queue_us_max = now.queue_us_max;
+    rec.drop_self = now.drop_self;
+    rec.drop_rate = now.drop_rate;
+    rec.peer_evictions = now.peer_evictions;
+    rec.local_only = now.local_only;
+
+    s->cb_cycles_max = 0;
+    s->handler_cycles_max = 0;
+    s->queue_us_max = 0;
+    *prev = now;
+
+    memcpy(out, &rec, sizeof(rec));
+    return sizeof(rec);
+}
+
+#endif //ESP32_CSI_STATS_COMPONENT_H
@@ -0,0 +1,181 @@
+#ifndef ESP32_CSI_TASK_COMPONENT_H
+#define ESP32_CSI_TASK_COMPONENT_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "record_component.h"
+
+/*
+ * Where the tasks of a device run, and how much CPU each of them takes.
+ *
+ * The wifi driver calls the CSI callback in its task on core 0, next to lwIP and mDNS (pinned
+ * there in sdkconfig). csi_handler_task, which serializes and batches the frames, is pinned to
+ * CSI_HANDLER_CORE, core 1 by default, so it gets a core of its own instead of taking turns with
+ * the network stack. Core, priority and stack come from menuconfig (Task layout).
+ *
+ * With CONFIG_CSI_TASK_STATS every stats record is followed by a task record: the share of one
+ * core each task took since the previous one, from the FreeRTOS run time counters, and the least
+ * free stack it had. Decoded by parse_tasks() in active_ap/csi_record.py.
+ */
+#ifdef CONFIG_CSI_HANDLER_CORE
+#define CSI_HANDLER_CORE        CONFIG_CSI_HANDLER_CORE
+#define CSI_HANDLER_PRIORITY    CONFIG_CSI_HANDLER_PRIORITY
+#define CSI_HANDLER_STACK       CONFIG_CSI_HANDLER_STACK
+#else
+#define CSI_HANDLER_CORE        1
+#define CSI_HANDLER_PRIORITY    4
+#define CSI_HANDLER_STACK       4096
+#endif
+#define CSI_NET_CORE            0 // wifi, lwIP, mDNS and the low priority tasks of the app
+
+#define CSI_RECORD_TYPE_TASKS   0x11
+#define TASK_STATS_MAX          24  // tasks per record, the rest are left out
+#define TASK_NAME_LEN           16  // CONFIG_FREERTOS_MAX_TASK_NAME_LEN
+#define TASK_CORE_ANY           0xFF
+
+/* One task as the device sampled it. */
+typedef struct {
+    uint32_t number;                // xTaskNumber, unique per task
+    char name[TASK_NAME_LEN];
+    uint8_t core;                   // pinned to, or TASK_CORE_ANY
+    uint8_t priority;
+    uint32_t runtime;               // run time counter, wraps
+    uint32_t stack_free;            // bytes, least since the task started
+} task_sample_t;
+
+/* Run time counters at the previous record, to take the differences. */
+typedef struct {
+    uint32_t number[TASK_STATS_MAX];
+    uint32_t runtime[TASK_STATS_MAX];
+    int count;
+    uint32_t total;
+} csi_task_stats_t;
+
+typedef struct __attribute__((packed)) {
+    char name[TASK_NAME_LEN];
+    uint8_t core;
+    uint8_t priority;
+    uint16_t cpu_permille;          // of one core since the previous record
+    uint16_t stack_free;            // bytes, saturated
+    uint16_t reserved;
+} task_record_entry_t;
+
+/* Same first 16 bytes as csi_stats_record_t, then count entries. */
+typedef struct __attribute__((packed)) {
+    uint8_t  magic;                 // CSI_RECORD_MAGIC
+    uint8_t  version;               // CSI_RECORD_VERSION
+    uint8_t  type;                  // CSI_RECORD_TYPE_TASKS
+    uint8_t  flags;
+    uint16_t len;
+    uint8_t  mac[6];
+    uint32_t uptime_ms;
+    uint32_t interval;              // run time counter ticks since the previous record
+    uint8_t  count;
+    uint8_t  cores;
+    uint16_t reserved;
+    task_record_entry_t tasks[];
+} task_record_t;
+
+_Static_assert(sizeof(task_record_t) == 24 && sizeof(task_record_entry_t) == 24,
+               "task_record_t layout changed, update csi_record.py");
+
+#define TASK_RECORD_MAX_LEN     (sizeof(task_record_t) + TASK_STATS_MAX * sizeof(task_record_entry_t))
+
+void task_stats_init(csi_task_stats_t *t) {
+    memset(t, 0, sizeof(*t));
+}
+
+/*
+ * Build the task record of n samples taken at run time counter total in out, t holds the
+ * counters of the previous record and is updated. A task new since then counts from its start.
+ * Returns the record length, 0 if it does not fit into cap bytes.
+ */
+size_t task_stats_pack(csi_task_stats_t *t, const task_sample_t *samples, int n, uint32_t total, int cores,
+                       const uint8_t mac[6], uint32_t uptime_ms, uint8_t *out, size_t cap) {
+    if (n > TASK_STATS_MAX) {
+        n = TASK_STATS_MAX;
+    }
+    size_t len = sizeof(task_record_t) + n * sizeof(task_record_entry_t);
+    if (len > cap) {
+        return 0;
+    }
+    task_record_t *rec = (task_record_t *)out;
+    rec->magic = CSI_RECORD_MAGIC;
+    rec->version = CSI_RECORD_VERSION;
+    rec->type = CSI_RECORD_TYPE_TASKS;
+    rec->flags = 0;
+    rec->len = len;
+    memcpy(rec->mac, mac, 6);
+    rec->uptime_ms = uptime_ms;
+    uint32_t interval = total - t->total;
+    rec->interval = interval;
+    rec->count = n;
+    rec->cores = cores;
+    rec->reserved = 0;
+
+    csi_task_stats_t next = {.count = n, .total = total};
+    for (int i = 0; i < n; i++) {
+        const task_sample_t *s = &samples[i];
+        uint32_t prev = 0;
+        for (int j = 0; j < t->count; j++) {
+            if (t->number[j] == s->number) {
+                prev = t->runtime[j];
+                break;
+            }
+        }
+        uint32_t ran = s->runtime - prev;
+        uint32_t permille = interval == 0 ? 0 : (uint32_t)((uint64_t)ran * 1000 / interval);
+        task_record_entry_t e;
+        memset(&e, 0, sizeof(e));
+        memcpy(e.name, s->name, strnlen(s->name, TASK_NAME_LEN)); // not terminated when it takes all 16
+        e.core = s->core;
+        e.priority = s->priority;
+        e.cpu_permille = permille > 1000 ? 1000 : permille;
+        e.stack_free = s->stack_free > 0xFFFF ? 0xFFFF : s->stack_free;
+        memcpy(&rec->tasks[i], &e, sizeof(e));
+        next.number[i] = s->number;
+        next.runtime[i] = s->runtime;
+    }
+    *t = next;
+    return len;
+}
+
+#ifdef ESP_PLATFORM
+/* xTaskCreatePinnedToCore(), core < 0 for none. Single core builds run everything on core 0. */
+static inline BaseType_t task_create(TaskFunction_t fn, const char *name, uint32_t stack, UBaseType_t priority,
+                                     int core, TaskHandle_t *handle) {
+#ifdef CONFIG_FREERTOS_UNICORE
+    core = 0;
+#endif
+    return xTaskCreatePinnedToCore(fn, name, stack, NULL, priority, handle, core < 0 ? tskNO_AFFINITY : core);
+}
+
+#ifdef CONFIG_CSI_TASK_STATS
+#define TASK_SAMPLE_MAX         32  // tasks sampled, uxTaskGetSystemState() gives none when there are more
+
+/*
+ * The task record of all tasks now, see task_stats_pack(). The sample arrays are static, only the
+ * task that sends the stats calls this.
+ */
+size_t task_stats_sample(csi_task_stats_t *t, const uint8_t mac[6], uint32_t uptime_ms, uint8_t *out, size_t cap) {
+    static TaskStatus_t status[TASK_SAMPLE_MAX];
+    static task_sample_t samples[TASK_SAMPLE_MAX];
+    uint32_t total = 0;
+    UBaseType_t n = uxTaskGetSystemState(status, TASK_SAMPLE_MAX, &total);
+    for (UBaseType_t i = 0; i < n; i++) {
+        task_sample_t *s = &samples[i];
+        s->number = status[i].xTaskNumber;
+        strncpy(s->name, status[i].pcTaskName, TASK_NAME_LEN);
+        BaseType_t core = xTaskGetAffinity(status[i].xHandle);
+        s->core = core == tskNO_AFFINITY ? TASK_CORE_ANY : core;
+        s->priority = status[i].uxCurrentPriority;
+        s->runtime = status[i].ulRunTimeCounter;
+        s->stack_free = status[i].usStackHighWaterMark; // bytes on ESP-IDF
+    }
+    return task_stats_pack(t, samples, n, total, portNUM_PROCESSORS, mac, uptime_ms, out, cap);
+}
+#endif
+#endif
+
+#endif //ESP32_CSI_TASK_COMPONENT_H
@@ -28,6 +28,13 @@ void time_set(char *timestamp_string) {
     }
 }
 
+/* The clock of time_string_get() in us, for callers that do not need the string. */
+int64_t time_us_get() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
+
 char *time_string_get() {
     struct timeval currentTimeGot;
     gettimeofday(&currentTimeGot, NULL);
@@ -0,0 +1,220 @@
+#ifndef ESP32_CSI_WRITER_COMPONENT_H
+#define ESP32_CSI_WRITER_COMPONENT_H
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Cursor based text writer with a capacity bound.
+ * Every call appends at the cursor, so building a payload is a single pass instead of
+ * the strlen() rescan of sprintf(payload + strlen(payload), ...).
+ * Once something does not fit, the writer stops appending and remembers the overflow.
+ * The buffer is kept NUL-terminated as long as cap > 0.
+ */
+typedef struct {
+    char *buf;
+    size_t cap;
+    size_t pos;
+    bool overflow;
+} csi_writer_t;
+
+// "00" "01" ... "99", two digits per lookup when formatting integers
+static const char WRITER_DIGIT_PAIRS[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const char WRITER_HEX_LOWER[] = "0123456789abcdef";
+static const char WRITER_HEX_UPPER[] = "0123456789ABCDEF";
+
+void writer_init(csi_writer_t *w, char *buf, size_t cap) {
+    w->buf = buf;
+    w->cap = cap;
+    w->pos = 0;
+    w->overflow = (cap == 0);
+    if (cap > 0) {
+        buf[0] = '\0';
+    }
+}
+
+// room left for characters, one byte is always kept for the NUL terminator.
+static inline size_t writer_room(const csi_writer_t *w) {
+    return w->overflow ? 0 : w->cap - w->pos - 1;
+}
+
+void writer_mem(csi_writer_t *w, const char *s, size_t n) {
+    if (n > writer_room(w)) {
+        w->overflow = true;
+        return;
+    }
+    memcpy(w->buf + w->pos, s, n);
+    w->pos += n;
+    w->buf[w->pos] = '\0';
+}
+
+void writer_str(csi_writer_t *w, const char *s) {
+    writer_mem(w, s, strlen(s));
+}
+
+void writer_char(csi_writer_t *w, char c) {
+    if (writer_room(w) < 1) {
+        w->overflow = true;
+        return;
+    }
+    w->buf[w->pos++] = c;
+    w->buf[w->pos] = '\0';
+}
+
+// decimal digits of v, written backwards ending at end. returns the first char.
+static inline char *writer_fmt_u32(char *end, uint32_t v) {
+    char *p = end;
+    while (v >= 100) {
+        uint32_t r = v % 100;
+        v /= 100;
+        p -= 2;
+        memcpy(p, &WRITER_DIGIT_PAIRS[r * 2], 2);
+    }
+    if (v >= 10) {
+        p -= 2;
+        memcpy(p, &WRITER_DIGIT_PAIRS[v * 2], 2);
+    } else {
+        *--p = '0' + v;
+    }
+    return p;
+}
+
+void writer_uint(csi_writer_t *w, uint32_t v) {
+    char tmp[10];
+    char *p = writer_fmt_u32(tmp + sizeof(tmp), v);
+    writer_mem(w, p, tmp + sizeof(tmp) - p);
+}
+
+/* Same output as printf("%llu", v), for the 64-bit timestamps. */
+void writer_u64(csi_writer_t *w, uint64_t v) {
+    if (v <= UINT32_MAX) {
+        writer_uint(w, v);
+        return;
+    }
+    char tmp[20];
+    char *end = tmp + sizeof(tmp);
+    char *p = end;
+    // 9 zero padded digits at a time while the rest does not fit 32 bits
+    while (v > UINT32_MAX) {
+        char *group = p - 9;
+        p = writer_fmt_u32(p, v % 1000000000);
+        while (p > group) {
+            *--p = '0';
+        }
+        v /= 1000000000;
+    }
+    p = writer_fmt_u32(p, v);
+    writer_mem(w, p, end - p);
+}
+
+/* Same output as printf("%d", v). */
+void writer_int(csi_writer_t *w, int32_t v) {
+    char tmp[11];
+    uint32_t u = v < 0 ? 0u - (uint32_t)v : (uint32_t)v;
+    char *p = writer_fmt_u32(tmp + sizeof(tmp), u);
+    if (v < 0) {
+        *--p = '-';
+    }
+    writer_mem(w, p, tmp + sizeof(tmp) - p);
+}
+
+/* v / 10000 with 4 decimals, same output as printf("%.4f", v / 1e4) without floating point. */
+void writer_e4(csi_writer_t *w, int32_t v) {
+    char tmp[16];
+    uint32_t u = v < 0 ? 0u - (uint32_t)v : (uint32_t)v;
+    char *end = tmp + sizeof(tmp);
+    uint32_t frac = u % 10000;
+    memcpy(end - 4, &WRITER_DIGIT_PAIRS[(frac / 100) * 2], 2);
+    memcpy(end - 2, &WRITER_DIGIT_PAIRS[(frac % 100) * 2], 2);
+    end[-5] = '.';
+    char *p = writer_fmt_u32(end - 5, u / 10000);
+    if (v < 0) {
+        *--p = '-';
+    }
+    writer_mem(w, p, end - p);
+}
+
+/*
+ * Append v followed by sep, the hot path of the CSI text formats.
+ * An int8 is at most 4 chars, so the bound is checked once and the digits come straight from the table.
+ */
+void writer_i8_sep(csi_writer_t *w, int8_t v, char sep) {
+    if (writer_room(w) < 5) {
+        writer_int(w, v);
+        writer_char(w, sep);
+        return;
+    }
+    char *p = w->buf + w->pos;
+    uint32_t u = v;
+    if (v < 0) {
+        *p++ = '-';
+        u = -(int32_t)v;
+    }
+    if (u >= 100) {
+        *p++ = '1';
+        u -= 100;
+        memcpy(p, &WRITER_DIGIT_PAIRS[u * 2], 2);
+        p += 2;
+    } else if (u >= 10) {
+        memcpy(p, &WRITER_DIGIT_PAIRS[u * 2], 2);
+        p += 2;
+    } else {
+        *p++ = '0' + u;
+    }
+    *p++ = sep;
+    *p = '\0';
+    w->pos = p - w->buf;
+}
+
+/* Append aa:bb:cc:dd:ee:ff */
+void writer_mac(csi_writer_t *w, const uint8_t mac[6], bool upper) {
+    const char *hex = upper ? WRITER_HEX_UPPER : WRITER_HEX_LOWER;
+    char tmp[17];
+    for (int i = 0; i < 6; i++) {
+        tmp[i * 3] = hex[mac[i] >> 4];
+        tmp[i * 3 + 1] = hex[mac[i] & 0x0F];
+        if (i < 5) {
+            tmp[i * 3 + 2] = ':';
+        }
+    }
+    writer_mem(w, tmp, sizeof(tmp));
+}
+
+/* Bounded printf at the cursor, for the rare formats the helpers above do not cover. */
+void writer_printf(csi_writer_t *w, const char *format, ...) {
+    if (w->overflow) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(w->buf + w->pos, w->cap - w->pos, format, args);
+    va_end(args);
+
+    if (n < 0 || (size_t)n > writer_room(w)) {
+        w->buf[w->pos] = '\0';
+        w->overflow = true;
+        return;
+    }
+    w->pos += n;
+}
+
+/* Length of the text written so far, or -1 if anything was dropped. */
+int writer_finish(const csi_writer_t *w) {
+    return w->overflow ? -1 : (int)w->pos;
+}
+
+#endif //ESP32_CSI_WRITER_COMPONENT_H
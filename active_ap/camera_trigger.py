@@ -0,0 +1,171 @@
+import http.client
+import threading
+import time
+
+# Brings up the camera on motion without holding up ingest or detection, instead of starting
+# camera_streaming.py in a new interpreter on every trigger.
+# trigger() only takes a timestamp and wakes the worker thread. The worker keeps a connection to
+# the camera open (the framesize set once, a /status request every keepalive_s), so on a trigger
+# the first frame is one /capture request over it; the video stream on stream_port follows.
+# Hysteresis: triggers while the stream runs keep it on until hold_s after the last of them, then
+# triggers are dropped for cooldown_s. Each JPEG goes to on_frame(jpeg, t) in the worker thread,
+# the newest is also in latest().
+IDLE = 0
+STREAMING = 1
+COOLDOWN = 2
+
+class CameraTrigger :
+    def __init__ (self, host, port=80, stream_port=81, framesize=8, hold_s=10.0, cooldown_s=5.0,
+                  keepalive_s=5.0, timeout_s=2.0, on_frame=None) :
+        self.host = host
+        self.port = port
+        self.stream_port = stream_port
+        self.framesize = framesize
+        self.hold_s = hold_s
+        self.cooldown_s = cooldown_s
+        self.keepalive_s = keepalive_s
+        self.timeout_s = timeout_s
+        self.on_frame = on_frame
+        self.state = IDLE
+        self.cooldown_until = 0.0
+        self.last_trigger = 0.0
+        self.first_trigger = None   # of the stream about to start
+        self.triggers = 0
+        self.suppressed = 0         # dropped in the cooldown
+        self.streams = 0
+        self.frames = 0
+        self.errors = 0
+        self.latency_s = None       # from the first trigger to the first frame, of the last stream
+        self.frame = None
+        self.frame_t = 0.0
+        self.conn = None
+        self.lock = threading.Lock()
+        self.wake = threading.Event()
+        self.quit = False
+        self.thread = None
+
+    def start (self) :
+        self.thread = threading.Thread(target=self._run, daemon=True)
+        self.thread.start()
+
+    def stop (self) :
+        self.quit = True
+        self.wake.set()
+        if self.thread is not None:
+            self.thread.join()
+
+    # from any thread, never blocks; False when dropped in the cooldown
+    def trigger (self) :
+        now = time.monotonic()
+        with self.lock:
+            if self.state == COOLDOWN and now < self.cooldown_until:
+                self.suppressed += 1
+                return False
+            self.triggers += 1
+            self.last_trigger = now
+            if self.state != STREAMING and self.first_trigger is None:
+                self.first_trigger = now
+        self.wake.set()
+        return True
+
+    # (jpeg, monotonic time) of the newest frame, or None
+    def latest (self) :
+        with self.lock:
+            return (self.frame, self.frame_t) if self.frame is not None else None
+
+    # GET over the kept connection, once more on a fresh one when the camera closed it
+    def _get (self, path) :
+        for attempt in range(2):
+            if self.conn is None:
+                self.conn = http.client.HTTPConnection(self.host, self.port, timeout=self.timeout_s)
+            try:
+                self.conn.request("GET", path)
+                resp = self.conn.getresponse()
+                body = resp.read()
+                if resp.status != 200:
+                    raise http.client.HTTPException("{} {}".format(path, resp.status))
+                return body
+            except (OSError, http.client.HTTPException):
+                self.conn.close()
+                self.conn = None
+                if attempt == 1:
+                    raise
+
+    def _deliver (self, jpeg) :
+        now = time.monotonic()
+        with self.lock:
+            self.frame = jpeg
+            self.frame_t = now
+            self.frames += 1
+            if self.first_trigger is not None:
+                self.latency_s = now - self.first_trigger
+                self.first_trigger = None
+        if self.on_frame is not None:
+            self.on_frame(jpeg, now)
+
+    def _streaming (self) :
+        return not self.quit and time.monotonic() < self.last_trigger + self.hold_s
+
+    def _stream (self) :
+        with self.lock:
+            self.state = STREAMING
+        self.streams += 1
+        try:
+            self._deliver(self._get("/capture"))
+            conn = http.client.HTTPConnection(self.host, self.stream_port, timeout=self.timeout_s)
+            try:
+                conn.request("GET", "/stream")
+                resp = conn.getresponse()
+                buf = bytes()
+                while self._streaming():
+                    chunk = resp.read1(65536)
+                    if not chunk:
+                        break
+                    buf += chunk
+                    # multipart of JPEGs, each from its start to its end marker
+                    while True:
+                        a = buf.find(b'\xff\xd8')
+                        b = buf.find(b'\xff\xd9', a + 2) if a != -1 else -1
+                        if b == -1:
+                            break
+                        self._deliver(buf[a:b + 2])
+                        buf = buf[b + 2:]
+            finally:
+                conn.close()
+        except (OSError, http.client.HTTPException):
+            self.errors += 1
+        with self.lock:
+            self.state = COOLDOWN
+            self.cooldown_until = time.monotonic() + self.cooldown_s
+            self.first_trigger = None
+
+    def _run (self) :
+        ready = False
+        while not self.quit:
+            if self.wake.wait(self.keepalive_s if ready else min(self.keepalive_s, 1.0)):
+                self.wake.clear()
+            if self.quit:
+                break
+            with self.lock:
+                now = time.monotonic()
+                if self.state == COOLDOWN and now >= self.cooldown_until:
+                    self.state = IDLE
+                if self.first_trigger is not None and now >= self.last_trigger + self.hold_s:
+                    # the camera was down for the whole hold time, too late to stream
+                    self.first_trigger = None
+                pending = self.first_trigger is not None
+            try:
+                if not ready:
+                    # as camera_streaming.py: a large frame size
+                    self._get("/control?var=framesize&val={}".format(self.framesize))
+                    ready = True
+                if pending:
+                    self._stream()
+                else:
+                    # keep the connection warm
+                    self._get("/status")
+            except (OSError, http.client.HTTPException):
+                self.errors += 1
+                ready = False
+        if self.conn is not None:
+            self.conn.close()
@@ -0,0 +1,92 @@
+import collections
+
+# Maps the device clock of each node onto the host clock, from the rx_us the device stamps on each
+# record (see _components/record_component.h) and the host time the record arrived.
+# arrival = device time + offset + delay, where the delay (ring, batch wait, WiFi, UDP) is never
+# negative but varies a lot. The smallest arrival - device time within a window belongs to the
+# least delayed record, a line fitted through these minima gives the offset and the drift of the
+# device crystal (tens of ppm). Device times mapped this way share the host clock, up to the
+# smallest delay of each link, which is about the same for all nodes.
+WINDOW_S = 1.0      # one minimum per window
+FIT_WINDOWS = 60    # minima the line is fitted through, older ones are forgotten
+
+class NodeClock :
+    def __init__ (self) :
+        self.resets = 0
+        self._reset()
+
+    def _reset (self) :
+        self.minima = collections.deque(maxlen=FIT_WINDOWS) # (device_s, arrival_s - device_s)
+        self.window_end = None
+        self.window_min = None
+        self.last_device_s = None
+        self.ref_s = 0.0
+        self.offset_s = None    # arrival - device time at ref_s, None until the first record
+        self.drift = 0.0        # change of the offset per device second
+
+    def update (self, device_s, arrival_s) :
+        if self.last_device_s is not None and device_s < self.last_device_s - WINDOW_S:
+            # the device rebooted, its clock starts over
+            self.resets += 1
+            self._reset()
+        self.last_device_s = device_s
+        diff = arrival_s - device_s
+        if self.window_end is not None and device_s >= self.window_end:
+            self.minima.append(self.window_min)
+            self.window_min = None
+            self._fit_line()
+        if self.window_min is None:
+            self.window_end = device_s + WINDOW_S
+            self.window_min = (device_s, diff)
+        elif diff < self.window_min[1]:
+            self.window_min = (device_s, diff)
+        if not self.minima:
+            # no full window yet, go with the smallest offset so far
+            self.ref_s = self.window_min[0]
+            self.offset_s = self.window_min[1]
+
+    # least squares line through the window minima
+    def _fit_line (self) :
+        points = self.minima
+        self.ref_s = points[-1][0]
+        self.offset_s = points[-1][1]
+        self.drift = 0.0
+        if len(points) < 3:
+            return
+        # relative to the newest point, the offsets are large numbers that differ in the microseconds
+        (x0, y0) = points[-1]
+        n = len(points)
+        mean_x = sum(p[0] - x0 for p in points) / n
+        mean_y = sum(p[1] - y0 for p in points) / n
+        sxx = sum((p[0] - x0 - mean_x) ** 2 for p in points)
+        sxy = sum((p[0] - x0 - mean_x) * (p[1] - y0 - mean_y) for p in points)
+        self.drift = sxy / sxx
+        self.offset_s = y0 + mean_y - self.drift * mean_x
+
+    def to_host (self, device_s) :
+        if self.offset_s is None:
+            return None
+        return device_s + self.offset_s + self.drift * (device_s - self.ref_s)
+
+class ClockSync :
+    def __init__ (self) :
+        self.nodes = {} # mac addr -> NodeClock
+
+    # account one record: rx_us is its device time, arrival_s the host time it was received in seconds
+    def update (self, mac_addr, rx_us, arrival_s) :
+        node = self.nodes.get(mac_addr)
+        if node is None:
+            node = self.nodes[mac_addr] = NodeClock()
+        node.update(rx_us / 1e6, arrival_s)
+
+    # host time in seconds of a device time of the node, None if the node was not seen yet
+    def to_host (self, mac_addr, rx_us) :
+        node = self.nodes.get(mac_addr)
+        return node.to_host(rx_us / 1e6) if node is not None else None
+
+    def summary (self, mac_addr) :
+        node = self.nodes[mac_addr]
+        if node.offset_s is None:
+            return "{}: clock not synced yet".format(mac_addr)
+        return "{}: clock offset {:.6f} s, drift {:+.1f} ppm, {} minima".format(
+            mac_addr, node.offset_s, node.drift * 1e6, len(node.minima))
@@ -0,0 +1,143 @@
+import collections
+
+import numpy as np
+
+# Reader of the captures host_tools/csi_ingest -r records, see host_tools/capture.h for the format
+# and keep the layouts here in sync with it. The file is mapped, not read: opening an hours long
+# capture reads only its index, and the columns of a chunk are NumPy views into the mapping.
+CAPTURE_MAGIC = b"CSICAP01"
+CAPTURE_INDEX_MAGIC = b"CSIIDX01"
+CAPTURE_CHUNK_MAGIC = 0x4b4e4843
+CAPTURE_VERSION = 1
+
+FILE_HDR = np.dtype([("magic", "S8"), ("version", "<u4"), ("csi_width", "<u2"), ("hdr_size", "<u2"),
+                     ("created_us", "<u8"), ("pad", "V40")])
+CHUNK_HDR = np.dtype([("magic", "<u4"), ("frames", "<u4"), ("node", "<u2"), ("csi_width", "<u2"),
+                      ("mac", "u1", 6), ("reserved", "<u2"), ("off_host_us", "<u4"), ("t_first", "<u8"),
+                      ("t_last", "<u8"), ("chunk_len", "<u8"), ("off_rssi", "<u4"), ("off_noise_floor", "<u4"),
+                      ("off_hdr", "<u4"), ("off_csi", "<u4")])
+INDEX_ENTRY = np.dtype([("offset", "<u8"), ("t_first", "<u8"), ("t_last", "<u8"), ("frames", "<u4"),
+                        ("node", "<u2"), ("reserved", "<u2")])
+NODE = np.dtype([("mac", "u1", 6), ("reserved", "<u2")])
+TRAILER = np.dtype([("magic", "S8"), ("index_offset", "<u8"), ("n_entries", "<u4"), ("n_nodes", "<u4"),
+                    ("frames", "<u8")])
+# csi_record_hdr_t, the fields of csi_record.RECORD_HDR
+RECORD_HDR = np.dtype([("magic", "u1"), ("version", "u1"), ("type", "u1"), ("flags", "u1"), ("len", "<u2"),
+                       ("mac", "u1", 6), ("rssi", "i1"), ("rate", "u1"), ("sig_mode", "u1"), ("mcs", "u1"),
+                       ("cwb", "u1"), ("smoothing", "u1"), ("not_sounding", "u1"), ("aggregation", "u1"),
+                       ("stbc", "u1"), ("fec_coding", "u1"), ("sgi", "u1"), ("noise_floor", "i1"),
+                       ("ampdu_cnt", "u1"), ("channel", "u1"), ("secondary_channel", "u1"), ("ant", "u1"),
+                       ("timestamp", "<u4"), ("sig_len", "<u2"), ("rx_state", "u1"), ("delta_seq", "u1"),
+                       ("seq", "<u2"), ("handler_us", "<u4"), ("rx_us", "<u8"), ("csi_len", "<u2")])
+for (dtype, size) in ((FILE_HDR, 64), (CHUNK_HDR, 64), (INDEX_ENTRY, 32), (NODE, 8), (TRAILER, 32), (RECORD_HDR, 52)):
+    assert(dtype.itemsize == size)
+
+ALIGN = 64
+
+# Frames of one node from one chunk, all columns are views into the file:
+# host_us: uint64 arrival time on the host in us, rssi and noise_floor: int8, hdr: RECORD_HDR records,
+# csi: uint8 matrix with a row of csi_width bytes per frame, the first hdr["csi_len"] of them used
+Span = collections.namedtuple("Span", "node host_us rssi noise_floor hdr csi")
+
+def _align (x) :
+    return (x + ALIGN - 1) & ~(ALIGN - 1)
+
+def _chunk_len (frames, csi_width) :
+    off = _align(CHUNK_HDR.itemsize + frames * 8)
+    off = _align(off + frames)
+    off = _align(off + frames)
+    off = _align(off + frames * RECORD_HDR.itemsize)
+    return _align(off + frames * csi_width)
+
+class Capture :
+    def __init__ (self, path) :
+        self.data = np.memmap(path, dtype=np.uint8, mode="r")
+        hdr = self.data[:FILE_HDR.itemsize].view(FILE_HDR)[0]
+        if hdr["magic"] != CAPTURE_MAGIC or hdr["version"] != CAPTURE_VERSION or hdr["hdr_size"] != RECORD_HDR.itemsize:
+            raise ValueError("{} is not a csi capture of version {}".format(path, CAPTURE_VERSION))
+        self.csi_width = int(hdr["csi_width"])
+        self.created_us = int(hdr["created_us"])
+        self.rebuilt = False
+        trailer = self.data[-TRAILER.itemsize:].view(TRAILER)[0]
+        index_end = len(self.data) - TRAILER.itemsize
+        if (trailer["magic"] == CAPTURE_INDEX_MAGIC and int(trailer["index_offset"]) + int(trailer["n_nodes"]) *
+                NODE.itemsize + int(trailer["n_entries"]) * INDEX_ENTRY.itemsize == index_end):
+            start = int(trailer["index_offset"])
+            nodes_end = start + int(trailer["n_nodes"]) * NODE.itemsize
+            nodes = self.data[start:nodes_end].view(NODE)
+            self.index = self.data[nodes_end:index_end].view(INDEX_ENTRY)
+            self.frames = int(trailer["frames"])
+            self.macs = [":".join("{:02x}".format(b) for b in n["mac"]) for n in nodes]
+        else:
+            self._rebuild()
+        # where the chunks of each node start in the index
+        self.node_start = np.searchsorted(self.index["node"], np.arange(len(self.macs) + 1))
+
+    # no trailer, the capture was cut short: scan the chunk headers
+    def _rebuild (self) :
+        entries = []
+        macs = {}
+        offset = FILE_HDR.itemsize
+        while offset + CHUNK_HDR.itemsize <= len(self.data):
+            c = self.data[offset:offset + CHUNK_HDR.itemsize].view(CHUNK_HDR)[0]
+            chunk_len = int(c["chunk_len"])
+            if (c["magic"] != CAPTURE_CHUNK_MAGIC or c["csi_width"] != self.csi_width or c["frames"] == 0 or
+                    offset + chunk_len > len(self.data) or _chunk_len(int(c["frames"]), self.csi_width) != chunk_len):
+                break
+            entries.append((offset, c["t_first"], c["t_last"], c["frames"], c["node"], 0))
+            macs[int(c["node"])] = ":".join("{:02x}".format(b) for b in c["mac"])
+            offset += chunk_len
+        index = np.array(entries, dtype=INDEX_ENTRY)
+        self.index = index[np.lexsort((index["t_first"], index["node"]))]
+        self.frames = int(np.sum(self.index["frames"]))
+        self.macs = [macs.get(n, "") for n in range(max(macs) + 1 if macs else 0)]
+        self.rebuilt = True
+
+    def _span (self, entry) :
+        offset = int(entry["offset"])
+        c = self.data[offset:offset + CHUNK_HDR.itemsize].view(CHUNK_HDR)[0]
+        n = int(c["frames"])
+        def column (off, dtype, size) :
+            start = offset + int(off)
+            return self.data[start:start + n * size].view(dtype)
+        csi = self.data[offset + int(c["off_csi"]):offset + int(c["off_csi"]) + n * self.csi_width]
+        return Span(int(c["node"]), column(c["off_host_us"], "<u8", 8), column(c["off_rssi"], "i1", 1),
+                    column(c["off_noise_floor"], "i1", 1), column(c["off_hdr"], RECORD_HDR, RECORD_HDR.itemsize),
+                    csi.reshape(n, self.csi_width))
+
+    # spans of the frames with t0_us <= host_us < t1_us of node, or of all nodes one after the other.
+    # Binary searches over the index and the host_us column of the first and last chunk.
+    def window (self, t0_us, t1_us, node=None) :
+        spans = []
+        for n in (range(len(self.macs)) if node is None else [node]):
+            (start, end) = (self.node_start[n], self.node_start[n + 1])
+            i = start + np.searchsorted(self.index["t_last"][start:end], t0_us, side="left")
+            while i < end and self.index[i]["t_first"] < t1_us:
+                entry = self.index[i]
+                span = self._span(entry)
+                first = np.searchsorted(span.host_us, t0_us, side="left") if entry["t_first"] < t0_us else 0
+                last = np.searchsorted(span.host_us, t1_us, side="left") if entry["t_last"] >= t1_us else len(span.host_us)
+                if first < last:
+                    spans.append(Span(span.node, *(column[first:last] for column in span[1:])))
+                i += 1
+        return spans
+
+    # the columns of window() joined into arrays of their own, with a node column
+    def read (self, t0_us, t1_us, node=None) :
+        spans = self.window(t0_us, t1_us, node)
+        if not spans:
+            return {"node": np.zeros(0, np.uint16), "host_us": np.zeros(0, np.uint64), "rssi": np.zeros(0, np.int8),
+                    "noise_floor": np.zeros(0, np.int8), "hdr": np.zeros(0, RECORD_HDR),
+                    "csi": np.zeros((0, self.csi_width), np.uint8)}
+        return {"node": np.concatenate([np.full(len(s.host_us), s.node, np.uint16) for s in spans]),
+                "host_us": np.concatenate([s.host_us for s in spans]),
+                "rssi": np.concatenate([s.rssi for s in spans]),
+                "noise_floor": np.concatenate([s.noise_floor for s in spans]),
+                "hdr": np.concatenate([s.hdr for s in spans]),
+                "csi": np.concatenate([s.csi for s in spans])}
+
+    # first and last host_us of the capture
+    def time_range (self) :
+        if len(self.index) == 0:
+            return (0, 0)
+        return (int(np.min(self.index["t_first"])), int(np.max(self.index["t_last"])))
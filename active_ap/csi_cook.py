@@ -0,0 +1,68 @@
+import ctypes
+import os
+
+import numpy as np
+
+import csi_record
+
+# Binding of the batch cook kernels in host_tools/cook.h, cook_csi_data() of host_processing_pyqt.py
+# for many frames in one call. Build the library first: make -C host_tools libcsi_cook.so
+# The input arrays are passed to the kernel as they are when they already have the right type and
+# layout, the results are NumPy arrays the kernel writes into, nothing is copied on the way back.
+LIB_PATH = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "host_tools", "libcsi_cook.so")
+RAW_LEN = 384
+SUBCARRIERS = 114
+
+try:
+    _lib = ctypes.CDLL(LIB_PATH)
+except OSError:
+    _lib = None
+# whether cook() can be used, cook_csi_data() is the fallback
+available = _lib is not None
+
+_i8 = np.ctypeslib.ndpointer(dtype=np.int8, flags="C_CONTIGUOUS")
+_i16 = np.ctypeslib.ndpointer(dtype=np.int16, flags="C_CONTIGUOUS")
+_f32 = np.ctypeslib.ndpointer(dtype=np.float32, flags="C_CONTIGUOUS")
+
+# record type -> (kernel, input dtype, values per frame)
+_kernels = {}
+if available:
+    for (name, rec_types, pointer, dtype, width) in (
+            ("cook_raw_batch", (csi_record.CSI_RECORD_TYPE_RAW,), _i8, np.int8, RAW_LEN),
+            ("cook_subcarriers_batch", (csi_record.CSI_RECORD_TYPE_SUBCARRIERS,), _i8, np.int8, 2 * SUBCARRIERS),
+            ("cook_amplitude_batch", (csi_record.CSI_RECORD_TYPE_AMPLITUDE, csi_record.CSI_RECORD_TYPE_AMP_PHASE),
+             _i16, np.int16, SUBCARRIERS)):
+        kernel = getattr(_lib, name)
+        kernel.argtypes = [ctypes.c_int, _i8, _i8, pointer, _f32, _f32]
+        kernel.restype = None
+        for rec_type in rec_types:
+            _kernels[rec_type] = (kernel, dtype, width)
+
+def supports (rec_type) :
+    return rec_type in _kernels
+
+# values per frame cook() expects for rec_type
+def frame_width (rec_type) :
+    return _kernels[rec_type][2]
+
+# Cook n frames of one record type.
+# rssi, noise_floor: n values in dBm, csi: n rows of frame_width(rec_type) values as the record
+# carries them (int8 (imaginary, real) pairs for RAW and SUBCARRIERS, int16 amplitudes in 1/16 units
+# for AMPLITUDE and AMP_PHASE, the phases are not needed).
+# Returns (snr_db, amp_db): float32 arrays of n and (n, 114), like the SNR and
+# 10 * np.log10(np.abs(csi)**2 + 0.1) of cook_csi_data().
+def cook (rec_type, rssi, noise_floor, csi) :
+    (kernel, dtype, width) = _kernels[rec_type]
+    csi = np.ascontiguousarray(csi, dtype=dtype)
+    n = len(csi)
+    if csi.shape != (n, width):
+        raise ValueError("csi of record type {} must be n x {}, not {}".format(rec_type, width, csi.shape))
+    rssi = np.ascontiguousarray(rssi, dtype=np.int8)
+    noise_floor = np.ascontiguousarray(noise_floor, dtype=np.int8)
+    if rssi.shape != (n,) or noise_floor.shape != (n,):
+        raise ValueError("one rssi and noise floor per frame")
+    snr_db = np.empty(n, dtype=np.float32)
+    amp_db = np.empty((n, SUBCARRIERS), dtype=np.float32)
+    if n > 0:
+        kernel(n, rssi, noise_floor, csi, snr_db, amp_db)
+    return (snr_db, amp_db)
@@ -0,0 +1,166 @@
+import threading
+
+import numpy as np
+
+# Streaming motion detector of host_tools/detect.h, crossing_decction() for every node.
+# Per node an EMA baseline of the cooked CSI in dB and the running sum of the last window frames,
+# so a frame costs the same whatever the window:
+#   score = max over the subcarriers of |mean of the window - baseline|
+# After warmup frames a node turns active when the score goes over threshold, and quiet again
+# once it stayed under release for hold frames. Each turn comes back as an event tuple
+#   (DETECT_START or DETECT_END, node, t_us, score, frames)
+# with the score at the start, the highest score of the event and its frames at the end.
+DETECT_START = 1
+DETECT_END = 2
+# the running sums are added up again this often, as float rounding adds up
+RESUM_FRAMES = 1024
+
+class NodeDetector :
+    def __init__ (self, alpha, window, warmup, threshold, release, hold) :
+        self.alpha = np.float32(alpha)
+        self.window = window
+        self.warmup = warmup
+        self.threshold = threshold
+        self.release = release
+        self.hold = hold
+        self.baseline = None
+        self.frames = 0
+        self.score = 0.0
+        self.active = False
+        self.below = 0
+        self.peak = 0.0
+        self.event_frames = 0
+
+    # one cooked frame, returns an event tuple or None
+    def update (self, node, t_us, csi_db) :
+        csi_db = np.asarray(csi_db, dtype=np.float32)
+        if self.baseline is None:
+            self.baseline = csi_db.copy()
+            self.ring = np.zeros((self.window, len(csi_db)), dtype=np.float32)
+            self.sum = np.zeros(len(csi_db), dtype=np.float32)
+        head = self.frames % self.window
+        if self.frames >= self.window:
+            self.sum -= self.ring[head]
+        self.sum += csi_db
+        self.ring[head] = csi_db
+        self.baseline = self.baseline * self.alpha + csi_db * (np.float32(1) - self.alpha)
+        score = float(np.max(np.abs(self.sum * np.float32(1.0 / self.window) - self.baseline)))
+        self.frames += 1
+        if self.frames % RESUM_FRAMES == 0:
+            self.sum = np.sum(self.ring, axis=0, dtype=np.float32)
+        if self.frames < self.warmup or self.frames < self.window:
+            self.score = 0.0
+            return None
+        self.score = score
+
+        if not self.active:
+            if score > self.threshold:
+                self.active = True
+                self.below = 0
+                self.peak = score
+                self.event_frames = 0
+                return (DETECT_START, node, t_us, score, 0)
+            return None
+        self.event_frames += 1
+        self.peak = max(self.peak, score)
+        self.below = self.below + 1 if score < self.release else 0
+        if self.below > self.hold:
+            self.active = False
+            return (DETECT_END, node, t_us, self.peak, self.event_frames)
+        return None
+
+# A NodeDetector per node, made on the first frame of a node. Defaults as in detect_default_cfg().
+# update() runs in the ingest thread, baseline() may be called from another (the GUI): both take
+# the lock, and baseline() hands out a copy that later frames leave alone.
+class Detectors :
+    def __init__ (self, alpha=0.95, window=3, warmup=100, threshold=3.0, release=2.0, hold=10) :
+        if window < 1 or not 0 <= alpha < 1 or release > threshold or hold < 0:
+            raise ValueError("bad detector settings")
+        self.settings = (alpha, window, warmup, threshold, release, hold)
+        self.nodes = {}
+        self.lock = threading.Lock()
+
+    def update (self, node, t_us, csi_db) :
+        with self.lock:
+            if node not in self.nodes:
+                self.nodes[node] = NodeDetector(*self.settings)
+            return self.nodes[node].update(node, t_us, csi_db)
+
+    # a copy of the current baseline of a node, None before its first frame
+    def baseline (self, node) :
+        with self.lock:
+            detector = self.nodes.get(node)
+            if detector is None or detector.baseline is None:
+                return None
+            return detector.baseline.copy()
+
+FUSION_K_OF_N = 1
+FUSION_WEIGHTED = 2
+
+# One decision from many links, host_tools/fusion.h: the scores of the frames of all nodes go
+# into epochs of epoch_us by their time, and an epoch closes once a frame more than grace_us past
+# its end comes in. Each link gets the mean score of its frames in the epoch, then
+#   FUSION_K_OF_N: motion when at least k links are over link_threshold
+#   FUSION_WEIGHTED: motion when the weighted mean of the scores, capped at score_cap, is over
+#   weighted_threshold
+# add() returns the epochs it closed as (start_us, links, votes, score, motion).
+class Fusion :
+    def __init__ (self, epoch_us=100000, grace_us=30000, rule=FUSION_K_OF_N, k=2, link_threshold=4.5,
+                  weighted_threshold=3.0, score_cap=9.0, weights=None) :
+        if grace_us >= epoch_us or rule not in (FUSION_K_OF_N, FUSION_WEIGHTED) or k < 1:
+            raise ValueError("bad fusion settings")
+        self.epoch_us = epoch_us
+        self.grace_us = grace_us
+        self.rule = rule
+        self.k = k
+        self.link_threshold = link_threshold
+        self.weighted_threshold = weighted_threshold
+        self.score_cap = score_cap
+        self.weights = weights if weights is not None else {}
+        self.start_us = None
+        # node -> [sum of scores, frames] of the open epoch, and of the frames past its end
+        self.cur = {}
+        self.next = {}
+
+    def _close (self) :
+        links = votes = 0
+        total = weights = 0.0
+        for node in sorted(self.cur):
+            (s, n) = self.cur[node]
+            s = np.float32(s) / n
+            links += 1
+            votes += s > self.link_threshold
+            w = self.weights.get(node, 1.0)
+            total += w * min(s, self.score_cap)
+            weights += w
+        score = total / weights if weights > 0 else 0.0
+        motion = votes >= self.k if self.rule == FUSION_K_OF_N else score > self.weighted_threshold
+        epoch = (self.start_us, links, votes, score, motion)
+        (self.cur, self.next) = (self.next, {})
+        self.start_us += self.epoch_us
+        return epoch
+
+    def add (self, node, t_us, score) :
+        closed = []
+        if self.start_us is None:
+            self.start_us = t_us - t_us % self.epoch_us
+        while t_us >= self.start_us + self.epoch_us + self.grace_us:
+            if not self.cur and not self.next:
+                # nothing came in for a while, skip the empty epochs
+                self.start_us = t_us - t_us % self.epoch_us
+                break
+            closed.append(self._close())
+        epoch = self.next if t_us >= self.start_us + self.epoch_us else self.cur
+        acc = epoch.setdefault(node, [np.float32(0), 0])
+        acc[0] = np.float32(acc[0] + np.float32(score))
+        acc[1] += 1
+        return closed
+
+    # the open epochs, at the end of the input
+    def flush (self) :
+        closed = []
+        if self.cur or self.next:
+            closed.append(self._close())
+        if self.cur:
+            closed.append(self._close())
+        return closed
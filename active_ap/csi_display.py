@@ -0,0 +1,72 @@
+import collections
+import threading
+
+import numpy as np
+
+# What the plots of host_processing_pyqt.py show, kept apart from drawing them.
+# The ingest thread add()s every cooked frame as it comes in, the GUI takes a snapshot() at its own
+# fixed rate, so drawing costs the same whatever the packet rate. Per node:
+#   - the latest cooked CSI, and the min, max and mean of all frames since the previous snapshot
+#   - the SNR history, one value per snapshot: the mean SNR of its frames, or the last one again
+#     when none came, so the history is a time axis at the display rate
+# add() only touches the few arrays of one node under the lock, snapshot() copies them out.
+NodeSnapshot = collections.namedtuple("NodeSnapshot",
+                                      ["csi_db", "csi_min", "csi_max", "csi_mean", "snr_db", "fresh", "frames"])
+
+class NodeView :
+    def __init__ (self, history, csi_db) :
+        self.latest = np.array(csi_db, dtype=np.float64)
+        self.csi_min = self.latest.copy()
+        self.csi_max = self.latest.copy()
+        self.csi_sum = np.zeros_like(self.latest)
+        self.snr = collections.deque(np.zeros(history), maxlen=history)
+        self.snr_sum = 0.0
+        self.fresh = 0          # frames since the previous snapshot
+        self.frames = 0
+
+    def add (self, snr_db, csi_db) :
+        self.latest[:] = csi_db
+        if self.fresh == 0:
+            self.csi_min[:] = csi_db
+            self.csi_max[:] = csi_db
+            self.csi_sum[:] = 0
+            self.snr_sum = 0.0
+        else:
+            np.minimum(self.csi_min, csi_db, out=self.csi_min)
+            np.maximum(self.csi_max, csi_db, out=self.csi_max)
+        self.csi_sum += csi_db
+        self.snr_sum += snr_db
+        self.fresh += 1
+        self.frames += 1
+
+    def snapshot (self) :
+        fresh = self.fresh
+        if fresh > 0:
+            self.snr.append(self.snr_sum / fresh)
+            self.fresh = 0
+        else:
+            self.snr.append(self.snr[-1])
+        return NodeSnapshot(self.latest.copy(), self.csi_min.copy(), self.csi_max.copy(),
+                            self.csi_sum / max(fresh, 1), np.array(self.snr), fresh, self.frames)
+
+class Display :
+    def __init__ (self, history=50) :
+        self.history = history
+        self.nodes = {}
+        self.frames = 0
+        self.lock = threading.Lock()
+
+    # one cooked frame of node, from the ingest thread
+    def add (self, node, snr_db, csi_db) :
+        with self.lock:
+            view = self.nodes.get(node)
+            if view is None:
+                view = self.nodes[node] = NodeView(self.history, csi_db)
+            view.add(snr_db, csi_db)
+            self.frames += 1
+
+    # node -> NodeSnapshot of every node seen so far, fresh is the number of frames it got since
+    # the previous snapshot; from the GUI at the display rate
+    def snapshot (self) :
+        with self.lock:
+            return dict((node, view.snapshot()) for (node, view) in self.nodes.items())
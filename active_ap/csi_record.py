@@ -0,0 +1,261 @@
+import collections
+import math
+import struct
+
+# Decoder for the packed binary CSI record.
+# Keep in sync with csi_record_hdr_t in _components/record_component.h
+CSI_RECORD_MAGIC = 0xC5
+CSI_RECORD_VERSION = 4
+# version 1 is version 2 without delta coding, version 2 is 3 without seq and handler_us, version 3 is 4 without rx_us
+CSI_RECORD_MIN_VERSION = 1
+
+CSI_RECORD_FLAG_DELTA = 0x01
+
+CSI_RECORD_TYPE_RAW = 1
+# preprocessed on the device from the used HT-LTF subcarriers, see _components/dsp_component.h
+CSI_RECORD_TYPE_SUBCARRIERS = 2 # (imaginary, real) int8 pairs, negative subcarriers first
+CSI_RECORD_TYPE_AMPLITUDE = 3   # int16, 1/16 units
+CSI_RECORD_TYPE_PHASE = 4       # int16, 32768 = pi
+CSI_RECORD_TYPE_AMP_PHASE = 5   # int16 amplitudes followed by int16 phases
+
+# device counters, see csi_stats_record_t in _components/stats_component.h
+CSI_RECORD_TYPE_STATS = 0x10
+# CPU share per task, see task_record_t in _components/task_component.h
+CSI_RECORD_TYPE_TASKS = 0x11
+
+# SD card logs are written in units of this many bytes, see _components/sdlog_component.h
+SDLOG_UNIT = 16 * 1024
+
+AMPLITUDE_SCALE = 1.0 / 16
+PHASE_SCALE = math.pi / 32768
+
+# magic, version, type, flags, len, mac,
+# rssi, rate, sig_mode, mcs, cwb, smoothing, not_sounding, aggregation, stbc, fec_coding, sgi,
+# noise_floor, ampdu_cnt, channel, secondary_channel, ant, timestamp, sig_len, rx_state, delta_seq,
+# seq, handler_us, rx_us, csi_len
+RECORD_HDR = struct.Struct("<BBBBH6s" + "bBBBBBBBBBB" + "bBBBBIHBB" + "HIQ" + "H")
+assert(RECORD_HDR.size == 52)
+# older versions end earlier, csi_len always comes last
+RECORD_HDR_V3 = struct.Struct("<BBBBH6s" + "bBBBBBBBBBB" + "bBBBBIHBB" + "HI" + "H")
+RECORD_HDR_V2 = struct.Struct("<BBBBH6s" + "bBBBBBBBBBB" + "bBBBBIHBB" + "H")
+RECORD_HDRS = {1: RECORD_HDR_V2, 2: RECORD_HDR_V2, 3: RECORD_HDR_V3, 4: RECORD_HDR}
+
+# where and when a record comes from, see _components/seq_component.h:
+# seq: per source mac sequence number, 16 bit
+# rx_us: device time in us since boot when the CSI callback got the frame, None before version 4
+# handler_us: device time in us when the handler serialized it, 32 bit, wraps
+RecordStamp = collections.namedtuple("RecordStamp", "seq rx_us handler_us")
+
+# magic, version, type, flags, len, mac, uptime_ms, then STATS_FIELDS
+STATS_RECORD = struct.Struct("<BBBBH6s" + "I" + "12I" + "HH" + "6I")
+assert(STATS_RECORD.size == 92)
+# appended later, one 32-bit counter each, 0 where the records of older firmware end before them.
+# drop_self and drop_rate make up drop_thinned, peer_evictions are sequence restarts that are no reboot,
+# local_only are handled frames that only went to the SD card or the serial port, before there was a host
+STATS_EXT_FIELDS = ("drop_self", "drop_rate", "peer_evictions", "local_only")
+STATS_FIELDS = ("cb_calls", "drop_filter", "drop_non_ht", "drop_no_host", "drop_ring_full", "drop_oversized",
+                "drop_thinned", "drop_serialize", "records_sent", "datagrams_sent", "bytes_sent", "send_errors",
+                "ring_size", "ring_high_water",
+                "cb_cycles_avg", "cb_cycles_max", "handler_cycles_avg", "handler_cycles_max",
+                "queue_us_avg", "queue_us_max")
+# counters since boot, the others are gauges or per stats interval
+STATS_COUNTERS = STATS_FIELDS[0:12] + STATS_EXT_FIELDS
+
+# magic, version, type, flags, len, mac, uptime_ms, interval, count, cores, reserved
+TASK_RECORD = struct.Struct("<BBBBH6sIIBBH")
+assert(TASK_RECORD.size == 24)
+# name, core, priority, cpu_permille, stack_free, reserved
+TASK_ENTRY = struct.Struct("<16sBBHHH")
+assert(TASK_ENTRY.size == 24)
+TASK_CORE_ANY = 0xFF
+# cpu: share of one core since the previous task record, core: None when not pinned
+TaskShare = collections.namedtuple("TaskShare", "name core priority cpu stack_free")
+
+DELTA_BLOCK = 16
+
+def is_binary_record (data) :
+    return len(data) > 0 and data[0] == CSI_RECORD_MAGIC
+
+# stats records come in a datagram of their own
+def is_stats_record (data, offset=0) :
+    return len(data) >= offset + 3 and data[offset] == CSI_RECORD_MAGIC and data[offset + 2] == CSI_RECORD_TYPE_STATS
+
+# decode a stats record starting at offset.
+# returns (mac_addr, stats, next_offset), stats maps uptime_ms, STATS_FIELDS and STATS_EXT_FIELDS to their values
+def parse_stats (data, offset=0) :
+    fields = STATS_RECORD.unpack_from(data, offset)
+    (magic, version, rec_type, flags, rec_len, mac) = fields[0:6]
+    assert(magic == CSI_RECORD_MAGIC and rec_type == CSI_RECORD_TYPE_STATS)
+    if rec_len < STATS_RECORD.size:
+        raise ValueError("stats record too short: {}".format(rec_len))
+    stats = dict(zip(STATS_FIELDS, fields[7:]))
+    stats["uptime_ms"] = fields[6]
+    for (i, k) in enumerate(STATS_EXT_FIELDS):
+        ext = STATS_RECORD.size + i * 4
+        stats[k] = struct.unpack_from("<I", data, offset + ext)[0] if rec_len >= ext + 4 else 0
+    mac_addr = ":".join("{:02x}".format(b) for b in mac)
+    return (mac_addr, stats, offset + rec_len)
+
+# task records follow the stats records, in a datagram of their own
+def is_tasks_record (data, offset=0) :
+    return len(data) >= offset + 3 and data[offset] == CSI_RECORD_MAGIC and data[offset + 2] == CSI_RECORD_TYPE_TASKS
+
+# decode a task record starting at offset.
+# returns (mac_addr, uptime_ms, cores, tasks, next_offset), tasks a list of TaskShare
+def parse_tasks (data, offset=0) :
+    (magic, version, rec_type, flags, rec_len, mac, uptime_ms, interval, count, cores, _) = \
+        TASK_RECORD.unpack_from(data, offset)
+    assert(magic == CSI_RECORD_MAGIC and rec_type == CSI_RECORD_TYPE_TASKS)
+    if rec_len < TASK_RECORD.size + count * TASK_ENTRY.size:
+        raise ValueError("task record too short: {}".format(rec_len))
+    tasks = []
+    for i in range(count):
+        (name, core, priority, permille, stack_free, _) = \
+            TASK_ENTRY.unpack_from(data, offset + TASK_RECORD.size + i * TASK_ENTRY.size)
+        name = name.split(b"\0", 1)[0].decode("ascii", "replace")
+        tasks.append(TaskShare(name, None if core == TASK_CORE_ANY else core, priority, permille / 1000.0, stack_free))
+    mac_addr = ":".join("{:02x}".format(b) for b in mac)
+    return (mac_addr, uptime_ms, cores, tasks, offset + rec_len)
+
+# busy share of each core, from the idle tasks of a task record
+def core_load (cores, tasks) :
+    return [1.0 - sum(t.cpu for t in tasks if t.name.startswith("IDLE") and t.core == c) for c in range(cores)]
+
+# per second rates of the counters between two stats records of a device,
+# None if the device rebooted in between
+def stats_rates (prev, cur) :
+    dt = (cur["uptime_ms"] - prev["uptime_ms"]) / 1000.0
+    if dt <= 0:
+        return None
+    # counters are 32 bit and wrap
+    return dict((k, ((cur[k] - prev[k]) & 0xFFFFFFFF) / dt) for k in STATS_COUNTERS)
+
+def value_size (rec_type) :
+    return 1 if rec_type in (CSI_RECORD_TYPE_RAW, CSI_RECORD_TYPE_SUBCARRIERS) else 2
+
+# undo the block bit packing of _delta_pack() in _components/delta_component.h.
+# returns the n values, or None if packed is malformed.
+def _delta_unpack (packed, prev, n, size) :
+    values = []
+    value_mask = (1 << (size * 8)) - 1
+    pos = 0
+    for b in range(0, n, DELTA_BLOCK):
+        cnt = min(DELTA_BLOCK, n - b)
+        if pos >= len(packed):
+            return None
+        width = packed[pos]
+        pos += 1
+        nbytes = (cnt * width + 7) // 8
+        if width > size * 8 or pos + nbytes > len(packed):
+            return None
+        bits = int.from_bytes(packed[pos:pos + nbytes], "little")
+        pos += nbytes
+        for i in range(cnt):
+            z = (bits >> (i * width)) & ((1 << width) - 1)
+            d = (z >> 1) ^ -(z & 1)
+            values.append((prev[b + i] + d) & value_mask)
+    return values if pos == len(packed) else None
+
+# Per-peer state to undo delta coding (CONFIG_CSI_DELTA_ENABLE), one per stream of records.
+# Records of a broken chain, after a lost datagram, decode to None up to the next keyframe.
+class DeltaDecoder :
+    def __init__ (self) :
+        self.peers = {} # mac -> (rec_type, delta_seq, values of the last payload)
+
+    # returns the payload of the record as it was before delta coding, or None
+    def decode (self, mac, rec_type, flags, delta_seq, payload) :
+        size = value_size(rec_type)
+        fmt = "<{}{}".format(len(payload) // size, "B" if size == 1 else "H")
+        if not (flags & CSI_RECORD_FLAG_DELTA):
+            self.peers[mac] = (rec_type, delta_seq, struct.unpack(fmt, payload))
+            return bytes(payload)
+
+        peer = self.peers.get(mac)
+        values = None
+        # delta_seq counts every record of the node, a gap means the reference was lost
+        if peer is not None and peer[0] == rec_type and (peer[1] + 1) & 0xFF == delta_seq:
+            values = _delta_unpack(payload, peer[2], len(peer[2]), size)
+        if values is None:
+            # chain broken, wait for the next keyframe
+            self.peers.pop(mac, None)
+            return None
+        self.peers[mac] = (rec_type, delta_seq, values)
+        return struct.pack("<{}{}".format(len(values), "B" if size == 1 else "H"), *values)
+
+# decode one record starting at offset.
+# returns (mac_addr, rx_ctrl_data, rec_type, csi_data, stamp, next_offset), where rx_ctrl_data keeps
+# the order of the text format: rssi, rate, sig_mode, mcs, cwb, smoothing, not_sounding, aggregation,
+# stbc, fec_coding, sgi, noise_floor, ampdu_cnt, channel, secondary_channel, timestamp, ant, sig_len, rx_state
+# and csi_data depends on rec_type:
+#   RAW, SUBCARRIERS: list of int8, (imaginary, real) pairs
+#   AMPLITUDE, PHASE: list of floats, one per subcarrier, phase in rad
+#   AMP_PHASE: tuple of (amplitudes, phases)
+# stamp is a RecordStamp, None before version 3.
+# csi_data is None for a delta coded record the decoder can not restore.
+# Delta coded records need a DeltaDecoder that sees every record of the stream.
+def parse_record (data, offset=0, decoder=None) :
+    version = data[offset + 1]
+    if version < CSI_RECORD_MIN_VERSION or version > CSI_RECORD_VERSION:
+        raise ValueError("unsupported csi record version {}".format(version))
+    hdr = RECORD_HDRS[version]
+    fields = hdr.unpack_from(data, offset)
+    (magic, version, rec_type, flags, rec_len, mac) = fields[0:6]
+    assert(magic == CSI_RECORD_MAGIC)
+    if rec_type < CSI_RECORD_TYPE_RAW or rec_type > CSI_RECORD_TYPE_AMP_PHASE:
+        raise ValueError("unsupported csi record type {}".format(rec_type))
+
+    (rssi, rate, sig_mode, mcs, cwb, smoothing, not_sounding, aggregation, stbc, fec_coding, sgi,
+     noise_floor, ampdu_cnt, channel, secondary_channel, ant, timestamp, sig_len, rx_state, delta_seq) = fields[6:26]
+    stamp = None
+    if version >= 3:
+        stamp = RecordStamp(fields[26], fields[28] if version >= 4 else None, fields[27])
+    csi_len = fields[-1]
+    rx_ctrl_data = [rssi, rate, sig_mode, mcs, cwb, smoothing, not_sounding, aggregation, stbc, fec_coding, sgi,
+                    noise_floor, ampdu_cnt, channel, secondary_channel, timestamp, ant, sig_len, rx_state]
+
+    csi_start = offset + hdr.size
+    assert(rec_len == hdr.size + csi_len)
+    payload = data[csi_start:csi_start + csi_len]
+    mac_addr = ":".join("{:02x}".format(b) for b in mac)
+    next_offset = offset + rec_len
+
+    if decoder is not None:
+        payload = decoder.decode(mac, rec_type, flags, delta_seq, payload)
+        if payload is None:
+            return (mac_addr, rx_ctrl_data, rec_type, None, stamp, next_offset)
+    elif flags & CSI_RECORD_FLAG_DELTA:
+        raise ValueError("delta coded csi record, pass a DeltaDecoder")
+
+    if rec_type == CSI_RECORD_TYPE_RAW or rec_type == CSI_RECORD_TYPE_SUBCARRIERS:
+        csi_data = list(struct.unpack("{}b".format(len(payload)), payload))
+    else:
+        values = struct.unpack("<{}h".format(len(payload) // 2), payload)
+        if rec_type == CSI_RECORD_TYPE_AMPLITUDE:
+            csi_data = [v * AMPLITUDE_SCALE for v in values]
+        elif rec_type == CSI_RECORD_TYPE_PHASE:
+            csi_data = [v * PHASE_SCALE for v in values]
+        else:
+            n = len(values) // 2
+            csi_data = ([v * AMPLITUDE_SCALE for v in values[:n]], [v * PHASE_SCALE for v in values[n:]])
+
+    return (mac_addr, rx_ctrl_data, rec_type, csi_data, stamp, next_offset)
+
+# the records of an SD card log file (_components/sdlog_component.h), as (offset, record type) in file
+# order. Where a record would start with a zero byte the rest of the unit is padding. A record cut
+# short ends the file, as when the power went during a write.
+# decode each with parse_record(), parse_stats() or parse_tasks() by its type.
+def log_records (data) :
+    offset = 0
+    while offset + 6 <= len(data):
+        if data[offset] == 0:
+            offset = (offset // SDLOG_UNIT + 1) * SDLOG_UNIT
+            continue
+        if data[offset] != CSI_RECORD_MAGIC:
+            raise ValueError("no record at offset {}".format(offset))
+        rec_len = struct.unpack_from("<H", data, offset + 4)[0]
+        if rec_len < 6:
+            raise ValueError("record of {} bytes at offset {}".format(rec_len, offset))
+        if offset + rec_len > len(data):
+            return
+        yield (offset, data[offset + 2])
+        offset += rec_len
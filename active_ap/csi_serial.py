@@ -0,0 +1,104 @@
+import os
+import termios
+import tty
+import zlib
+
+# Reader of the framed binary records a device built with CONFIG_CSI_SERIAL_FRAMED sends on its
+# serial port, see _components/serial_component.h. Every record is a zero byte, the record and
+# its CRC-32 (zlib's, little endian) COBS encoded, and a zero byte. Bytes lost or garbled drop
+# the frame they hit, the next zero byte starts over. Console text between the frames is counted.
+SERIAL_BAUD = 2000000
+SERIAL_CRC_LEN = 4
+SERIAL_MAX_RECORD = 2048
+SERIAL_FRAME_MAX = SERIAL_MAX_RECORD + SERIAL_CRC_LEN + (SERIAL_MAX_RECORD + SERIAL_CRC_LEN) // 254 + 3
+
+# printable, tabs, line ends and the escape sequences of the colored log
+TEXT_BYTES = bytes(range(0x20, 0x7F)) + b"\t\n\r\x1b"
+
+# the record in a COBS chunk without its delimiters, None if it is not valid COBS
+def cobs_decode (chunk) :
+    out = bytearray()
+    i = 0
+    n = len(chunk)
+    while i < n:
+        code = chunk[i]
+        i += 1
+        if i + code - 1 > n:
+            return None
+        out += chunk[i:i + code - 1]
+        i += code - 1
+        if code != 0xFF and i < n:
+            out.append(0)
+    return bytes(out)
+
+class Decoder :
+    def __init__ (self) :
+        self.buf = bytearray()
+        self.skip = False       # more than a frame without a zero, dropped up to the next one
+        self.bytes = 0
+        self.frames = 0
+        self.text_bytes = 0
+        self.crc_errors = 0
+        self.cobs_errors = 0
+        self.overflows = 0
+
+    # the records that arrived intact in data, read from the port in any pieces
+    def feed (self, data) :
+        self.bytes += len(data)
+        self.buf += data
+        chunks = self.buf.split(b"\x00")
+        self.buf = chunks.pop()
+        records = []
+        for chunk in chunks:
+            if self.skip:
+                self.skip = False
+            elif len(chunk) > 0:
+                rec = self._record(chunk)
+                if rec is not None:
+                    records.append(rec)
+        if len(self.buf) > SERIAL_FRAME_MAX:
+            self.buf = bytearray()
+            if not self.skip:
+                self.skip = True
+                self.overflows += 1
+        return records
+
+    def _record (self, chunk) :
+        # a frame is never all text, every record starts with CSI_RECORD_MAGIC
+        if len(chunk.translate(None, TEXT_BYTES)) == 0:
+            self.text_bytes += len(chunk)
+            return None
+        rec = cobs_decode(chunk)
+        if rec is None or len(rec) < SERIAL_CRC_LEN:
+            self.cobs_errors += 1
+            return None
+        if zlib.crc32(rec[:-SERIAL_CRC_LEN]) != int.from_bytes(rec[-SERIAL_CRC_LEN:], "little"):
+            self.crc_errors += 1
+            return None
+        self.frames += 1
+        return rec[:-SERIAL_CRC_LEN]
+
+class SerialReader :
+    # open the serial port raw at baud, or a file the port was copied into as it is
+    def __init__ (self, path, baud=SERIAL_BAUD) :
+        self.fd = os.open(path, os.O_RDONLY | os.O_NOCTTY)
+        if os.isatty(self.fd):
+            tty.setraw(self.fd)
+            attrs = termios.tcgetattr(self.fd)
+            speed = getattr(termios, "B{}".format(baud))
+            attrs[4] = speed
+            attrs[5] = speed
+            attrs[2] |= termios.CLOCAL | termios.CREAD
+            # reads return after 100 ms without bytes
+            attrs[6][termios.VMIN] = 0
+            attrs[6][termios.VTIME] = 1
+            termios.tcsetattr(self.fd, termios.TCSANOW, attrs)
+            termios.tcflush(self.fd, termios.TCIFLUSH)
+        self.decoder = Decoder()
+
+    # the records read since the last call, blocks up to 100 ms for the first bytes
+    def read (self) :
+        return self.decoder.feed(os.read(self.fd, 65536))
+
+    def close (self) :
+        os.close(self.fd)
@@ -0,0 +1,81 @@
+import collections
+import mmap
+import struct
+
+# Reader of the shared memory frame ring that host_tools/csi_ingest -s publishes decoded frames to.
+# Keep in sync with shm_ring_hdr_t and shm_slot_t in host_tools/shm_ring.h and csi_frame_t in
+# host_tools/ingest.h. Any number of readers can attach, each has its own cursor and only loses
+# frames itself when it falls more than a ring behind the writer.
+SHM_RING_MAGIC = 0x52495343
+SHM_RING_VERSION = 1
+SHM_RING_NAME = "/esp32_csi"
+
+# magic, version, slot_size, slots, writer_pid, head
+RING_HDR = struct.Struct("<IHHIIQ40x")
+assert(RING_HDR.size == 64)
+HEAD_OFFSET = 16
+# stamp, then csi_frame_t: host_us, node, reserved, record header and payload, pad
+SLOT_STAMP = struct.Struct("<Q")
+FRAME_HDR = struct.Struct("<QH6x")
+SLOT_SIZE = 728
+RECORD_OFFSET = SLOT_STAMP.size + FRAME_HDR.size
+RECORD_MAX = 52 + 612
+
+# host_us: arrival time on the host in us, node: index of the source mac in order of appearance,
+# record: the CSI record in the current version of csi_record.py, delta coding undone,
+# decode it with csi_record.parse_record(record)
+Frame = collections.namedtuple("Frame", "host_us node record")
+
+class RingReader :
+    # attach to the ring of a running csi_ingest, from the next frame it publishes
+    def __init__ (self, name=SHM_RING_NAME) :
+        # POSIX shared memory lives in /dev/shm on Linux
+        with open("/dev/shm/" + name.lstrip("/"), "rb") as f:
+            self.map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        (magic, version, slot_size, slots, writer_pid, head) = RING_HDR.unpack_from(self.map, 0)
+        if magic != SHM_RING_MAGIC or version != SHM_RING_VERSION or slot_size != SLOT_SIZE:
+            raise ValueError("{} is not a csi frame ring of version {}".format(name, SHM_RING_VERSION))
+        if len(self.map) != RING_HDR.size + slots * SLOT_SIZE:
+            raise ValueError("{} has the wrong size".format(name))
+        self.slots = slots
+        self.cursor = head
+        self.frames = 0
+        self.overruns = 0   # frames the writer overwrote before this reader got to them
+
+    def _head (self) :
+        return struct.unpack_from("<Q", self.map, HEAD_OFFSET)[0]
+
+    # the frames published since the last call, at most max_frames.
+    # Each slot is a seqlock (see shm_ring.h): the stamp is checked before and after the frame
+    # is copied out, a frame overwritten meanwhile counts as overrun. This relies on loads from the
+    # mapping not being reordered, as on x86.
+    def read (self, max_frames=None) :
+        frames = []
+        while max_frames is None or len(frames) < max_frames:
+            head = self._head()
+            if self.cursor >= head:
+                break
+            if head - self.cursor > self.slots:
+                # lapped, go on with the oldest frame still in the ring
+                self.overruns += head - self.slots - self.cursor
+                self.cursor = head - self.slots
+            n = self.cursor
+            self.cursor += 1
+            offset = RING_HDR.size + (n % self.slots) * SLOT_SIZE
+            valid = 2 * n + 2
+            if SLOT_STAMP.unpack_from(self.map, offset)[0] != valid:
+                self.overruns += 1
+                continue
+            (host_us, node) = FRAME_HDR.unpack_from(self.map, offset + SLOT_STAMP.size)
+            start = offset + RECORD_OFFSET
+            rec_len = struct.unpack_from("<H", self.map, start + 4)[0]
+            record = self.map[start:start + min(rec_len, RECORD_MAX)]
+            if SLOT_STAMP.unpack_from(self.map, offset)[0] != valid:
+                self.overruns += 1
+                continue
+            self.frames += 1
+            frames.append(Frame(host_us, node, record))
+        return frames
+
+    def close (self) :
+        self.map.close()
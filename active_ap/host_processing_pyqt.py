@@ -2,73 +2,82 @@ import sys
 import os
 import time
 import socket
+import threading
 import collections
 import numpy as np
 import pyqtgraph as pg
 from pyqtgraph.Qt import QtCore, QtGui
 
-import requests
 import PIL.Image
 from io import BytesIO
-import subprocess
+
+import csi_record
+import link_stats
+import clock_sync
+import csi_shm
+import csi_serial
+import csi_cook
+import csi_detect
+import csi_display
+import camera_trigger
 
 # whether turn on motion detection and call video streaming
 DETECTION_ON = True
+CAMERA_IP = "192.168.4.4" # the HTTP camera of camera_streaming.py
+# the camera streams until CAMERA_HOLD_S after the last motion, then ignores motion for CAMERA_COOLDOWN_S
+CAMERA_HOLD_S = 10
+CAMERA_COOLDOWN_S = 5
 
 UDP_IP = "192.168.4.2" # put your computer's ip in WiFi netowrk here
 UDP_PORT = 8848
+# set to csi_shm.SHM_RING_NAME to take the frames host_tools/csi_ingest -s decodes instead of
+# receiving them here, other consumers can then attach to the same frames
+SHM_RING = None
+# set to the serial port of a device built with CONFIG_CSI_SERIAL_FRAMED, e.g. "/dev/ttyUSB0", to
+# take its framed records from the wire instead of UDP
+SERIAL_PORT = None
+SERIAL_BAUD = csi_serial.SERIAL_BAUD
 
 QUEUE_LEN = 50
 CSI_LEN = 57 * 2
-DISP_FRAME_RATE = 10 # 10 frames per second, this is decided by the packet sender of CSI
-
-PLOT_FRESH_INTERVAL = 20 # ms
+# the plots are redrawn this many times per second from a snapshot of csi_display.Display,
+# whatever the packet rate; the ingest thread takes in every frame meanwhile
+DISPLAY_HZ = 10
+RECV_BUFFER = 4 << 20 # bytes of socket buffer for bursts of the ingest thread
 
 node_mac_list = []
 corlor_list = []
 
-# lists to hold 'artists' from matplotlib
+# undoes per-node delta coding of binary records (CONFIG_CSI_DELTA_ENABLE)
+delta_decoder = csi_record.DeltaDecoder()
+# mac addr -> (latest stats record, counter rates), from the stats records of the devices
+device_stats = {}
+# per node loss, reordering and jitter, from the sequence numbers of the records
+node_links = link_stats.LinkStats()
+# maps the device time of each node onto the host clock
+node_clocks = clock_sync.ClockSync()
+
+# per node latest CSI, envelope and SNR history, filled by the ingest thread, drawn by App
+display = csi_display.Display(history=QUEUE_LEN)
+
+# 'artists' of the plots by node id, made by App when a node first shows in a snapshot
 curve_rssi_list = []
-scatter_rssi_list = []
-text_rssi_list = []
 curve_csi_list = []
 
-LOG_LEN = 3
-TEST_MIN_NUM = 100
-DIFF_THRESHOLD = 3
-TARGET_NODE = 0
+# motion detection on every node, see csi_detect.py
+LOG_LEN = 3             # frames averaged against the baseline
+TEST_MIN_NUM = 100      # frames of a node before it decides
+DIFF_THRESHOLD = 3      # dB over the baseline where motion starts
+DIFF_RELEASE = 2        # dB under which it ends, after HOLD_FRAMES frames
+HOLD_FRAMES = 10
+TARGET_NODE = 0         # whose baseline is plotted
 baseline_alpha = 0.95
-test_counter = 0
-# compute diff, record multiple records, corr, test peak.
-def crossing_decction(new_csi_data):
-    global csi_data_log
-    global csi_db_baseline
-    global test_counter
-
-    test_counter += 1
-    if len(csi_data_log) < LOG_LEN:
-        csi_data_log.append( new_csi_data )
-        return False
-    elif test_counter < TEST_MIN_NUM:
-        csi_data_log.popleft()
-        csi_data_log.append( new_csi_data )
-        # update baseline
-        csi_db_baseline = csi_db_baseline * baseline_alpha + new_csi_data * (1 - baseline_alpha)
-        return False
-    else:
-        csi_data_log.popleft()
-        csi_data_log.append( new_csi_data )
-        # update baseline
-        csi_db_baseline = csi_db_baseline * baseline_alpha + new_csi_data * (1 - baseline_alpha)
-
-    csi_diff = np.zeros(CSI_LEN)
-    for csi in csi_data_log:
-        csi_diff += ( csi - csi_db_baseline ) / LOG_LEN
-    
-    if np.max( np.abs( csi_diff ) ) > DIFF_THRESHOLD:
-        return True
-    else:
-        return False
+detectors = csi_detect.Detectors(alpha=baseline_alpha, window=LOG_LEN, warmup=TEST_MIN_NUM,
+                                 threshold=DIFF_THRESHOLD, release=DIFF_RELEASE, hold=HOLD_FRAMES)
+# with several boards, set to the number of nodes that must see motion in the same 100 ms epoch
+# (csi_detect.Fusion), fewer false triggers than any single node
+FUSION_K = None
+fusion = csi_detect.Fusion(k=FUSION_K) if FUSION_K is not None else None
 
 
 def parse_data_line (line, data_len) :
@@ -79,37 +88,94 @@ def parse_data_line (line, data_len) :
 
     return data
 
-def add_new_node (pyqt_app, node_id):
-    if node_id == 0:
-        return
-    rssi_que_list.append( collections.deque(np.zeros(QUEUE_LEN)) )
-    csi_points_list.append( np.zeros(CSI_LEN) )
-    # new rssi curve
-    curve_rssi_list.append( pyqt_app.pw1.plot(pen=(node_id, 3)) ) # append SNR curve
-
-
-    # new csi curve
-    curve_csi_list.append( pyqt_app.pw2.plot(pen=(node_id, 3)) ) # append SNR curve
+def get_node_id (mac_addr):
+    # if a new mac addr
+    if not mac_addr in node_mac_list:
+        node_mac_list.append(mac_addr)
+        node_id = len(node_mac_list) - 1
+    else:
+        node_id = node_mac_list.index(mac_addr)
+    return node_id
 
+# a datagram can hold several records when the device batches them.
+# returns a list of (rx_ctrl_data, raw_csi_data, node_id), one per record.
+def parse_binary_packet (data) :
+    frames = []
+    offset = 0
+    arrival = time.time()
+    while offset < len(data):
+        (mac_addr, rx_ctrl_data, rec_type, csi_data, stamp, offset) = \
+            csi_record.parse_record(data, offset, delta_decoder)
+        if stamp is not None:
+            node_links.update(mac_addr, stamp.seq, stamp.handler_us, arrival)
+        if stamp is not None and stamp.rx_us is not None:
+            node_clocks.update(mac_addr, stamp.rx_us, arrival)
+        if csi_data is None:
+            # delta coded record after a lost datagram, wait for the next keyframe of this node
+            continue
+        node_id = get_node_id(mac_addr)
+        frames.append( (rx_ctrl_data, rec_type, csi_data, node_id) )
+    return frames
+
+# keep the latest stats of the device, print where its frames go
+def parse_stats_packet (data) :
+    (mac_addr, stats, _) = csi_record.parse_stats(data)
+    prev = device_stats.get(mac_addr)
+    rates = csi_record.stats_rates(prev[0], stats) if prev is not None else None
+    device_stats[mac_addr] = (stats, rates)
+    if rates is not None:
+        print("{} stats: {:.0f} frames/s, {:.0f} records/s sent, drops/s: ring full {:.1f}, non-HT {:.1f}, "
+              "filter {:.1f}, own reports {:.1f}, over rate {:.1f}, send errors {:.1f}; ring high water {}/{}, "
+              "queue {} us avg".format(
+              mac_addr, rates["cb_calls"], rates["records_sent"], rates["drop_ring_full"], rates["drop_non_ht"],
+              rates["drop_filter"], rates["drop_self"], rates["drop_rate"], rates["send_errors"],
+              stats["ring_high_water"], stats["ring_size"], stats["queue_us_avg"]))
+    for node_mac in node_links.nodes:
+        print(node_links.summary(node_mac))
+    for node_mac in node_clocks.nodes:
+        print(node_clocks.summary(node_mac))
+
+# print the busy share of each core and the tasks that take the most of it
+def parse_tasks_packet (data) :
+    (mac_addr, _, cores, tasks, _) = csi_record.parse_tasks(data)
+    load = csi_record.core_load(cores, tasks)
+    busy = sorted((t for t in tasks if not t.name.startswith("IDLE")), key=lambda t: -t.cpu)
+    print("{} cores busy {}; {}".format(mac_addr, ", ".join("{:.0f}%".format(l * 100) for l in load),
+          ", ".join("{} {:.1f}% on {} ({} B stack free)".format(t.name, t.cpu * 100, "any" if t.core is None else t.core,
+                    t.stack_free) for t in busy[:6])))
+
+def parse_data_packet (data) :
+    if csi_record.is_stats_record(data):
+        parse_stats_packet(data)
+        return []
+    if csi_record.is_tasks_record(data):
+        parse_tasks_packet(data)
+        return []
+    if csi_record.is_binary_record(data):
+        return parse_binary_packet(data)
 
-def parse_data_packet (pyqt_app, data) :
     data_str = str(data, encoding="ascii")
     lines = data_str.splitlines()
+    frames = []
     node_id = -1
     for l_count in range(len(lines)):
         line = lines[l_count]
-        print(line)
         items = line.split(",")
 
+        # each text record starts with a "CSI_DATA" line
+        if items[0].startswith("CSI_DATA"):
+            node_id = -1
+
         if items[0].find("mac =") >= 0:
-            mac_addr = items[0][items[0].find("mac =") + 5:]
-            # if a new mac addr
-            if not mac_addr in node_mac_list:
-                node_mac_list.append(mac_addr)
-                node_id = len(node_mac_list) - 1
-                add_new_node(pyqt_app, node_id)
-            else:
-                node_id = node_mac_list.index(mac_addr)
+            mac_addr = items[0][items[0].find("mac =") + 5:].strip()
+            node_id = get_node_id(mac_addr)
+            # ", seq = N, rx_us = R, handler_us = T" trail the mac, firmware before sequence numbers sends none
+            if len(items) > 1:
+                arrival = time.time()
+                stamp = dict((k.strip(), int(v)) for (k, v) in (item.split("=") for item in items[1:]))
+                node_links.update(mac_addr, stamp["seq"], stamp["handler_us"], arrival)
+                if "rx_us" in stamp:
+                    node_clocks.update(mac_addr, stamp["rx_us"], arrival)
 
         if items[0] == "rx_ctrl info":
             # the next line should be rx_ctrl info.
@@ -122,24 +188,43 @@ def parse_data_packet (pyqt_app, data) :
             # the next line should be raw csi data.
             tmp_pos = items[1].find("len = ")
             raw_csi_len = int(items[1][tmp_pos+6:])
-            # parse csi raw data
+            # parse csi raw data, the last part of a record
             raw_csi_data = parse_data_line(lines[l_count + 1], raw_csi_len)
-    # a newline to separate packets
-    print()
-
-    return ( rx_ctrl_data, raw_csi_data, node_id)
+            frames.append( (rx_ctrl_data, csi_record.CSI_RECORD_TYPE_RAW, raw_csi_data, node_id) )
+
+    return frames
+
+# the frames csi_ingest published since the last call, as parse_data_packet() returns them.
+# Device stats records stay with csi_ingest.
+def parse_ring_frames () :
+    frames = []
+    for frame in shm_reader.read():
+        (mac_addr, rx_ctrl_data, rec_type, csi_data, stamp, _) = csi_record.parse_record(frame.record)
+        # arrival as the kernel stamped it in csi_ingest
+        arrival = frame.host_us / 1e6
+        node_links.update(mac_addr, stamp.seq, stamp.handler_us, arrival)
+        node_clocks.update(mac_addr, stamp.rx_us, arrival)
+        frames.append( (rx_ctrl_data, rec_type, csi_data, get_node_id(mac_addr)) )
+    return frames
 
 # scale csi data accoding to SNR
 # change to numpy array as well
-def cook_csi_data (rx_ctrl_info, raw_csi_data) :
+# rec_type tells what csi_data holds, see csi_record.parse_record()
+def cook_csi_data (rx_ctrl_info, rec_type, csi_data) :
     rssi = rx_ctrl_info[0]  # dbm
     noise_floor = rx_ctrl_info[11] # dbm. The document says unit is 0.25 dbm but it does not make sense.
     # do not know AGC
 
-    # Each channel frequency response of sub-carrier is recorded by two bytes of signed characters. 
-    # The first one is imaginary part and the second one is real part.
-    raw_csi_data = [ (raw_csi_data[2*i] * 1j + raw_csi_data[2*i + 1]) for i in range(int(len(raw_csi_data) / 2)) ]
-    raw_csi_array = np.array(raw_csi_data)    
+    if rec_type == csi_record.CSI_RECORD_TYPE_AMPLITUDE:
+        # only magnitudes, which is all the plots and the detector use
+        raw_csi_array = np.array(csi_data)
+    elif rec_type == csi_record.CSI_RECORD_TYPE_AMP_PHASE:
+        raw_csi_array = np.array(csi_data[0]) * np.exp(1j * np.array(csi_data[1]))
+    else:
+        # Each channel frequency response of sub-carrier is recorded by two bytes of signed characters. 
+        # The first one is imaginary part and the second one is real part.
+        raw_csi_data = [ (csi_data[2*i] * 1j + csi_data[2*i + 1]) for i in range(int(len(csi_data) / 2)) ]
+        raw_csi_array = np.array(raw_csi_data)    
 
     ## Note:this part of SNR computation may not be accurate.
     #       The reason is that ESP32 may not provide a accurate noise floor value.
@@ -147,13 +232,13 @@ def cook_csi_data (rx_ctrl_info, raw_csi_data) :
     #       so ESP32 doc just consider noise * 0.25 dbm as a estimated value. (described in the official doc)
     #       But here I will jut use the noise value in rx_ctrl info times 1 dbm as the noise floor.
     # scale csi
+    # NOTE: preprocessed records only carry the used subcarriers, so the sum runs over those and not all 192.
     snr_db = rssi - noise_floor # dB
     snr_abs = 10**(snr_db / 10.0) # from db back to normal
     csi_sum = np.sum(np.abs(raw_csi_array)**2)
     num_subcarrier = len(raw_csi_array)
     scale = np.sqrt((snr_abs / csi_sum) * num_subcarrier)
     raw_csi_array = raw_csi_array * scale
-    print("SNR = {} dB".format(snr_db))
     #
 
     # Note:
@@ -163,65 +248,128 @@ def cook_csi_data (rx_ctrl_info, raw_csi_data) :
     # In the 40MHz HT transmission, two adjacent 20MHz channels are used. 
     # The channel is divided into 128 sub-carriers. 6 pilot signals are inserted in sub-carriers -53, -25, -11, 11, 25, 53. 
     # Signal is transmitted on sub-carriers -58 to -2 and 2 to 58.
-    assert(len(raw_csi_array) == 64 * 3)
-    cooked_csi_array = raw_csi_array[64:]
-    # rearrange to -58 ~ -2 and 2 ~ 58.
-    cooked_csi_array = np.concatenate((cooked_csi_array[-58:-1], cooked_csi_array[2:59]))
+    if rec_type == csi_record.CSI_RECORD_TYPE_RAW:
+        assert(len(raw_csi_array) == 64 * 3)
+        cooked_csi_array = raw_csi_array[64:]
+        # rearrange to -58 ~ -2 and 2 ~ 58.
+        cooked_csi_array = np.concatenate((cooked_csi_array[-58:-1], cooked_csi_array[2:59]))
+    else:
+        # already selected and in this order on the device
+        cooked_csi_array = raw_csi_array
     assert(len(cooked_csi_array) == CSI_LEN)
-    
-    print("RSSI = {} dBm\n".format(rssi))
-    return (snr_db, cooked_csi_array)
 
-def update_esp32_data(pyqt_app):
-    # recv UDP packet aync!
-    try:
-        data = sock.recv(2048) # buffer size is 2048 bytes
-    except:
-        return -1
-
-    # parse data packet to get lists of data
-    (rx_ctrl_data, raw_csi_data, node_id) = parse_data_packet(pyqt_app, data)
-
-    # only process HT(802.11 n) and 40 MHz frames without stbc
-    # Check https://docs.espressif.com/projects/esp-idf/en/latest/esp32/api-guides/wifi.html#wi-fi-channel-state-information
-    # sig-mod, channel bandwidth, stbc fields 
-    if rx_ctrl_data[2] != 1 or rx_ctrl_data[4] != 1 or rx_ctrl_data[8] != 0:
-        return -1
-    # you can support more formats by changing cook_csi_data() function
-    
-
-    # node_id not assigned, error
-    assert(node_id >= 0)
-    print("Got a HT 40MHz packet ...")
-
-    # prepare csi data
-    (rssi, csi_data) = cook_csi_data(rx_ctrl_data, raw_csi_data)
-
-    # update RSSI
-    print("node id = ", node_id)
-    rssi_que_list[node_id].popleft()
-    rssi_que_list[node_id].append( rssi )
-    # update CSI
-    csi_points_list[node_id] = 10 * np.log10(np.abs(csi_data)**2 + 0.1) # + 0.1 to avoid log(0)
+    return (snr_db, cooked_csi_array)
 
-    return node_id
+# csi_data of parse_record() as the batch kernel takes it
+def kernel_values (rec_type, csi_data) :
+    if rec_type == csi_record.CSI_RECORD_TYPE_AMP_PHASE:
+        csi_data = csi_data[0]
+    if rec_type in (csi_record.CSI_RECORD_TYPE_AMPLITUDE, csi_record.CSI_RECORD_TYPE_AMP_PHASE):
+        # back to the 1/16 units of the record
+        return np.rint(np.array(csi_data) / csi_record.AMPLITUDE_SCALE)
+    return csi_data
+
+# (snr_db, csi_db) of each of the frames, where csi_db is 10 * log10(|h|^2 + 0.1) of the cooked csi.
+# All frames of a record type go through the native batch kernel at once when
+# host_tools/libcsi_cook.so is built, the rest through cook_csi_data().
+def cook_frames (frames) :
+    results = [None] * len(frames)
+    if csi_cook.available:
+        for rec_type in set(f[1] for f in frames):
+            if not csi_cook.supports(rec_type):
+                continue
+            # HT20 or other frames of an unexpected length take the Python path
+            batch = [i for (i, f) in enumerate(frames)
+                     if f[1] == rec_type and len(kernel_values(rec_type, f[2])) == csi_cook.frame_width(rec_type)]
+            if not batch:
+                continue
+            (snr_db, csi_db) = csi_cook.cook(rec_type, [frames[i][0][0] for i in batch], [frames[i][0][11] for i in batch],
+                                             [kernel_values(rec_type, frames[i][2]) for i in batch])
+            for (k, i) in enumerate(batch):
+                results[i] = (snr_db[k], csi_db[k])
+    for (i, (rx_ctrl_data, rec_type, csi_data, node_id)) in enumerate(frames):
+        if results[i] is None:
+            (snr_db, csi_data) = cook_csi_data(rx_ctrl_data, rec_type, csi_data)
+            results[i] = (snr_db, 10 * np.log10(np.abs(csi_data)**2 + 0.1)) # + 0.1 to avoid log(0)
+    return results
+
+# returns a list of (node_id, csi_db) for every usable frame in the received datagram.
+def update_esp32_data():
+    if shm_reader is not None:
+        frames = parse_ring_frames()
+    elif serial_reader is not None:
+        # blocks up to 100 ms for the next bytes, every record is a datagram of its own
+        frames = []
+        for record in serial_reader.read():
+            frames += parse_data_packet(record)
+    else:
+        # blocks for the next datagram, up to the socket timeout
+        try:
+            data = sock.recv(2048) # buffer size is 2048 bytes
+        except:
+            return []
+        # parse data packet to get lists of data
+        frames = parse_data_packet(data)
+
+    usable = []
+    for (rx_ctrl_data, rec_type, csi_data, node_id) in frames:
+        # only process HT(802.11 n) and 40 MHz frames without stbc
+        # Check https://docs.espressif.com/projects/esp-idf/en/latest/esp32/api-guides/wifi.html#wi-fi-channel-state-information
+        # sig-mod, channel bandwidth, stbc fields 
+        if rx_ctrl_data[2] != 1 or rx_ctrl_data[4] != 1 or rx_ctrl_data[8] != 0:
+            continue
+        # you can support more formats by changing cook_csi_data() function
+        # phase alone carries no magnitude to plot
+        if rec_type == csi_record.CSI_RECORD_TYPE_PHASE:
+            continue
+
+        # node_id not assigned, error
+        assert(node_id >= 0)
+        usable.append( (rx_ctrl_data, rec_type, csi_data, node_id) )
+
+    updates = []
+    for ((rx_ctrl_data, rec_type, csi_data, node_id), (snr_db, csi_db)) in zip(usable, cook_frames(usable)):
+        display.add(node_id, snr_db, csi_db)
+        updates.append( (node_id, csi_db) )
+
+    return updates
+
+# The ingest thread: takes in datagrams as fast as they come and runs detection on every frame of
+# every node, App only draws what it put into display. Motion only wakes the camera thread.
+def ingest_loop():
+    while True:
+        updates = update_esp32_data()
+        if len(updates) == 0:
+            if shm_reader is not None:
+                # the ring does not block, wait for csi_ingest to publish more
+                time.sleep(0.002)
+            continue
+        if not DETECTION_ON:
+            continue
+        now_us = int(time.time() * 1e6)
+        for (node_id, csi_db) in updates:
+            event = detectors.update(node_id, now_us, csi_db)
+            if fusion is not None:
+                epochs = fusion.add(node_id, now_us, detectors.nodes[node_id].score)
+                motion = [e for e in epochs if e[4]]
+                if motion and camera.trigger():
+                    print("motion at {} of {} nodes".format(motion[0][2], motion[0][1]))
+            elif event is not None and event[0] == csi_detect.DETECT_START and camera.trigger():
+                print("motion at node {}, score {:.1f} dB".format(node_id, event[3]))
 
 
 class App(QtGui.QMainWindow):
     def __init__(self, parent=None):
         super(App, self).__init__(parent)
 
-        global csi_db_baseline
-
         #### Create Gui Elements ###########
         self.mainbox = pg.LayoutWidget()
         self.setCentralWidget(self.mainbox)
 
         # time domain for plot 1
-        self.disp_time = np.array([ (x - QUEUE_LEN + 1)/ DISP_FRAME_RATE for x in range(QUEUE_LEN)])
+        self.disp_time = np.array([ (x - QUEUE_LEN + 1)/ DISPLAY_HZ for x in range(QUEUE_LEN)])
         # set up Plot 1 widget
         self.pw1 = pg.PlotWidget(name="Plot1")
-        curve_rssi_list.append( self.pw1.plot(pen=(0, 3)) ) # append SNR curve
         self.mainbox.addWidget(self.pw1, row=0, col=0)
         self.pw1.setLabel('left', 'SNR', units='dB')
         self.pw1.setLabel('bottom', 'Time ', units=None)
@@ -229,24 +377,28 @@ class App(QtGui.QMainWindow):
 
         # set up Plot 2 widget
         self.pw2 = pg.PlotWidget(name="Plot2")
-        curve_csi_list.append( self.pw2.plot(pen=(0, 3)) ) # append CSI curve
         self.baseline_csi_curve = self.pw2.plot(pen=(10, 3)) # append baseline CSI curve
+        # spread of the CSI of TARGET_NODE between two redraws
+        envelope_pen = pg.mkPen(color=(150, 150, 150), style=QtCore.Qt.DashLine)
+        self.min_csi_curve = self.pw2.plot(pen=envelope_pen)
+        self.max_csi_curve = self.pw2.plot(pen=envelope_pen)
         self.mainbox.addWidget(self.pw2, row=0, col=1)
         self.pw2.setLabel('left', 'CSI', units='dB')
         self.pw2.setLabel('bottom', 'subcarriers [-58, -2] and [2, 58] ', units=None)
         self.pw2.setXRange(0, CSI_LEN)
         self.pw2.setYRange(20, 70)
 
-        # # set up image widget
-        # self.img_w = pg.GraphicsLayoutWidget()
-        # self.mainbox.addWidget(self.img_w, row=0, col=2)
-        # # image view box
-        # self.view = self.img_w.addViewBox()
-        # self.view.setAspectLocked(True)
-        # self.view.setRange(QtCore.QRectF(0,0, 800, 600))
-        # #  image plot
-        # self.img = pg.ImageItem(border='w')
-        # self.view.addItem(self.img)
+        # set up image widget, the camera once motion started it
+        self.img_w = pg.GraphicsLayoutWidget()
+        self.mainbox.addWidget(self.img_w, row=0, col=2)
+        # image view box
+        self.view = self.img_w.addViewBox()
+        self.view.setAspectLocked(True)
+        self.view.setRange(QtCore.QRectF(0,0, 800, 600))
+        #  image plot
+        self.img = pg.ImageItem(border='w')
+        self.view.addItem(self.img)
+        self.img_t = 0.
 
         # a text label widget for info dispaly
         self.label = QtGui.QLabel()
@@ -256,12 +408,14 @@ class App(QtGui.QMainWindow):
 
         self.fps = 0.
         self.lastupdate = time.time()
-
-        # to start video streaming
-        # subprocess.Popen(["python3", "camera_streaming.py"])
+        # frames/s the ingest thread took in
+        self.ingest_rate = 0.
+        self.ingest_frames = 0
 
         #### Start  #####################
-        self._update()
+        self.timer = QtCore.QTimer()
+        self.timer.timeout.connect(self._update)
+        self.timer.start(int(1000 / DISPLAY_HZ))
 
     def calculate_fps(self):
         now = time.time()
@@ -271,49 +425,77 @@ class App(QtGui.QMainWindow):
         fps2 = 1.0 / dt
         self.lastupdate = now
         self.fps = self.fps * 0.9 + fps2 * 0.1
+        frames = display.frames
+        self.ingest_rate = self.ingest_rate * 0.9 + (frames - self.ingest_frames) * fps2 * 0.1
+        self.ingest_frames = frames
 
     def update_label(self):
-        tx = 'Mean Frame Rate:  {fps:.3f} FPS'.format(fps=self.fps )
+        tx = 'Mean Frame Rate:  {fps:.3f} FPS, ingest {rate:.0f} frames/s'.format(fps=self.fps, rate=self.ingest_rate)
+        # what the devices sent and lost, from their stats records; the ingest thread adds to
+        # these, so iterate over copies
+        for (mac_addr, (stats, rates)) in list(device_stats.items()):
+            if rates is not None:
+                tx += '    {}: {:.0f} sent/s, {:.1f} ring drops/s'.format(
+                      mac_addr, rates["records_sent"], rates["drop_ring_full"])
+        # what got lost on the way, per node
+        for (mac_addr, node) in list(node_links.nodes.items()):
+            tx += '\n{}: {:.2f}% lost, {} reordered, jitter {:.0f} us'.format(
+                  mac_addr, node.loss_rate() * 100, node.reordered, node.jitter_us)
         self.label.setText(tx)
 
     def _update(self):
-
-        node_id = update_esp32_data(self)
-        if node_id < 0:
-            # schedule the next update call
-            QtCore.QTimer.singleShot(PLOT_FRESH_INTERVAL, self._update)
-            return
-
-        curve_rssi_list[node_id].setData(x=self.disp_time, y=rssi_que_list[node_id], pen=(node_id, 3))
-        curve_csi_list[node_id].setData(y=csi_points_list[node_id], pen=(node_id, 3))
+        snapshot = display.snapshot()
+        for node_id in sorted(snapshot):
+            while len(curve_csi_list) <= node_id:
+                # new node
+                curve_rssi_list.append( self.pw1.plot(pen=(len(curve_rssi_list), 3)) ) # append SNR curve
+                curve_csi_list.append( self.pw2.plot(pen=(len(curve_csi_list), 3)) ) # append CSI curve
+        # redraw every node that got new data once, with its latest frame
+        for (node_id, node) in snapshot.items():
+            if node.fresh == 0:
+                continue
+            curve_rssi_list[node_id].setData(x=self.disp_time, y=node.snr_db, pen=(node_id, 3))
+            curve_csi_list[node_id].setData(y=node.csi_db, pen=(node_id, 3))
+        target = snapshot.get(TARGET_NODE)
+        if target is not None and target.fresh > 1:
+            self.min_csi_curve.setData(y=target.csi_min)
+            self.max_csi_curve.setData(y=target.csi_max)
+        baseline = detectors.baseline(TARGET_NODE) if DETECTION_ON else None
+        if baseline is not None:
+            self.baseline_csi_curve.setData(y=baseline, pen=(10, 3))
+
+        # the newest camera frame, decoded only at the display rate
+        latest = camera.latest() if DETECTION_ON else None
+        if latest is not None and latest[1] != self.img_t:
+            self.img_t = latest[1]
+            img_capture = PIL.Image.open(BytesIO(latest[0]))
+            self.img.setImage(np.array(img_capture.rotate(-90)))
 
         self.calculate_fps()
         self.update_label()
 
-        if DETECTION_ON and TARGET_NODE == node_id:
-            self.baseline_csi_curve.setData(y=csi_db_baseline, pen=(10, 3))
-            ret = crossing_decction(csi_points_list[node_id])
-            if ret:
-                subprocess.Popen(["python3", "camera_streaming.py"])
-                return
-
-        # schedule the next update call
-        QtCore.QTimer.singleShot(PLOT_FRESH_INTERVAL, self._update)
-
 
 if __name__ == '__main__':
-    # a queue to hold SNR values
-    rssi_que_list = [collections.deque(np.zeros(QUEUE_LEN))]
-    csi_points_list = [np.zeros(CSI_LEN)]
-
-    csi_data_log = collections.deque()
-    csi_db_baseline = np.zeros(CSI_LEN)
-
-    # create a recv socket for packets from ESP32 soft-ap
-    sock = socket.socket(socket.AF_INET, # Internet
-                        socket.SOCK_DGRAM) # UDP
-    sock.bind((UDP_IP, UDP_PORT))
-    sock.settimeout(1)
+    shm_reader = None
+    serial_reader = None
+    if SHM_RING is not None:
+        # frames from a running csi_ingest
+        shm_reader = csi_shm.RingReader(SHM_RING)
+    elif SERIAL_PORT is not None:
+        # frames from a device on the serial port
+        serial_reader = csi_serial.SerialReader(SERIAL_PORT, SERIAL_BAUD)
+    else:
+        # create a recv socket for packets from ESP32 soft-ap
+        sock = socket.socket(socket.AF_INET, # Internet
+                            socket.SOCK_DGRAM) # UDP
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, RECV_BUFFER)
+        sock.bind((UDP_IP, UDP_PORT))
+        sock.settimeout(1)
+    # keeps a connection to the camera warm, so motion shows on it without delay
+    camera = camera_trigger.CameraTrigger(CAMERA_IP, hold_s=CAMERA_HOLD_S, cooldown_s=CAMERA_COOLDOWN_S)
+    if DETECTION_ON:
+        camera.start()
+    threading.Thread(target=ingest_loop, daemon=True).start()
 
     app = QtGui.QApplication(sys.argv)
     thisapp = App()
@@ -0,0 +1,76 @@
+# Per node loss, reordering and jitter of the CSI records, from the seq and handler_us the device
+# stamps on each record (see _components/seq_component.h).
+# A gap in seq is a record lost after the device handler: too large to send, a failed sendto(),
+# or lost in UDP. What the device dropped before (ring full, the guard) is in its stats records.
+# Records batched into one datagram arrive together, so the jitter includes their wait in the batch.
+SEQ_MOD = 1 << 16
+MAX_DROPOUT = 3000   # a larger jump forward means the device restarted the sequence
+WINDOW = 256         # how late a record may arrive and still count as reordered
+
+class NodeStats :
+    def __init__ (self, seq) :
+        self.received = 0
+        self.lost = 0           # gaps in seq, minus records that arrived late
+        self.reordered = 0      # arrived after a higher seq
+        self.duplicates = 0
+        self.restarts = 0
+        self.jitter_us = 0.0    # inter-arrival jitter as in RFC 3550
+        self._reset(seq)
+
+    def _reset (self, seq) :
+        self.highest = seq
+        self.seen = 1           # bit i: highest - i was received
+        self.last_transit = None
+
+    def loss_rate (self) :
+        total = self.received + self.lost
+        return self.lost / total if total > 0 else 0.0
+
+class LinkStats :
+    def __init__ (self) :
+        self.nodes = {} # mac addr -> NodeStats
+
+    # account one record, arrival_s is the host time it was received in seconds
+    def update (self, mac_addr, seq, handler_us, arrival_s) :
+        node = self.nodes.get(mac_addr)
+        if node is None:
+            node = self.nodes[mac_addr] = NodeStats(seq)
+            node.received = 1
+            node.last_transit = (arrival_s, handler_us)
+            return
+
+        d = (seq - node.highest) % SEQ_MOD
+        if d > SEQ_MOD // 2:
+            d -= SEQ_MOD
+        if 0 < d <= MAX_DROPOUT:
+            node.lost += d - 1
+            node.highest = seq
+            node.seen = ((node.seen << d) | 1) & ((1 << WINDOW) - 1)
+            self._jitter(node, handler_us, arrival_s, d)
+        elif d == 0 or -WINDOW < d < 0:
+            bit = 1 << -d
+            if node.seen & bit:
+                node.duplicates += 1
+                return
+            node.seen |= bit
+            node.reordered += 1
+            # it was counted as lost when the records after it arrived
+            node.lost -= 1
+        else:
+            node.restarts += 1
+            node._reset(seq)
+        node.received += 1
+
+    def _jitter (self, node, handler_us, arrival_s, d) :
+        # difference of the transit times of two records: arrival spacing minus send spacing
+        if node.last_transit is not None and d == 1:
+            (last_arrival_s, last_handler_us) = node.last_transit
+            sent_us = (handler_us - last_handler_us) % (1 << 32)
+            diff_us = (arrival_s - last_arrival_s) * 1e6 - sent_us
+            node.jitter_us += (abs(diff_us) - node.jitter_us) / 16
+        node.last_transit = (arrival_s, handler_us)
+
+    def summary (self, mac_addr) :
+        node = self.nodes[mac_addr]
+        return "{}: {} received, {:.2f}% lost, {} reordered, {} duplicates, jitter {:.0f} us".format(
+            mac_addr, node.received, node.loss_rate() * 100, node.reordered, node.duplicates, node.jitter_us)
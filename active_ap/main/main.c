@@ -6,6 +6,7 @@
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 #include "mdns.h"
 #include <string.h>
@@ -16,9 +17,10 @@
 
 // #include "../../_components/nvs_component.h"
 // #include "../../_components/sd_component.h"
-#include "../../_components/csi_component.h"
+#include "../../_components/handler_component.h"
+#include "../../_components/mac_filter_component.h"
 // #include "../../_components/time_component.h"
-// #include "../../_components/input_component.h"
+#include "../../_components/input_component.h"
 // #include "../../_components/sockets_component.h"
 
 /*
@@ -33,28 +35,20 @@
 #define EXAMPLE_ESP_WIFI_CHANNEL   1
 #define EXAMPLE_MAX_STA_CONN       16
 
-#define CSI_QUEUE_SIZE             32
-// #define HOST_IP_ADDR               "192.168.4.2" // the ip addr of the host computer.
-#define TARGET_HOSTNAME            "RuichunMacBook-Pro" // put your computer mDNS name here.
-#define HOST_UDP_PORT              8848
-
 
 
 static const char *TAG = "CSI collection (AP)";
 
-static char *target_host_ipv4 = NULL;
-
-static xQueueHandle csi_info_queue;
-
-static const uint8_t PEER_NODE_NUM = 4; // self is also included.
-static const char peer_mac_list[8][20] = {
+// default peers, used until a peer list is saved over the serial console (see peer_command()).
+static const char peer_mac_list[][20] = {
     "3c:61:05:4c:36:cd", // esp32 official dev board 0, as soft ap
     "3c:61:05:4c:3c:28", // esp32 official dev board 1
     "08:3a:f2:6c:d3:bc", // esp32 unofficial dev board 0
     "08:3a:f2:6e:05:94", // esp32 unofficial dev board 1
 };
 
-static void csi_handler_task(void *pvParameter);
+static void init_peer_filter(void);
+static void input_task(void *pvParameter);
 
 static void wifi_event_handler(void* arg, esp_event_base_t event_base,
                                     int32_t event_id, void* event_data)
@@ -135,8 +129,16 @@ static void initialise_mdns(void)
     free(hostname);
 }
 
-void wifi_csi_cb(void *ctx, wifi_csi_info_t *data);
-void parse_csi (wifi_csi_info_t *data, char* payload);
+// only frames from the peers are collected
+static bool is_peer(const wifi_csi_info_t *data) {
+    return mac_filter_contains(&peer_filter, data->mac);
+}
+
+static const csi_handler_hooks_t csi_handler_hooks = {
+    .type = "AP",
+    .stats_if = ESP_IF_WIFI_AP,
+    .accept = is_peer,
+};
 
 void app_main() {
     //Initialize NVS
@@ -151,238 +153,41 @@ void app_main() {
     // init wifi as soft-ap
     wifi_init_softap();
 
-    // init queue
-    csi_info_queue = xQueueCreate(CSI_QUEUE_SIZE, sizeof(wifi_csi_info_t));
-    if (csi_info_queue == NULL) {
-        ESP_LOGE(TAG, "Create queue fail");
-        return;
-    }
-    // register callback that push csi info to the queue
-    csi_init("AP", &wifi_csi_cb);
+    // peers to collect CSI from
+    init_peer_filter();
+
+    // init frame ring, register callback that push csi info to the ring
+    csi_handler_init(&csi_handler_hooks);
 
     // init mDNS
     initialise_mdns();
 
 
-    // start another task to handle CSI data
-    xTaskCreate(csi_handler_task, "csi_handler_task", 4096, NULL, 4, NULL);
-}
-
+    // SD log, host_task and csi_handler_task
+    csi_handler_start();
 
-int is_peer_node (uint8_t mac[6]) {
-    char mac_str[20] = {0};
-    sprintf(mac_str, "%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-    // ESP_LOGI(TAG, "Potential peer mac = %s", mac_str);
-    for (int p = 0; p < PEER_NODE_NUM; p++) {
-        // ESP_LOGI(TAG, "Testing peer mac = %s, ret = %d", peer_mac_list[p], strcmp(mac_str, peer_mac_list[p]));
-        if ( strcmp(mac_str, peer_mac_list[p])==0 )
-            return 1;
-    }
-    return 0;
+    // update the peer list at runtime
+    task_create(input_task, "input_task", 3072, 1, CSI_NET_CORE, NULL);
 }
 
-/* Callback function is called in WiFi task.
- * Users should not do lengthy operations from this task. Instead, post
- * necessary data to a queue and handle it from a lower priority task.
- * According to ESPNOW example. Makes sense. */
-void wifi_csi_cb(void *ctx, wifi_csi_info_t *data) {
-    // Done: filtering out packets accroding to mac addr.
-    if (!is_peer_node(data->mac)) {
-        // ESP_LOGI(TAG, "Non-peer node csi filtered.");
-        return;
-    }
-    // also need to drop non-HT packets to prevent queue from overflowing
-    if (data->rx_ctrl.sig_mode == 0) {
-        // ESP_LOGI(TAG, "Non-HT packet csi filtered.");
-        return; 
-    }
-
-    // if the host is not ready.
-    if (target_host_ipv4 == NULL) {
-        return;
-    }
 
-    // This callback pushs a csi entry to the queue.
-    wifi_csi_info_t local_csi_info;
-    if (data == NULL) {
-        ESP_LOGE(TAG, "Receive csi cb arg error");
+// load the saved peer list, or fall back to peer_mac_list.
+static void init_peer_filter(void) {
+    mac_filter_init(&peer_filter);
+    if (mac_filter_load(&peer_filter)) {
+        ESP_LOGI(TAG, "%d peer(s) loaded from NVS", mac_filter_count(&peer_filter));
         return;
     }
-
-    // copy content from wifi task to local
-    memcpy(&local_csi_info, data, sizeof(wifi_csi_info_t));
-    assert(local_csi_info.len == data->len);
-    // malloc buf
-    local_csi_info.buf = malloc(local_csi_info.len);
-    if (local_csi_info.buf == NULL) {
-        ESP_LOGE(TAG, "Malloc receive data fail");
-        return;
-    }
-    memcpy(local_csi_info.buf, data->buf, local_csi_info.len);
-    // csi info will be copied to the queue, but the buf is still pointing to what we allocated above. 
-    if (xQueueSend(csi_info_queue, &local_csi_info, portMAX_DELAY) != pdTRUE) {
-        ESP_LOGW(TAG, "Send entry to queue fail");
-        free(local_csi_info.buf);
-    }
-    ESP_LOGI(TAG, "CSI info pushed to queue");
-
-}
-
-static int query_mdns_host(const char * host_name)
-{
-    ESP_LOGI(TAG, "Query A: %s.local", host_name);
-
-    struct esp_ip4_addr addr;
-    addr.addr = 0;
-
-    esp_err_t err = mdns_query_a(host_name, 4000,  &addr);
-    if(err){
-        if(err == ESP_ERR_NOT_FOUND){
-            ESP_LOGW(TAG, "%s: Host was not found!", esp_err_to_name(err));
-            return -1;
+    for (int p = 0; p < sizeof(peer_mac_list) / sizeof(peer_mac_list[0]); p++) {
+        uint8_t mac[6];
+        if (!mac_parse(peer_mac_list[p], mac) || !mac_filter_add(&peer_filter, mac)) {
+            ESP_LOGW(TAG, "Invalid peer mac %s", peer_mac_list[p]);
         }
-        ESP_LOGE(TAG, "Query Failed: %s", esp_err_to_name(err));
-        return -1;
     }
-
-    ESP_LOGI(TAG, "Query A: %s.local resolved to: " IPSTR, host_name, IP2STR(&addr));
-    if (-1 == asprintf(&target_host_ipv4, IPSTR, IP2STR(&addr))) {
-        abort();
-    } 
-    return 0;
+    ESP_LOGI(TAG, "%d default peer(s)", mac_filter_count(&peer_filter));
 }
 
-int setup_udp_socket (struct sockaddr_in *dest_addr) {
-    int addr_family = 0;
-    int ip_protocol = 0;
-
-    if (target_host_ipv4 == NULL) {
-        while ( query_mdns_host(TARGET_HOSTNAME) < 0) {
-            ESP_LOGW(TAG, "No target host found, try again ...");
-        }
-    }
-
-    dest_addr->sin_addr.s_addr = inet_addr(target_host_ipv4);
-    dest_addr->sin_family = AF_INET;
-    dest_addr->sin_port = htons(HOST_UDP_PORT);
-    addr_family = AF_INET;
-    ip_protocol = IPPROTO_IP;
-
-    int sock = socket(addr_family, SOCK_DGRAM, ip_protocol);
-    if (sock < 0) {
-        ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
-        return sock;
-    }
-    ESP_LOGI(TAG, "Socket created, sending to %s:%d", target_host_ipv4, HOST_UDP_PORT);
-    return sock;
+static void input_task(void *pvParameter) {
+    // serial console, accepts SETTIME and PEER commands
+    input_loop();
 }
-
-
-static void csi_handler_task(void *pvParameter) {
-    wifi_csi_info_t local_csi;
-    struct sockaddr_in dest_addr;
-    char* payload;
-    int sock;
-    sock = setup_udp_socket(&dest_addr);
-    
-    // we use a max delay. so we keep waiting for new entry.
-    while (xQueueReceive(csi_info_queue, &local_csi, portMAX_DELAY) == pdTRUE) {
-        // NOTE: Even not connect to a computer, esp32 is still sending serial data of ESP_LOG. 
-        //       so turn them off to speed up.
-        // ESP_LOGI(TAG, "New CSI Info Recv!");
-        // send a udp packet to host computer.
-        payload = malloc(2048); // TODO: is this enough?
-        memset(payload, 0, 2048);
-
-        // test data
-        // sprintf(payload, "test data msg ...");
-        parse_csi(&local_csi, payload);
-
-        // send out udp packet
-        int err = sendto(sock, payload, strlen(payload), 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
-        if (err < 0) {
-            ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
-            vTaskDelay(100  / portTICK_PERIOD_MS);
-        } else {
-            ESP_LOGI(TAG, "CSI message sent, payload len = %d", strlen(payload));
-        }
-
-        // data must be freed !!!
-        free(local_csi.buf);
-        free(payload);
-        vTaskDelay(10 / portTICK_PERIOD_MS);
-    }
-    ESP_LOGI(TAG, "CSI Queue Time out!");
-    vTaskDelete(NULL);
-}
-
-
-void parse_csi (wifi_csi_info_t *data, char* payload) {
-    wifi_csi_info_t d = *data;
-    char mac[20] = {0};
-
-    // data description
-    sprintf(payload + strlen(payload), "CSI_DATA from Soft-AP\n");
-    sprintf(mac, "%02x:%02x:%02x:%02x:%02x:%02x", d.mac[0], d.mac[1], d.mac[2], d.mac[3], d.mac[4], d.mac[5]);
-    // src mac addr
-    sprintf(payload + strlen(payload), "src mac = %s\n", mac);
-
-    // https://github.com/espressif/esp-idf/blob/9d0ca60398481a44861542638cfdc1949bb6f312/components/esp_wifi/include/esp_wifi_types.h#L314
-    // rx_ctrl info
-    sprintf(payload + strlen(payload), "rx_ctrl info, len = %d\n", 19);
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.rssi);      /**< Received Signal Strength Indicator(RSSI) of packet. unit: dBm */
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.rate);      /**< PHY rate encoding of the packet. Only valid for non HT(11bg) packet */
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.sig_mode);  /**< 0: non HT(11bg) packet; 1: HT(11n) packet; 3: VHT(11ac) packet */
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.mcs);       /**< Modulation Coding Scheme. If is HT(11n) packet, shows the modulation, range from 0 to 76(MSC0 ~ MCS76) */
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.cwb);       /**< Channel Bandwidth of the packet. 0: 20MHz; 1: 40MHz */
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.smoothing);
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.not_sounding);
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.aggregation);
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.stbc);
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.fec_coding);
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.sgi);
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.noise_floor); /**< noise floor of Radio Frequency Module(RF). unit: 0.25dBm*/
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.ampdu_cnt);
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.channel);
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.secondary_channel);
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.timestamp);
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.ant);
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.sig_len);
-    sprintf(payload + strlen(payload), "%d,\n", d.rx_ctrl.rx_state);
-    // new line
-
-    // show some info on monitor
-    ESP_LOGI(TAG, "CSI from %s, buf_len = %d, rssi = %d, rate = %d, sig_mode = %d, mcs = %d, cwb = %d", \
-                    mac, d.len, d.rx_ctrl.rssi, d.rx_ctrl.rate, d.rx_ctrl.sig_mode, d.rx_ctrl.mcs, d.rx_ctrl.cwb);
-
-    int8_t *my_ptr;
-
-#if CSI_RAW
-    sprintf(payload + strlen(payload), "RAW, len = %d\n", data->len);
-    my_ptr = data->buf;
-
-    for (int i = 0; i < data->len; i++) {
-        sprintf(payload + strlen(payload), "%d,", my_ptr[i]);
-    }
-    sprintf(payload + strlen(payload), "\n"); // new line
-#endif
-#if CSI_AMPLITUDE
-    sprintf(payload + strlen(payload), "AMP len = %d \n", data->len/2);
-    my_ptr = data->buf;
-
-    for (int i = 0; i < data->len/2; i++) {
-        sprintf(payload + strlen(payload), "%.4f, ", sqrt(pow(my_ptr[i * 2], 2) + pow(my_ptr[(i * 2) + 1], 2)));
-    }
-    sprintf(payload + strlen(payload), "\n");
-#endif
-#if CSI_PHASE
-    sprintf(payload + strlen(payload), "PHASE len = %d \n", data->len/2);
-    my_ptr = data->buf;
-
-    for (int i = 0; i < data->len/2; i++) {
-        sprintf(payload + strlen(payload), "%.4f, ", atan2(my_ptr[i*2], my_ptr[(i*2)+1]));
-    }
-    sprintf(payload + strlen(payload), "\n");
-#endif
-    vTaskDelay(0);
-}
\ No newline at end of file
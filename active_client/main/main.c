@@ -7,6 +7,7 @@
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 #include "mdns.h"
 #include <string.h>
@@ -14,12 +15,15 @@
 #include "lwip/err.h"
 #include "lwip/sys.h"
 #include "lwip/sockets.h"
-#include "ping/ping_sock.h"
+#include "lwip/inet_chksum.h"
+#include "lwip/prot/icmp.h"
 
 
 // #include "../../_components/nvs_component.h"
 // #include "../../_components/sd_component.h"
-#include "../../_components/csi_component.h"
+#include "../../_components/handler_component.h"
+#include "../../_components/pacer_component.h"
+#include "../../_components/guard_component.h"
 // #include "../../_components/time_component.h"
 // #include "../../_components/input_component.h"
 // #include "../../_components/sockets_component.h"
@@ -37,17 +41,14 @@
 #define EXAMPLE_ESP_WIFI_PASS      "esp32-ap"
 #define EXAMPLE_ESP_MAXIMUM_RETRY   10
 
-#define CSI_QUEUE_SIZE             32
-// #define HOST_IP_ADDR               "192.168.4.2" // the ip addr of the host computer.
-#define HOST_UDP_PORT              8848
+#define STIMULUS_REPORT_US         5000000
 
 
 
 static const char *TAG = "CSI collection (Client)";
 
-static char *target_host_ipv4 = NULL;
-
-static xQueueHandle csi_info_queue;
+// what of the frames is caused by our own reports or over the rate of its source, only used by csi_handler_task
+static csi_guard_t csi_guard;
 
 /* FreeRTOS event group to signal when we are connected*/
 static EventGroupHandle_t s_wifi_event_group;
@@ -60,9 +61,7 @@ static EventGroupHandle_t s_wifi_event_group;
 
 static int s_retry_num = 0;
 
-static void csi_handler_task(void *pvParameter);
-void wifi_csi_cb(void *ctx, wifi_csi_info_t *data);
-void parse_csi (wifi_csi_info_t *data, char* payload);
+static void stimulus_task(void *pvParameter);
 
 static void event_handler(void* arg, esp_event_base_t event_base,
                                 int32_t event_id, void* event_data)
@@ -187,31 +186,102 @@ static void initialise_mdns(void)
     free(hostname);
 }
 
-esp_err_t ping_start()
-{
-    static esp_ping_handle_t ping_handle = NULL;
-    esp_ping_config_t ping_config        = {
-        .count           = 0,
-        .interval_ms     = 100,
-        .timeout_ms      = 1000,
-        .data_size       = 1,
-        .tos             = 0,
-        .task_stack_size = 4096,
-        .task_prio       = 0,
-    };
-
+/*
+ * Echo requests to the gateway, the AP, at CONFIG_CSI_STIMULUS_RATE_HZ: the AP takes a CSI frame from
+ * every one and this station from every reply. esp_ping sleeps a fixed interval after every reply, so
+ * its rate was below the interval and moved with the round trip; here the pacer keeps the requests on
+ * a grid and a request that finds no buffer is tried again. Replies are read and dropped.
+ */
+static void stimulus_task(void *pvParameter) {
     esp_netif_ip_info_t local_ip;
-    esp_netif_get_ip_info(esp_netif_get_handle_from_ifkey("WIFI_STA_DEF"), &local_ip);
+    esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+    do {
+        esp_netif_get_ip_info(netif, &local_ip);
+        if (local_ip.gw.addr == 0) {
+            vTaskDelay(100 / portTICK_PERIOD_MS);
+        }
+    } while (local_ip.gw.addr == 0);
     ESP_LOGI(TAG, "got ip:" IPSTR ", gw: " IPSTR, IP2STR(&local_ip.ip), IP2STR(&local_ip.gw));
-    inet_addr_to_ip4addr(ip_2_ip4(&ping_config.target_addr), (struct in_addr *)&local_ip.gw);
 
-    esp_ping_callbacks_t cbs = { 0 };
-    esp_ping_new_session(&ping_config, &cbs, &ping_handle);
-    esp_ping_start(ping_handle);
+    int sock = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
+    if (sock < 0) {
+        ESP_LOGE(TAG, "Unable to create ICMP socket: errno %d", errno);
+        vTaskDelete(NULL);
+        return;
+    }
+    struct sockaddr_in gw_addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = local_ip.gw.addr,
+    };
+    struct {
+        struct icmp_echo_hdr hdr;
+        uint8_t data[1];
+    } __attribute__((packed)) echo;
+    memset(&echo, 0, sizeof(echo));
+    ICMPH_TYPE_SET(&echo.hdr, ICMP_ECHO);
+    echo.hdr.id = htons(0xC5);
+    uint8_t reply[64];
+
+    csi_pacer_t pacer;
+    pacer_start(&pacer, CONFIG_CSI_STIMULUS_RATE_HZ, CONFIG_CSI_STIMULUS_DITHER_US);
+    int64_t next_report_us = esp_timer_get_time() + STIMULUS_REPORT_US;
+    uint16_t seqno = 0;
+    while (true) {
+        pacer_wait(&pacer);
+        echo.hdr.seqno = htons(seqno++);
+        echo.hdr.chksum = 0;
+        echo.hdr.chksum = inet_chksum(&echo, sizeof(echo));
+        bool ok = sendto(sock, &echo, sizeof(echo), 0, (struct sockaddr *) &gw_addr, sizeof(gw_addr)) == sizeof(echo);
+        int64_t now = esp_timer_get_time();
+        pacer_result(&pacer, now, ok);
+
+        while (recv(sock, reply, sizeof(reply), MSG_DONTWAIT) > 0) {
+        }
+
+        if (now >= next_report_us) {
+            pacer_report_t r;
+            pacer_report(&pacer, now, &r);
+            ESP_LOGI(TAG, "stimulus %.2f Hz of %d, jitter %.0f us, %+.0f us late, %u failed, %u skipped", r.rate_hz,
+                     CONFIG_CSI_STIMULUS_RATE_HZ, r.jitter_us, r.late_us, r.failed, r.skipped);
+            next_report_us = now + STIMULUS_REPORT_US;
+        }
+    }
+}
 
-    return ESP_OK;
+// the reports go out through the AP, the station is connected before csi_handler_task starts
+static void guard_start(void) {
+    guard_init(&csi_guard, CONFIG_CSI_GUARD_WINDOW_US, CONFIG_CSI_SOURCE_RATE_HZ, CSI_SOURCE_BURST);
+    wifi_ap_record_t ap_info;
+    if (esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK) {
+        guard_set_ap(&csi_guard, ap_info.bssid);
+    }
 }
 
+// Note: when the client sends csi info packets to host computer, it will also trigger packets from router.
+//       This would form an amplifying loop, so drop what our own reports caused and what goes over
+//       the rate of its source (Self traffic in menuconfig).
+static bool guard_frame(const csi_slot_t *slot) {
+    guard_verdict_t verdict = guard_check(&csi_guard, slot->info.mac, slot->push_us, slot->info.rx_ctrl.sig_len);
+    if (verdict == GUARD_SELF) {
+        csi_stats.drop_self++;
+    } else if (verdict == GUARD_RATE) {
+        csi_stats.drop_rate++;
+    }
+    return verdict == GUARD_KEEP;
+}
+
+static void guard_report_sent(int64_t now_us, size_t len) {
+    guard_sent(&csi_guard, now_us, len);
+}
+
+static const csi_handler_hooks_t csi_handler_hooks = {
+    .type = "AP",
+    .stats_if = ESP_IF_WIFI_STA,
+    .start = guard_start,
+    .keep = guard_frame,
+    .sent = guard_report_sent,
+};
+
 void app_main() {
     //Initialize NVS
     esp_err_t ret = nvs_flash_init();
@@ -225,227 +295,15 @@ void app_main() {
     // init wifi as a station
     wifi_init_sta();
 
-    // init queue
-    csi_info_queue = xQueueCreate(CSI_QUEUE_SIZE, sizeof(wifi_csi_info_t));
-    if (csi_info_queue == NULL) {
-        ESP_LOGE(TAG, "Create queue fail");
-        return;
-    }
-    // register callback that push csi info to the queue
-    csi_init("AP", &wifi_csi_cb);
+    // init frame ring, register callback that push csi info to the ring
+    csi_handler_init(&csi_handler_hooks);
 
     // init mDNS
     initialise_mdns();
 
-    // start ping the gateway
-    ping_start();
-
-    // start another task to handle CSI data
-    xTaskCreate(csi_handler_task, "csi_handler_task", 4096, NULL, 4, NULL);
-}
-
-
-/* Callback function is called in WiFi task.
- * Users should not do lengthy operations from this task. Instead, post
- * necessary data to a queue and handle it from a lower priority task.
- * According to ESPNOW example. Makes sense. */
-void wifi_csi_cb(void *ctx, wifi_csi_info_t *data) {
-    // drop non-HT packets to prevent queue from overflowing
-    if (data->rx_ctrl.sig_mode == 0) {
-        // ESP_LOGI(TAG, "Non-HT packet csi filtered.");
-        return; 
-    }
-
-    // if the host is not ready.
-    if (target_host_ipv4 == NULL) {
-        return;
-    }
-
-    // This callback pushs a csi entry to the queue.
-    wifi_csi_info_t local_csi_info;
-    if (data == NULL) {
-        ESP_LOGE(TAG, "Receive csi cb arg error");
-        return;
-    }
-
-    // copy content from wifi task to local
-    memcpy(&local_csi_info, data, sizeof(wifi_csi_info_t));
-    assert(local_csi_info.len == data->len);
-    // malloc buf
-    local_csi_info.buf = malloc(local_csi_info.len);
-    if (local_csi_info.buf == NULL) {
-        ESP_LOGE(TAG, "Malloc receive data fail");
-        return;
-    }
-    memcpy(local_csi_info.buf, data->buf, local_csi_info.len);
-    // csi info will be copied to the queue, but the buf is still pointing to what we allocated above. 
-    if (xQueueSend(csi_info_queue, &local_csi_info, portMAX_DELAY) != pdTRUE) {
-        ESP_LOGW(TAG, "Send entry to queue fail");
-        free(local_csi_info.buf);
-    }
-    ESP_LOGI(TAG, "CSI info pushed to queue");
-
-}
-
-static int query_mdns_host(const char * host_name)
-{
-    ESP_LOGI(TAG, "Query A: %s.local", host_name);
-
-    struct esp_ip4_addr addr;
-    addr.addr = 0;
+    // stimulus traffic to the gateway, paced by an esp_timer (Stimulus traffic in menuconfig)
+    task_create(stimulus_task, "stimulus_task", 4096, 5, CSI_NET_CORE, NULL);
 
-    esp_err_t err = mdns_query_a(host_name, 4000,  &addr);
-    if(err){
-        if(err == ESP_ERR_NOT_FOUND){
-            ESP_LOGW(TAG, "%s: Host was not found!", esp_err_to_name(err));
-            return -1;
-        }
-        ESP_LOGE(TAG, "Query Failed: %s", esp_err_to_name(err));
-        return -1;
-    }
-
-    ESP_LOGI(TAG, "Query A: %s.local resolved to: " IPSTR, host_name, IP2STR(&addr));
-    if (-1 == asprintf(&target_host_ipv4, IPSTR, IP2STR(&addr))) {
-        abort();
-    } 
-    return 0;
+    // SD log, host_task and csi_handler_task
+    csi_handler_start();
 }
-
-int setup_udp_socket (struct sockaddr_in *dest_addr) {
-    int addr_family = 0;
-    int ip_protocol = 0;
-
-    if (target_host_ipv4 == NULL) {
-        while ( query_mdns_host("RuichunMacBook-Pro") < 0) {
-            ESP_LOGW(TAG, "No target host found, try again ...");
-        }
-    }
-
-    dest_addr->sin_addr.s_addr = inet_addr(target_host_ipv4);
-    dest_addr->sin_family = AF_INET;
-    dest_addr->sin_port = htons(HOST_UDP_PORT);
-    addr_family = AF_INET;
-    ip_protocol = IPPROTO_IP;
-
-    int sock = socket(addr_family, SOCK_DGRAM, ip_protocol);
-    if (sock < 0) {
-        ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
-        return sock;
-    }
-    ESP_LOGI(TAG, "Socket created, sending to %s:%d", target_host_ipv4, HOST_UDP_PORT);
-    return sock;
-}
-
-static void csi_handler_task(void *pvParameter) {
-    wifi_csi_info_t local_csi;
-    struct sockaddr_in dest_addr;
-    char* payload;
-    int sock;
-    sock = setup_udp_socket(&dest_addr);
-    
-    // we use a max delay. so we keep waiting for new entry.
-    while (xQueueReceive(csi_info_queue, &local_csi, portMAX_DELAY) == pdTRUE) {
-        // NOTE: Even not connect to a computer, esp32 is still sending serial data of ESP_LOG. 
-        //       so turn them off to speed up.
-        // ESP_LOGI(TAG, "New CSI Info Recv!");
-        // send a udp packet to host computer.
-        payload = malloc(2048); // TODO: is this enough?
-        memset(payload, 0, 2048);
-
-        // test data
-        // sprintf(payload, "test data msg ...");
-        parse_csi(&local_csi, payload);
-
-        // send out udp packet
-        // Note: when the client sends csi info packets to host computer, it will also trigger packets from router.
-        //       This will form a amplifying loop to create many packets. So drop some CSI info packets here.
-        int err = 0;
-        if (strlen(payload) % 4 == 0) {
-            err = sendto(sock, payload, strlen(payload), 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
-        }
-        if (err < 0) {
-            ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
-            vTaskDelay(100  / portTICK_PERIOD_MS);
-        } else {
-            ESP_LOGI(TAG, "CSI message sent, payload len = %d", strlen(payload));
-        }
-
-        // data must be freed !!!
-        free(local_csi.buf);
-        free(payload);
-        vTaskDelay(10 / portTICK_PERIOD_MS);
-    }
-    ESP_LOGI(TAG, "CSI Queue Time out!");
-    vTaskDelete(NULL);
-}
-
-
-void parse_csi (wifi_csi_info_t *data, char* payload) {
-    wifi_csi_info_t d = *data;
-    char mac[20] = {0};
-
-    // data description
-    sprintf(payload + strlen(payload), "CSI_DATA from Soft-AP\n");
-    sprintf(mac, "%02x:%02x:%02x:%02x:%02x:%02x", d.mac[0], d.mac[1], d.mac[2], d.mac[3], d.mac[4], d.mac[5]);
-    // src mac addr
-    sprintf(payload + strlen(payload), "src mac = %s\n", mac);
-
-    // https://github.com/espressif/esp-idf/blob/9d0ca60398481a44861542638cfdc1949bb6f312/components/esp_wifi/include/esp_wifi_types.h#L314
-    // rx_ctrl info
-    sprintf(payload + strlen(payload), "rx_ctrl info, len = %d\n", 19);
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.rssi);      /**< Received Signal Strength Indicator(RSSI) of packet. unit: dBm */
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.rate);      /**< PHY rate encoding of the packet. Only valid for non HT(11bg) packet */
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.sig_mode);  /**< 0: non HT(11bg) packet; 1: HT(11n) packet; 3: VHT(11ac) packet */
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.mcs);       /**< Modulation Coding Scheme. If is HT(11n) packet, shows the modulation, range from 0 to 76(MSC0 ~ MCS76) */
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.cwb);       /**< Channel Bandwidth of the packet. 0: 20MHz; 1: 40MHz */
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.smoothing);
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.not_sounding);
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.aggregation);
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.stbc);
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.fec_coding);
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.sgi);
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.noise_floor); /**< noise floor of Radio Frequency Module(RF). unit: 0.25dBm*/
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.ampdu_cnt);
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.channel);
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.secondary_channel);
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.timestamp);
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.ant);
-    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.sig_len);
-    sprintf(payload + strlen(payload), "%d,\n", d.rx_ctrl.rx_state);
-    // new line
-
-    // show some info on monitor
-    ESP_LOGI(TAG, "CSI from %s, buf_len = %d, rssi = %d, rate = %d, sig_mode = %d, mcs = %d, cwb = %d", \
-                    mac, d.len, d.rx_ctrl.rssi, d.rx_ctrl.rate, d.rx_ctrl.sig_mode, d.rx_ctrl.mcs, d.rx_ctrl.cwb);
-
-    int8_t *my_ptr;
-
-#if CSI_RAW
-    sprintf(payload + strlen(payload), "RAW, len = %d\n", data->len);
-    my_ptr = data->buf;
-
-    for (int i = 0; i < data->len; i++) {
-        sprintf(payload + strlen(payload), "%d,", my_ptr[i]);
-    }
-    sprintf(payload + strlen(payload), "\n"); // new line
-#endif
-#if CSI_AMPLITUDE
-    sprintf(payload + strlen(payload), "AMP len = %d \n", data->len/2);
-    my_ptr = data->buf;
-
-    for (int i = 0; i < data->len/2; i++) {
-        sprintf(payload + strlen(payload), "%.4f, ", sqrt(pow(my_ptr[i * 2], 2) + pow(my_ptr[(i * 2) + 1], 2)));
-    }
-    sprintf(payload + strlen(payload), "\n");
-#endif
-#if CSI_PHASE
-    sprintf(payload + strlen(payload), "PHASE len = %d \n", data->len/2);
-    my_ptr = data->buf;
-
-    for (int i = 0; i < data->len/2; i++) {
-        sprintf(payload + strlen(payload), "%.4f, ", atan2(my_ptr[i*2], my_ptr[(i*2)+1]));
-    }
-    sprintf(payload + strlen(payload), "\n");
-#endif
-    vTaskDelay(0);
-}
\ No newline at end of file
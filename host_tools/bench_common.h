@@ -0,0 +1,53 @@
+#ifndef ESP32_CSI_BENCH_COMMON_H
+#define ESP32_CSI_BENCH_COMMON_H
+
+/* Shared helpers of the host side benchmarks, include after esp_shim.h */
+#include <time.h>
+
+#define BENCH_CORPUS            64      // distinct frames cycled through by the benchmarks
+#define CSI_PAYLOAD_BENCH_SIZE  2048    // CSI_PAYLOAD_SIZE of the firmware
+
+static inline double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint32_t bench_rand_state = 0x12345678;
+
+// xorshift32, reproducible across runs
+static inline uint32_t bench_rand(void) {
+    uint32_t x = bench_rand_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return bench_rand_state = x;
+}
+
+/* HT40 frames from a handful of peers with rx_ctrl values in their real ranges. */
+static void bench_make_corpus(wifi_csi_info_t *corpus, int8_t (*bufs)[384], int buf_len) {
+    for (int i = 0; i < BENCH_CORPUS; i++) {
+        wifi_csi_info_t *d = &corpus[i];
+        memset(d, 0, sizeof(*d));
+        uint8_t mac[6] = {0x3c, 0x61, 0x05, 0x4c, 0x36, (uint8_t)(0xc0 + i % 4)};
+        memcpy(d->mac, mac, 6);
+        d->rx_ctrl.rssi = -30 - (int)(bench_rand() % 60);
+        d->rx_ctrl.rate = bench_rand() % 32;
+        d->rx_ctrl.sig_mode = 1;
+        d->rx_ctrl.mcs = bench_rand() % 8;
+        d->rx_ctrl.cwb = 1;
+        d->rx_ctrl.aggregation = bench_rand() % 2;
+        d->rx_ctrl.noise_floor = -90 - (int)(bench_rand() % 8);
+        d->rx_ctrl.channel = 1;
+        d->rx_ctrl.secondary_channel = 1;
+        d->rx_ctrl.timestamp = bench_rand();
+        d->rx_ctrl.sig_len = 60 + bench_rand() % 1500;
+        for (int k = 0; k < buf_len; k++) {
+            bufs[i][k] = (int8_t)(bench_rand() % 256);
+        }
+        d->buf = bufs[i];
+        d->len = buf_len;
+    }
+}
+
+#endif //ESP32_CSI_BENCH_COMMON_H
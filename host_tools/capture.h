@@ -0,0 +1,513 @@
+#ifndef ESP32_CSI_CAPTURE_H
+#define ESP32_CSI_CAPTURE_H
+
+/*
+ * Recording format for decoded CSI frames (csi_frame_t of ingest.h), include after ingest.h.
+ *
+ * A capture is a file header, a sequence of chunks, and an index at the end:
+ *   - a chunk holds up to chunk_frames consecutive frames of one node, in columns: host_us,
+ *     rssi and noise_floor, the full record header of each frame, and a fixed width CSI matrix
+ *     (csi_width bytes per frame, zero padded, the true length is csi_len in the record header).
+ *     Every column starts at a multiple of CAPTURE_ALIGN from the start of the file, so a reader
+ *     that maps the file uses them in place as arrays.
+ *   - the index lists the chunks sorted by node, then time, with their time span, and the mac of
+ *     each node. A time window of a node is found with a binary search over its chunks and one
+ *     over the host_us column of the first chunk, O(log n) however long the capture.
+ *   - a trailer in the last 32 bytes points at the index. A capture cut short, by a crash or a
+ *     full disk, has no trailer, readers then rebuild the index from the chunk headers.
+ * A node's chunk is written when it is full, when its oldest frame is flush_us old, or when the
+ * capture is closed, so a crash loses at most flush_us of frames.
+ * host_us is assumed not to go back within a node, a step back starts a new chunk.
+ *
+ * Written by csi_ingest -r, checked by capture_check, read from Python with active_ap/csi_capture.py.
+ * Keep the layout in sync with it.
+ */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CAPTURE_MAGIC           "CSICAP01"
+#define CAPTURE_INDEX_MAGIC     "CSIIDX01"
+#define CAPTURE_CHUNK_MAGIC     0x4b4e4843  // "CHNK"
+#define CAPTURE_VERSION         1
+#define CAPTURE_ALIGN           64
+#define CAPTURE_CSI_WIDTH       384     // HT40 raw records, longer payloads are cut
+#define CAPTURE_CHUNK_FRAMES    1024
+#define CAPTURE_FLUSH_US        5000000
+
+typedef struct {
+    char magic[8];                  // CAPTURE_MAGIC
+    uint32_t version;
+    uint16_t csi_width;
+    uint16_t hdr_size;              // sizeof(csi_record_hdr_t)
+    uint64_t created_us;
+    uint8_t pad[40];
+} capture_file_hdr_t;
+
+typedef struct {
+    uint32_t magic;                 // CAPTURE_CHUNK_MAGIC
+    uint32_t frames;
+    uint16_t node;
+    uint16_t csi_width;
+    uint8_t mac[6];
+    uint16_t reserved;
+    // off_*: column offsets from the start of the chunk
+    uint32_t off_host_us;           // uint64_t[frames]
+    uint64_t t_first;               // host_us of the first and last frame
+    uint64_t t_last;
+    uint64_t chunk_len;             // bytes from this header to the next chunk
+    uint32_t off_rssi;              // int8_t[frames]
+    uint32_t off_noise_floor;       // int8_t[frames]
+    uint32_t off_hdr;               // csi_record_hdr_t[frames]
+    uint32_t off_csi;               // uint8_t[frames][csi_width]
+} capture_chunk_hdr_t;
+
+typedef struct {
+    uint64_t offset;                // of the chunk header in the file
+    uint64_t t_first;
+    uint64_t t_last;
+    uint32_t frames;
+    uint16_t node;
+    uint16_t reserved;
+} capture_index_entry_t;
+
+/* index: capture_node_t[n_nodes], then capture_index_entry_t[n_entries], then this */
+typedef struct {
+    char magic[8];                  // CAPTURE_INDEX_MAGIC
+    uint64_t index_offset;
+    uint32_t n_entries;
+    uint32_t n_nodes;
+    uint64_t frames;
+} capture_trailer_t;
+
+typedef struct {
+    uint8_t mac[6];
+    uint16_t reserved;
+} capture_node_t;
+
+_Static_assert(sizeof(capture_file_hdr_t) == 64, "capture_file_hdr_t layout changed, update csi_capture.py");
+_Static_assert(sizeof(capture_chunk_hdr_t) == 64, "capture_chunk_hdr_t layout changed, update csi_capture.py");
+_Static_assert(sizeof(capture_index_entry_t) == 32, "capture_index_entry_t layout changed, update csi_capture.py");
+_Static_assert(sizeof(capture_trailer_t) == 32, "capture_trailer_t layout changed, update csi_capture.py");
+
+static inline uint64_t _capture_align(uint64_t x) {
+    return (x + CAPTURE_ALIGN - 1) & ~(uint64_t)(CAPTURE_ALIGN - 1);
+}
+
+/* Column offsets of a chunk of n frames. Returns the chunk length. */
+static uint64_t _capture_layout(capture_chunk_hdr_t *c, uint32_t n, uint16_t csi_width) {
+    uint64_t off = sizeof(*c);
+    c->off_host_us = off;
+    off = _capture_align(off + n * sizeof(uint64_t));
+    c->off_rssi = off;
+    off = _capture_align(off + n);
+    c->off_noise_floor = off;
+    off = _capture_align(off + n);
+    c->off_hdr = off;
+    off = _capture_align(off + (uint64_t)n * sizeof(csi_record_hdr_t));
+    c->off_csi = off;
+    return _capture_align(off + (uint64_t)n * csi_width);
+}
+
+/* Writer */
+
+typedef struct {
+    uint8_t mac[6];
+    bool seen;
+    uint32_t n;
+    uint64_t t_first;
+    uint64_t t_last;
+    uint64_t *host_us;
+    int8_t *rssi;
+    int8_t *noise_floor;
+    csi_record_hdr_t *hdr;
+    uint8_t *csi;
+} _capture_node_buf_t;
+
+typedef struct {
+    FILE *f;
+    uint64_t offset;                // where the next chunk goes
+    uint16_t csi_width;
+    uint32_t chunk_frames;
+    uint64_t flush_us;
+    _capture_node_buf_t nodes[INGEST_MAX_NODES];
+    int n_nodes;
+    capture_index_entry_t *index;
+    uint32_t n_index;
+    uint32_t cap_index;
+    uint64_t frames;                // written
+    uint64_t dropped;               // from nodes beyond INGEST_MAX_NODES
+    uint64_t cut;                   // frames with more than csi_width bytes of csi
+    uint8_t *zeros;
+} capture_writer_t;
+
+/* Start a capture at path. Returns false with errno set. */
+bool capture_open(capture_writer_t *w, const char *path, uint16_t csi_width, uint32_t chunk_frames, uint64_t flush_us) {
+    memset(w, 0, sizeof(*w));
+    w->f = fopen(path, "wb");
+    if (w->f == NULL) {
+        return false;
+    }
+    w->csi_width = csi_width;
+    w->chunk_frames = chunk_frames;
+    w->flush_us = flush_us;
+    w->zeros = calloc(1, CAPTURE_ALIGN);
+    capture_file_hdr_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CAPTURE_MAGIC, 8);
+    hdr.version = CAPTURE_VERSION;
+    hdr.csi_width = csi_width;
+    hdr.hdr_size = sizeof(csi_record_hdr_t);
+    hdr.created_us = ingest_now_us();
+    fwrite(&hdr, sizeof(hdr), 1, w->f);
+    w->offset = sizeof(hdr);
+    return !ferror(w->f);
+}
+
+static void _capture_column(capture_writer_t *w, const void *p, size_t len, uint64_t chunk_start, uint32_t next_off) {
+    fwrite(p, 1, len, w->f);
+    w->offset += len;
+    size_t pad = chunk_start + next_off - w->offset;
+    fwrite(w->zeros, 1, pad, w->f);
+    w->offset += pad;
+}
+
+/* Write the buffered frames of node as a chunk. */
+static void _capture_seal(capture_writer_t *w, int node) {
+    _capture_node_buf_t *b = &w->nodes[node];
+    if (b->n == 0) {
+        return;
+    }
+    capture_chunk_hdr_t c;
+    memset(&c, 0, sizeof(c));
+    c.magic = CAPTURE_CHUNK_MAGIC;
+    c.node = node;
+    memcpy(c.mac, b->mac, 6);
+    c.frames = b->n;
+    c.csi_width = w->csi_width;
+    c.t_first = b->t_first;
+    c.t_last = b->t_last;
+    c.chunk_len = _capture_layout(&c, b->n, w->csi_width);
+
+    uint64_t start = w->offset;
+    fwrite(&c, sizeof(c), 1, w->f);
+    w->offset += sizeof(c);
+    _capture_column(w, b->host_us, b->n * sizeof(uint64_t), start, c.off_rssi);
+    _capture_column(w, b->rssi, b->n, start, c.off_noise_floor);
+    _capture_column(w, b->noise_floor, b->n, start, c.off_hdr);
+    _capture_column(w, b->hdr, b->n * sizeof(csi_record_hdr_t), start, c.off_csi);
+    _capture_column(w, b->csi, (size_t)b->n * w->csi_width, start, c.chunk_len);
+
+    if (w->n_index == w->cap_index) {
+        w->cap_index = w->cap_index ? 2 * w->cap_index : 1024;
+        w->index = realloc(w->index, w->cap_index * sizeof(*w->index));
+    }
+    w->index[w->n_index++] = (capture_index_entry_t){start, c.t_first, c.t_last, c.frames, c.node, 0};
+    w->frames += b->n;
+    b->n = 0;
+    // a crash loses at most what is still buffered
+    fflush(w->f);
+}
+
+/* Add a frame, its node is frame->node. */
+void capture_add(capture_writer_t *w, const csi_frame_t *frame) {
+    int node = frame->node;
+    if (node >= INGEST_MAX_NODES) {
+        w->dropped++;
+        return;
+    }
+    _capture_node_buf_t *b = &w->nodes[node];
+    if (!b->seen) {
+        b->seen = true;
+        memcpy(b->mac, frame->hdr.mac, 6);
+        b->host_us = malloc(w->chunk_frames * sizeof(*b->host_us));
+        b->rssi = malloc(w->chunk_frames);
+        b->noise_floor = malloc(w->chunk_frames);
+        b->hdr = malloc(w->chunk_frames * sizeof(*b->hdr));
+        b->csi = calloc(w->chunk_frames, w->csi_width);
+        if (node >= w->n_nodes) {
+            w->n_nodes = node + 1;
+        }
+    }
+    if (b->n > 0 && (frame->host_us < b->t_last || frame->host_us - b->t_first >= w->flush_us)) {
+        _capture_seal(w, node);
+    }
+    uint32_t i = b->n++;
+    if (i == 0) {
+        b->t_first = frame->host_us;
+    }
+    b->t_last = frame->host_us;
+    b->host_us[i] = frame->host_us;
+    b->rssi[i] = frame->hdr.rssi;
+    b->noise_floor[i] = frame->hdr.noise_floor;
+    b->hdr[i] = frame->hdr;
+    uint16_t len = frame->hdr.csi_len;
+    if (len > w->csi_width) {
+        len = w->csi_width;
+        w->cut++;
+    }
+    uint8_t *row = b->csi + (size_t)i * w->csi_width;
+    memcpy(row, frame->csi, len);
+    memset(row + len, 0, w->csi_width - len);
+    if (b->n == w->chunk_frames) {
+        _capture_seal(w, node);
+    }
+}
+
+/* Write the chunks of nodes whose oldest buffered frame is flush_us older than now_us. */
+void capture_tick(capture_writer_t *w, uint64_t now_us) {
+    for (int node = 0; node < w->n_nodes; node++) {
+        _capture_node_buf_t *b = &w->nodes[node];
+        if (b->n > 0 && now_us - b->t_first >= w->flush_us) {
+            _capture_seal(w, node);
+        }
+    }
+}
+
+static int _capture_entry_cmp(const void *a, const void *b) {
+    const capture_index_entry_t *x = a, *y = b;
+    if (x->node != y->node) {
+        return x->node < y->node ? -1 : 1;
+    }
+    return x->t_first < y->t_first ? -1 : (x->t_first > y->t_first ? 1 : 0);
+}
+
+static void _capture_write_index(FILE *f, uint64_t offset, capture_index_entry_t *index, uint32_t n_index,
+                                 const capture_node_t *nodes, uint32_t n_nodes, uint64_t frames) {
+    qsort(index, n_index, sizeof(*index), _capture_entry_cmp);
+    fwrite(nodes, sizeof(*nodes), n_nodes, f);
+    fwrite(index, sizeof(*index), n_index, f);
+    capture_trailer_t t;
+    memcpy(t.magic, CAPTURE_INDEX_MAGIC, 8);
+    t.index_offset = offset;
+    t.n_entries = n_index;
+    t.n_nodes = n_nodes;
+    t.frames = frames;
+    fwrite(&t, sizeof(t), 1, f);
+}
+
+/* Write what is buffered and the index. Returns false on a write error. */
+bool capture_close(capture_writer_t *w) {
+    for (int node = 0; node < w->n_nodes; node++) {
+        _capture_seal(w, node);
+    }
+    capture_node_t nodes[INGEST_MAX_NODES];
+    memset(nodes, 0, sizeof(nodes));
+    for (int node = 0; node < w->n_nodes; node++) {
+        memcpy(nodes[node].mac, w->nodes[node].mac, 6);
+    }
+    _capture_write_index(w->f, w->offset, w->index, w->n_index, nodes, w->n_nodes, w->frames);
+    bool ok = !ferror(w->f);
+    ok &= fclose(w->f) == 0;
+    for (int node = 0; node < w->n_nodes; node++) {
+        _capture_node_buf_t *b = &w->nodes[node];
+        free(b->host_us);
+        free(b->rssi);
+        free(b->noise_floor);
+        free(b->hdr);
+        free(b->csi);
+    }
+    free(w->index);
+    free(w->zeros);
+    return ok;
+}
+
+/* Reader */
+
+typedef struct {
+    const uint8_t *base;            // the mapped file
+    size_t len;
+    const capture_file_hdr_t *hdr;
+    const capture_index_entry_t *index;
+    uint32_t n_index;
+    const capture_node_t *nodes;
+    uint32_t n_nodes;
+    uint64_t frames;
+    bool rebuilt;                   // no trailer, the index was rebuilt from the chunk headers
+    void *owned;                    // rebuilt index and nodes
+} capture_reader_t;
+
+/* Frames [first, end) of a chunk, the columns are used in place. */
+typedef struct {
+    const capture_chunk_hdr_t *chunk;
+    const uint64_t *host_us;
+    const int8_t *rssi;
+    const int8_t *noise_floor;
+    const csi_record_hdr_t *hdr;
+    const uint8_t *csi;             // row i at csi + i * csi_width
+    uint32_t first;
+    uint32_t end;
+} capture_span_t;
+
+static const capture_chunk_hdr_t *_capture_chunk_at(const capture_reader_t *r, uint64_t offset) {
+    if (offset + sizeof(capture_chunk_hdr_t) > r->len) {
+        return NULL;
+    }
+    const capture_chunk_hdr_t *c = (const capture_chunk_hdr_t *)(r->base + offset);
+    capture_chunk_hdr_t layout = *c;
+    if (c->magic != CAPTURE_CHUNK_MAGIC || c->csi_width != r->hdr->csi_width || c->frames == 0 ||
+        offset + c->chunk_len > r->len || _capture_layout(&layout, c->frames, c->csi_width) != c->chunk_len) {
+        return NULL;
+    }
+    return c;
+}
+
+/* Scan the chunk headers of a capture without trailer. */
+static bool _capture_rebuild(capture_reader_t *r) {
+    uint32_t n = 0, cap = 1024;
+    capture_index_entry_t *index = malloc(cap * sizeof(*index));
+    capture_node_t nodes[INGEST_MAX_NODES];
+    memset(nodes, 0, sizeof(nodes));
+    uint32_t n_nodes = 0;
+    r->frames = 0;
+    const capture_chunk_hdr_t *c;
+    for (uint64_t off = sizeof(capture_file_hdr_t); (c = _capture_chunk_at(r, off)) != NULL; off += c->chunk_len) {
+        if (c->node >= INGEST_MAX_NODES) {
+            break;
+        }
+        if (n == cap) {
+            cap *= 2;
+            index = realloc(index, cap * sizeof(*index));
+        }
+        index[n++] = (capture_index_entry_t){off, c->t_first, c->t_last, c->frames, c->node, 0};
+        memcpy(nodes[c->node].mac, c->mac, 6);
+        if (c->node >= n_nodes) {
+            n_nodes = c->node + 1;
+        }
+        r->frames += c->frames;
+    }
+    qsort(index, n, sizeof(*index), _capture_entry_cmp);
+    // nodes first, then the index, in one block
+    uint8_t *owned = malloc(n_nodes * sizeof(capture_node_t) + n * sizeof(*index) + 1);
+    memcpy(owned, nodes, n_nodes * sizeof(capture_node_t));
+    memcpy(owned + n_nodes * sizeof(capture_node_t), index, n * sizeof(*index));
+    free(index);
+    r->owned = owned;
+    r->nodes = (const capture_node_t *)owned;
+    r->n_nodes = n_nodes;
+    r->index = (const capture_index_entry_t *)(owned + n_nodes * sizeof(capture_node_t));
+    r->n_index = n;
+    r->rebuilt = true;
+    return true;
+}
+
+/* Map a capture read only. Returns false with errno set. */
+bool capture_map(capture_reader_t *r, const char *path) {
+    memset(r, 0, sizeof(*r));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(capture_file_hdr_t)) {
+        close(fd);
+        errno = EINVAL;
+        return false;
+    }
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return false;
+    }
+    r->base = p;
+    r->len = st.st_size;
+    r->hdr = p;
+    if (memcmp(r->hdr->magic, CAPTURE_MAGIC, 8) != 0 || r->hdr->version != CAPTURE_VERSION ||
+        r->hdr->hdr_size != sizeof(csi_record_hdr_t)) {
+        munmap(p, r->len);
+        errno = EINVAL;
+        return false;
+    }
+    const capture_trailer_t *t = (const capture_trailer_t *)(r->base + r->len - sizeof(*t));
+    if (r->len >= sizeof(capture_file_hdr_t) + sizeof(*t) && memcmp(t->magic, CAPTURE_INDEX_MAGIC, 8) == 0 &&
+        t->index_offset + t->n_nodes * sizeof(capture_node_t) + t->n_entries * sizeof(capture_index_entry_t) ==
+            r->len - sizeof(*t)) {
+        r->nodes = (const capture_node_t *)(r->base + t->index_offset);
+        r->n_nodes = t->n_nodes;
+        r->index = (const capture_index_entry_t *)(r->nodes + t->n_nodes);
+        r->n_index = t->n_entries;
+        r->frames = t->frames;
+        return true;
+    }
+    return _capture_rebuild(r);
+}
+
+void capture_unmap(capture_reader_t *r) {
+    munmap((void *)r->base, r->len);
+    free(r->owned);
+}
+
+static capture_span_t _capture_span(const capture_reader_t *r, const capture_index_entry_t *e) {
+    const uint8_t *c = r->base + e->offset;
+    const capture_chunk_hdr_t *chunk = (const capture_chunk_hdr_t *)c;
+    capture_span_t s = {
+        .chunk = chunk,
+        .host_us = (const uint64_t *)(c + chunk->off_host_us),
+        .rssi = (const int8_t *)(c + chunk->off_rssi),
+        .noise_floor = (const int8_t *)(c + chunk->off_noise_floor),
+        .hdr = (const csi_record_hdr_t *)(c + chunk->off_hdr),
+        .csi = c + chunk->off_csi,
+        .first = 0,
+        .end = chunk->frames,
+    };
+    return s;
+}
+
+/* First i in [0, n) with v[i] >= t, n if there is none. */
+static uint32_t _capture_lower_bound(const uint64_t *v, uint32_t n, uint64_t t) {
+    uint32_t lo = 0, hi = n;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (v[mid] < t) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Position in the index of the first chunk of node that ends at or after t. */
+static uint32_t _capture_seek(const capture_reader_t *r, uint16_t node, uint64_t t) {
+    uint32_t lo = 0, hi = r->n_index;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const capture_index_entry_t *e = &r->index[mid];
+        if (e->node < node || (e->node == node && e->t_last < t)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/*
+ * Frames of node with t0 <= host_us < t1, as spans of chunks in time order, into spans[max].
+ * Returns the number of spans, or -(spans needed) if max is too small.
+ */
+int capture_window(const capture_reader_t *r, uint16_t node, uint64_t t0, uint64_t t1, capture_span_t *spans, int max) {
+    int n = 0;
+    for (uint32_t i = _capture_seek(r, node, t0); i < r->n_index; i++) {
+        const capture_index_entry_t *e = &r->index[i];
+        if (e->node != node || e->t_first >= t1) {
+            break;
+        }
+        capture_span_t s = _capture_span(r, e);
+        if (e->t_first < t0) {
+            s.first = _capture_lower_bound(s.host_us, s.end, t0);
+        }
+        if (e->t_last >= t1) {
+            s.end = _capture_lower_bound(s.host_us, s.end, t1);
+        }
+        if (s.first < s.end) {
+            if (n < max) {
+                spans[n] = s;
+            }
+            n++;
+        }
+    }
+    return n <= max ? n : -n;
+}
+
+#endif //ESP32_CSI_CAPTURE_H
@@ -0,0 +1,234 @@
+/*
+ * Check of the capture format in capture.h on a synthetic recording of CHECK_NODES nodes at
+ * 100 frames/s each, one node silent for a while and one sending shorter payloads:
+ *   - every frame must read back in order with its columns and csi, from the mapped file
+ *   - random time windows must hold exactly the frames a brute force count finds
+ *   - a capture cut short without index must give the same answers from the rebuilt index,
+ *     and one cut inside its last chunk must lose only that chunk
+ * Then the write rate and the time per window query.
+ *
+ *   make capture_check && ./capture_check [seconds]
+ *   ./capture_check --dump file [seconds]   only write the capture, for capture_check.py
+ */
+#include "esp_shim.h"
+#include "ingest.h"
+#include "capture.h"
+#include "bench_common.h"
+
+#define CHECK_NODES     8
+#define INTERVAL_US     10000
+#define T0_US           1700000000000000ull
+#define QUIET_NODE      7               // sends nothing from 30 to 60 s
+#define SHORT_NODE      3               // 114 subcarrier records
+#define QUERIES         10000
+
+// host_us of every frame of each node, what the capture must hold
+static uint64_t *expect[CHECK_NODES];
+static uint32_t n_expect[CHECK_NODES];
+
+static uint16_t csi_len_of(int node) {
+    return node == SHORT_NODE ? 228 : CAPTURE_CSI_WIDTH;
+}
+
+static uint8_t csi_byte(int node, uint32_t k, int i) {
+    return (uint8_t)(node * 31 + k * 7 + i);
+}
+
+static int8_t rssi_of(int node, uint32_t k) {
+    return -40 - (int)((node + k) % 30);
+}
+
+/* Write the capture, returns the frames/s of capture_add(). */
+static double write_capture(const char *path, int seconds) {
+    static capture_writer_t w;
+    if (!capture_open(&w, path, CAPTURE_CSI_WIDTH, CAPTURE_CHUNK_FRAMES, CAPTURE_FLUSH_US)) {
+        perror(path);
+        exit(1);
+    }
+    static csi_frame_t f;
+    memset(&f, 0, sizeof(f));
+    uint32_t steps = seconds * (1000000 / INTERVAL_US);
+    for (int node = 0; node < CHECK_NODES; node++) {
+        expect[node] = realloc(expect[node], steps * sizeof(uint64_t));
+        n_expect[node] = 0;
+    }
+    bench_rand_state = 0x12345678;
+    double t0 = bench_now();
+    for (uint32_t step = 0; step < steps; step++) {
+        uint64_t t = T0_US + (uint64_t)step * INTERVAL_US;
+        if (step % 100 == 0) {
+            capture_tick(&w, t);
+        }
+        for (int node = 0; node < CHECK_NODES; node++) {
+            if (node == QUIET_NODE && t >= T0_US + 30000000 && t < T0_US + 60000000) {
+                continue;
+            }
+            uint32_t k = n_expect[node];
+            f.node = node;
+            f.host_us = t + node * 37 + bench_rand() % 5000;
+            f.hdr.magic = CSI_RECORD_MAGIC;
+            f.hdr.version = CSI_RECORD_VERSION;
+            f.hdr.type = node == SHORT_NODE ? CSI_RECORD_TYPE_SUBCARRIERS : CSI_RECORD_TYPE_RAW;
+            f.hdr.mac[5] = 0xc0 + node;
+            f.hdr.rssi = rssi_of(node, k);
+            f.hdr.noise_floor = -93 - node % 4;
+            f.hdr.seq = k;
+            f.hdr.rx_us = (uint64_t)k * INTERVAL_US;
+            f.hdr.csi_len = csi_len_of(node);
+            for (int i = 0; i < f.hdr.csi_len; i++) {
+                f.csi[i] = csi_byte(node, k, i);
+            }
+            expect[node][n_expect[node]++] = f.host_us;
+            capture_add(&w, &f);
+        }
+    }
+    double dt = bench_now() - t0;
+    if (!capture_close(&w)) {
+        perror(path);
+        exit(1);
+    }
+    return w.frames / dt;
+}
+
+/* Every frame of every node, in order and intact. */
+static int check_all(const capture_reader_t *r, uint32_t *nodes_checked) {
+    static capture_span_t spans[4096];
+    *nodes_checked = 0;
+    for (int node = 0; node < CHECK_NODES; node++) {
+        int n = capture_window(r, node, 0, UINT64_MAX, spans, 4096);
+        if (n < 0) {
+            printf("node %d: too many chunks\n", node);
+            return 1;
+        }
+        uint32_t k = 0;
+        for (int s = 0; s < n; s++) {
+            for (uint32_t i = spans[s].first; i < spans[s].end; i++, k++) {
+                const csi_record_hdr_t *h = &spans[s].hdr[i];
+                const uint8_t *row = spans[s].csi + (size_t)i * spans[s].chunk->csi_width;
+                bool ok = k < n_expect[node] && spans[s].host_us[i] == expect[node][k] && h->seq == (uint16_t)k &&
+                          spans[s].rssi[i] == rssi_of(node, k) && spans[s].noise_floor[i] == h->noise_floor &&
+                          h->csi_len == csi_len_of(node) && spans[s].chunk->mac[5] == 0xc0 + node;
+                for (int b = 0; ok && b < CAPTURE_CSI_WIDTH; b++) {
+                    ok = row[b] == (b < h->csi_len ? csi_byte(node, k, b) : 0);
+                }
+                if (!ok) {
+                    printf("node %d frame %u read back wrong\n", node, k);
+                    return 1;
+                }
+            }
+        }
+        if (k != n_expect[node]) {
+            printf("node %d: %u of %u frames\n", node, k, n_expect[node]);
+            return 1;
+        }
+        (*nodes_checked)++;
+    }
+    return 0;
+}
+
+/* Random windows against a linear count over the expected times. Returns the us per query. */
+static int check_windows(const capture_reader_t *r, int seconds, double *us_per_query) {
+    static capture_span_t spans[64];
+    bench_rand_state = 0xabcdef;
+    double busy = 0;
+    for (int q = 0; q < QUERIES; q++) {
+        int node = bench_rand() % CHECK_NODES;
+        uint64_t t0 = T0_US - 1000000 + (uint64_t)(bench_rand() % ((seconds + 2) * 1000)) * 1000 + bench_rand() % 1000;
+        uint64_t t1 = t0 + bench_rand() % 10000000;
+        double start = bench_now();
+        int n = capture_window(r, node, t0, t1, spans, 64);
+        busy += bench_now() - start;
+        uint32_t got = 0;
+        uint64_t first = 0;
+        for (int s = 0; s < n; s++) {
+            if (s == 0) {
+                first = spans[s].host_us[spans[s].first];
+            }
+            got += spans[s].end - spans[s].first;
+        }
+        uint32_t want = 0;
+        uint64_t want_first = 0;
+        for (uint32_t k = 0; k < n_expect[node]; k++) {
+            if (expect[node][k] >= t0 && expect[node][k] < t1) {
+                if (want++ == 0) {
+                    want_first = expect[node][k];
+                }
+            }
+        }
+        if (n < 0 || got != want || (want > 0 && first != want_first)) {
+            printf("window %lu..%lu of node %d: %u frames, expected %u\n", t0, t1, node, got, want);
+            return 1;
+        }
+    }
+    *us_per_query = busy * 1e6 / QUERIES;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 3 && strcmp(argv[1], "--dump") == 0) {
+        write_capture(argv[2], argc > 3 ? atoi(argv[3]) : 120);
+        return 0;
+    }
+    int seconds = argc > 1 ? atoi(argv[1]) : 120;
+    char path[64], cut_path[80];
+    snprintf(path, sizeof(path), "/tmp/capture_check_%d.csic", (int)getpid());
+    snprintf(cut_path, sizeof(cut_path), "%s.cut", path);
+
+    double rate = write_capture(path, seconds);
+    static capture_reader_t r;
+    if (!capture_map(&r, path)) {
+        perror(path);
+        return 1;
+    }
+    printf("%lu frames of %d nodes, %u chunks, %.1f MB: written at %.0f frames/s\n", r.frames, r.n_nodes, r.n_index,
+           r.len / 1e6, rate);
+    int err = 0;
+    uint32_t nodes_checked;
+    double us;
+    err |= check_all(&r, &nodes_checked);
+    err |= check_windows(&r, seconds, &us);
+    printf("all frames read back, %d random windows match, %.2f us per window\n", QUERIES, us);
+
+    // without the index, as after a crash
+    const capture_trailer_t *t = (const capture_trailer_t *)(r.base + r.len - sizeof(*t));
+    uint64_t index_offset = t->index_offset;
+    const capture_index_entry_t *last = NULL;
+    for (uint32_t i = 0; i < r.n_index; i++) {
+        if (last == NULL || r.index[i].offset > last->offset) {
+            last = &r.index[i];
+        }
+    }
+    uint64_t frames = r.frames, last_frames = last->frames, last_offset = last->offset;
+    capture_unmap(&r);
+    FILE *in = fopen(path, "rb"), *out = fopen(cut_path, "wb");
+    static uint8_t buf[1 << 16];
+    for (uint64_t left = index_offset; left > 0;) {
+        size_t n = fread(buf, 1, left < sizeof(buf) ? left : sizeof(buf), in);
+        fwrite(buf, 1, n, out);
+        left -= n;
+    }
+    fclose(in);
+    fclose(out);
+    if (!capture_map(&r, cut_path) || !r.rebuilt || r.frames != frames) {
+        printf("capture without index: not rebuilt, or %lu of %lu frames\n", r.frames, frames);
+        return 1;
+    }
+    err |= check_all(&r, &nodes_checked);
+    err |= check_windows(&r, seconds, &us);
+    capture_unmap(&r);
+    printf("without index: rebuilt, same frames and windows\n");
+
+    // and cut inside the last chunk
+    if (truncate(cut_path, last_offset + 100) < 0 || !capture_map(&r, cut_path) || r.frames != frames - last_frames) {
+        printf("capture cut in its last chunk: %lu frames, expected %lu\n", r.frames, frames - last_frames);
+        return 1;
+    }
+    capture_unmap(&r);
+    printf("cut inside the last chunk: its %lu frames lost, the rest readable\n", last_frames);
+    unlink(path);
+    unlink(cut_path);
+    if (err == 0) {
+        printf("capture format checked\n");
+    }
+    return err;
+}
@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+# Reads a capture written by capture_check --dump with csi_capture.Capture:
+#   ./capture_check.py [seconds]
+# Every frame must come back with the columns capture_check wrote, random time windows must hold
+# exactly the frames a scan of the whole capture finds, also from a copy without the index.
+import os
+import subprocess
+import sys
+import time
+
+import numpy as np
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "active_ap"))
+import csi_capture
+
+# what capture_check.c writes
+NODES = 8
+SHORT_NODE = 3
+T0_US = 1700000000000000
+QUERIES = 2000
+
+def check_frames (capture) :
+    err = 0
+    for node in range(NODES):
+        f = capture.read(0, 2 ** 64 - 1, node)
+        k = np.arange(len(f["host_us"]))
+        csi_len = 228 if node == SHORT_NODE else capture.csi_width
+        i = np.arange(capture.csi_width)
+        want = ((node * 31 + k[:, None] * 7 + i[None, :]) & 0xFF).astype(np.uint8)
+        want[:, csi_len:] = 0
+        if (np.any(np.diff(f["host_us"].astype(np.int64)) <= 0) or np.any(f["hdr"]["seq"] != (k & 0xFFFF)) or
+                np.any(f["rssi"] != -40 - (node + k) % 30) or np.any(f["noise_floor"] != -93 - node % 4) or
+                np.any(f["hdr"]["csi_len"] != csi_len) or np.any(f["hdr"]["mac"][:, 5] != 0xc0 + node) or
+                capture.macs[node] != "00:00:00:00:00:{:02x}".format(0xc0 + node) or not np.array_equal(f["csi"], want)):
+            print("node {}: frames read back wrong".format(node))
+            err = 1
+    return err
+
+def check_windows (capture, seconds) :
+    all_frames = capture.read(0, 2 ** 64 - 1)
+    rng = np.random.default_rng(1)
+    busy = 0.0
+    for _ in range(QUERIES):
+        node = int(rng.integers(NODES)) if rng.random() < 0.8 else None
+        t0 = T0_US - 1000000 + int(rng.integers((seconds + 2) * 1000000))
+        t1 = t0 + int(rng.integers(10000000))
+        start = time.perf_counter()
+        spans = capture.window(t0, t1, node)
+        busy += time.perf_counter() - start
+        got = np.concatenate([s.host_us for s in spans]) if spans else np.zeros(0, np.uint64)
+        hit = (all_frames["host_us"] >= t0) & (all_frames["host_us"] < t1)
+        if node is not None:
+            hit &= all_frames["node"] == node
+        if not np.array_equal(np.sort(got), np.sort(all_frames["host_us"][hit])):
+            print("window {}..{} of node {}: {} frames, expected {}".format(t0, t1, node, len(got), np.sum(hit)))
+            return (1, 0)
+    return (0, busy * 1e6 / QUERIES)
+
+def main () :
+    seconds = int(sys.argv[1]) if len(sys.argv) > 1 else 60
+    path = "/tmp/capture_check_py_{}.csic".format(os.getpid())
+    cut_path = path + ".cut"
+    subprocess.check_call([os.path.join(os.path.dirname(os.path.abspath(__file__)), "capture_check"),
+                           "--dump", path, str(seconds)])
+    err = 0
+    start = time.perf_counter()
+    capture = csi_capture.Capture(path)
+    opened = time.perf_counter() - start
+    print("{} frames of {} nodes in {} chunks, opened in {:.2f} ms".format(capture.frames, len(capture.macs),
+                                                                         len(capture.index), opened * 1e3))
+    err |= check_frames(capture)
+    (e, us) = check_windows(capture, seconds)
+    err |= e
+    print("all frames read back, {} random windows match, {:.0f} us per window".format(QUERIES, us))
+
+    # without the index, as after a crash
+    index_offset = int(capture.data[-csi_capture.TRAILER.itemsize:].view(csi_capture.TRAILER)[0]["index_offset"])
+    frames = capture.frames
+    with open(cut_path, "wb") as out:
+        out.write(capture.data[:index_offset].tobytes())
+    del capture
+    capture = csi_capture.Capture(cut_path)
+    if not capture.rebuilt or capture.frames != frames:
+        print("capture without index: not rebuilt, or {} of {} frames".format(capture.frames, frames))
+        err = 1
+    err |= check_frames(capture)
+    err |= check_windows(capture, seconds)[0]
+    print("without index: rebuilt, same frames and windows")
+    del capture
+    os.unlink(path)
+    os.unlink(cut_path)
+    if err == 0:
+        print("capture reader checked")
+    return err
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+# Checks clock_sync.ClockSync on simulated nodes: each has its own boot time and a crystal off by up
+# to 50 ppm, and its records arrive after a random delay (queueing, batching, WiFi retries, spikes).
+# Events that happen at the same host time on all nodes are mapped back onto the host clock, their
+# spread across nodes must stay well under the 10 ms frame interval.
+#   ./clock_sync_check.py [seconds]
+import os
+import random
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "active_ap"))
+import clock_sync
+
+FRAME_S = 0.01
+WARMUP_S = 10
+N_NODES = 4
+
+def delay_s (rng) :
+    d = 0.001 + rng.expovariate(1 / 0.002) + rng.uniform(0, 0.005)
+    if rng.random() < 0.01:
+        d += rng.uniform(0.02, 0.1)
+    return d
+
+def main () :
+    seconds = int(sys.argv[1]) if len(sys.argv) > 1 else 120
+    rng = random.Random(42)
+    host_start = 1.7e9
+    nodes = []
+    for i in range(N_NODES):
+        # device time = (host time - boot) * (1 + skew)
+        nodes.append(("aa:00:00:00:00:{:02x}".format(i), host_start - rng.uniform(10, 100000), rng.uniform(-50e-6, 50e-6)))
+
+    sync = clock_sync.ClockSync()
+    spreads = []
+    arrival_spreads = []
+    t = host_start
+    while t < host_start + seconds:
+        rx = []
+        for (mac, boot, skew) in nodes:
+            rx_us = int((t - boot) * (1 + skew) * 1e6)
+            rx.append((t + delay_s(rng), mac, rx_us))
+        # feed in arrival order
+        for (arrival_s, mac, rx_us) in sorted(rx):
+            sync.update(mac, rx_us, arrival_s)
+        if t > host_start + WARMUP_S:
+            mapped = [sync.to_host(mac, rx_us) for (arrival_s, mac, rx_us) in rx]
+            spreads.append(max(mapped) - min(mapped))
+            arrival_spreads.append(max(rx)[0] - min(rx)[0])
+        t += FRAME_S
+
+    spreads.sort()
+    arrival_spreads.sort()
+    p99 = spreads[int(len(spreads) * 0.99)]
+    worst = spreads[-1]
+    for (mac, boot, skew) in nodes:
+        print(sync.summary(mac) + " (true drift {:+.1f} ppm)".format(-skew / (1 + skew) * 1e6))
+    print("{} events after {} s warmup: spread across nodes p50 {:.0f} us, p99 {:.0f} us, max {:.0f} us".format(
+        len(spreads), WARMUP_S, spreads[len(spreads) // 2] * 1e6, p99 * 1e6, worst * 1e6))
+    print("  by arrival time instead: p50 {:.0f} us, p99 {:.0f} us, max {:.0f} us".format(
+        arrival_spreads[len(spreads) // 2] * 1e6, arrival_spreads[int(len(spreads) * 0.99)] * 1e6,
+        arrival_spreads[-1] * 1e6))
+    if worst > FRAME_S / 4:
+        print("nodes not aligned to well under a frame interval")
+        return 1
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
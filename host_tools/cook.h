@@ -0,0 +1,108 @@
+#ifndef ESP32_CSI_COOK_H
+#define ESP32_CSI_COOK_H
+
+/*
+ * cook_csi_data() of active_ap/host_processing_pyqt.py for a batch of frames at once:
+ * scale each frame to its SNR (rssi - noise floor), keep the 114 HT-LTF subcarriers -58..-2 and
+ * 2..58 in that order, and convert to dB as 10 * log10(|h|^2 + 0.1).
+ *
+ * The batch is a structure of arrays: rssi[n], noise_floor[n] and the CSI of frame i at row i of
+ * a contiguous matrix, the results go to snr_db[n] and amp_db[n][COOK_SUBCARRIERS].
+ * The loops have no branches or calls per subcarrier, so the compiler vectorizes them, log10
+ * included (_cook_db() below).
+ *
+ * Built into libcsi_cook.so for active_ap/csi_cook.py, checked by cook_check and cook_check.py.
+ * Unlike cook_csi_data(), a frame without any energy comes out at -10 dB instead of NaN.
+ */
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#define COOK_RAW_LEN        384     // 192 (imaginary, real) int8 pairs: LLTF, then HT-LTF 0..63, -64..-1
+#define COOK_SUBCARRIERS    114     // CSI_LEN of host_processing_pyqt.py
+#define COOK_HALF           57
+
+/* out[i] = 10 * log10(scale2 * power[i] + 0.1), with log2 from the float bits and a short series. */
+static inline void _cook_db(const int32_t *power, int n, float scale2, float *out) {
+    for (int i = 0; i < n; i++) {
+        float x = scale2 * (float)power[i] + 0.1f;
+        uint32_t bits;
+        memcpy(&bits, &x, sizeof(bits));
+        int32_t e = (int32_t)(bits >> 23) - 127;    // x > 0
+        bits = (bits & 0x007fffff) | 0x3f800000;
+        float m;                                    // x = m * 2^e, m in [1, 2)
+        memcpy(&m, &bits, sizeof(m));
+        // move m into [sqrt(1/2), sqrt(2)), where the series below converges fast
+        float big = m > 1.41421356f ? 1.0f : 0.0f;
+        m *= 1.0f - 0.5f * big;
+        float s = (m - 1.0f) / (m + 1.0f);
+        float s2 = s * s;
+        // ln(m) = 2 atanh(s), |s| < 0.172, the first term left out is below 1e-9
+        float ln_m = 2.0f * s * (1.0f + s2 * (1.0f / 3 + s2 * (1.0f / 5 + s2 * (1.0f / 7 + s2 * (1.0f / 9)))));
+        // 10 * log10(2) per octave, 10 / ln(10) per neper
+        out[i] = ((float)e + big) * 3.01029996f + ln_m * 4.34294482f;
+    }
+}
+
+/* |h|^2 of n (imaginary, real) int8 pairs, returns the sum. */
+static inline int32_t _cook_power_iq(const int8_t *iq, int n, int32_t *power) {
+    int32_t sum = 0;
+    for (int k = 0; k < n; k++) {
+        int32_t im = iq[2 * k], re = iq[2 * k + 1];
+        power[k] = im * im + re * re;
+        sum += power[k];
+    }
+    return sum;
+}
+
+/* scale^2 of cook_csi_data(): SNR as a power ratio, times the subcarriers, over the sum of |h|^2. */
+static inline float _cook_scale2(int8_t rssi, int8_t noise_floor, int n, int64_t sum, float *snr_db) {
+    *snr_db = rssi - noise_floor;
+    return sum > 0 ? (float)(pow(10.0, *snr_db / 10.0) * n / sum) : 0.0f;
+}
+
+/* CSI_RECORD_TYPE_RAW frames of HT40, iq[n][COOK_RAW_LEN]. The SNR scaling sums over all 192 subcarriers. */
+void cook_raw_batch(int n, const int8_t *rssi, const int8_t *noise_floor, const int8_t *iq,
+                    float *snr_db, float *amp_db) {
+    int32_t power[COOK_RAW_LEN / 2];
+    for (int f = 0; f < n; f++) {
+        int32_t sum = _cook_power_iq(iq + (size_t)f * COOK_RAW_LEN, COOK_RAW_LEN / 2, power);
+        float scale2 = _cook_scale2(rssi[f], noise_floor[f], COOK_RAW_LEN / 2, sum, &snr_db[f]);
+        float *out = amp_db + (size_t)f * COOK_SUBCARRIERS;
+        // HT-LTF starts at 64 with subcarrier 0, -58..-2 are at 64 + 70..126 and 2..58 at 64 + 2..58
+        _cook_db(power + 64 + 70, COOK_HALF, scale2, out);
+        _cook_db(power + 64 + 2, COOK_HALF, scale2, out + COOK_HALF);
+    }
+}
+
+/* CSI_RECORD_TYPE_SUBCARRIERS frames, iq[n][2 * COOK_SUBCARRIERS], already selected and in order on the device. */
+void cook_subcarriers_batch(int n, const int8_t *rssi, const int8_t *noise_floor, const int8_t *iq,
+                            float *snr_db, float *amp_db) {
+    int32_t power[COOK_SUBCARRIERS];
+    for (int f = 0; f < n; f++) {
+        int32_t sum = _cook_power_iq(iq + (size_t)f * 2 * COOK_SUBCARRIERS, COOK_SUBCARRIERS, power);
+        float scale2 = _cook_scale2(rssi[f], noise_floor[f], COOK_SUBCARRIERS, sum, &snr_db[f]);
+        _cook_db(power, COOK_SUBCARRIERS, scale2, amp_db + (size_t)f * COOK_SUBCARRIERS);
+    }
+}
+
+/*
+ * CSI_RECORD_TYPE_AMPLITUDE frames (and the amplitude half of AMP_PHASE), amplitude[n][COOK_SUBCARRIERS]
+ * as sent, in 1/16 units. The unit cancels out in the SNR scaling.
+ */
+void cook_amplitude_batch(int n, const int8_t *rssi, const int8_t *noise_floor, const int16_t *amplitude,
+                          float *snr_db, float *amp_db) {
+    int32_t power[COOK_SUBCARRIERS];
+    for (int f = 0; f < n; f++) {
+        const int16_t *a = amplitude + (size_t)f * COOK_SUBCARRIERS;
+        int64_t sum = 0;
+        for (int k = 0; k < COOK_SUBCARRIERS; k++) {
+            power[k] = (int32_t)a[k] * a[k];
+            sum += power[k];
+        }
+        float scale2 = _cook_scale2(rssi[f], noise_floor[f], COOK_SUBCARRIERS, sum, &snr_db[f]);
+        _cook_db(power, COOK_SUBCARRIERS, scale2, amp_db + (size_t)f * COOK_SUBCARRIERS);
+    }
+}
+
+#endif //ESP32_CSI_COOK_H
@@ -0,0 +1,144 @@
+/*
+ * Check of the batch cook kernels in cook.h against a double precision transcription of
+ * cook_csi_data() in active_ap/host_processing_pyqt.py (complex values, sum of |h|^2, scale,
+ * reorder, 10 * log10(|h|^2 + 0.1)), on random frames of every record type they take.
+ * Then frames/s of the kernel against that reference with libm log10().
+ *
+ *   make cook_check && ./cook_check [frames]
+ * cook_check.py compares the Python binding with cook_csi_data() itself.
+ */
+#include "esp_shim.h"
+#include "cook.h"
+#include "bench_common.h"
+
+#define MAX_ERR_DB  1e-3
+
+/* cook_csi_data() for n_sub (imaginary, real) pairs, sel[i] is the index of output subcarrier i. */
+static float ref_cook_iq(int8_t rssi, int8_t noise_floor, const int8_t *iq, int n_sub, const int *sel, double *out) {
+    double snr_db = rssi - noise_floor;
+    double sum = 0;
+    for (int k = 0; k < n_sub; k++) {
+        sum += (double)iq[2 * k] * iq[2 * k] + (double)iq[2 * k + 1] * iq[2 * k + 1];
+    }
+    double scale = sqrt(pow(10, snr_db / 10.0) / sum * n_sub);
+    for (int i = 0; i < COOK_SUBCARRIERS; i++) {
+        double im = iq[2 * sel[i]] * scale, re = iq[2 * sel[i] + 1] * scale;
+        out[i] = 10 * log10(im * im + re * re + 0.1);
+    }
+    return snr_db;
+}
+
+static float ref_cook_amplitude(int8_t rssi, int8_t noise_floor, const int16_t *a, double *out) {
+    double snr_db = rssi - noise_floor;
+    double sum = 0;
+    for (int k = 0; k < COOK_SUBCARRIERS; k++) {
+        sum += (a[k] / 16.0) * (a[k] / 16.0);
+    }
+    double scale = sqrt(pow(10, snr_db / 10.0) / sum * COOK_SUBCARRIERS);
+    for (int i = 0; i < COOK_SUBCARRIERS; i++) {
+        double v = a[i] / 16.0 * scale;
+        out[i] = 10 * log10(v * v + 0.1);
+    }
+    return snr_db;
+}
+
+static double max_err(const float *snr, const float *amp_db, const double *ref_snr, const double *ref_db, int n) {
+    double worst = 0;
+    for (int f = 0; f < n; f++) {
+        worst = fmax(worst, fabs(snr[f] - ref_snr[f]));
+        for (int i = 0; i < COOK_SUBCARRIERS; i++) {
+            worst = fmax(worst, fabs(amp_db[f * COOK_SUBCARRIERS + i] - ref_db[f * COOK_SUBCARRIERS + i]));
+        }
+    }
+    return worst;
+}
+
+int main(int argc, char **argv) {
+    int frames = argc > 1 ? atoi(argv[1]) : 100000;
+    int n = BENCH_CORPUS * 16;
+    static int8_t rssi[BENCH_CORPUS * 16], noise_floor[BENCH_CORPUS * 16];
+    static int8_t raw[BENCH_CORPUS * 16][COOK_RAW_LEN];
+    static int8_t sub[BENCH_CORPUS * 16][2 * COOK_SUBCARRIERS];
+    static int16_t amp[BENCH_CORPUS * 16][COOK_SUBCARRIERS];
+    static float snr[BENCH_CORPUS * 16], amp_db[BENCH_CORPUS * 16][COOK_SUBCARRIERS];
+    static double ref_snr[BENCH_CORPUS * 16], ref_db[BENCH_CORPUS * 16][COOK_SUBCARRIERS];
+
+    int raw_sel[COOK_SUBCARRIERS], sub_sel[COOK_SUBCARRIERS];
+    for (int i = 0; i < COOK_HALF; i++) {
+        raw_sel[i] = 64 + 128 - 58 + i;     // [64:][-58:-1]
+        raw_sel[COOK_HALF + i] = 64 + 2 + i; // [64:][2:59]
+    }
+    for (int i = 0; i < COOK_SUBCARRIERS; i++) {
+        sub_sel[i] = i;
+    }
+    for (int f = 0; f < n; f++) {
+        rssi[f] = -30 - (int)(bench_rand() % 60);
+        noise_floor[f] = -90 - (int)(bench_rand() % 8);
+        for (int k = 0; k < COOK_RAW_LEN; k++) {
+            raw[f][k] = (int8_t)bench_rand();
+        }
+        // a few quiet frames, where the + 0.1 matters
+        int amp_max = f % 8 == 0 ? 3 : 127;
+        for (int k = 0; k < 2 * COOK_SUBCARRIERS; k++) {
+            sub[f][k] = (int)(bench_rand() % (2 * amp_max + 1)) - amp_max;
+        }
+        sub[f][0] = 1;
+        for (int k = 0; k < COOK_SUBCARRIERS; k++) {
+            amp[f][k] = bench_rand() % (f % 8 == 0 ? 64 : 2900);
+        }
+    }
+
+    int err = 0;
+    double worst;
+    cook_raw_batch(n, rssi, noise_floor, &raw[0][0], snr, &amp_db[0][0]);
+    for (int f = 0; f < n; f++) {
+        ref_snr[f] = ref_cook_iq(rssi[f], noise_floor[f], raw[f], COOK_RAW_LEN / 2, raw_sel, ref_db[f]);
+    }
+    worst = max_err(snr, &amp_db[0][0], ref_snr, &ref_db[0][0], n);
+    printf("raw:         max error %.2e dB over %d frames\n", worst, n);
+    err |= worst > MAX_ERR_DB;
+
+    cook_subcarriers_batch(n, rssi, noise_floor, &sub[0][0], snr, &amp_db[0][0]);
+    for (int f = 0; f < n; f++) {
+        ref_snr[f] = ref_cook_iq(rssi[f], noise_floor[f], sub[f], COOK_SUBCARRIERS, sub_sel, ref_db[f]);
+    }
+    worst = max_err(snr, &amp_db[0][0], ref_snr, &ref_db[0][0], n);
+    printf("subcarriers: max error %.2e dB over %d frames\n", worst, n);
+    err |= worst > MAX_ERR_DB;
+
+    cook_amplitude_batch(n, rssi, noise_floor, &amp[0][0], snr, &amp_db[0][0]);
+    for (int f = 0; f < n; f++) {
+        ref_snr[f] = ref_cook_amplitude(rssi[f], noise_floor[f], amp[f], ref_db[f]);
+    }
+    worst = max_err(snr, &amp_db[0][0], ref_snr, &ref_db[0][0], n);
+    printf("amplitude:   max error %.2e dB over %d frames\n", worst, n);
+    err |= worst > MAX_ERR_DB;
+
+    // a frame without energy
+    memset(raw[0], 0, COOK_RAW_LEN);
+    cook_raw_batch(1, rssi, noise_floor, &raw[0][0], snr, &amp_db[0][0]);
+    if (fabs(amp_db[0][0] + 10) > MAX_ERR_DB) {
+        printf("silent frame: %f dB instead of -10\n", amp_db[0][0]);
+        err = 1;
+    }
+
+    double t0 = bench_now();
+    for (int done = 0; done < frames; done += n) {
+        cook_raw_batch(n, rssi, noise_floor, &raw[0][0], snr, &amp_db[0][0]);
+    }
+    double t_kernel = bench_now() - t0;
+    double sink = 0;
+    t0 = bench_now();
+    for (int done = 0; done < frames; done += n) {
+        for (int f = 0; f < n; f++) {
+            sink += ref_cook_iq(rssi[f], noise_floor[f], raw[f], COOK_RAW_LEN / 2, raw_sel, ref_db[f]);
+        }
+    }
+    double t_ref = bench_now() - t0;
+    printf("raw frames/s: %.0f batch kernel, %.0f scalar reference, %.1fx (sink %.0f)\n",
+           frames / t_kernel, frames / t_ref, t_ref / t_kernel, sink + amp_db[0][0]);
+    if (err == 0) {
+        printf("batch kernels match cook_csi_data()\n");
+    }
+    return err;
+}
@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+# Compares the batch cook kernels through their Python binding (active_ap/csi_cook.py) with
+# cook_csi_data() of host_processing_pyqt.py as it is, on random frames of every record type:
+#   make libcsi_cook.so && ./cook_check.py [frames]
+# cook_csi_data() and cook_frames() are taken from the source, the rest of the script needs Qt.
+# Then frames/s of both for raw frames.
+import ast
+import contextlib
+import io
+import os
+import random
+import sys
+import time
+
+import numpy as np
+
+ACTIVE_AP = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "active_ap")
+sys.path.insert(0, ACTIVE_AP)
+import csi_record
+import csi_cook
+
+MAX_ERR_DB = 1e-3
+
+def load_pyqt_functions (names) :
+    path = os.path.join(ACTIVE_AP, "host_processing_pyqt.py")
+    tree = ast.parse(open(path).read(), path)
+    keep = [node for node in tree.body if (isinstance(node, ast.FunctionDef) and node.name in names) or
+            (isinstance(node, ast.Assign) and any(getattr(t, "id", None) == "CSI_LEN" for t in node.targets))]
+    namespace = {"np": np, "csi_record": csi_record, "csi_cook": csi_cook}
+    exec(compile(ast.Module(body=keep, type_ignores=[]), path, "exec"), namespace)
+    return namespace
+
+def make_frames (rng, n) :
+    frames = []
+    for i in range(n):
+        rx_ctrl = [0] * 19
+        rx_ctrl[0] = rng.randint(-90, -30)    # rssi
+        rx_ctrl[11] = rng.randint(-97, -90)   # noise floor
+        amp = 3 if i % 8 == 0 else 127
+        raw = [rng.randint(-amp, amp) for _ in range(csi_cook.RAW_LEN)]
+        raw[129] = 1 # never all zero
+        sub = [rng.randint(-amp, amp) for _ in range(2 * csi_cook.SUBCARRIERS)]
+        sub[1] = 1
+        amplitudes = [rng.randint(1, 2900) * csi_record.AMPLITUDE_SCALE for _ in range(csi_cook.SUBCARRIERS)]
+        phases = [rng.randint(-32768, 32767) * csi_record.PHASE_SCALE for _ in range(csi_cook.SUBCARRIERS)]
+        frames.append( (rx_ctrl, csi_record.CSI_RECORD_TYPE_RAW, raw, i) )
+        frames.append( (rx_ctrl, csi_record.CSI_RECORD_TYPE_SUBCARRIERS, sub, i) )
+        frames.append( (rx_ctrl, csi_record.CSI_RECORD_TYPE_AMPLITUDE, amplitudes, i) )
+        frames.append( (rx_ctrl, csi_record.CSI_RECORD_TYPE_AMP_PHASE, (amplitudes, phases), i) )
+    return frames
+
+def main () :
+    n = int(sys.argv[1]) if len(sys.argv) > 1 else 500
+    if not csi_cook.available:
+        print("{} not built, run make libcsi_cook.so".format(csi_cook.LIB_PATH))
+        return 1
+    pyqt = load_pyqt_functions(("cook_csi_data", "kernel_values", "cook_frames"))
+    frames = make_frames(random.Random(7), n)
+
+    # what the plots got before: cook_csi_data() one frame at a time
+    expected = []
+    with contextlib.redirect_stdout(io.StringIO()):
+        for (rx_ctrl, rec_type, csi_data, _) in frames:
+            (snr_db, cooked) = pyqt["cook_csi_data"](rx_ctrl, rec_type, csi_data)
+            expected.append( (snr_db, 10 * np.log10(np.abs(cooked)**2 + 0.1)) )
+        got = pyqt["cook_frames"](frames)
+
+    err = 0
+    for rec_type in sorted(set(f[1] for f in frames)):
+        idx = [i for (i, f) in enumerate(frames) if f[1] == rec_type]
+        worst = max(max(abs(got[i][0] - expected[i][0]), np.max(np.abs(got[i][1] - expected[i][1]))) for i in idx)
+        print("record type {}: max error {:.2e} dB over {} frames".format(rec_type, worst, len(idx)))
+        if worst > MAX_ERR_DB:
+            err = 1
+        if any(np.asarray(got[i][1]).dtype != np.float32 for i in idx):
+            print("record type {} did not go through the kernel".format(rec_type))
+            err = 1
+
+    # the results are views of the arrays the kernel wrote
+    raw = [f for f in frames if f[1] == csi_record.CSI_RECORD_TYPE_RAW]
+    rssi = np.array([f[0][0] for f in raw], dtype=np.int8)
+    noise_floor = np.array([f[0][11] for f in raw], dtype=np.int8)
+    iq = np.array([f[2] for f in raw], dtype=np.int8)
+    (snr_db, amp_db) = csi_cook.cook(csi_record.CSI_RECORD_TYPE_RAW, rssi, noise_floor, iq)
+    if amp_db.shape != (len(raw), csi_cook.SUBCARRIERS) or not amp_db.flags["OWNDATA"]:
+        print("unexpected result array")
+        err = 1
+
+    t0 = time.perf_counter()
+    with contextlib.redirect_stdout(io.StringIO()):
+        for (rx_ctrl, rec_type, csi_data, _) in raw:
+            (s, cooked) = pyqt["cook_csi_data"](rx_ctrl, rec_type, csi_data)
+            10 * np.log10(np.abs(cooked)**2 + 0.1)
+    t_python = time.perf_counter() - t0
+    rounds = 200
+    t0 = time.perf_counter()
+    for _ in range(rounds):
+        csi_cook.cook(csi_record.CSI_RECORD_TYPE_RAW, rssi, noise_floor, iq)
+    t_kernel = (time.perf_counter() - t0) / rounds
+    print("raw frames/s: {:.0f} cook_csi_data(), {:.0f} batch kernel on arrays, {:.0f}x".format(
+        len(raw) / t_python, len(raw) / t_kernel, t_python / t_kernel))
+    if err == 0:
+        print("batch kernels match cook_csi_data()")
+    return err
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,5 @@
+/*
+ * libcsi_cook.so, the batch kernels of cook.h for active_ap/csi_cook.py (ctypes).
+ *   make libcsi_cook.so
+ */
+#include "cook.h"
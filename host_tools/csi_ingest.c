@@ -0,0 +1,267 @@
+/*
+ * Native receiver of the CSI datagrams of all nodes, in place of the per-tick sock.recv() of
+ * host_processing_pyqt.py. Drains the port with recvmmsg() and decodes text and binary records
+ * into fixed size csi_frame_t (see ingest.h), then publishes them.
+ *
+ *   make csi_ingest && ./csi_ingest [-p port | -t tty [-b baud]] [-o frames.bin] [-r capture.csic] [-s [name]] [-n slots] [-e [events.txt]]
+ *                                   [-f [epochs.txt] [-k links | -w db] [-j threads]]
+ *     -p   UDP port, 8848 by default (HOST_UDP_PORT of the firmware)
+ *     -t   read the framed records of a device with CONFIG_CSI_SERIAL_FRAMED from this serial port
+ *          instead (serial_component.h), or from a file the port was copied into
+ *     -b   baud rate of the serial port, 2000000 by default (CONFIG_CSI_SERIAL_BAUD)
+ *     -o   append every decoded frame to this file, - for stdout
+ *     -r   record into this chunked columnar capture (capture.h), indexed by node and time when
+ *          csi_ingest exits on SIGINT or SIGTERM, read with active_ap/csi_capture.py
+ *     -s   publish the frames in the shared memory ring name (shm_ring.h), /esp32_csi by default,
+ *          for any number of readers such as active_ap/csi_shm.py
+ *     -n   slots of the ring, SHM_RING_SLOTS by default
+ *     -e   run the motion detector of detect.h on every node and write a line per start and end
+ *          of motion (host_us, mac, start score or end peak score and frames) to this file,
+ *          stdout by default
+ *     -f   fuse the detectors of all nodes (fusion.h) into one decision per 100 ms epoch, written
+ *          as a line (epoch start host_us, motion or quiet, nodes over the threshold, nodes, mean
+ *          score) to this file, stdout by default. Motion when -k nodes agree, 2 by default, or
+ *          when the mean score is over -w db. -j threads share the nodes
+ * Prints datagrams (records from a serial port), frames and errors per second to stderr.
+ */
+#include <signal.h>
+
+#include "esp_shim.h"
+#include "ingest.h"
+#include "shm_ring.h"
+#include "capture.h"
+#include "cook.h"
+#include "detect.h"
+#include "fusion.h"
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+typedef struct {
+    FILE *out;
+    shm_ring_t *ring;
+    capture_writer_t *capture;
+    csi_detect_t *detect;
+    csi_fusion_t *fusion;
+} ingest_sinks_t;
+
+typedef struct {
+    FILE *out;
+    const csi_ingest_t *in;
+} event_sink_t;
+
+static void write_event(void *ctx, const detect_event_t *e) {
+    event_sink_t *sink = ctx;
+    const uint8_t *m = sink->in->macs[e->node];
+    fprintf(sink->out, "%lu %02x:%02x:%02x:%02x:%02x:%02x ", e->t_us, m[0], m[1], m[2], m[3], m[4], m[5]);
+    if (e->type == DETECT_START) {
+        fprintf(sink->out, "start %.2f\n", e->score);
+    } else {
+        fprintf(sink->out, "end %.2f %u\n", e->score, e->frames);
+    }
+}
+
+static void write_epoch(void *ctx, const fusion_epoch_t *e) {
+    fprintf(ctx, "%lu %s %d %d %.2f\n", e->start_us, e->motion ? "motion" : "quiet", e->votes, e->links, e->score);
+}
+
+static void publish_frame(void *ctx, const csi_frame_t *frame) {
+    ingest_sinks_t *sinks = ctx;
+    if (sinks->ring != NULL) {
+        shm_ring_publish(sinks->ring, frame);
+    }
+    if (sinks->out != NULL) {
+        fwrite(frame, sizeof(*frame), 1, sinks->out);
+    }
+    if (sinks->capture != NULL) {
+        capture_add(sinks->capture, frame);
+    }
+    if (sinks->detect != NULL) {
+        detect_frame(sinks->detect, frame);
+    }
+    if (sinks->fusion != NULL) {
+        fusion_add(sinks->fusion, frame);
+    }
+}
+
+int main(int argc, char **argv) {
+    int port = 8848;
+    const char *tty = NULL;
+    int baud = SERIAL_BAUD;
+    const char *out_path = NULL;
+    const char *capture_path = NULL;
+    const char *shm_name = NULL;
+    const char *events_path = NULL;
+    const char *epochs_path = NULL;
+    fusion_cfg_t fusion_cfg;
+    fusion_default_cfg(&fusion_cfg);
+    int slots = SHM_RING_SLOTS;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            tty = argv[++i];
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            baud = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            capture_path = argv[++i];
+        } else if (strcmp(argv[i], "-s") == 0) {
+            shm_name = i + 1 < argc && argv[i + 1][0] == '/' ? argv[++i] : SHM_RING_NAME;
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            slots = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-e") == 0) {
+            events_path = i + 1 < argc && argv[i + 1][0] != '-' ? argv[++i] : "-";
+        } else if (strcmp(argv[i], "-f") == 0) {
+            epochs_path = i + 1 < argc && argv[i + 1][0] != '-' ? argv[++i] : "-";
+        } else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            fusion_cfg.rule = FUSION_K_OF_N;
+            fusion_cfg.k = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            fusion_cfg.rule = FUSION_WEIGHTED;
+            fusion_cfg.weighted_threshold = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            fusion_cfg.threads = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [-p port | -t tty [-b baud]] [-o frames.bin] [-r capture.csic] [-s [/name]] [-n slots] [-e [events.txt]]\n"
+                            "       [-f [epochs.txt] [-k links | -w db] [-j threads]]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    ingest_sinks_t sinks = {NULL, NULL, NULL, NULL, NULL};
+    if (out_path != NULL) {
+        sinks.out = strcmp(out_path, "-") == 0 ? stdout : fopen(out_path, "ab");
+        if (sinks.out == NULL) {
+            perror(out_path);
+            return 1;
+        }
+    }
+    static capture_writer_t capture;
+    if (capture_path != NULL) {
+        if (!capture_open(&capture, capture_path, CAPTURE_CSI_WIDTH, CAPTURE_CHUNK_FRAMES, CAPTURE_FLUSH_US)) {
+            perror(capture_path);
+            return 1;
+        }
+        sinks.capture = &capture;
+    }
+    static shm_ring_t ring;
+    if (shm_name != NULL) {
+        if (slots < 1 || !shm_ring_create(&ring, shm_name, slots)) {
+            perror(shm_name);
+            return 1;
+        }
+        sinks.ring = &ring;
+        fprintf(stderr, "publishing to shared memory ring %s, %u slots\n", shm_name, ring.hdr->slots);
+    }
+    int sock = tty != NULL ? ingest_open_serial(tty, baud) : ingest_open_socket(port, 8 << 20);
+    if (sock < 0) {
+        perror(tty != NULL ? tty : "socket");
+        return 1;
+    }
+    // wake up at least every 100 ms to print and to notice signals, a serial port does with VTIME
+    struct timeval tv = {.tv_sec = 0, .tv_usec = 100000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    static csi_ingest_t in;
+    ingest_init(&in, sock, publish_frame, &sinks);
+    static csi_detect_t detect;
+    event_sink_t events = {NULL, &in};
+    if (events_path != NULL) {
+        events.out = strcmp(events_path, "-") == 0 ? stdout : fopen(events_path, "a");
+        if (events.out == NULL) {
+            perror(events_path);
+            return 1;
+        }
+        detect_cfg_t cfg;
+        detect_default_cfg(&cfg);
+        detect_init(&detect, &cfg, write_event, &events);
+        sinks.detect = &detect;
+    }
+    static csi_fusion_t fusion;
+    FILE *epochs = NULL;
+    if (epochs_path != NULL) {
+        epochs = strcmp(epochs_path, "-") == 0 ? stdout : fopen(epochs_path, "a");
+        if (epochs == NULL) {
+            perror(epochs_path);
+            return 1;
+        }
+        if (!fusion_init(&fusion, &fusion_cfg, write_epoch, epochs)) {
+            fprintf(stderr, "bad fusion settings\n");
+            return 1;
+        }
+        sinks.fusion = &fusion;
+    }
+    if (tty != NULL) {
+        fprintf(stderr, "reading serial frames from %s at %d baud\n", tty, baud);
+    } else {
+        fprintf(stderr, "listening on udp port %d\n", port);
+    }
+
+    ingest_counters_t last = in.counters;
+    uint64_t next_print = ingest_now_us() + 1000000;
+    while (!stop) {
+        if (tty != NULL) {
+            if (ingest_read_serial(&in, sock) < 0) {
+                if (errno != 0) {
+                    perror(tty);
+                }
+                break;
+            }
+        } else if (ingest_poll(&in, MSG_WAITFORONE) < 0) {
+            // MSG_WAITFORONE: block for the first datagram, then take whatever else is queued
+            perror("recvmmsg");
+            break;
+        }
+        uint64_t now = ingest_now_us();
+        if (sinks.capture != NULL) {
+            capture_tick(sinks.capture, now);
+        }
+        if (now >= next_print) {
+            ingest_counters_t c = in.counters;
+            fprintf(stderr, "%d nodes, %lu datagrams/s, %lu frames/s (%lu text), %lu stats, %lu delta gaps, %lu errors\n",
+                    in.n_nodes, c.datagrams - last.datagrams, c.frames - last.frames, c.text_frames - last.text_frames,
+                    c.stats_records - last.stats_records, c.delta_gaps - last.delta_gaps, c.errors - last.errors);
+            last = c;
+            next_print = now + 1000000;
+            if (sinks.out != NULL) {
+                fflush(sinks.out);
+            }
+            if (events.out != NULL) {
+                fflush(events.out);
+            }
+            if (epochs != NULL) {
+                fflush(epochs);
+            }
+        }
+    }
+    if (sinks.out != NULL && sinks.out != stdout) {
+        fclose(sinks.out);
+    }
+    if (events.out != NULL && events.out != stdout) {
+        fclose(events.out);
+    }
+    if (sinks.fusion != NULL) {
+        fusion_flush(sinks.fusion);
+        fusion_close(sinks.fusion);
+        if (epochs != stdout) {
+            fclose(epochs);
+        }
+    }
+    if (sinks.capture != NULL && !capture_close(sinks.capture)) {
+        perror(capture_path);
+    }
+    if (sinks.ring != NULL) {
+        // left in place, readers stay attached and a restarted writer goes on with it
+        shm_ring_close(sinks.ring);
+    }
+    close(sock);
+    return 0;
+}
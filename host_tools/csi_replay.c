@@ -0,0 +1,218 @@
+/*
+ * Load generator for the host side: plays a recorded capture (capture.h), or a synthetic corpus,
+ * to a UDP port in the format csi_handler_task sends, from one socket and mac per virtual node
+ * (replay.h). Takes the place of the boards for benchmarks and regression runs of csi_ingest or
+ * host_processing_pyqt.py, at field load or many times it.
+ *
+ *   make csi_replay && ./csi_replay [options]
+ *     -h host -p port     where to send, 127.0.0.1:8848 by default
+ *     -c capture.csic     play this capture, node by node with the times it was received at.
+ *                         Otherwise a synthetic corpus:
+ *     -N nodes -f hz -t s   nodes sending hz frames/s each for s seconds, 8, 100 and 10 by default,
+ *     -s seed               in a room with someone walking now and then, as csi_synth makes it
+ *     -x speed            play at speed times the recorded rate, 1 by default, 0 as fast as possible
+ *     -r frames/s         or at a fixed total rate, ignoring the recorded times
+ *     -l loops            play the capture or corpus this many times in a row
+ *     -m mac              mac of node 0, node i gets mac + i, 3c:61:05:4c:36:00 by default
+ *     -b [type]           binary records (CONFIG_CSI_OUTPUT_BINARY) of payload type raw, sub, amp,
+ *                         phase or ampphase, raw by default. Text records otherwise
+ *     -d [keyframes]      delta coded, every 16th record a keyframe by default
+ *     -B mtu [-D ms]      batch records up to mtu bytes, sent at the latest after ms (10 by default)
+ * Prints frames and datagrams per second to stderr, then the achieved rate against the target
+ * and how late the frames went out against their slots.
+ */
+#include <signal.h>
+#include <sys/prctl.h>
+
+#include "esp_shim.h"
+#include "ingest.h"
+#include "capture.h"
+#include "replay.h"
+#include "mac_filter_component.h"
+#include "csi_synth.h"
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+static uint64_t last_print_ns;
+static replay_counters_t last;
+
+/* Rates of the last second, called after every frame. */
+static void progress(const replay_counters_t *c) {
+    uint64_t now = replay_now_ns();
+    if (now - last_print_ns < 1000000000) {
+        return;
+    }
+    double dt = (now - last_print_ns) * 1e-9;
+    fprintf(stderr, "%.0f frames/s, %.0f datagrams/s, %.1f Mbit/s, %lu skipped, %lu send errors\n",
+            (c->frames - last.frames) / dt, (c->datagrams - last.datagrams) / dt, (c->bytes - last.bytes) * 8e-6 / dt,
+            c->skipped - last.skipped, c->send_errors - last.send_errors);
+    last = *c;
+    last_print_ns = now;
+}
+
+/* Synthetic nodes (csi_synth.h) with the default room and motion, frames of all nodes in time order. */
+static void play_synthetic(csi_replay_t *r, synth_cfg_t *cfg, double seconds, int loops) {
+    static csi_synth_t s;
+    static int8_t buf[SYNTH_BUF_LEN];
+    uint64_t duration_us = seconds * 1e6;
+    for (int loop = 0; loop < loops && !stop; loop++) {
+        // a loop plays the same frames again, later
+        synth_init(&s, cfg, r->nodes[0].mac, duration_us);
+        for (;;) {
+            int n = synth_next_link(&s);
+            if (s.links[n].next_us >= duration_us || stop) {
+                break;
+            }
+            wifi_csi_info_t d;
+            bool moving;
+            uint64_t t_us = synth_frame(&s, n, &d, buf, &moving);
+            replay_send_info(r, n, &d, loop * duration_us + t_us);
+        }
+    }
+}
+
+static bool parse_type(const char *s, uint8_t *type) {
+    static const struct { const char *name; uint8_t type; } types[] = {
+        {"raw", CSI_RECORD_TYPE_RAW}, {"sub", CSI_RECORD_TYPE_SUBCARRIERS}, {"amp", CSI_RECORD_TYPE_AMPLITUDE},
+        {"phase", CSI_RECORD_TYPE_PHASE}, {"ampphase", CSI_RECORD_TYPE_AMP_PHASE},
+    };
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        if (strcmp(s, types[i].name) == 0) {
+            *type = types[i].type;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-h host] [-p port] [-c capture.csic | -N nodes -f hz -t seconds [-s seed]] [-x speed | -r frames/s]\n"
+                    "       [-l loops] [-m mac] [-b [raw|sub|amp|phase|ampphase]] [-d [keyframes]] [-B mtu [-D ms]]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    const char *host = "127.0.0.1";
+    int port = 8848;
+    const char *capture_path = NULL;
+    int nodes = 8, loops = 1;
+    double hz = 100, seconds = 10, speed = 1, rate = 0;
+    uint32_t seed = 1;
+    uint8_t mac[6] = {0x3c, 0x61, 0x05, 0x4c, 0x36, 0x00};
+    replay_format_t fmt = {.binary = false, .payload_type = CSI_RECORD_TYPE_RAW, .delta = false,
+                           .keyframe_interval = CSI_DELTA_KEYFRAME_INTERVAL, .batch_mtu = 0, .batch_deadline_us = 10000};
+    for (int i = 1; i < argc; i++) {
+        const char *opt = argv[i];
+        bool has_arg = i + 1 < argc;
+        bool optional_arg = has_arg && argv[i + 1][0] != '-';
+        if (strcmp(opt, "-h") == 0 && has_arg) {
+            host = argv[++i];
+        } else if (strcmp(opt, "-p") == 0 && has_arg) {
+            port = atoi(argv[++i]);
+        } else if (strcmp(opt, "-c") == 0 && has_arg) {
+            capture_path = argv[++i];
+        } else if (strcmp(opt, "-N") == 0 && has_arg) {
+            nodes = atoi(argv[++i]);
+        } else if (strcmp(opt, "-f") == 0 && has_arg) {
+            hz = atof(argv[++i]);
+        } else if (strcmp(opt, "-t") == 0 && has_arg) {
+            seconds = atof(argv[++i]);
+        } else if (strcmp(opt, "-x") == 0 && has_arg) {
+            speed = atof(argv[++i]);
+        } else if (strcmp(opt, "-r") == 0 && has_arg) {
+            rate = atof(argv[++i]);
+        } else if (strcmp(opt, "-s") == 0 && has_arg) {
+            seed = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(opt, "-l") == 0 && has_arg) {
+            loops = atoi(argv[++i]);
+        } else if (strcmp(opt, "-m") == 0 && has_arg) {
+            if (!mac_parse(argv[++i], mac)) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(opt, "-b") == 0) {
+            fmt.binary = true;
+            if (optional_arg && !parse_type(argv[++i], &fmt.payload_type)) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(opt, "-d") == 0) {
+            fmt.delta = true;
+            if (optional_arg) {
+                fmt.keyframe_interval = atoi(argv[++i]);
+            }
+        } else if (strcmp(opt, "-B") == 0 && has_arg) {
+            fmt.batch_mtu = atoi(argv[++i]);
+        } else if (strcmp(opt, "-D") == 0 && has_arg) {
+            fmt.batch_deadline_us = atof(argv[++i]) * 1000;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if ((fmt.delta && !fmt.binary) || hz <= 0 || seconds <= 0 || speed < 0 || rate < 0 || loops < 1) {
+        usage(argv[0]);
+    }
+
+    static capture_reader_t cap;
+    if (capture_path != NULL) {
+        if (!capture_map(&cap, capture_path)) {
+            perror(capture_path);
+            return 1;
+        }
+        nodes = cap.n_nodes < REPLAY_MAX_NODES ? cap.n_nodes : REPLAY_MAX_NODES;
+        fprintf(stderr, "%s: %lu frames of %u nodes%s\n", capture_path, cap.frames, cap.n_nodes,
+                cap.rebuilt ? ", index rebuilt" : "");
+    }
+    static csi_replay_t r;
+    if (!replay_init(&r, &fmt, host, port, nodes, mac)) {
+        fprintf(stderr, "can not send to %s:%d from %d nodes\n", host, port, nodes);
+        return 1;
+    }
+    r.speed = speed;
+    r.rate = rate;
+    // slots are met to a few us, not the default 50 us of timer slack
+    prctl(PR_SET_TIMERSLACK, 1);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    r.tick = progress;
+    replay_start(&r);
+    last_print_ns = r.start_ns;
+    if (capture_path != NULL) {
+        replay_capture(&r, &cap, loops, &stop);
+    } else {
+        synth_cfg_t cfg;
+        synth_default_cfg(&cfg);
+        cfg.links = nodes;
+        cfg.hz = hz;
+        cfg.seed = seed;
+        play_synthetic(&r, &cfg, seconds, loops);
+    }
+    replay_finish(&r);
+    double wall = (replay_now_ns() - r.start_ns) * 1e-9;
+
+    const replay_counters_t *c = &r.counters;
+    printf("%lu frames of %d nodes in %lu datagrams, %.1f MB, %.2f s\n", c->frames, nodes, c->datagrams, c->bytes / 1e6, wall);
+    if (rate > 0) {
+        printf("target %.0f frames/s, ", rate);
+    } else if (speed > 0) {
+        printf("target %.1fx, ", speed);
+    }
+    printf("achieved %.0f frames/s, %.0f datagrams/s, %.1f Mbit/s\n", c->frames / wall, c->datagrams / wall, c->bytes * 8e-6 / wall);
+    if (speed > 0 || rate > 0) {
+        printf("late against the slots: mean %.1f us, median %lu us, p99 %lu us, max %lu us\n",
+               r.slots > 0 ? (double)r.late_sum_us / r.slots : 0.0, replay_late_quantile(&r, 0.5),
+               replay_late_quantile(&r, 0.99), r.late_max_us);
+    }
+    if (c->skipped > 0 || c->send_errors > 0) {
+        printf("%lu frames skipped (preprocessed records as text), %lu send errors\n", c->skipped, c->send_errors);
+    }
+    replay_close(&r);
+    if (capture_path != NULL) {
+        capture_unmap(&cap);
+    }
+    return 0;
+}
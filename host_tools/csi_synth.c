@@ -0,0 +1,149 @@
+/*
+ * Synthetic CSI of a room of links (csi_synth.h) with known motion events, written as a capture
+ * that csi_replay sends and active_ap/csi_capture.py reads, for tuning and regression tests of
+ * detectors without boards or people walking around.
+ *
+ *   make csi_synth && ./csi_synth [options]
+ *     -o capture.csic     write the frames into this capture (capture.h), otherwise only generate
+ *                         them, to measure the rate
+ *     -L labels.csv       ground truth: one line link,mac,start_us,end_us per link and event, in
+ *                         host_us of the capture
+ *     -N links -f hz -t s   links sending hz frames/s each for s seconds, 8, 100 and 60 by default
+ *     -m mac              mac of link 0, link i gets mac + i, 3c:61:05:4c:36:00 by default
+ *     -S snr_db -F noise_floor   mean SNR of the static channel and the noise floor, 25 and -93
+ *     -T taps -d ns -K db        static taps, their rms delay spread and the K factor, 8, 40 ns and 3 dB
+ *     -M db -v m/s -w db         power of the moving paths, their speed and the shadowing, -6, 1 and 3
+ *     -q s -e s -c share         mean quiet time, event length and share of links per event, 20, 5, 0.5
+ *     -s seed             1 by default, the same seed gives the same frames
+ * Prints the frames, events and the generation rate.
+ */
+#include "esp_shim.h"
+#include "ingest.h"
+#include "capture.h"
+#include "csi_synth.h"
+#include "mac_filter_component.h"
+#include "bench_common.h"
+
+// host arrival behind the frame, as over a quiet LAN
+#define SYNTH_LATENCY_US    300
+#define SYNTH_JITTER_US     400
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-o capture.csic] [-L labels.csv] [-N links] [-f hz] [-t seconds] [-m mac] [-S snr_db]\n"
+                    "       [-F noise_floor] [-T taps] [-d spread_ns] [-K k_db] [-M motion_db] [-v speed] [-w shadow_db]\n"
+                    "       [-q quiet_s] [-e motion_s] [-c coverage] [-s seed]\n", prog);
+    exit(1);
+}
+
+static bool write_labels(const char *path, const csi_synth_t *s, uint64_t t0_us) {
+    FILE *f = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (f == NULL) {
+        return false;
+    }
+    fprintf(f, "link,mac,start_us,end_us\n");
+    for (int e = 0; e < s->n_events; e++) {
+        for (int i = 0; i < s->cfg.links; i++) {
+            if (s->events[e].links >> i & 1) {
+                const uint8_t *m = s->links[i].mac;
+                fprintf(f, "%d,%02x:%02x:%02x:%02x:%02x:%02x,%lu,%lu\n", i, m[0], m[1], m[2], m[3], m[4], m[5],
+                        t0_us + s->events[e].start_us, t0_us + s->events[e].end_us);
+            }
+        }
+    }
+    return f == stdout ? fflush(f) == 0 : fclose(f) == 0;
+}
+
+int main(int argc, char **argv) {
+    const char *capture_path = NULL, *labels_path = NULL;
+    double seconds = 60;
+    uint8_t mac[6] = {0x3c, 0x61, 0x05, 0x4c, 0x36, 0x00};
+    synth_cfg_t cfg;
+    synth_default_cfg(&cfg);
+    for (int i = 1; i < argc; i++) {
+        const char *opt = argv[i];
+        if (i + 1 >= argc || opt[0] != '-' || opt[1] == 0 || opt[2] != 0) {
+            usage(argv[0]);
+        }
+        const char *arg = argv[++i];
+        switch (opt[1]) {
+            case 'o': capture_path = arg; break;
+            case 'L': labels_path = arg; break;
+            case 'N': cfg.links = atoi(arg); break;
+            case 'f': cfg.hz = atof(arg); break;
+            case 't': seconds = atof(arg); break;
+            case 'm':
+                if (!mac_parse(arg, mac)) {
+                    usage(argv[0]);
+                }
+                break;
+            case 'S': cfg.snr_db = atof(arg); break;
+            case 'F': cfg.noise_floor = atoi(arg); break;
+            case 'T': cfg.taps = atoi(arg); break;
+            case 'd': cfg.delay_spread_ns = atof(arg); break;
+            case 'K': cfg.k_factor_db = atof(arg); break;
+            case 'M': cfg.motion_db = atof(arg); break;
+            case 'v': cfg.speed_mps = atof(arg); break;
+            case 'w': cfg.shadow_db = atof(arg); break;
+            case 'q': cfg.quiet_s = atof(arg); break;
+            case 'e': cfg.motion_s = atof(arg); break;
+            case 'c': cfg.coverage = atof(arg); break;
+            case 's': cfg.seed = strtoul(arg, NULL, 0); break;
+            default: usage(argv[0]);
+        }
+    }
+    uint64_t duration_us = seconds * 1e6;
+    static csi_synth_t s;
+    if (seconds <= 0 || cfg.delay_spread_ns <= 0 || !synth_init(&s, &cfg, mac, duration_us)) {
+        usage(argv[0]);
+    }
+
+    static capture_writer_t cap;
+    if (capture_path != NULL && !capture_open(&cap, capture_path, CAPTURE_CSI_WIDTH, CAPTURE_CHUNK_FRAMES, CAPTURE_FLUSH_US)) {
+        perror(capture_path);
+        return 1;
+    }
+    uint64_t t0_us = ingest_now_us();
+    if (labels_path != NULL && !write_labels(labels_path, &s, t0_us)) {
+        perror(labels_path);
+        return 1;
+    }
+
+    static csi_frame_t frame;
+    static uint8_t rec[sizeof(csi_record_hdr_t) + SYNTH_BUF_LEN];
+    static int8_t buf[SYNTH_BUF_LEN];
+    static uint16_t seq[SYNTH_MAX_LINKS];
+    uint64_t frames = 0, moving = 0;
+    uint64_t start = ingest_now_us();
+    for (;;) {
+        int link = synth_next_link(&s);
+        if (s.links[link].next_us >= duration_us) {
+            break;
+        }
+        wifi_csi_info_t d;
+        bool m;
+        uint64_t t_us = synth_frame(&s, link, &d, buf, &m);
+        frames++;
+        moving += m;
+        if (capture_path == NULL) {
+            continue;
+        }
+        // board clocks started a few seconds apart, as csi_replay gives its nodes
+        size_t len = csi_record_pack(&d, rec, sizeof(rec));
+        csi_record_stamp(rec, seq[link]++, 5000000 + link * 1234567ull + t_us, 0);
+        frame.host_us = t0_us + t_us + SYNTH_LATENCY_US + bench_rand() % SYNTH_JITTER_US;
+        frame.node = link;
+        memcpy(&frame.hdr, rec, sizeof(frame.hdr));
+        memcpy(frame.csi, rec + sizeof(frame.hdr), len - sizeof(frame.hdr));
+        capture_add(&cap, &frame);
+    }
+    double wall = (ingest_now_us() - start) * 1e-6;
+    if (capture_path != NULL && !capture_close(&cap)) {
+        perror(capture_path);
+        return 1;
+    }
+    printf("%lu frames of %d links over %.0f s, %d motion events, %.1f%% of the frames during motion\n",
+           frames, cfg.links, seconds, s.n_events, frames > 0 ? 100.0 * moving / frames : 0.0);
+    printf("%.2f s, %.0f frames/s, %.1f M frames/min%s\n", wall, frames / wall, frames / wall * 60e-6,
+           capture_path != NULL ? " including the capture" : "");
+    return 0;
+}
@@ -0,0 +1,396 @@
+#ifndef ESP32_CSI_SYNTH_H
+#define ESP32_CSI_SYNTH_H
+
+/*
+ * Synthetic CSI with known ground truth, include after esp_shim.h.
+ * Each link is a transmitter/receiver pair on a HT40 channel (secondary above) and produces
+ * frames as the wifi driver hands them to the CSI callback: a wifi_csi_info_t with all rx_ctrl
+ * fields parse_csi() prints, and 192 (imaginary, real) int8 pairs, the 64 LLTF subcarriers of
+ * the primary 20 MHz followed by the 128 HT-LTF subcarriers 0..63, -64..-1, unused ones zero.
+ *
+ * The channel of a link:
+ *   - static multipath: a line of sight tap and taps with an exponential power delay profile of
+ *     the configured rms delay spread, K factor between the two
+ *   - motion episodes: while someone moves, SYNTH_MOVING scattered paths whose length drifts with
+ *     a random velocity (carrier phase and delay follow it), and shadowing of the static channel
+ *   - receiver noise at the SNR of the frame, rssi follows the channel power, noise_floor is fixed
+ *   - per frame the receiver's common phase and timing offset (a phase slope), and an AGC gain
+ *     that brings the largest component near SYNTH_AGC_PEAK before quantizing to int8
+ * Episodes are planned ahead as events, each moving on a random subset of the links, and every
+ * frame says whether it was taken during one, for precision and recall of detectors.
+ *
+ * Fast enough for millions of frames per minute on one core: the static response is computed
+ * once per link, a frame costs one complex rotation per subcarrier and moving path, and the
+ * noise comes from a table.
+ * Used by csi_synth (writes captures), csi_replay (sends them), checked by synth_check.py.
+ */
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SYNTH_MAX_LINKS     64
+#define SYNTH_MAX_TAPS      16
+#define SYNTH_MOVING        3           // scattered paths of a moving person
+#define SYNTH_SUBCARRIERS   128         // HT40 grid, k = -64..63
+#define SYNTH_BUF_LEN       384         // 64 LLTF + 128 HT-LTF (imaginary, real) pairs
+#define SYNTH_DF_HZ         312500.0    // subcarrier spacing
+#define SYNTH_AGC_PEAK      40          // the AGC keeps the largest int8 component around this
+#define SYNTH_NOISE_TABLE   4096
+#define SYNTH_MAX_EVENTS    4096
+
+typedef struct {
+    int links;
+    double hz;                  // frames/s of each link
+    double jitter;              // spread of the frame interval, as a share of it
+    float snr_db;               // mean rssi - noise_floor of the static channel
+    int8_t noise_floor;
+    int taps;                   // static taps, the first one line of sight
+    float delay_spread_ns;      // rms delay spread of the static taps
+    float k_factor_db;          // line of sight power over the other static taps
+    float motion_db;            // power of the moving paths over the static channel
+    float shadow_db;            // deepest shadowing of the static channel while moving
+    float speed_mps;            // rms speed at which the moving path lengths change
+    double quiet_s;             // mean time between motion events
+    double motion_s;            // mean length of a motion event
+    double coverage;            // share of the links an event shows up on
+    int channel;                // primary channel, 1..9
+    uint32_t seed;
+} synth_cfg_t;
+
+typedef struct {
+    uint64_t start_us;
+    uint64_t end_us;
+    uint64_t links;             // bit per link
+} synth_event_t;
+
+typedef struct {
+    float static_re[SYNTH_SUBCARRIERS];
+    float static_im[SYNTH_SUBCARRIERS];
+    float rssi0;                // rssi of the static channel
+    // moving paths
+    float amp[SYNTH_MOVING];
+    float tau_ns[SYNTH_MOVING];
+    float len_m[SYNTH_MOVING];  // change of the path length
+    float vel[SYNTH_MOVING];
+    float shadow;               // 0..1, how deep the static channel is shadowed
+    float presence;             // 0..1, ramps the moving paths in and out
+    uint64_t next_us;           // time of the next frame
+    uint64_t last_us;
+    uint64_t frames;
+    int event;                  // first event that has not ended at last_us
+    uint8_t mac[6];
+} synth_link_t;
+
+typedef struct {
+    synth_cfg_t cfg;
+    synth_link_t links[SYNTH_MAX_LINKS];
+    synth_event_t events[SYNTH_MAX_EVENTS];
+    int n_events;
+    double fc_hz;               // carrier at the center of the 40 MHz channel
+    uint64_t rand;
+    float noise[SYNTH_NOISE_TABLE]; // standard normal
+} csi_synth_t;
+
+/* Defaults: 8 links at 100 Hz in a room, someone walking now and then. */
+void synth_default_cfg(synth_cfg_t *c) {
+    c->links = 8;
+    c->hz = 100;
+    c->jitter = 0.2;
+    c->snr_db = 25;
+    c->noise_floor = -93;
+    c->taps = 8;
+    c->delay_spread_ns = 40;
+    c->k_factor_db = 3;
+    c->motion_db = -6;
+    c->shadow_db = 3;
+    c->speed_mps = 1.0f;
+    c->quiet_s = 20;
+    c->motion_s = 5;
+    c->coverage = 0.5;
+    c->channel = 6;
+    c->seed = 1;
+}
+
+// xorshift64*, reproducible for a seed
+static inline uint64_t _synth_next(csi_synth_t *s) {
+    s->rand ^= s->rand >> 12;
+    s->rand ^= s->rand << 25;
+    s->rand ^= s->rand >> 27;
+    return s->rand * 2685821657736338717ull;
+}
+
+static inline double _synth_uniform(csi_synth_t *s) {
+    return (_synth_next(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static inline float _synth_gauss(csi_synth_t *s) {
+    return s->noise[_synth_next(s) >> (64 - 12)];
+}
+
+static inline int8_t _synth_quantize(float x) {
+    return lrintf(fminf(127, fmaxf(-128, x)));
+}
+
+/* Static taps of a link and their response on the 128 subcarriers, normalized to unit power. */
+static void _synth_static(csi_synth_t *s, synth_link_t *l) {
+    const synth_cfg_t *c = &s->cfg;
+    int taps = c->taps < 1 ? 1 : (c->taps > SYNTH_MAX_TAPS ? SYNTH_MAX_TAPS : c->taps);
+    double delay[SYNTH_MAX_TAPS], power[SYNTH_MAX_TAPS], phase[SYNTH_MAX_TAPS];
+    double nlos = 0;
+    delay[0] = 0;
+    for (int i = 1; i < taps; i++) {
+        delay[i] = -log(1.0 - _synth_uniform(s)) * c->delay_spread_ns;
+        power[i] = exp(-delay[i] / c->delay_spread_ns);
+        nlos += power[i];
+    }
+    power[0] = taps > 1 ? nlos * pow(10.0, c->k_factor_db / 10.0) : 1;
+    // scale the excess delays so the profile has exactly the configured rms delay spread
+    double p = 0, m1 = 0, m2 = 0;
+    for (int i = 0; i < taps; i++) {
+        p += power[i];
+        m1 += power[i] * delay[i];
+        m2 += power[i] * delay[i] * delay[i];
+        phase[i] = 2 * M_PI * _synth_uniform(s);
+    }
+    double rms = sqrt(m2 / p - (m1 / p) * (m1 / p));
+    double scale = rms > 0 ? c->delay_spread_ns / rms : 1;
+    // line of sight over a few meters
+    double los_ns = 10 + 30 * _synth_uniform(s);
+    double sum = 0;
+    for (int k = 0; k < SYNTH_SUBCARRIERS; k++) {
+        double f = (k - SYNTH_SUBCARRIERS / 2) * SYNTH_DF_HZ;
+        double re = 0, im = 0;
+        for (int i = 0; i < taps; i++) {
+            double a = sqrt(power[i] / p);
+            double arg = phase[i] - 2 * M_PI * f * (los_ns + delay[i] * scale) * 1e-9;
+            re += a * cos(arg);
+            im += a * sin(arg);
+        }
+        l->static_re[k] = re;
+        l->static_im[k] = im;
+        sum += re * re + im * im;
+    }
+    // taps closer than the resolution add up coherently, the rssi is set by the mean power
+    float norm = 1 / sqrt(sum / SYNTH_SUBCARRIERS);
+    for (int k = 0; k < SYNTH_SUBCARRIERS; k++) {
+        l->static_re[k] *= norm;
+        l->static_im[k] *= norm;
+    }
+}
+
+/* Plan motion events over duration_us, each on a random subset of the links. */
+static void _synth_plan(csi_synth_t *s, uint64_t duration_us) {
+    const synth_cfg_t *c = &s->cfg;
+    s->n_events = 0;
+    double t = -log(1.0 - _synth_uniform(s)) * c->quiet_s;
+    while (t * 1e6 < duration_us && s->n_events < SYNTH_MAX_EVENTS && c->motion_s > 0) {
+        synth_event_t *e = &s->events[s->n_events++];
+        double len = c->motion_s * (0.5 + _synth_uniform(s));
+        e->start_us = t * 1e6;
+        e->end_us = (t + len) * 1e6;
+        e->links = 0;
+        for (int i = 0; i < c->links; i++) {
+            if (_synth_uniform(s) < c->coverage) {
+                e->links |= 1ull << i;
+            }
+        }
+        if (e->links == 0) {
+            e->links = 1ull << (_synth_next(s) % c->links);
+        }
+        t += len - log(1.0 - _synth_uniform(s)) * c->quiet_s;
+    }
+}
+
+/*
+ * Set up the links of cfg with macs base_mac + i, and plan the motion events of the first
+ * duration_us. Frames are then generated with synth_frame() in time order.
+ */
+bool synth_init(csi_synth_t *s, const synth_cfg_t *cfg, const uint8_t base_mac[6], uint64_t duration_us) {
+    if (cfg->links < 1 || cfg->links > SYNTH_MAX_LINKS || cfg->hz <= 0 || cfg->channel < 1 || cfg->channel > 9) {
+        return false;
+    }
+    memset(s, 0, sizeof(*s));
+    s->cfg = *cfg;
+    s->rand = 0x9e3779b97f4a7c15ull ^ ((uint64_t)cfg->seed << 17) ^ cfg->seed;
+    for (int i = 0; i < SYNTH_NOISE_TABLE; i += 2) {
+        double u = (i + 0.5) / SYNTH_NOISE_TABLE;
+        double r = sqrt(-2 * log(u)), a = 2 * M_PI * _synth_uniform(s);
+        s->noise[i] = r * cos(a);
+        s->noise[i + 1] = r * sin(a);
+    }
+    // secondary above: the 40 MHz channel is centered 10 MHz over the primary
+    s->fc_hz = (2407.0 + 5.0 * cfg->channel + 10.0) * 1e6;
+    uint32_t base = (base_mac[3] << 16) | (base_mac[4] << 8) | base_mac[5];
+    for (int i = 0; i < cfg->links; i++) {
+        synth_link_t *l = &s->links[i];
+        _synth_static(s, l);
+        l->rssi0 = cfg->noise_floor + cfg->snr_db + 4 * (_synth_uniform(s) - 0.5);
+        for (int m = 0; m < SYNTH_MOVING; m++) {
+            l->amp[m] = sqrtf(powf(10.0f, cfg->motion_db / 10.0f) / SYNTH_MOVING) * (0.5f + _synth_uniform(s));
+            l->tau_ns[m] = 10 + 60 * _synth_uniform(s);
+        }
+        l->next_us = _synth_uniform(s) * 1e6 / cfg->hz;
+        memcpy(l->mac, base_mac, 3);
+        l->mac[3] = (base + i) >> 16;
+        l->mac[4] = (base + i) >> 8;
+        l->mac[5] = base + i;
+    }
+    _synth_plan(s, duration_us);
+    return true;
+}
+
+/* Whether link is in a motion event at t_us. The events do not overlap and are in time order. */
+bool synth_moving(const csi_synth_t *s, int link, uint64_t t_us) {
+    int lo = 0, hi = s->n_events;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (s->events[mid].end_us <= t_us) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < s->n_events && s->events[lo].start_us <= t_us && (s->events[lo].links >> link & 1);
+}
+
+/* Advance the moving paths and shadowing of a link by dt. */
+static void _synth_move(csi_synth_t *s, synth_link_t *l, bool moving, float dt) {
+    const synth_cfg_t *c = &s->cfg;
+    // presence ramps over 200 ms, velocities follow an Ornstein-Uhlenbeck process with 0.5 s memory
+    float ramp = dt / 0.2f;
+    l->presence = moving ? fminf(1, l->presence + ramp) : fmaxf(0, l->presence - ramp);
+    if (l->presence == 0) {
+        l->shadow = 0;
+        return;
+    }
+    float keep = expf(-dt / 0.5f), kick = c->speed_mps * sqrtf(1 - keep * keep);
+    for (int m = 0; m < SYNTH_MOVING; m++) {
+        l->vel[m] = l->vel[m] * keep + kick * _synth_gauss(s);
+        l->len_m[m] += l->vel[m] * dt;
+    }
+    float target = moving ? 0.5f + 0.5f * _synth_gauss(s) : 0;
+    l->shadow += (fminf(1, fmaxf(0, target)) - l->shadow) * fminf(1, dt / 0.3f);
+}
+
+/*
+ * The next frame of link into d, with its CSI in buf[SYNTH_BUF_LEN] (d->buf points there).
+ * Returns the time of the frame in us since the start, and whether it was taken during motion.
+ */
+uint64_t synth_frame(csi_synth_t *s, int link, wifi_csi_info_t *d, int8_t *buf, bool *moving) {
+    const synth_cfg_t *c = &s->cfg;
+    synth_link_t *l = &s->links[link];
+    uint64_t t_us = l->next_us;
+    double period_us = 1e6 / c->hz;
+    l->next_us += (uint64_t)(period_us * (1 + c->jitter * (2 * _synth_uniform(s) - 1)));
+    while (l->event < s->n_events && s->events[l->event].end_us <= t_us) {
+        l->event++;
+    }
+    *moving = l->event < s->n_events && s->events[l->event].start_us <= t_us && (s->events[l->event].links >> link & 1);
+    _synth_move(s, l, *moving, l->frames == 0 ? 0 : (t_us - l->last_us) * 1e-6f);
+    l->last_us = t_us;
+    l->frames++;
+
+    // channel on the 40 MHz grid: shadowed static part plus the moving paths
+    float h_re[SYNTH_SUBCARRIERS], h_im[SYNTH_SUBCARRIERS];
+    float g = powf(10.0f, -c->shadow_db * l->shadow / 20.0f);
+    for (int k = 0; k < SYNTH_SUBCARRIERS; k++) {
+        h_re[k] = g * l->static_re[k];
+        h_im[k] = g * l->static_im[k];
+    }
+    if (l->presence > 0) {
+        for (int m = 0; m < SYNTH_MOVING; m++) {
+            double tau = (l->tau_ns[m] + l->len_m[m] / 0.299792458) * 1e-9;
+            // rotation per subcarrier, and the value at k = -64 including the carrier phase
+            float step_re = cos(2 * M_PI * SYNTH_DF_HZ * tau), step_im = -sin(2 * M_PI * SYNTH_DF_HZ * tau);
+            double arg0 = -2 * M_PI * (s->fc_hz - SYNTH_SUBCARRIERS / 2 * SYNTH_DF_HZ) * tau;
+            float a = l->presence * l->amp[m];
+            float w_re = a * cos(arg0), w_im = a * sin(arg0);
+            for (int k = 0; k < SYNTH_SUBCARRIERS; k++) {
+                h_re[k] += w_re;
+                h_im[k] += w_im;
+                float re = w_re * step_re - w_im * step_im;
+                w_im = w_re * step_im + w_im * step_re;
+                w_re = re;
+            }
+        }
+    }
+    float power = 0;
+    for (int k = 0; k < SYNTH_SUBCARRIERS; k++) {
+        power += h_re[k] * h_re[k] + h_im[k] * h_im[k];
+    }
+    power /= SYNTH_SUBCARRIERS;
+
+    memset(d, 0, sizeof(*d));
+    memcpy(d->mac, l->mac, 6);
+    int rssi = lrintf(l->rssi0 + 10 * log10f(power + 1e-9f) + 0.7f * _synth_gauss(s));
+    d->rx_ctrl.rssi = rssi < -100 ? -100 : (rssi > -10 ? -10 : rssi);
+    d->rx_ctrl.sig_mode = 1;
+    d->rx_ctrl.mcs = 7 - (_synth_next(s) >> 62);
+    d->rx_ctrl.cwb = 1;
+    d->rx_ctrl.smoothing = 1;
+    d->rx_ctrl.not_sounding = 1;
+    d->rx_ctrl.aggregation = _synth_next(s) >> 63;
+    d->rx_ctrl.sgi = _synth_next(s) >> 63;
+    d->rx_ctrl.noise_floor = c->noise_floor;
+    d->rx_ctrl.channel = c->channel;
+    d->rx_ctrl.secondary_channel = 1;
+    d->rx_ctrl.timestamp = t_us;
+    d->rx_ctrl.sig_len = 100 + _synth_next(s) % 1400;
+
+    // receiver: noise at the SNR of this frame, common phase and timing offset, AGC, int8
+    float snr = powf(10.0f, (d->rx_ctrl.rssi - c->noise_floor) / 10.0f);
+    float sigma = sqrtf(power / snr / 2);
+    double phi = 2 * M_PI * _synth_uniform(s), sto = (_synth_uniform(s) - 0.5) * 100e-9;
+    float rot_re = cos(2 * M_PI * SYNTH_DF_HZ * sto), rot_im = -sin(2 * M_PI * SYNTH_DF_HZ * sto);
+    double arg0 = phi + 2 * M_PI * SYNTH_SUBCARRIERS / 2 * SYNTH_DF_HZ * sto;
+    float w_re = cos(arg0), w_im = sin(arg0);
+    float peak = 0;
+    for (int k = 0; k < SYNTH_SUBCARRIERS; k++) {
+        float re = h_re[k] * w_re - h_im[k] * w_im;
+        float im = h_re[k] * w_im + h_im[k] * w_re;
+        h_re[k] = re;
+        h_im[k] = im;
+        peak = fmaxf(peak, fmaxf(fabsf(re), fabsf(im)));
+        re = w_re * rot_re - w_im * rot_im;
+        w_im = w_re * rot_im + w_im * rot_re;
+        w_re = re;
+    }
+    float gain = (SYNTH_AGC_PEAK + 8 * (_synth_uniform(s) - 0.5f)) / (peak + 2 * sigma);
+    memset(buf, 0, SYNTH_BUF_LEN);
+    for (int k = -58; k <= 58; k++) {
+        // HT-LTF entries 64 + 0..63 hold k = 0..63, 64 + 64..127 hold k = -64..-1
+        if (k >= -1 && k <= 1) {
+            continue;
+        }
+        int e = 64 + (k >= 0 ? k : SYNTH_SUBCARRIERS + k);
+        buf[2 * e] = _synth_quantize(gain * (h_im[k + 64] + sigma * _synth_gauss(s)));
+        buf[2 * e + 1] = _synth_quantize(gain * (h_re[k + 64] + sigma * _synth_gauss(s)));
+    }
+    for (int m = -26; m <= 26; m++) {
+        // LLTF of the primary 20 MHz, the lower half: subcarrier m is k = m - 32, a symbol with its own noise
+        if (m == 0) {
+            continue;
+        }
+        int e = m >= 0 ? m : 64 + m;
+        int k = m - 32 + 64;
+        buf[2 * e] = _synth_quantize(gain * (h_im[k] + sigma * _synth_gauss(s)));
+        buf[2 * e + 1] = _synth_quantize(gain * (h_re[k] + sigma * _synth_gauss(s)));
+    }
+    d->buf = buf;
+    d->len = SYNTH_BUF_LEN;
+    return t_us;
+}
+
+/* The link whose next frame is due first, frames of all links in time order come from calling this each time. */
+int synth_next_link(const csi_synth_t *s) {
+    int next = 0;
+    for (int i = 1; i < s->cfg.links; i++) {
+        if (s->links[i].next_us < s->links[next].next_us) {
+            next = i;
+        }
+    }
+    return next;
+}
+
+#endif //ESP32_CSI_SYNTH_H
@@ -0,0 +1,201 @@
+/*
+ * Round trip check of the per-peer delta coding in ../_components/delta_component.h.
+ * A corpus of correlated CSI streams (static links with receiver noise, slow drift and
+ * motion episodes) from several peers is packed with the firmware serializers, delta coded
+ * and decoded again, for every payload type:
+ *   - without loss every record must come back byte for byte
+ *   - with datagrams lost, every record that decodes must still be exact, and a broken chain
+ *     must recover at the next keyframe
+ * Then prints the compressed size relative to the uncompressed records.
+ *
+ *   make delta_check && ./delta_check [frames]
+ *   ./delta_check --dump corpus   writes corpus.enc (delta coded, with losses) and corpus.dec
+ *                                 (what delta_decode_record() made of it) for delta_roundtrip.py
+ */
+#include <stddef.h>
+
+#include "esp_shim.h"
+#include "record_component.h"
+#include "delta_component.h"
+#include "bench_common.h"
+
+#define CSI_BUF_LEN     384
+#define LOSS_PERCENT    2
+#define MAX_REC         (sizeof(csi_record_hdr_t) + DELTA_MAX_PAYLOAD)
+
+typedef struct {
+    int8_t base[CSI_BUF_LEN];
+    int8_t buf[CSI_BUF_LEN];
+    wifi_csi_info_t info;
+} stream_peer_t;
+
+static int clamp8(int v) {
+    return v < -128 ? -128 : (v > 127 ? 127 : v);
+}
+
+static int noise(int amp) {
+    return (int)(bench_rand() % (2 * amp + 1)) - amp;
+}
+
+static int n_peers = 4;
+
+static void stream_init(stream_peer_t *peers) {
+    for (int p = 0; p < n_peers; p++) {
+        stream_peer_t *s = &peers[p];
+        memset(&s->info, 0, sizeof(s->info));
+        uint8_t mac[6] = {0x3c, 0x61, 0x05, 0x4c, 0x36 + p / 16, (uint8_t)(0xc0 + p % 16)};
+        memcpy(s->info.mac, mac, 6);
+        s->info.rx_ctrl.sig_mode = 1;
+        s->info.rx_ctrl.cwb = 1;
+        s->info.rx_ctrl.channel = 1;
+        s->info.rx_ctrl.secondary_channel = 1;
+        s->info.rx_ctrl.noise_floor = -93;
+        s->info.buf = s->buf;
+        s->info.len = CSI_BUF_LEN;
+        for (int i = 0; i < CSI_BUF_LEN; i++) {
+            s->base[i] = noise(40);
+        }
+    }
+}
+
+/* Next frame of peer p: receiver noise on a static channel, which drifts slowly, with larger changes while something moves. */
+static wifi_csi_info_t *stream_next(stream_peer_t *peers, int frame) {
+    stream_peer_t *s = &peers[frame % n_peers];
+    int t = frame / n_peers;
+    bool motion = (t / 500) % 4 == 3;
+    if (bench_rand() % 16 == 0) {
+        int i = bench_rand() % CSI_BUF_LEN;
+        s->base[i] = clamp8(s->base[i] + noise(1));
+    }
+    for (int i = 0; i < CSI_BUF_LEN; i++) {
+        s->buf[i] = clamp8(s->base[i] + noise(motion ? 12 : 1));
+    }
+    s->info.rx_ctrl.rssi = -45 + noise(2);
+    s->info.rx_ctrl.timestamp = t * 10000;
+    return &s->info;
+}
+
+static int run(uint8_t type, int frames, int loss_percent, FILE *enc_out, FILE *dec_out) {
+    static stream_peer_t peers[PEER_MAX_PEERS];
+    static csi_delta_t enc, dec;
+    static uint8_t orig[MAX_REC], rec[MAX_REC], out[MAX_REC];
+    bench_rand_state = 0x12345678;
+    stream_init(peers);
+    delta_init(&enc, CSI_DELTA_KEYFRAME_INTERVAL);
+    delta_init(&dec, CSI_DELTA_KEYFRAME_INTERVAL);
+
+    size_t raw_bytes = 0, enc_bytes = 0;
+    int lost = 0, undecodable = 0, keyframes = 0;
+    for (int f = 0; f < frames; f++) {
+        wifi_csi_info_t *d = stream_next(peers, f);
+        size_t len = csi_record_pack_type(d, type, orig, sizeof(orig));
+        csi_record_stamp(orig, f / n_peers, d->rx_ctrl.timestamp + 100, d->rx_ctrl.timestamp + 150);
+        memcpy(rec, orig, len);
+        size_t rec_len = delta_encode_record(&enc, rec, len);
+        // the decoder restores the record as sent, which carries the record count of its peer
+        orig[offsetof(csi_record_hdr_t, delta_seq)] = rec[offsetof(csi_record_hdr_t, delta_seq)];
+        raw_bytes += len;
+        enc_bytes += rec_len;
+        keyframes += !(rec[3] & CSI_RECORD_FLAG_DELTA);
+
+        if (loss_percent > 0 && (int)(bench_rand() % 100) < loss_percent) {
+            lost++;
+            continue;
+        }
+        if (enc_out != NULL) {
+            fwrite(rec, 1, rec_len, enc_out);
+        }
+        size_t out_len = delta_decode_record(&dec, rec, out, sizeof(out));
+        if (out_len == 0) {
+            if (loss_percent == 0) {
+                fprintf(stderr, "type %d: frame %d not decodable without loss\n", type, f);
+                return 1;
+            }
+            undecodable++;
+            continue;
+        }
+        if (out_len != len || memcmp(out, orig, len) != 0) {
+            fprintf(stderr, "type %d: frame %d decoded wrong\n", type, f);
+            return 1;
+        }
+        if (dec_out != NULL) {
+            fwrite(out, 1, out_len, dec_out);
+        }
+    }
+    // a chain is at most one keyframe interval long, so a loss costs at most that many records of its peer
+    if (undecodable > lost * (CSI_DELTA_KEYFRAME_INTERVAL - 1)) {
+        fprintf(stderr, "type %d: %d records lost, %d undecodable\n", type, lost, undecodable);
+        return 1;
+    }
+    // as many peers as the peer filter holds keep their references
+    if (enc.peers.evictions != 0 || dec.peers.evictions != 0) {
+        fprintf(stderr, "type %d: %u peers evicted\n", type, enc.peers.evictions);
+        return 1;
+    }
+    if (loss_percent == 0) {
+        printf("  type %d: %7zu -> %7zu bytes (%.2f), %d keyframes\n",
+               type, raw_bytes, enc_bytes, (double)enc_bytes / raw_bytes, keyframes);
+    } else {
+        printf("  type %d: %d of %d records lost, %d more undecodable until the next keyframe\n",
+               type, lost, frames, undecodable);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 2 && strcmp(argv[1], "--dump") == 0) {
+        char path[256];
+        snprintf(path, sizeof(path), "%s.enc", argv[2]);
+        FILE *enc_out = fopen(path, "wb");
+        snprintf(path, sizeof(path), "%s.dec", argv[2]);
+        FILE *dec_out = fopen(path, "wb");
+        if (enc_out == NULL || dec_out == NULL) {
+            perror("fopen");
+            return 1;
+        }
+        int err = 0;
+        for (uint8_t t = CSI_RECORD_TYPE_RAW; t <= CSI_RECORD_TYPE_AMP_PHASE; t++) {
+            err |= run(t, 2000, LOSS_PERCENT, enc_out, dec_out);
+        }
+        fclose(enc_out);
+        fclose(dec_out);
+        return err;
+    }
+
+    int frames = argc > 1 ? atoi(argv[1]) : 8000;
+    printf("%d frames from %d peers, keyframe every %d records, lossless round trip\n",
+           frames, n_peers, CSI_DELTA_KEYFRAME_INTERVAL);
+    for (uint8_t t = CSI_RECORD_TYPE_RAW; t <= CSI_RECORD_TYPE_AMP_PHASE; t++) {
+        if (run(t, frames, 0, NULL, NULL)) {
+            return 1;
+        }
+    }
+    printf("%d%% of the records lost\n", LOSS_PERCENT);
+    for (uint8_t t = CSI_RECORD_TYPE_RAW; t <= CSI_RECORD_TYPE_AMP_PHASE; t++) {
+        if (run(t, frames, LOSS_PERCENT, NULL, NULL)) {
+            return 1;
+        }
+    }
+
+    n_peers = PEER_MAX_PEERS;
+    printf("%d frames from %d peers\n", frames * 4, n_peers);
+    if (run(CSI_RECORD_TYPE_RAW, frames * 4, 0, NULL, NULL)) {
+        return 1;
+    }
+
+    n_peers = 4;
+    static stream_peer_t peers[PEER_MAX_PEERS];
+    static csi_delta_t enc;
+    static uint8_t rec[MAX_REC];
+    stream_init(peers);
+    delta_init(&enc, CSI_DELTA_KEYFRAME_INTERVAL);
+    size_t sink = 0;
+    double t0 = bench_now();
+    for (int f = 0; f < frames; f++) {
+        size_t len = csi_record_pack_type(stream_next(peers, f), CSI_RECORD_TYPE_RAW, rec, sizeof(rec));
+        sink += delta_encode_record(&enc, rec, len);
+    }
+    double t1 = bench_now();
+    printf("pack + delta code raw records: %.0f frames/s (sink %zu)\n", frames / (t1 - t0), sink);
+    return 0;
+}
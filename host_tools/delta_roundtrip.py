@@ -0,0 +1,38 @@
+#!/usr/bin/env python3
+# Checks csi_record.DeltaDecoder against delta_decode_record() in C on the corpus of delta_check:
+#   ./delta_check --dump /tmp/corpus && ./delta_roundtrip.py /tmp/corpus
+# Both must decode the same records (some are lost in the corpus) to the same values.
+import os
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "active_ap"))
+import csi_record
+
+def records (data, decoder) :
+    offset = 0
+    while offset < len(data):
+        (mac_addr, rx_ctrl_data, rec_type, csi_data, stamp, offset) = csi_record.parse_record(data, offset, decoder)
+        if csi_data is not None:
+            yield (mac_addr, rx_ctrl_data, rec_type, csi_data, stamp)
+
+def main () :
+    prefix = sys.argv[1]
+    with open(prefix + ".enc", "rb") as f:
+        enc = f.read()
+    with open(prefix + ".dec", "rb") as f:
+        dec = f.read()
+
+    decoded = list(records(enc, csi_record.DeltaDecoder()))
+    expected = list(records(dec, None))
+    if len(decoded) != len(expected):
+        print("python decoded {} records, C decoded {}".format(len(decoded), len(expected)))
+        return 1
+    for i in range(len(expected)):
+        if decoded[i] != expected[i]:
+            print("record {} differs".format(i))
+            return 1
+    print("{} records from {} bytes decoded identically".format(len(decoded), len(enc)))
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
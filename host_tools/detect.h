@@ -0,0 +1,208 @@
+#ifndef ESP32_CSI_DETECT_H
+#define ESP32_CSI_DETECT_H
+
+/*
+ * Streaming motion detector, crossing_decction() of active_ap/host_processing_pyqt.py for every
+ * node instead of TARGET_NODE only. Include after esp_shim.h, ingest.h and cook.h.
+ *
+ * Per node it keeps an EMA baseline of the cooked CSI (dB per subcarrier, as cook.h makes it) and
+ * the running sum of the last window frames, so a frame costs O(subcarriers) whatever the window:
+ *   score = max over the subcarriers of |mean of the window - baseline|
+ * The baseline starts at the first frame, not at zero as in crossing_decction(). After warmup
+ * frames a node turns active when the score goes over threshold, and quiet again once it stayed
+ * under release for hold frames. Each turn is a detect_event_t to the emit callback.
+ *
+ * The same detector in Python is active_ap/csi_detect.py.
+ * Used by csi_ingest -e, detect_bench.
+ */
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#define DETECT_MAX_NODES    INGEST_MAX_NODES
+#define DETECT_MAX_WINDOW   64
+#define DETECT_SUBCARRIERS  COOK_SUBCARRIERS
+#define DETECT_RESUM_FRAMES 1024    // the running sums are added up again this often
+
+enum {
+    DETECT_START = 1,
+    DETECT_END = 2,
+};
+
+typedef struct {
+    float alpha;            // weight of the old baseline per frame, baseline_alpha
+    int window;             // frames averaged against the baseline, LOG_LEN
+    int warmup;             // frames of a node before it decides, TEST_MIN_NUM
+    float threshold;        // dB, DIFF_THRESHOLD
+    float release;          // dB, at most threshold
+    int hold;               // frames under release before the end of an event
+} detect_cfg_t;
+
+typedef struct {
+    uint64_t t_us;          // of the frame that started or ended the event
+    uint16_t node;
+    uint8_t type;           // DETECT_START or DETECT_END
+    uint8_t reserved;
+    float score;            // at the start, the highest of the event at the end
+    uint32_t frames;        // of the event so far, 0 at the start
+} detect_event_t;
+
+typedef void (*detect_emit_t)(void *ctx, const detect_event_t *event);
+
+typedef struct {
+    float baseline[DETECT_SUBCARRIERS];
+    float sum[DETECT_SUBCARRIERS];      // of the frames in the ring
+    float ring[DETECT_MAX_WINDOW][DETECT_SUBCARRIERS];
+    uint32_t head;
+    uint64_t frames;
+    float score;
+    bool active;
+    int below;              // frames under release while active
+    float peak;
+    uint32_t event_frames;
+} detect_node_t;
+
+typedef struct {
+    detect_cfg_t cfg;
+    detect_emit_t emit;
+    void *ctx;
+    uint64_t events;
+    detect_node_t nodes[DETECT_MAX_NODES];
+    float amp_db[DETECT_SUBCARRIERS];
+    float snr_db;
+    float dev[DETECT_SUBCARRIERS];
+} csi_detect_t;
+
+/* The settings of host_processing_pyqt.py, with a little hysteresis. */
+void detect_default_cfg(detect_cfg_t *c) {
+    c->alpha = 0.95f;
+    c->window = 3;
+    c->warmup = 100;
+    c->threshold = 3;
+    c->release = 2;
+    c->hold = 10;
+}
+
+bool detect_init(csi_detect_t *d, const detect_cfg_t *cfg, detect_emit_t emit, void *ctx) {
+    if (cfg->window < 1 || cfg->window > DETECT_MAX_WINDOW || cfg->alpha < 0 || cfg->alpha >= 1 ||
+            cfg->release > cfg->threshold || cfg->hold < 0) {
+        return false;
+    }
+    memset(d, 0, sizeof(*d));
+    d->cfg = *cfg;
+    d->emit = emit;
+    d->ctx = ctx;
+    return true;
+}
+
+/* The running sums again from the full ring, before float rounding adds up over many frames. */
+static void _detect_resum(const csi_detect_t *d, detect_node_t *n) {
+    memset(n->sum, 0, sizeof(n->sum));
+    for (int i = 0; i < d->cfg.window; i++) {
+        for (int k = 0; k < DETECT_SUBCARRIERS; k++) {
+            n->sum[k] += n->ring[i][k];
+        }
+    }
+}
+
+static void _detect_emit(csi_detect_t *d, uint16_t node, uint8_t type, uint64_t t_us, float score, uint32_t frames) {
+    detect_event_t e = {.t_us = t_us, .node = node, .type = type, .score = score, .frames = frames};
+    d->events++;
+    if (d->emit != NULL) {
+        d->emit(d->ctx, &e);
+    }
+}
+
+/*
+ * One cooked frame of node, amp_db[DETECT_SUBCARRIERS]. Returns the score, 0 while the node
+ * fills its window and warms up.
+ */
+float detect_update(csi_detect_t *d, uint16_t node, uint64_t t_us, const float *amp_db) {
+    const detect_cfg_t *c = &d->cfg;
+    detect_node_t *n = &d->nodes[node];
+    if (n->frames == 0) {
+        memcpy(n->baseline, amp_db, sizeof(n->baseline));
+    }
+    float *old = n->ring[n->head];
+    float keep = n->frames >= (uint64_t)c->window ? 1 : 0;
+    float a = c->alpha, b = 1 - c->alpha, inv = 1.0f / c->window;
+    // branch free, in separate loops so the compiler vectorizes them
+    for (int k = 0; k < DETECT_SUBCARRIERS; k++) {
+        n->sum[k] += amp_db[k] - keep * old[k];
+        old[k] = amp_db[k];
+        n->baseline[k] = n->baseline[k] * a + amp_db[k] * b;
+        d->dev[k] = fabsf(n->sum[k] * inv - n->baseline[k]);
+    }
+    float score = 0;
+    for (int k = 0; k < DETECT_SUBCARRIERS; k++) {
+        score = d->dev[k] > score ? d->dev[k] : score;
+    }
+    n->head = n->head + 1 == (uint32_t)c->window ? 0 : n->head + 1;
+    n->frames++;
+    if (n->frames % DETECT_RESUM_FRAMES == 0) {
+        _detect_resum(d, n);
+    }
+    if (n->frames < (uint64_t)c->warmup || n->frames < (uint64_t)c->window) {
+        return n->score = 0;
+    }
+    n->score = score;
+
+    if (!n->active) {
+        if (score > c->threshold) {
+            n->active = true;
+            n->below = 0;
+            n->peak = score;
+            n->event_frames = 0;
+            _detect_emit(d, node, DETECT_START, t_us, score, 0);
+        }
+        return score;
+    }
+    n->event_frames++;
+    n->peak = fmaxf(n->peak, score);
+    n->below = score < c->release ? n->below + 1 : 0;
+    if (n->below > c->hold) {
+        n->active = false;
+        _detect_emit(d, node, DETECT_END, t_us, n->peak, n->event_frames);
+    }
+    return score;
+}
+
+/*
+ * A decoded frame: cooked as host_processing_pyqt.py does (HT40 frames without stbc, not
+ * CSI_RECORD_TYPE_PHASE), then detect_update() with its host_us.
+ * Returns false for frames it does not use.
+ */
+bool detect_frame(csi_detect_t *d, const csi_frame_t *f) {
+    const csi_record_hdr_t *h = &f->hdr;
+    if (f->node >= DETECT_MAX_NODES || h->sig_mode != 1 || h->cwb != 1 || h->stbc != 0) {
+        return false;
+    }
+    switch (h->type) {
+        case CSI_RECORD_TYPE_RAW:
+            if (h->csi_len != COOK_RAW_LEN) {
+                return false;
+            }
+            cook_raw_batch(1, &h->rssi, &h->noise_floor, (const int8_t *)f->csi, &d->snr_db, d->amp_db);
+            break;
+        case CSI_RECORD_TYPE_SUBCARRIERS:
+            if (h->csi_len != 2 * COOK_SUBCARRIERS) {
+                return false;
+            }
+            cook_subcarriers_batch(1, &h->rssi, &h->noise_floor, (const int8_t *)f->csi, &d->snr_db, d->amp_db);
+            break;
+        case CSI_RECORD_TYPE_AMPLITUDE:
+        case CSI_RECORD_TYPE_AMP_PHASE:
+            // the amplitudes come first, csi is 4 byte aligned in csi_frame_t
+            if (h->csi_len < COOK_SUBCARRIERS * sizeof(int16_t)) {
+                return false;
+            }
+            cook_amplitude_batch(1, &h->rssi, &h->noise_floor, (const int16_t *)f->csi, &d->snr_db, d->amp_db);
+            break;
+        default:
+            return false;
+    }
+    detect_update(d, f->node, f->host_us, d->amp_db);
+    return true;
+}
+
+#endif //ESP32_CSI_DETECT_H
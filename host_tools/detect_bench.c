@@ -0,0 +1,277 @@
+/*
+ * Throughput of the streaming detector in detect.h on a synthetic corpus (csi_synth.h) of many
+ * links with labelled motion, against crossing_decction() as host_processing_pyqt.py runs it:
+ * the window kept as a list of frames and averaged again on every frame.
+ *   - the scores of both must agree on every frame of every node
+ *   - cost per frame of cook + detect, of detect alone, and of the rescan, for a few windows
+ *   - events against the labels: starts during motion, and the motion events found
+ *
+ *   make detect_bench && ./detect_bench [links] [seconds]
+ *   ./detect_bench --dump /tmp/detect    writes detect.frames (node, host_us and the cooked frame
+ *                                        of every frame), detect.events and the fused decisions
+ *                                        of fusion.h in detect.epochs for detect_check.py
+ */
+#include "esp_shim.h"
+#include "ingest.h"
+#include "cook.h"
+#include "detect.h"
+#include "fusion.h"
+#include "csi_synth.h"
+#include "bench_common.h"
+
+#define HZ              100
+#define LATE_US         500000  // a start this long after the end of a motion event still counts
+
+typedef struct {
+    csi_frame_t *frames;
+    float (*amp_db)[DETECT_SUBCARRIERS];
+    int n;
+    csi_synth_t synth;
+} corpus_t;
+
+typedef struct {
+    detect_event_t *events;
+    int n, cap;
+} event_log_t;
+
+static void log_event(void *ctx, const detect_event_t *e) {
+    event_log_t *log = ctx;
+    if (log->n < log->cap) {
+        log->events[log->n++] = *e;
+    }
+}
+
+/* The frames of all links in time order, as csi_ingest would publish them. */
+static void make_corpus(corpus_t *c, int links, double seconds) {
+    synth_cfg_t cfg;
+    synth_default_cfg(&cfg);
+    cfg.links = links;
+    cfg.hz = HZ;
+    // a shorter quiet time than the default, for enough events in a short run
+    cfg.quiet_s = 10;
+    uint8_t mac[6] = {0x3c, 0x61, 0x05, 0x4c, 0x36, 0x00};
+    uint64_t duration_us = seconds * 1e6;
+    synth_init(&c->synth, &cfg, mac, duration_us);
+    int cap = links * seconds * HZ * 1.3 + 16;
+    c->frames = calloc(cap, sizeof(*c->frames));
+    c->amp_db = calloc(cap, sizeof(*c->amp_db));
+    c->n = 0;
+    static uint8_t rec[sizeof(csi_record_hdr_t) + SYNTH_BUF_LEN];
+    static int8_t buf[SYNTH_BUF_LEN];
+    while (c->n < cap) {
+        int link = synth_next_link(&c->synth);
+        if (c->synth.links[link].next_us >= duration_us) {
+            break;
+        }
+        wifi_csi_info_t d;
+        csi_frame_t *f = &c->frames[c->n];
+        bool moving;
+        uint64_t t_us = synth_frame(&c->synth, link, &d, buf, &moving);
+        size_t len = csi_record_pack(&d, rec, sizeof(rec));
+        f->host_us = t_us;
+        f->node = link;
+        memcpy(&f->hdr, rec, sizeof(f->hdr));
+        memcpy(f->csi, rec + sizeof(f->hdr), len - sizeof(f->hdr));
+        float snr_db;
+        cook_raw_batch(1, &f->hdr.rssi, &f->hdr.noise_floor, (const int8_t *)f->csi, &snr_db, c->amp_db[c->n]);
+        c->n++;
+    }
+}
+
+/* crossing_decction(): the last window frames of each node, averaged again on every frame. */
+typedef struct {
+    float baseline[DETECT_MAX_NODES][DETECT_SUBCARRIERS];
+    float hist[DETECT_MAX_NODES][DETECT_MAX_WINDOW][DETECT_SUBCARRIERS];
+    uint64_t frames[DETECT_MAX_NODES];
+} rescan_t;
+
+static float rescan_update(rescan_t *r, const detect_cfg_t *c, uint16_t node, const float *amp_db) {
+    float *baseline = r->baseline[node];
+    float (*hist)[DETECT_SUBCARRIERS] = r->hist[node];
+    uint64_t n = r->frames[node]++;
+    if (n == 0) {
+        memcpy(baseline, amp_db, sizeof(r->baseline[node]));
+    }
+    int w = c->window;
+    if (n >= (uint64_t)w) {
+        memmove(hist[0], hist[1], (w - 1) * sizeof(hist[0]));
+    }
+    memcpy(hist[n < (uint64_t)w ? n : (uint64_t)w - 1], amp_db, sizeof(hist[0]));
+    float score = 0;
+    for (int k = 0; k < DETECT_SUBCARRIERS; k++) {
+        baseline[k] = baseline[k] * c->alpha + amp_db[k] * (1 - c->alpha);
+        float diff = 0;
+        for (int i = 0; i < w; i++) {
+            diff += (hist[i][k] - baseline[k]) / w;
+        }
+        score = fmaxf(score, fabsf(diff));
+    }
+    return n + 1 < (uint64_t)c->warmup || n + 1 < (uint64_t)w ? 0 : score;
+}
+
+/* Starts during motion of their link, and labelled events of a link with a start. */
+static void score_events(const corpus_t *c, const event_log_t *log, int links, int *starts, int *true_starts,
+                         int *found, int *labelled) {
+    *starts = *true_starts = *found = *labelled = 0;
+    const csi_synth_t *s = &c->synth;
+    for (int i = 0; i < log->n; i++) {
+        const detect_event_t *e = &log->events[i];
+        if (e->type != DETECT_START) {
+            continue;
+        }
+        (*starts)++;
+        *true_starts += synth_moving(s, e->node, e->t_us) ||
+                        (e->t_us > LATE_US && synth_moving(s, e->node, e->t_us - LATE_US));
+    }
+    for (int m = 0; m < s->n_events; m++) {
+        const synth_event_t *ev = &s->events[m];
+        for (int link = 0; link < links; link++) {
+            if (!(ev->links >> link & 1) || ev->end_us > c->frames[c->n - 1].host_us) {
+                continue;
+            }
+            (*labelled)++;
+            for (int i = 0; i < log->n; i++) {
+                const detect_event_t *e = &log->events[i];
+                if (e->type == DETECT_START && e->node == link && e->t_us >= ev->start_us && e->t_us < ev->end_us + LATE_US) {
+                    (*found)++;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+static void write_epoch(void *ctx, const fusion_epoch_t *e) {
+    fprintf(ctx, "%lu %d %d %.6f %d\n", e->start_us, e->links, e->votes, e->score, e->motion);
+}
+
+static int dump(const char *prefix, const corpus_t *c, const detect_cfg_t *cfg) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s.frames", prefix);
+    FILE *frames = fopen(path, "wb");
+    snprintf(path, sizeof(path), "%s.events", prefix);
+    FILE *events = fopen(path, "w");
+    snprintf(path, sizeof(path), "%s.epochs", prefix);
+    FILE *epochs = fopen(path, "w");
+    if (frames == NULL || events == NULL || epochs == NULL) {
+        perror("fopen");
+        return 1;
+    }
+    static csi_detect_t det;
+    static detect_event_t buf[1 << 16];
+    event_log_t log = {buf, 0, 1 << 16};
+    detect_init(&det, cfg, log_event, &log);
+    for (int i = 0; i < c->n; i++) {
+        uint16_t node = c->frames[i].node;
+        uint64_t t_us = c->frames[i].host_us;
+        fwrite(&node, sizeof(node), 1, frames);
+        fwrite(&t_us, sizeof(t_us), 1, frames);
+        fwrite(c->amp_db[i], sizeof(c->amp_db[i]), 1, frames);
+        detect_update(&det, node, t_us, c->amp_db[i]);
+    }
+    for (int i = 0; i < log.n; i++) {
+        const detect_event_t *e = &log.events[i];
+        fprintf(events, "%u %u %lu %.6f %u\n", e->type, e->node, e->t_us, e->score, e->frames);
+    }
+    static csi_fusion_t fusion;
+    fusion_cfg_t fcfg;
+    fusion_default_cfg(&fcfg);
+    fcfg.detect = *cfg;
+    fusion_init(&fusion, &fcfg, write_epoch, epochs);
+    for (int i = 0; i < c->n; i++) {
+        fusion_add(&fusion, &c->frames[i]);
+    }
+    fusion_flush(&fusion);
+    fusion_close(&fusion);
+    fclose(frames);
+    fclose(events);
+    fclose(epochs);
+    printf("%d frames, %d events\n", c->n, log.n);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *dump_prefix = NULL;
+    int links = 32;
+    double seconds = 120;
+    if (argc > 2 && strcmp(argv[1], "--dump") == 0) {
+        dump_prefix = argv[2];
+        links = 8;
+        seconds = 60;
+    } else {
+        if (argc > 1) {
+            links = atoi(argv[1]);
+        }
+        if (argc > 2) {
+            seconds = atof(argv[2]);
+        }
+    }
+    if (links < 1 || links > SYNTH_MAX_LINKS || seconds <= 0) {
+        fprintf(stderr, "usage: %s [links] [seconds] | --dump prefix\n", argv[0]);
+        return 1;
+    }
+    static corpus_t c;
+    make_corpus(&c, links, seconds);
+    detect_cfg_t cfg;
+    detect_default_cfg(&cfg);
+    if (dump_prefix != NULL) {
+        return dump(dump_prefix, &c, &cfg);
+    }
+    printf("%d frames of %d links at %d Hz, %.0f s, %d motion events\n", c.n, links, HZ, seconds, c.synth.n_events);
+
+    static csi_detect_t det;
+    static rescan_t rescan;
+    static detect_event_t buf[1 << 16];
+    event_log_t log = {buf, 0, 1 << 16};
+    int err = 0;
+    static const int windows[] = {3, 10, 30};
+    for (size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); w++) {
+        cfg.window = windows[w];
+        // the scores of every frame against the rescan
+        detect_init(&det, &cfg, NULL, NULL);
+        memset(&rescan, 0, sizeof(rescan));
+        float worst = 0;
+        for (int i = 0; i < c.n; i++) {
+            float a = detect_update(&det, c.frames[i].node, c.frames[i].host_us, c.amp_db[i]);
+            float b = rescan_update(&rescan, &cfg, c.frames[i].node, c.amp_db[i]);
+            worst = fmaxf(worst, fabsf(a - b));
+        }
+        if (worst > 1e-3f) {
+            printf("window %d: scores differ from the rescan by up to %g dB\n", cfg.window, worst);
+            err = 1;
+        }
+
+        double t = bench_now();
+        detect_init(&det, &cfg, log_event, &log);
+        log.n = 0;
+        for (int i = 0; i < c.n; i++) {
+            detect_frame(&det, &c.frames[i]);
+        }
+        double cooked = (bench_now() - t) * 1e9 / c.n;
+        t = bench_now();
+        detect_init(&det, &cfg, NULL, NULL);
+        for (int i = 0; i < c.n; i++) {
+            detect_update(&det, c.frames[i].node, c.frames[i].host_us, c.amp_db[i]);
+        }
+        double streaming = (bench_now() - t) * 1e9 / c.n;
+        t = bench_now();
+        memset(&rescan, 0, sizeof(rescan));
+        for (int i = 0; i < c.n; i++) {
+            rescan_update(&rescan, &cfg, c.frames[i].node, c.amp_db[i]);
+        }
+        double rescanned = (bench_now() - t) * 1e9 / c.n;
+
+        int starts, true_starts, found, labelled;
+        score_events(&c, &log, links, &starts, &true_starts, &found, &labelled);
+        printf("window %2d: cook + detect %4.0f ns/frame (%.2f M frames/s, %4.0f nodes at %d Hz), detect %4.0f ns, rescan %5.0f ns\n",
+               cfg.window, cooked, 1e3 / cooked, 1e9 / cooked / HZ, HZ, streaming, rescanned);
+        printf("           %d starts, %.1f%% during motion, %d of %d motion events found\n", starts,
+               starts > 0 ? 100.0 * true_starts / starts : 0.0, found, labelled);
+    }
+    if (err == 0) {
+        printf("streaming detector checked against the rescan\n");
+    }
+    free(c.frames);
+    free(c.amp_db);
+    return err;
+}
@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+# Runs csi_detect.Detectors over the cooked frames of detect_bench and compares the events with
+# the ones detect.h raised on the same frames, and the epochs of csi_detect.Fusion over their
+# scores with the decisions of fusion.h:
+#   ./detect_bench --dump /tmp/detect && ./detect_check.py /tmp/detect
+# Then frames/s of csi_detect, and of crossing_decction() taken from host_processing_pyqt.py as
+# it was, on the same frames of one node.
+import collections
+import os
+import sys
+import time
+
+import numpy as np
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "active_ap"))
+import csi_detect
+
+SUBCARRIERS = 114
+FRAME = np.dtype([("node", "<u2"), ("t_us", "<u8"), ("csi_db", "<f4", SUBCARRIERS)])
+
+# crossing_decction() and its globals before csi_detect replaced it
+LOG_LEN = 3
+TEST_MIN_NUM = 100
+DIFF_THRESHOLD = 3
+baseline_alpha = 0.95
+csi_data_log = collections.deque()
+csi_db_baseline = np.zeros(SUBCARRIERS)
+test_counter = 0
+def crossing_decction(new_csi_data):
+    global csi_data_log
+    global csi_db_baseline
+    global test_counter
+
+    test_counter += 1
+    if len(csi_data_log) < LOG_LEN:
+        csi_data_log.append( new_csi_data )
+        return False
+    elif test_counter < TEST_MIN_NUM:
+        csi_data_log.popleft()
+        csi_data_log.append( new_csi_data )
+        # update baseline
+        csi_db_baseline = csi_db_baseline * baseline_alpha + new_csi_data * (1 - baseline_alpha)
+        return False
+    else:
+        csi_data_log.popleft()
+        csi_data_log.append( new_csi_data )
+        # update baseline
+        csi_db_baseline = csi_db_baseline * baseline_alpha + new_csi_data * (1 - baseline_alpha)
+
+    csi_diff = np.zeros(SUBCARRIERS)
+    for csi in csi_data_log:
+        csi_diff += ( csi - csi_db_baseline ) / LOG_LEN
+
+    if np.max( np.abs( csi_diff ) ) > DIFF_THRESHOLD:
+        return True
+    else:
+        return False
+
+def main () :
+    prefix = sys.argv[1]
+    frames = np.fromfile(prefix + ".frames", dtype=FRAME)
+    with open(prefix + ".events") as f:
+        expected = [line.split() for line in f]
+    expected = [(int(e[0]), int(e[1]), int(e[2]), float(e[3]), int(e[4])) for e in expected]
+
+    detectors = csi_detect.Detectors()
+    events = []
+    scores = []
+    start = time.perf_counter()
+    for f in frames:
+        node = int(f["node"])
+        e = detectors.update(node, int(f["t_us"]), f["csi_db"])
+        if e is not None:
+            events.append(e)
+        scores.append(detectors.nodes[node].score)
+    busy = time.perf_counter() - start
+    err = 0
+    if len(events) != len(expected):
+        print("{} events, detect.h raised {}".format(len(events), len(expected)))
+        err = 1
+    for (got, want) in zip(events, expected):
+        if got[0:3] != want[0:3] or got[4] != want[4] or abs(got[3] - want[3]) > 1e-3:
+            print("event {}, detect.h raised {}".format(got, want))
+            err = 1
+            break
+    print("{} frames of {} nodes, {} events as detect.h raised them, {:.0f} frames/s".format(
+        len(frames), len(detectors.nodes), len(events), len(frames) / busy))
+
+    fusion = csi_detect.Fusion()
+    epochs = []
+    for (f, score) in zip(frames, scores):
+        epochs += fusion.add(int(f["node"]), int(f["t_us"]), score)
+    epochs += fusion.flush()
+    with open(prefix + ".epochs") as f:
+        expected = [line.split() for line in f]
+    expected = [(int(e[0]), int(e[1]), int(e[2]), float(e[3]), e[4] == "1") for e in expected]
+    if len(epochs) != len(expected):
+        print("{} epochs, fusion.h closed {}".format(len(epochs), len(expected)))
+        err = 1
+    for (got, want) in zip(epochs, expected):
+        if got[0:3] != want[0:3] or got[4] != want[4] or abs(got[3] - want[3]) > 1e-3:
+            print("epoch {}, fusion.h decided {}".format(got, want))
+            err = 1
+            break
+    print("{} epochs, {} with motion, as fusion.h decided them".format(len(epochs), sum(e[4] for e in epochs)))
+
+    one = frames[frames["node"] == 0]["csi_db"].astype(np.float64)
+    start = time.perf_counter()
+    for csi_db in one:
+        crossing_decction(csi_db)
+    print("crossing_decction(): {:.0f} frames/s of one node".format(len(one) / (time.perf_counter() - start)))
+    if err == 0:
+        print("csi_detect checked")
+    return err
+
+if __name__ == "__main__":
+    sys.exit(main())
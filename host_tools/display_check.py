@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+# Checks csi_display.Display, what host_processing_pyqt.py draws from:
+#   ./display_check.py [seconds]
+# The envelope and SNR history of every snapshot must match numpy over the frames added since the
+# previous one, with no frame lost or counted twice. Then a thread adds frames of 8 nodes as fast
+# as it can while snapshots are taken at 10 Hz: frames/s taken in, and the time per snapshot,
+# which must not grow with the frame rate.
+import os
+import sys
+import threading
+import time
+
+import numpy as np
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "active_ap"))
+import csi_display
+
+SUBCARRIERS = 114
+NODES = 8
+DISPLAY_HZ = 10
+
+def check_envelope () :
+    rng = np.random.default_rng(1)
+    display = csi_display.Display(history=5)
+    pending = dict((node, []) for node in range(4))
+    snr = dict((node, [0.0] * 5) for node in range(4))
+    total = 0
+    for tick in range(200):
+        for _ in range(rng.integers(0, 30)):
+            node = int(rng.integers(0, 4))
+            frame = (float(rng.normal(30, 3)), rng.normal(40, 5, SUBCARRIERS))
+            display.add(node, *frame)
+            pending[node].append(frame)
+        snapshot = display.snapshot()
+        for (node, frames) in pending.items():
+            if node not in snapshot:
+                if frames:
+                    print("node {} missing after {} frames".format(node, len(frames)))
+                    return 1
+                continue
+            got = snapshot[node]
+            snr[node] = snr[node][1:] + [np.mean([f[0] for f in frames]) if frames else snr[node][-1]]
+            if got.fresh != len(frames) or not np.allclose(got.snr_db, snr[node]):
+                print("node {} tick {}: {} fresh frames, {} added, snr {} not {}".format(
+                      node, tick, got.fresh, len(frames), got.snr_db, snr[node]))
+                return 1
+            total += got.fresh
+            if not frames:
+                continue
+            csi = np.array([f[1] for f in frames])
+            if (not np.array_equal(got.csi_db, csi[-1]) or not np.array_equal(got.csi_min, csi.min(axis=0)) or
+                    not np.array_equal(got.csi_max, csi.max(axis=0)) or not np.allclose(got.csi_mean, csi.mean(axis=0))):
+                print("node {} tick {}: envelope differs from numpy".format(node, tick))
+                return 1
+            frames.clear()
+    if total != display.frames:
+        print("{} frames in snapshots, {} added".format(total, display.frames))
+        return 1
+    print("envelope, mean and snr history of {} frames in 200 snapshots as numpy makes them".format(total))
+    return 0
+
+# frames/s one thread adds at most rate frames/s, while the main thread snapshots at DISPLAY_HZ
+def run (seconds, rate) :
+    display = csi_display.Display()
+    rng = np.random.default_rng(2)
+    frames = rng.normal(40, 5, (256, SUBCARRIERS))
+    stop = threading.Event()
+
+    def ingest () :
+        n = 0
+        start = time.perf_counter()
+        while not stop.is_set():
+            display.add(n % NODES, 30.0, frames[n % len(frames)])
+            n += 1
+            if rate is not None and n % 64 == 0:
+                ahead = n / rate - (time.perf_counter() - start)
+                if ahead > 0:
+                    time.sleep(ahead)
+
+    thread = threading.Thread(target=ingest)
+    thread.start()
+    busy = 0.0
+    ticks = 0
+    seen = 0
+    start = time.perf_counter()
+    while time.perf_counter() - start < seconds:
+        time.sleep(1.0 / DISPLAY_HZ)
+        t = time.perf_counter()
+        snapshot = display.snapshot()
+        busy += time.perf_counter() - t
+        ticks += 1
+        seen += sum(node.fresh for node in snapshot.values())
+    stop.set()
+    thread.join()
+    elapsed = time.perf_counter() - start
+    seen += sum(node.fresh for node in display.snapshot().values())
+    return (display.frames / elapsed, busy / ticks * 1e3, seen == display.frames)
+
+def main () :
+    seconds = float(sys.argv[1]) if len(sys.argv) > 1 else 2
+    err = check_envelope()
+    times = []
+    for rate in (1000, None):
+        (fps, ms, complete) = run(seconds, rate)
+        times.append(ms)
+        print("{:>9} frames/s offered: {:.0f} taken in, {:.3f} ms per snapshot of {} nodes".format(
+              "full" if rate is None else rate, fps, ms, NODES))
+        if not complete:
+            print("frames lost between snapshots")
+            err = 1
+    # the copy out is the same whatever came in, allow for the contention on the lock
+    if times[1] > 5 * times[0] + 1:
+        print("snapshot cost grows with the frame rate")
+        err = 1
+    if err == 0:
+        print("csi_display checked")
+    return err
+
+if __name__ == "__main__":
+    sys.exit(main())
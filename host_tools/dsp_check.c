@@ -0,0 +1,215 @@
+/*
+ * Checks the integer CSI kernels of ../_components/dsp_component.h against double precision
+ * on every possible (imaginary, real) int8 pair, the subcarrier selection against the index
+ * math of cook_csi_data() in host_processing_pyqt.py, and times both kernels against the
+ * sqrt(pow()) / atan2() they replace. Exits non-zero if a stated error bound is exceeded.
+ *
+ *   make dsp_check && ./dsp_check [frames]
+ */
+#include <math.h>
+
+#include "esp_shim.h"
+#include "csi_component.h"
+#include "record_component.h"
+#include "bench_common.h"
+
+#define CSI_BUF_LEN 384
+
+#define AMP_Q4_BOUND    (1.0 / 32)
+#define AMP_E4_BOUND    0.002
+#define PHASE_BOUND     2.0         // binary angle units, 32768 = pi
+
+// difference of two angles in binary angle units, wrapped into [-32768, 32768)
+static double phase_diff(double a, double b) {
+    double d = fmod(a - b + 3 * 32768.0, 65536.0) - 32768.0;
+    return fabs(d);
+}
+
+static int check_kernels(void) {
+    double amp_q4_err = 0, amp_e4_err = 0, phase_err = 0, phase_e4_err = 0;
+    for (int im = -128; im < 128; im++) {
+        for (int re = -128; re < 128; re++) {
+            double amp = sqrt((double)im * im + (double)re * re);
+            double e = fabs(dsp_amplitude_q4(im, re) / 16.0 - amp);
+            amp_q4_err = e > amp_q4_err ? e : amp_q4_err;
+            e = fabs(dsp_amplitude_e4(im, re) / 1e4 - amp);
+            amp_e4_err = e > amp_e4_err ? e : amp_e4_err;
+
+            if (im == 0 && re == 0) {
+                if (dsp_phase_q15(0, 0) != 0) {
+                    fprintf(stderr, "phase of 0 is %d\n", dsp_phase_q15(0, 0));
+                    return 1;
+                }
+                continue;
+            }
+            double ref = atan2(im, re);
+            int16_t p = dsp_phase_q15(im, re);
+            e = phase_diff(p, ref / M_PI * 32768);
+            phase_err = e > phase_err ? e : phase_err;
+            // the text formats print (-pi, pi] like atan2(), +pi never shows up as -pi
+            e = fabs(dsp_phase_e4(im, re) / 1e4 - ref);
+            phase_e4_err = e > phase_e4_err ? e : phase_e4_err;
+        }
+    }
+    printf("max |error| over all 65536 int8 pairs\n");
+    printf("  amplitude Q4 : %.6f (bound %.6f)\n", amp_q4_err, AMP_Q4_BOUND);
+    printf("  amplitude e4 : %.6f (bound %.6f)\n", amp_e4_err, AMP_E4_BOUND);
+    printf("  phase        : %.3f units, %.6f rad (bound %.1f units)\n", phase_err, phase_err * M_PI / 32768, PHASE_BOUND);
+    printf("  phase e4     : %.6f rad\n", phase_e4_err);
+    if (amp_q4_err > AMP_Q4_BOUND || amp_e4_err > AMP_E4_BOUND || phase_err > PHASE_BOUND ||
+        phase_e4_err > PHASE_BOUND * M_PI / 32768 + 0.5e-4) {
+        fprintf(stderr, "error bound exceeded\n");
+        return 1;
+    }
+    return 0;
+}
+
+// floor(sqrt(x)) on both sides of every square up to 2^32 - 1, where a wrong result would show first
+static int check_isqrt(void) {
+    for (uint64_t r = 0; r <= 0xFFFF; r++) {
+        uint64_t lo = r * r;
+        uint64_t hi = r == 0xFFFF ? 0xFFFFFFFFu : (r + 1) * (r + 1) - 1;
+        uint64_t xs[] = {lo, lo + 1, lo + r, hi - 1, hi};
+        for (int i = 0; i < 5; i++) {
+            uint64_t x = xs[i] < lo ? lo : xs[i] > hi ? hi : xs[i];
+            if (dsp_isqrt((uint32_t)x) != r) {
+                fprintf(stderr, "dsp_isqrt(%lu) = %u, not %lu\n", x, dsp_isqrt((uint32_t)x), r);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// same as printf("%.4f", v / 1e4), over the ranges the text formats print
+static int check_writer_e4(void) {
+    char a[32], b[32];
+    for (int32_t v = -40000; v <= 2000000; v += 7) {
+        csi_writer_t w;
+        writer_init(&w, a, sizeof(a));
+        writer_e4(&w, v);
+        snprintf(b, sizeof(b), "%.4f", v / 1e4);
+        if (strcmp(a, b) != 0) {
+            fprintf(stderr, "writer_e4(%d) = %s, printf gives %s\n", v, a, b);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// cook_csi_data(): HT-LTF = buf[64:], then [-58:-1] and [2:59] of the 128 complex entries
+static int check_selection(const wifi_csi_info_t *d) {
+    int8_t iq[DSP_MAX_SUBCARRIERS * 2];
+    int n = dsp_select_subcarriers(d, iq);
+    if (n != DSP_MAX_SUBCARRIERS) {
+        fprintf(stderr, "HT40 selected %d subcarriers\n", n);
+        return 1;
+    }
+    int k = 0;
+    for (int i = 128 - 58; i < 128 - 1; i++, k++) {
+        if (memcmp(&iq[k * 2], &d->buf[(64 + i) * 2], 2) != 0) {
+            fprintf(stderr, "subcarrier %d differs from cook_csi_data()\n", k);
+            return 1;
+        }
+    }
+    for (int i = 2; i < 59; i++, k++) {
+        if (memcmp(&iq[k * 2], &d->buf[(64 + i) * 2], 2) != 0) {
+            fprintf(stderr, "subcarrier %d differs from cook_csi_data()\n", k);
+            return 1;
+        }
+    }
+
+    // HT20 keeps -28..-1 and 1..28 of 64 entries, non-HT has nothing to select
+    wifi_csi_info_t ht20 = *d;
+    ht20.rx_ctrl.cwb = 0;
+    ht20.len = 256;
+    if (dsp_select_subcarriers(&ht20, iq) != 56 || memcmp(iq, &d->buf[(64 + 36) * 2], 56) != 0 ||
+        memcmp(&iq[56], &d->buf[(64 + 1) * 2], 56) != 0) {
+        fprintf(stderr, "HT20 selection is wrong\n");
+        return 1;
+    }
+    wifi_csi_info_t non_ht = *d;
+    non_ht.rx_ctrl.sig_mode = 0;
+    if (dsp_select_subcarriers(&non_ht, iq) != 0) {
+        fprintf(stderr, "non-HT frame selected subcarriers\n");
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int frames = argc > 1 ? atoi(argv[1]) : 20000;
+    static int8_t bufs[BENCH_CORPUS][CSI_BUF_LEN];
+    wifi_csi_info_t corpus[BENCH_CORPUS];
+    bench_make_corpus(corpus, bufs, CSI_BUF_LEN);
+
+    if (check_isqrt() || check_kernels() || check_writer_e4()) {
+        return 1;
+    }
+    for (int i = 0; i < BENCH_CORPUS; i++) {
+        if (check_selection(&corpus[i])) {
+            return 1;
+        }
+    }
+
+    static uint8_t rec[CSI_PAYLOAD_BENCH_SIZE];
+    printf("record size of a HT40 frame\n");
+    const char *names[] = {"", "raw", "subcarriers", "amplitude", "phase", "amp + phase"};
+    for (int t = CSI_RECORD_TYPE_RAW; t <= CSI_RECORD_TYPE_AMP_PHASE; t++) {
+        printf("  %-12s: %zu bytes\n", names[t], csi_record_pack_type(&corpus[0], t, rec, sizeof(rec)));
+    }
+
+    // per frame cost, all subcarriers of a frame like the text formats
+    static double out_d[CSI_BUF_LEN];
+    static int16_t out_i[CSI_BUF_LEN];
+    double sink = 0;
+    double t0 = bench_now();
+    for (int f = 0; f < frames; f++) {
+        int8_t *p = corpus[f % BENCH_CORPUS].buf;
+        for (int i = 0; i < CSI_BUF_LEN / 2; i++) {
+            out_d[i] = sqrt(pow(p[i * 2], 2) + pow(p[(i * 2) + 1], 2));
+        }
+        sink += out_d[f % (CSI_BUF_LEN / 2)];
+    }
+    double t1 = bench_now();
+    for (int f = 0; f < frames; f++) {
+        dsp_amplitude(corpus[f % BENCH_CORPUS].buf, CSI_BUF_LEN / 2, out_i);
+        sink += out_i[f % (CSI_BUF_LEN / 2)];
+    }
+    double t2 = bench_now();
+    // single precision, which the ESP32 FPU has, as a Q4 amplitude
+    for (int f = 0; f < frames; f++) {
+        int8_t *p = corpus[f % BENCH_CORPUS].buf;
+        for (int i = 0; i < CSI_BUF_LEN / 2; i++) {
+            out_i[i] = (int16_t)(sqrtf((float)(p[i * 2] * p[i * 2] + p[(i * 2) + 1] * p[(i * 2) + 1])) * 16 + 0.5f);
+        }
+        sink += out_i[f % (CSI_BUF_LEN / 2)];
+    }
+    double t2f = bench_now();
+    for (int f = 0; f < frames; f++) {
+        int8_t *p = corpus[f % BENCH_CORPUS].buf;
+        for (int i = 0; i < CSI_BUF_LEN / 2; i++) {
+            out_d[i] = atan2(p[i * 2], p[(i * 2) + 1]);
+        }
+        sink += out_d[f % (CSI_BUF_LEN / 2)];
+    }
+    double t3 = bench_now();
+    for (int f = 0; f < frames; f++) {
+        dsp_phase(corpus[f % BENCH_CORPUS].buf, CSI_BUF_LEN / 2, out_i);
+        sink += out_i[f % (CSI_BUF_LEN / 2)];
+    }
+    double t4 = bench_now();
+
+    double n = (double)frames * (CSI_BUF_LEN / 2);
+    printf("%d frames of %d subcarriers (sink %.0f)\n", frames, CSI_BUF_LEN / 2, sink);
+    printf("  sqrt(pow())  : %10.0f frames/s  %6.1f ns/subcarrier\n", frames / (t1 - t0), (t1 - t0) / n * 1e9);
+    printf("  isqrt Q4     : %10.0f frames/s  %6.1f ns/subcarrier\n", frames / (t2 - t1), (t2 - t1) / n * 1e9);
+    printf("  sqrtf() Q4   : %10.0f frames/s  %6.1f ns/subcarrier\n", frames / (t2f - t2), (t2f - t2) / n * 1e9);
+    printf("  atan2()      : %10.0f frames/s  %6.1f ns/subcarrier\n", frames / (t3 - t2f), (t3 - t2f) / n * 1e9);
+    printf("  atan LUT     : %10.0f frames/s  %6.1f ns/subcarrier\n", frames / (t4 - t3), (t4 - t3) / n * 1e9);
+    // x86 computes sqrt of a double in hardware, several per instruction once vectorized.
+    // The ESP32 has no double FPU and runs both double functions in software, the kernels only use integer ops.
+    printf("note: host timings, sqrt() of a double is a (vectorized) hardware instruction here but software on the ESP32,\n"
+           "      sqrtf() one instruction here but an FPU sequence with a libm fallback there\n");
+    return 0;
+}
@@ -0,0 +1,95 @@
+#ifndef ESP32_CSI_ESP_SHIM_H
+#define ESP32_CSI_ESP_SHIM_H
+
+/*
+ * Just enough of the ESP-IDF and FreeRTOS API for the headers in ../_components
+ * to compile on Linux, so the firmware code paths can be benchmarked and checked on a host.
+ * Types follow esp_wifi_types.h of ESP-IDF v4.2.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_ERROR_CHECK(x) do { esp_err_t __err_rc = (x); if (__err_rc != ESP_OK) abort(); } while (0)
+
+#define ESP_LOGE(tag, format, ...) fprintf(stderr, "E (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) fprintf(stderr, "W (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) do { } while (0)
+#define ESP_LOGD(tag, format, ...) do { } while (0)
+
+#define MACSTR "%02x:%02x:%02x:%02x:%02x:%02x"
+#define MAC2STR(a) (a)[0], (a)[1], (a)[2], (a)[3], (a)[4], (a)[5]
+
+typedef uint32_t TickType_t;
+#define portTICK_PERIOD_MS 10
+static inline void vTaskDelay(TickType_t ticks) { (void)ticks; }
+
+// CPU cycle counter of the ESP32 at 160 MHz, from the monotonic clock
+static inline uint32_t xthal_get_ccount(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 160000000ull + ts.tv_nsec * 16 / 100);
+}
+
+typedef struct {
+    signed rssi:8;
+    unsigned rate:5;
+    unsigned :1;
+    unsigned sig_mode:2;
+    unsigned :16;
+    unsigned mcs:7;
+    unsigned cwb:1;
+    unsigned :16;
+    unsigned smoothing:1;
+    unsigned not_sounding:1;
+    unsigned :1;
+    unsigned aggregation:1;
+    unsigned stbc:2;
+    unsigned fec_coding:1;
+    unsigned sgi:1;
+    signed noise_floor:8;
+    unsigned ampdu_cnt:8;
+    unsigned channel:4;
+    unsigned secondary_channel:4;
+    unsigned :8;
+    unsigned timestamp:32;
+    unsigned :32;
+    unsigned :31;
+    unsigned ant:1;
+    unsigned sig_len:12;
+    unsigned :12;
+    unsigned rx_state:8;
+} wifi_pkt_rx_ctrl_t;
+
+typedef struct {
+    wifi_pkt_rx_ctrl_t rx_ctrl;
+    uint8_t mac[6];
+    bool first_word_invalid;
+    int8_t *buf;
+    uint16_t len;
+} wifi_csi_info_t;
+
+typedef struct {
+    bool lltf_en;
+    bool htltf_en;
+    bool stbc_htltf2_en;
+    bool ltf_merge_en;
+    bool channel_filter_en;
+    bool manu_scale;
+    uint8_t shift;
+} wifi_csi_config_t;
+
+typedef void (*wifi_csi_cb_t)(void *ctx, wifi_csi_info_t *data);
+
+static inline esp_err_t esp_wifi_set_csi(bool en) { (void)en; return ESP_OK; }
+static inline esp_err_t esp_wifi_set_csi_config(const wifi_csi_config_t *config) { (void)config; return ESP_OK; }
+static inline esp_err_t esp_wifi_set_csi_rx_cb(wifi_csi_cb_t cb, void *ctx) { (void)cb; (void)ctx; return ESP_OK; }
+
+#endif //ESP32_CSI_ESP_SHIM_H
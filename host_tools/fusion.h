@@ -0,0 +1,286 @@
+#ifndef ESP32_CSI_FUSION_H
+#define ESP32_CSI_FUSION_H
+
+/*
+ * One motion decision from many links, include after esp_shim.h, ingest.h, cook.h and detect.h.
+ *
+ * Frames go in as csi_ingest publishes them. They are put into fixed epochs of epoch_us by host_us,
+ * and an epoch closes once a frame more than grace_us past its end comes in, so frames of slower
+ * boards still make it. At the close every link gets the mean score detect.h gave its frames in
+ * the epoch, a single noisy frame does not stand out of it. The scores are then combined by the rule:
+ *   - FUSION_K_OF_N: motion when at least k links are over link_threshold
+ *   - FUSION_WEIGHTED: motion when the mean of the scores, each capped at score_cap and weighted
+ *     per link, is over weighted_threshold
+ * Links without frames in the epoch do not count. Each epoch goes to the emit callback as a
+ * fusion_epoch_t with its decision.
+ *
+ * The links are split over threads by node, each thread with its own detectors, so the work per
+ * epoch is linear in the frames and spread evenly over the cores. The calling thread takes the
+ * first share, the other threads wait on a barrier between epochs.
+ *
+ * Used by csi_ingest -f, fusion_bench. The same fusion in Python is csi_detect.Fusion.
+ */
+#include <pthread.h>
+#include <stdlib.h>
+
+#define FUSION_MAX_THREADS  16
+
+enum {
+    FUSION_K_OF_N = 1,
+    FUSION_WEIGHTED = 2,
+};
+
+typedef struct {
+    detect_cfg_t detect;            // of the detector of each link
+    uint64_t epoch_us;
+    uint64_t grace_us;              // below epoch_us
+    int rule;                       // FUSION_K_OF_N or FUSION_WEIGHTED
+    int k;
+    float link_threshold;           // dB, a link votes when its score is over it
+    float weighted_threshold;       // dB
+    float score_cap;                // dB
+    float weights[DETECT_MAX_NODES];
+    int threads;
+} fusion_cfg_t;
+
+typedef struct {
+    uint64_t start_us;
+    int links;                      // with frames in the epoch
+    int votes;                      // links over link_threshold
+    float score;                    // weighted mean of the capped scores
+    bool motion;
+    uint32_t frames;
+    uint32_t late;                  // frames that came after their epoch closed, counted in this one
+    float link_score[DETECT_MAX_NODES]; // -1 for links without frames
+} fusion_epoch_t;
+
+typedef void (*fusion_emit_t)(void *ctx, const fusion_epoch_t *epoch);
+
+typedef struct csi_fusion csi_fusion_t;
+
+typedef struct {
+    csi_fusion_t *fusion;
+    int index;
+    pthread_t thread;
+    float sum[DETECT_MAX_NODES];    // of the scores of a link in the epoch
+    uint32_t n[DETECT_MAX_NODES];
+    csi_detect_t detect;            // of the links node % threads == index
+} fusion_worker_t;
+
+typedef struct {
+    csi_frame_t *frames;
+    int n, cap;
+    uint32_t late;
+} fusion_batch_t;
+
+struct csi_fusion {
+    fusion_cfg_t cfg;
+    fusion_emit_t emit;
+    void *ctx;
+    fusion_worker_t *workers;
+    pthread_barrier_t start, done;
+    bool quit;
+    // the open epoch and the frames already past its end
+    fusion_batch_t batch[2];
+    fusion_batch_t *cur, *next;
+    uint64_t epoch_start_us;
+    bool started;
+    uint64_t epochs;
+    uint64_t frames;
+    uint64_t late;
+    fusion_epoch_t epoch;
+};
+
+/* 100 ms epochs, 2 of the links well over the detector threshold, one thread. */
+void fusion_default_cfg(fusion_cfg_t *c) {
+    detect_default_cfg(&c->detect);
+    c->epoch_us = 100000;
+    c->grace_us = 30000;
+    c->rule = FUSION_K_OF_N;
+    c->k = 2;
+    // an epoch averages out much of the noise of single frames, but not the slow deviations of
+    // quiet links with a lagging baseline
+    c->link_threshold = 1.5f * c->detect.threshold;
+    c->weighted_threshold = c->detect.threshold;
+    c->score_cap = 3 * c->detect.threshold;
+    for (int i = 0; i < DETECT_MAX_NODES; i++) {
+        c->weights[i] = 1;
+    }
+    c->threads = 1;
+}
+
+/* The frames of the worker's links in the batch, in order, and the sum of their scores. */
+static void _fusion_work(fusion_worker_t *w) {
+    csi_fusion_t *f = w->fusion;
+    int threads = f->cfg.threads;
+    memset(w->sum, 0, sizeof(w->sum));
+    memset(w->n, 0, sizeof(w->n));
+    const fusion_batch_t *b = f->cur;
+    for (int i = 0; i < b->n; i++) {
+        const csi_frame_t *frame = &b->frames[i];
+        if (frame->node % threads != w->index || !detect_frame(&w->detect, frame)) {
+            continue;
+        }
+        w->sum[frame->node] += w->detect.nodes[frame->node].score;
+        w->n[frame->node]++;
+    }
+}
+
+static void *_fusion_thread(void *arg) {
+    fusion_worker_t *w = arg;
+    csi_fusion_t *f = w->fusion;
+    for (;;) {
+        pthread_barrier_wait(&f->start);
+        if (f->quit) {
+            return NULL;
+        }
+        _fusion_work(w);
+        pthread_barrier_wait(&f->done);
+    }
+}
+
+bool fusion_init(csi_fusion_t *f, const fusion_cfg_t *cfg, fusion_emit_t emit, void *ctx) {
+    if (cfg->threads < 1 || cfg->threads > FUSION_MAX_THREADS || cfg->epoch_us == 0 || cfg->grace_us >= cfg->epoch_us ||
+            (cfg->rule != FUSION_K_OF_N && cfg->rule != FUSION_WEIGHTED) || cfg->k < 1) {
+        return false;
+    }
+    memset(f, 0, sizeof(*f));
+    f->cfg = *cfg;
+    f->emit = emit;
+    f->ctx = ctx;
+    f->workers = calloc(cfg->threads, sizeof(*f->workers));
+    if (f->workers == NULL) {
+        return false;
+    }
+    for (int i = 0; i < cfg->threads; i++) {
+        f->workers[i].fusion = f;
+        f->workers[i].index = i;
+        if (!detect_init(&f->workers[i].detect, &cfg->detect, NULL, NULL)) {
+            free(f->workers);
+            return false;
+        }
+    }
+    f->cur = &f->batch[0];
+    f->next = &f->batch[1];
+    pthread_barrier_init(&f->start, NULL, cfg->threads);
+    pthread_barrier_init(&f->done, NULL, cfg->threads);
+    for (int i = 1; i < cfg->threads; i++) {
+        pthread_create(&f->workers[i].thread, NULL, _fusion_thread, &f->workers[i]);
+    }
+    return true;
+}
+
+/* Score the open epoch on all threads, combine and emit it, then open the next one. */
+static void _fusion_close_epoch(csi_fusion_t *f) {
+    const fusion_cfg_t *c = &f->cfg;
+    if (c->threads > 1) {
+        pthread_barrier_wait(&f->start);
+    }
+    _fusion_work(&f->workers[0]);
+    if (c->threads > 1) {
+        pthread_barrier_wait(&f->done);
+    }
+
+    fusion_epoch_t *e = &f->epoch;
+    e->start_us = f->epoch_start_us;
+    e->links = e->votes = 0;
+    e->frames = f->cur->n;
+    e->late = f->cur->late;
+    float sum = 0, weights = 0;
+    for (int i = 0; i < DETECT_MAX_NODES; i++) {
+        const fusion_worker_t *w = &f->workers[i % c->threads];
+        if (w->n[i] == 0) {
+            e->link_score[i] = -1;
+            continue;
+        }
+        float s = w->sum[i] / w->n[i];
+        e->link_score[i] = s;
+        e->links++;
+        e->votes += s > c->link_threshold;
+        sum += c->weights[i] * (s < c->score_cap ? s : c->score_cap);
+        weights += c->weights[i];
+    }
+    e->score = weights > 0 ? sum / weights : 0;
+    e->motion = c->rule == FUSION_K_OF_N ? e->votes >= c->k : e->score > c->weighted_threshold;
+    f->epochs++;
+    if (f->emit != NULL) {
+        f->emit(f->ctx, e);
+    }
+
+    fusion_batch_t *closed = f->cur;
+    closed->n = 0;
+    closed->late = 0;
+    f->cur = f->next;
+    f->next = closed;
+    f->epoch_start_us += c->epoch_us;
+}
+
+static bool _fusion_push(fusion_batch_t *b, const csi_frame_t *frame) {
+    if (b->n == b->cap) {
+        int cap = b->cap > 0 ? 2 * b->cap : 256;
+        csi_frame_t *frames = realloc(b->frames, cap * sizeof(*frames));
+        if (frames == NULL) {
+            return false;
+        }
+        b->frames = frames;
+        b->cap = cap;
+    }
+    b->frames[b->n++] = *frame;
+    return true;
+}
+
+/* A decoded frame. Closes the epochs it shows to be complete first. */
+void fusion_add(csi_fusion_t *f, const csi_frame_t *frame) {
+    const fusion_cfg_t *c = &f->cfg;
+    uint64_t t = frame->host_us;
+    if (!f->started) {
+        f->epoch_start_us = t - t % c->epoch_us;
+        f->started = true;
+    }
+    while (t >= f->epoch_start_us + c->epoch_us + c->grace_us) {
+        if (f->cur->n == 0 && f->next->n == 0) {
+            // nothing came in for a while, skip the empty epochs
+            f->epoch_start_us = t - t % c->epoch_us;
+            break;
+        }
+        _fusion_close_epoch(f);
+    }
+    f->frames++;
+    if (t >= f->epoch_start_us + c->epoch_us) {
+        _fusion_push(f->next, frame);
+        return;
+    }
+    if (t < f->epoch_start_us) {
+        f->late++;
+        f->cur->late++;
+    }
+    _fusion_push(f->cur, frame);
+}
+
+/* Close the open epochs, at the end of the input. */
+void fusion_flush(csi_fusion_t *f) {
+    if (f->cur->n > 0 || f->next->n > 0) {
+        _fusion_close_epoch(f);
+    }
+    if (f->cur->n > 0) {
+        _fusion_close_epoch(f);
+    }
+}
+
+void fusion_close(csi_fusion_t *f) {
+    if (f->cfg.threads > 1) {
+        f->quit = true;
+        pthread_barrier_wait(&f->start);
+        for (int i = 1; i < f->cfg.threads; i++) {
+            pthread_join(f->workers[i].thread, NULL);
+        }
+    }
+    pthread_barrier_destroy(&f->start);
+    pthread_barrier_destroy(&f->done);
+    for (int i = 0; i < 2; i++) {
+        free(f->batch[i].frames);
+    }
+    free(f->workers);
+}
+
+#endif //ESP32_CSI_FUSION_H
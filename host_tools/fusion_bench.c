@@ -0,0 +1,183 @@
+/*
+ * Cross-link fusion of fusion.h on a synthetic corpus (csi_synth.h) of many links at 200 Hz,
+ * with labelled motion events that show on a part of the links each.
+ *   - decisions of every epoch must be the same on any number of threads
+ *   - frames/s and real time factor on 1.. threads, and ns per frame for 8, 16 and 32 links,
+ *     which stays flat when the cost is linear in the links
+ *   - triggers (epochs turning to motion) during and outside the labelled motion, for any single
+ *     link, k of n links and the weighted rule
+ *
+ *   make fusion_bench && ./fusion_bench [links] [seconds] [threads]
+ */
+#include <unistd.h>
+
+#include "esp_shim.h"
+#include "ingest.h"
+#include "cook.h"
+#include "detect.h"
+#include "fusion.h"
+#include "csi_synth.h"
+#include "bench_common.h"
+
+#define HZ              200
+#define LATE_US         1500000 // a trigger this long after the end of a motion event still counts
+
+typedef struct {
+    csi_frame_t *frames;
+    int n;
+    csi_synth_t synth;
+} corpus_t;
+
+typedef struct {
+    uint8_t *motion;            // decision per epoch
+    uint64_t *start_us;
+    int n, cap;
+} decisions_t;
+
+static void record_epoch(void *ctx, const fusion_epoch_t *e) {
+    decisions_t *d = ctx;
+    if (d->n < d->cap) {
+        d->motion[d->n] = e->motion;
+        d->start_us[d->n] = e->start_us;
+        d->n++;
+    }
+}
+
+/* The frames of all links in arrival order, each a few hundred us after it was taken. */
+static void make_corpus(corpus_t *c, int links, double seconds) {
+    synth_cfg_t cfg;
+    synth_default_cfg(&cfg);
+    cfg.links = links;
+    cfg.hz = HZ;
+    cfg.quiet_s = 5;
+    uint8_t mac[6] = {0x3c, 0x61, 0x05, 0x4c, 0x36, 0x00};
+    uint64_t duration_us = seconds * 1e6;
+    synth_init(&c->synth, &cfg, mac, duration_us);
+    int cap = links * seconds * HZ * 1.3 + 16;
+    c->frames = calloc(cap, sizeof(*c->frames));
+    c->n = 0;
+    static uint8_t rec[sizeof(csi_record_hdr_t) + SYNTH_BUF_LEN];
+    static int8_t buf[SYNTH_BUF_LEN];
+    while (c->n < cap) {
+        int link = synth_next_link(&c->synth);
+        if (c->synth.links[link].next_us >= duration_us) {
+            break;
+        }
+        wifi_csi_info_t d;
+        bool moving;
+        csi_frame_t *f = &c->frames[c->n++];
+        uint64_t t_us = synth_frame(&c->synth, link, &d, buf, &moving);
+        size_t len = csi_record_pack(&d, rec, sizeof(rec));
+        f->host_us = t_us + 300 + bench_rand() % 400;
+        f->node = link;
+        memcpy(&f->hdr, rec, sizeof(f->hdr));
+        memcpy(f->csi, rec + sizeof(f->hdr), len - sizeof(f->hdr));
+    }
+}
+
+/* All frames of links below max_link through a fusion of cfg, returns the seconds it took. */
+static double run(const corpus_t *c, const fusion_cfg_t *cfg, int max_link, decisions_t *d, uint64_t *frames) {
+    static csi_fusion_t f;
+    d->n = 0;
+    if (!fusion_init(&f, cfg, record_epoch, d)) {
+        fprintf(stderr, "bad fusion settings\n");
+        exit(1);
+    }
+    double t = bench_now();
+    for (int i = 0; i < c->n; i++) {
+        if (c->frames[i].node < max_link) {
+            fusion_add(&f, &c->frames[i]);
+        }
+    }
+    fusion_flush(&f);
+    t = bench_now() - t;
+    *frames = f.frames;
+    fusion_close(&f);
+    return t;
+}
+
+/* Epochs turning to motion, and those of them in or just after a labelled motion event. */
+static void score_triggers(const corpus_t *c, const decisions_t *d, int *triggers, int *true_triggers, int *found) {
+    *triggers = *true_triggers = *found = 0;
+    const csi_synth_t *s = &c->synth;
+    for (int i = 0; i < d->n; i++) {
+        if (!d->motion[i] || (i > 0 && d->motion[i - 1])) {
+            continue;
+        }
+        (*triggers)++;
+        for (int m = 0; m < s->n_events; m++) {
+            if (d->start_us[i] + 100000 > s->events[m].start_us && d->start_us[i] < s->events[m].end_us + LATE_US) {
+                (*true_triggers)++;
+                break;
+            }
+        }
+    }
+    for (int m = 0; m < s->n_events; m++) {
+        for (int i = 0; i < d->n; i++) {
+            if (d->motion[i] && d->start_us[i] + 100000 > s->events[m].start_us && d->start_us[i] < s->events[m].end_us) {
+                (*found)++;
+                break;
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    int links = argc > 1 ? atoi(argv[1]) : 32;
+    double seconds = argc > 2 ? atof(argv[2]) : 60;
+    int cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = argc > 3 ? atoi(argv[3]) : (cores < 4 ? 4 : cores);
+    if (links < 1 || links > SYNTH_MAX_LINKS || seconds <= 0 || max_threads < 1 || max_threads > FUSION_MAX_THREADS) {
+        fprintf(stderr, "usage: %s [links] [seconds] [threads]\n", argv[0]);
+        return 1;
+    }
+    static corpus_t c;
+    make_corpus(&c, links, seconds);
+    printf("%d frames of %d links at %d Hz, %.0f s, %d motion events, %d cores\n", c.n, links, HZ, seconds,
+           c.synth.n_events, cores);
+
+    int cap = seconds * 10 + 16;
+    decisions_t ref = {calloc(cap, 1), calloc(cap, sizeof(uint64_t)), 0, cap};
+    decisions_t d = {calloc(cap, 1), calloc(cap, sizeof(uint64_t)), 0, cap};
+    fusion_cfg_t cfg;
+    fusion_default_cfg(&cfg);
+    uint64_t frames;
+    int err = 0;
+    double one = 0;
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        cfg.threads = threads;
+        double t = run(&c, &cfg, links, threads == 1 ? &ref : &d, &frames);
+        if (threads == 1) {
+            one = t;
+        } else if (d.n != ref.n || memcmp(d.motion, ref.motion, d.n) != 0) {
+            printf("%d threads: decisions differ from one thread\n", threads);
+            err = 1;
+        }
+        printf("%2d threads: %.2f M frames/s, %.0fx real time, %.2fx one thread\n", threads, frames / t * 1e-6,
+               seconds / t, one / t);
+    }
+    cfg.threads = 1;
+    for (int l = 8; l <= links; l *= 2) {
+        double t = run(&c, &cfg, l, &d, &frames);
+        printf("%2d links: %.0f ns/frame, %lu epochs\n", l, t * 1e9 / frames, (uint64_t)d.n);
+    }
+
+    static const struct { const char *name; int rule; int k; } rules[] = {
+        {"any link", FUSION_K_OF_N, 1}, {"2 of n", FUSION_K_OF_N, 2}, {"4 of n", FUSION_K_OF_N, 4},
+        {"weighted", FUSION_WEIGHTED, 1},
+    };
+    for (size_t r = 0; r < sizeof(rules) / sizeof(rules[0]); r++) {
+        cfg.rule = rules[r].rule;
+        cfg.k = rules[r].k;
+        run(&c, &cfg, links, &d, &frames);
+        int triggers, true_triggers, found;
+        score_triggers(&c, &d, &triggers, &true_triggers, &found);
+        printf("%-9s %4d triggers, %4d outside motion, %d of %d motion events found\n", rules[r].name, triggers,
+               triggers - true_triggers, found, c.synth.n_events);
+    }
+    if (err == 0) {
+        printf("fusion checked on 1..%d threads\n", max_threads);
+    }
+    free(c.frames);
+    return err;
+}
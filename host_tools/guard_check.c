@@ -0,0 +1,313 @@
+/*
+ * Check of the self traffic guard in ../_components/guard_component.h.
+ * A client is simulated event by event for a minute of device time: echo replies to its stimulus
+ * requests from the AP, a neighbour now and then, a source flooding at 1500 frames/s, and the
+ * frames the AP sends back for every report the client makes (the report relayed, at least as
+ * long as it, and short frames) which are reported in turn. The handler takes the frames from a
+ * ring of CSI_QUEUE_SIZE slots, and each report keeps it busy for a while.
+ * The loop is run with the guard, with the one in four thinning the client used before, and
+ * with nothing in between. Checks that with the guard every frame is accounted for once, the
+ * stimulus replies are kept, hardly a relayed report is, the loop dies down, and the flooding
+ * source gets its rate and no more. Then ns per guard_check() on this host.
+ *
+ *   make guard_check && ./guard_check [seconds]
+ */
+#include <math.h>
+
+#include "esp_shim.h"
+#include "guard_component.h"
+#include "bench_common.h"
+
+#define RING_SIZE       32      // CSI_QUEUE_SIZE of handler_component.h
+#define REPORT_US       400     // handler busy with a frame it reports: serialize and sendto()
+#define DROP_US         5       // and with one it drops
+#define REPORT_LEN      420     // a raw binary record
+#define STATS_EVERY_US  5000000
+#define STATS_LEN       108     // sizeof(csi_stats_record_t)
+#define RELAY_P         80      // percent of the reports the AP relays where the client hears it
+#define SHORT_P         10      // percent that draw a short HT frame from the AP
+#define NOISY_HZ        1500
+#define NEIGHBOUR_HZ    30
+#define WINDOW_US       2000    // defaults of Self traffic in menuconfig
+#define BURST           8
+#define MAX_EVENTS      (1 << 16)
+
+enum { STIMULUS, RELAYED, SHORT, NEIGHBOUR, NOISY, KINDS };
+static const char *kind_names[KINDS] = {"stimulus replies", "relayed reports", "short frames", "neighbour", "flood"};
+static const uint8_t macs[KINDS][6] = {
+    {0x24, 0x0a, 0xc4, 0x00, 0x00, 0x01},   // the AP
+    {0x24, 0x0a, 0xc4, 0x00, 0x00, 0x01},
+    {0x24, 0x0a, 0xc4, 0x00, 0x00, 0x01},
+    {0x3c, 0x61, 0x05, 0x4c, 0x36, 0xc1},
+    {0x3c, 0x61, 0x05, 0x4c, 0x36, 0xc2},
+};
+
+typedef enum { WITH_GUARD, THINNED, NOTHING } scheme_t;
+
+typedef struct {
+    int64_t us;
+    uint8_t kind;
+    uint16_t sig_len;
+} event_t;
+
+// arrivals not yet in the ring, a binary min heap on us
+static event_t heap[MAX_EVENTS];
+static int heap_n;
+
+static void heap_push(int64_t us, int kind, uint16_t sig_len) {
+    if (heap_n == MAX_EVENTS) {
+        return; // the air is full, more than the loop needs to show
+    }
+    int i = heap_n++;
+    while (i > 0 && heap[(i - 1) / 2].us > us) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = (event_t){us, (uint8_t)kind, sig_len};
+}
+
+static event_t heap_pop(void) {
+    event_t top = heap[0];
+    event_t last = heap[--heap_n];
+    int i = 0;
+    for (;;) {
+        int c = 2 * i + 1;
+        if (c >= heap_n) {
+            break;
+        }
+        if (c + 1 < heap_n && heap[c + 1].us < heap[c].us) {
+            c++;
+        }
+        if (heap[c].us >= last.us) {
+            break;
+        }
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = last;
+    return top;
+}
+
+static int64_t rand_us(int64_t lo, int64_t hi) {
+    return lo + bench_rand() % (hi - lo + 1);
+}
+
+// a Poisson source at hz: the time of its next frame
+static int64_t next_poisson(int64_t now, double hz) {
+    double u = (bench_rand() + 1.0) / 4294967297.0;
+    return now + 1 + (int64_t)(-log(u) / hz * 1e6);
+}
+
+typedef struct {
+    uint32_t arrived[KINDS];
+    uint32_t reported[KINDS];
+    uint32_t ring_full[KINDS];
+    uint32_t drop_self[KINDS];
+    uint32_t drop_rate[KINDS];
+    uint32_t reports;               // datagrams sent, records and stats
+} sim_result_t;
+
+// what the AP does over the air because of a datagram of len bytes the client sent at us
+static void ap_reacts(int64_t us, size_t len) {
+    if (bench_rand() % 100 < RELAY_P) {
+        heap_push(us + rand_us(300, 1500), RELAYED, (uint16_t)(len + rand_us(60, 90)));
+    }
+    if (bench_rand() % 100 < SHORT_P) {
+        heap_push(us + rand_us(100, 1000), SHORT, (uint16_t)rand_us(30, 60));
+    }
+}
+
+static sim_result_t run(scheme_t scheme, uint32_t stimulus_hz, uint32_t rate_hz, int seconds) {
+    sim_result_t r;
+    memset(&r, 0, sizeof(r));
+    heap_n = 0;
+    csi_guard_t guard;
+    guard_init(&guard, WINDOW_US, rate_hz, BURST);
+    guard_set_ap(&guard, macs[STIMULUS]);
+    event_t ring[RING_SIZE];
+    int ring_head = 0, ring_n = 0;
+    int64_t end = (int64_t)seconds * 1000000;
+    int64_t handler_free = 0;
+    int64_t next_stats = STATS_EVERY_US;
+    uint32_t frame_cnt = 0;
+    // the sources that do not depend on the client's reports
+    int64_t period = 1000000 / stimulus_hz;
+    int64_t next_stimulus = period, next_neighbour = next_poisson(0, NEIGHBOUR_HZ);
+    int64_t next_noisy = next_poisson(0, NOISY_HZ);
+
+    for (;;) {
+        // the source frames due before anything else happens go into the air
+        int64_t horizon = heap_n > 0 ? heap[0].us : end;
+        if (ring_n > 0 && handler_free < horizon) {
+            horizon = handler_free;
+        }
+        while (next_stimulus <= horizon || next_neighbour <= horizon || next_noisy <= horizon) {
+            if (next_stimulus <= horizon) {
+                // the reply to a request on the pacer's grid, after the round trip
+                heap_push(next_stimulus + rand_us(800, 3000), STIMULUS, (uint16_t)rand_us(70, 90));
+                next_stimulus += period;
+            }
+            if (next_neighbour <= horizon) {
+                heap_push(next_neighbour, NEIGHBOUR, (uint16_t)rand_us(60, 1500));
+                next_neighbour = next_poisson(next_neighbour, NEIGHBOUR_HZ);
+            }
+            if (next_noisy <= horizon) {
+                heap_push(next_noisy, NOISY, (uint16_t)rand_us(60, 200));
+                next_noisy = next_poisson(next_noisy, NOISY_HZ);
+            }
+            horizon = heap[0].us;
+            if (ring_n > 0 && handler_free < horizon) {
+                horizon = handler_free;
+            }
+        }
+        int64_t next_arrival = heap_n > 0 ? heap[0].us : INT64_MAX;
+        if (ring_n > 0 && handler_free <= next_arrival) {
+            // the handler takes the oldest frame
+            event_t f = ring[ring_head];
+            ring_head = (ring_head + 1) % RING_SIZE;
+            ring_n--;
+            int64_t at = handler_free > f.us ? handler_free : f.us;
+            bool keep = true;
+            if (scheme == WITH_GUARD) {
+                guard_verdict_t v = guard_check(&guard, macs[f.kind], f.us, f.sig_len);
+                r.drop_self[f.kind] += v == GUARD_SELF;
+                r.drop_rate[f.kind] += v == GUARD_RATE;
+                keep = v == GUARD_KEEP;
+            } else if (scheme == THINNED) {
+                keep = ++frame_cnt % 4 == 0;
+                r.drop_rate[f.kind] += !keep;
+            }
+            if (!keep) {
+                handler_free = at + DROP_US;
+                continue;
+            }
+            handler_free = at + REPORT_US;
+            r.reported[f.kind]++;
+            r.reports++;
+            guard_sent(&guard, handler_free, REPORT_LEN);
+            ap_reacts(handler_free, REPORT_LEN);
+            if (handler_free >= next_stats) {
+                r.reports++;
+                guard_sent(&guard, handler_free, STATS_LEN);
+                ap_reacts(handler_free, STATS_LEN);
+                next_stats += STATS_EVERY_US;
+            }
+            continue;
+        }
+        if (heap_n == 0) {
+            break;
+        }
+        event_t f = heap_pop();
+        if (f.us >= end) {
+            break;
+        }
+        r.arrived[f.kind]++;
+        if (ring_n == RING_SIZE) {
+            r.ring_full[f.kind]++;
+            continue;
+        }
+        ring[(ring_head + ring_n) % RING_SIZE] = f;
+        ring_n++;
+    }
+    // what is still in the ring at the end counts as reported
+    for (int i = 0; i < ring_n; i++) {
+        r.reported[ring[(ring_head + i) % RING_SIZE].kind]++;
+    }
+    return r;
+}
+
+static void print_result(const char *what, const sim_result_t *r, int seconds) {
+    printf("%s: %.0f reports/s\n", what, r->reports / (double)seconds);
+    for (int k = 0; k < KINDS; k++) {
+        printf("  %-17s %7.1f/s arrived, %7.1f/s reported, ring full %7.1f/s, own reports %7.1f/s, "
+               "over the rate %7.1f/s\n", kind_names[k], r->arrived[k] / (double)seconds,
+               r->reported[k] / (double)seconds, r->ring_full[k] / (double)seconds,
+               r->drop_self[k] / (double)seconds, r->drop_rate[k] / (double)seconds);
+    }
+}
+
+static int check_guard(uint32_t stimulus_hz, uint32_t rate_hz, int seconds) {
+    sim_result_t r = run(WITH_GUARD, stimulus_hz, rate_hz, seconds);
+    char what[128];
+    snprintf(what, sizeof(what), "guard, stimulus %u Hz, %u frames/s a source", stimulus_hz, rate_hz);
+    print_result(what, &r, seconds);
+    int err = 0;
+    for (int k = 0; k < KINDS; k++) {
+        if (r.arrived[k] != r.reported[k] + r.ring_full[k] + r.drop_self[k] + r.drop_rate[k]) {
+            printf("%s: %u arrived, %u accounted for\n", kind_names[k], r.arrived[k],
+                   r.reported[k] + r.ring_full[k] + r.drop_self[k] + r.drop_rate[k]);
+            err = 1;
+        }
+    }
+    // the stimulus replies are what the client is there for
+    if (r.reported[STIMULUS] < r.arrived[STIMULUS] * 0.995) {
+        printf("%u of %u stimulus replies reported\n", r.reported[STIMULUS], r.arrived[STIMULUS]);
+        err = 1;
+    }
+    if (r.reported[RELAYED] > r.arrived[RELAYED] * 0.01) {
+        printf("%u of %u relayed reports reported again\n", r.reported[RELAYED], r.arrived[RELAYED]);
+        err = 1;
+    }
+    // no loop: a report per frame kept, and the short frames the reports draw
+    double kept = r.reported[STIMULUS] + r.reported[NEIGHBOUR] + r.reported[NOISY];
+    if (r.reports > (kept + r.reported[SHORT]) * 1.01 + seconds / 5 + 1 || r.reported[SHORT] > kept * 0.5) {
+        printf("%u reports for %.0f frames kept\n", r.reports, kept);
+        err = 1;
+    }
+    // the flood gets its rate and burst, and nothing is lost in the ring
+    double flood = r.reported[NOISY] / (double)seconds;
+    if (flood > rate_hz * 1.01 + BURST || flood < rate_hz * 0.99) {
+        printf("flood reported at %.1f/s, %u allowed\n", flood, rate_hz);
+        err = 1;
+    }
+    uint32_t ring_full = 0;
+    for (int k = 0; k < KINDS; k++) {
+        ring_full += r.ring_full[k];
+    }
+    if (ring_full > 0) {
+        printf("%u frames dropped with the ring full\n", ring_full);
+        err = 1;
+    }
+    return err;
+}
+
+int main(int argc, char **argv) {
+    int seconds = argc > 1 ? atoi(argv[1]) : 60;
+    int err = 0;
+    err |= check_guard(100, 200, seconds);
+    err |= check_guard(500, 750, seconds);
+
+    sim_result_t r = run(THINNED, 100, 0, seconds);
+    print_result("one in four kept (before, thinned under over the rate), stimulus 100 Hz", &r, seconds);
+    r = run(NOTHING, 100, 0, seconds);
+    print_result("everything kept, stimulus 100 Hz", &r, seconds);
+
+    // cost per frame with a full peer table and the tx history; every source sends above the rate
+    static csi_guard_t g;
+    guard_init(&g, WINDOW_US, 200, BURST);
+    uint8_t mac[6] = {0x3c, 0x61, 0x05, 0x4c, 0x36, 0};
+    for (int i = 0; i < GUARD_TX_HISTORY; i++) {
+        guard_sent(&g, i * 1000, REPORT_LEN);
+    }
+    int n = 10000000;
+    uint32_t kept = 0;
+    double t0 = bench_now();
+    for (int i = 0; i < n; i++) {
+        mac[5] = i % PEER_MAX_PEERS;
+        kept += guard_check(&g, mac, 10000 + i * 50, 80) == GUARD_KEEP;
+    }
+    double t1 = bench_now();
+    printf("guard_check %.1f ns per frame on this host (%u kept)\n", (t1 - t0) * 1e9 / n, kept);
+    // as many sources as the peer filter holds keep their buckets, so none gets more than its rate
+    uint64_t limit = (uint64_t)PEER_MAX_PEERS * (200 * (uint64_t)n * 50 / 1000000 + BURST + 1);
+    if (g.peers.evictions != 0 || kept > limit) {
+        printf("%d sources: %u evictions, %u kept, at most %llu expected\n", PEER_MAX_PEERS, g.peers.evictions, kept,
+               (unsigned long long)limit);
+        err = 1;
+    }
+
+    if (err == 0) {
+        printf("guard checked\n");
+    }
+    return err;
+}
@@ -0,0 +1,484 @@
+#ifndef ESP32_CSI_INGEST_H
+#define ESP32_CSI_INGEST_H
+
+/*
+ * Host side receiver of the CSI datagrams sent by csi_handler_task, include after esp_shim.h.
+ * Drains the UDP port with recvmmsg() in batches and decodes every record, text (parse_csi())
+ * or binary (record_component.h, delta coded or not, any version), into a fixed size
+ * csi_frame_t without allocating. Decoded frames go to a publish callback.
+ * Records framed on a serial port (CONFIG_CSI_SERIAL_FRAMED, serial_component.h) go through the same
+ * decoding, one per datagram, read with ingest_read_serial().
+ *
+ * Used by csi_ingest (the daemon) and ingest_bench. Needs _GNU_SOURCE for recvmmsg(), the Makefile sets it.
+ */
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define INGEST_MAX_NODES    64
+
+#include "record_component.h"
+#include "delta_component.h"
+#include "stats_component.h"
+#include "task_component.h"
+#include "serial_component.h"
+
+_Static_assert(INGEST_MAX_NODES <= PEER_MAX_PEERS, "a delta reference per node");
+
+#define INGEST_BATCH        64      // datagrams per recvmmsg() call
+#define INGEST_DGRAM_MAX    2048    // CSI_PAYLOAD_SIZE of the firmware
+#define CSI_FRAME_MAX_CSI   612     // CSI_MAX_BUF_LEN, the largest raw payload
+
+/*
+ * A decoded frame: the record header in the current layout (older versions and text records are
+ * converted, delta coding is undone), the payload, and where and when it came in.
+ */
+typedef struct {
+    uint64_t host_us;               // arrival time on the host, CLOCK_REALTIME in us
+    uint16_t node;                  // index of the source mac, in order of appearance
+    uint16_t reserved[3];
+    csi_record_hdr_t hdr;           // hdr.csi_len bytes of csi follow
+    uint8_t csi[CSI_FRAME_MAX_CSI];
+    uint8_t pad[40];
+} csi_frame_t;
+
+_Static_assert(sizeof(csi_frame_t) == 720, "csi_frame_t layout changed, update csi_shm.py");
+
+typedef void (*ingest_publish_t)(void *ctx, const csi_frame_t *frame);
+
+typedef struct {
+    uint64_t datagrams;             // or records on a serial port
+    uint64_t bytes;
+    uint64_t frames;                // published
+    uint64_t text_frames;
+    uint64_t stats_records;         // device stats and task records, not published as frames
+    uint64_t delta_gaps;            // delta coded records that could not be restored
+    uint64_t errors;                // malformed or truncated datagrams, broken serial frames
+    uint64_t recv_calls;
+} ingest_counters_t;
+
+typedef struct {
+    int sock;
+    ingest_publish_t publish;
+    void *ctx;
+    ingest_counters_t counters;
+    uint8_t macs[INGEST_MAX_NODES][6];
+    int n_nodes;
+    csi_delta_t delta;
+    uint8_t rec[sizeof(csi_record_hdr_t) + CSI_FRAME_MAX_CSI]; // a record in the current layout
+    uint8_t decoded[sizeof(csi_record_hdr_t) + CSI_FRAME_MAX_CSI]; // and with delta coding undone
+    csi_frame_t frame;
+    serial_decoder_t serial;
+    uint64_t serial_us;             // when the bytes being decoded were read
+    uint64_t serial_errors;         // of the decoder, already in counters.errors
+    // recvmmsg() buffers
+    struct mmsghdr msgs[INGEST_BATCH];
+    struct iovec iovs[INGEST_BATCH];
+    char control[INGEST_BATCH][64];
+    uint8_t bufs[INGEST_BATCH][INGEST_DGRAM_MAX];
+} csi_ingest_t;
+
+static inline uint64_t ingest_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Bind a UDP socket on port with kernel receive timestamps. Returns the socket, or -1. */
+int ingest_open_socket(int port, int rcvbuf) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    int on = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+    if (rcvbuf > 0) {
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+void ingest_init(csi_ingest_t *in, int sock, ingest_publish_t publish, void *ctx) {
+    memset(in, 0, sizeof(*in));
+    in->sock = sock;
+    in->publish = publish;
+    in->ctx = ctx;
+    delta_init(&in->delta, 255);
+    serial_decoder_init(&in->serial);
+    for (int i = 0; i < INGEST_BATCH; i++) {
+        in->iovs[i].iov_base = in->bufs[i];
+        in->iovs[i].iov_len = INGEST_DGRAM_MAX;
+        in->msgs[i].msg_hdr.msg_iov = &in->iovs[i];
+        in->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+}
+
+static uint16_t _ingest_node(csi_ingest_t *in, const uint8_t mac[6]) {
+    for (int i = 0; i < in->n_nodes; i++) {
+        if (memcmp(in->macs[i], mac, 6) == 0) {
+            return i;
+        }
+    }
+    if (in->n_nodes == INGEST_MAX_NODES) {
+        return INGEST_MAX_NODES; // more nodes than the table holds share the last index
+    }
+    memcpy(in->macs[in->n_nodes], mac, 6);
+    return in->n_nodes++;
+}
+
+static void _ingest_publish(csi_ingest_t *in, const uint8_t *rec, uint64_t host_us) {
+    csi_frame_t *f = &in->frame;
+    memcpy(&f->hdr, rec, sizeof(f->hdr));
+    memcpy(f->csi, rec + sizeof(f->hdr), f->hdr.csi_len);
+    f->host_us = host_us;
+    f->node = _ingest_node(in, f->hdr.mac);
+    in->counters.frames++;
+    in->publish(in->ctx, f);
+}
+
+/* Header length of a binary record version, 0 if unknown. */
+static inline size_t _ingest_hdr_len(uint8_t version) {
+    switch (version) {
+        case 1: case 2: return 38;
+        case 3: return 44;
+        case CSI_RECORD_VERSION: return sizeof(csi_record_hdr_t);
+        default: return 0;
+    }
+}
+
+/*
+ * Decode the binary records of a datagram. Older headers are moved into the current layout:
+ * they are the current one cut off before seq (versions 1, 2) or rx_us (3), with csi_len last.
+ */
+static void _ingest_binary(csi_ingest_t *in, const uint8_t *p, size_t n, uint64_t host_us) {
+    size_t off = 0;
+    while (off + 6 <= n) {
+        const uint8_t *r = p + off;
+        uint16_t rec_len = r[4] | (r[5] << 8);
+        if (r[0] != CSI_RECORD_MAGIC || rec_len < 6 || off + rec_len > n) {
+            in->counters.errors++;
+            return;
+        }
+        off += rec_len;
+        if (r[2] == CSI_RECORD_TYPE_STATS || r[2] == CSI_RECORD_TYPE_TASKS) {
+            in->counters.stats_records++;
+            continue;
+        }
+        size_t hdr_len = _ingest_hdr_len(r[1]);
+        if (hdr_len == 0 || rec_len < hdr_len) {
+            in->counters.errors++;
+            continue;
+        }
+        uint16_t csi_len = r[hdr_len - 2] | (r[hdr_len - 1] << 8);
+        if (hdr_len + csi_len != rec_len || csi_len > CSI_FRAME_MAX_CSI) {
+            in->counters.errors++;
+            continue;
+        }
+        uint8_t *rec = in->rec;
+        csi_record_hdr_t *hdr = (csi_record_hdr_t *)rec;
+        memset(rec, 0, sizeof(*hdr));
+        memcpy(rec, r, hdr_len - 2);
+        hdr->version = CSI_RECORD_VERSION;
+        hdr->csi_len = csi_len;
+        hdr->len = sizeof(*hdr) + csi_len;
+        memcpy(rec + sizeof(*hdr), r + hdr_len, csi_len);
+
+        uint8_t *out = rec;
+        if (r[1] >= 2) {
+            // keyframes only update the reference, delta records are restored from it
+            if (delta_decode_record(&in->delta, rec, in->decoded, sizeof(in->decoded)) == 0) {
+                in->counters.delta_gaps++;
+                continue;
+            }
+            out = in->decoded;
+        }
+        _ingest_publish(in, out, host_us);
+    }
+}
+
+/* Text cursor helpers, the input is not NUL terminated. */
+typedef struct {
+    const char *p;
+    const char *end;
+} _ingest_cur_t;
+
+static bool _cur_skip(_ingest_cur_t *c, const char *lit) {
+    size_t n = strlen(lit);
+    if ((size_t)(c->end - c->p) < n || memcmp(c->p, lit, n) != 0) {
+        return false;
+    }
+    c->p += n;
+    return true;
+}
+
+static bool _cur_int(_ingest_cur_t *c, int64_t *v) {
+    const char *p = c->p;
+    bool neg = p < c->end && *p == '-';
+    p += neg;
+    if (p >= c->end || *p < '0' || *p > '9') {
+        return false;
+    }
+    uint64_t x = 0;
+    while (p < c->end && *p >= '0' && *p <= '9') {
+        x = x * 10 + (*p++ - '0');
+    }
+    *v = neg ? -(int64_t)x : (int64_t)x;
+    c->p = p;
+    return true;
+}
+
+static bool _cur_line_end(_ingest_cur_t *c) {
+    while (c->p < c->end && *c->p == ' ') {
+        c->p++;
+    }
+    return _cur_skip(c, "\n");
+}
+
+static int _hex(char ch) {
+    if (ch >= '0' && ch <= '9') return ch - '0';
+    if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+    return -1;
+}
+
+/* One text record of parse_csi() at the cursor into in->rec as a RAW record. */
+static bool _ingest_text_record(csi_ingest_t *in, _ingest_cur_t *c) {
+    csi_record_hdr_t *hdr = (csi_record_hdr_t *)in->rec;
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = CSI_RECORD_MAGIC;
+    hdr->version = CSI_RECORD_VERSION;
+    hdr->type = CSI_RECORD_TYPE_RAW;
+
+    const char *nl = memchr(c->p, '\n', c->end - c->p);
+    if (nl == NULL) {
+        return false;
+    }
+    c->p = nl + 1; // "CSI_DATA from ..."
+    if (!_cur_skip(c, "src mac = ") || c->end - c->p < 17) {
+        return false;
+    }
+    for (int i = 0; i < 6; i++) {
+        int hi = _hex(c->p[i * 3]), lo = _hex(c->p[i * 3 + 1]);
+        if (hi < 0 || lo < 0) {
+            return false;
+        }
+        hdr->mac[i] = hi << 4 | lo;
+    }
+    c->p += 17;
+
+    int64_t v;
+    // optional, firmware before sequence numbers does not send them
+    if (_cur_skip(c, ", seq = ")) {
+        if (!_cur_int(c, &v)) return false;
+        hdr->seq = v;
+        if (_cur_skip(c, ", rx_us = ")) {
+            if (!_cur_int(c, &v)) return false;
+            hdr->rx_us = v;
+        }
+        if (!_cur_skip(c, ", handler_us = ") || !_cur_int(c, &v)) return false;
+        hdr->handler_us = v;
+    }
+    if (!_cur_line_end(c)) {
+        return false;
+    }
+
+    if (!_cur_skip(c, "rx_ctrl info, len = ") || !_cur_int(c, &v) || v != 19 || !_cur_line_end(c)) {
+        return false;
+    }
+    int64_t rx[19];
+    for (int i = 0; i < 19; i++) {
+        if (!_cur_int(c, &rx[i]) || !_cur_skip(c, ",")) {
+            return false;
+        }
+    }
+    if (!_cur_line_end(c)) {
+        return false;
+    }
+    // the order of parse_csi()
+    hdr->rssi = rx[0]; hdr->rate = rx[1]; hdr->sig_mode = rx[2]; hdr->mcs = rx[3]; hdr->cwb = rx[4];
+    hdr->smoothing = rx[5]; hdr->not_sounding = rx[6]; hdr->aggregation = rx[7]; hdr->stbc = rx[8];
+    hdr->fec_coding = rx[9]; hdr->sgi = rx[10]; hdr->noise_floor = rx[11]; hdr->ampdu_cnt = rx[12];
+    hdr->channel = rx[13]; hdr->secondary_channel = rx[14]; hdr->timestamp = (uint32_t)rx[15];
+    hdr->ant = rx[16]; hdr->sig_len = rx[17]; hdr->rx_state = rx[18];
+
+    int64_t len;
+    if (!_cur_skip(c, "RAW, len = ") || !_cur_int(c, &len) || len < 0 || len > CSI_FRAME_MAX_CSI ||
+        !_cur_line_end(c)) {
+        return false;
+    }
+    int8_t *csi = (int8_t *)(in->rec + sizeof(*hdr));
+    for (int i = 0; i < len; i++) {
+        if (!_cur_int(c, &v) || !_cur_skip(c, ",")) {
+            return false;
+        }
+        csi[i] = v;
+    }
+    if (!_cur_line_end(c)) {
+        return false;
+    }
+    hdr->csi_len = len;
+    hdr->len = sizeof(*hdr) + len;
+    return true;
+}
+
+static void _ingest_text(csi_ingest_t *in, const uint8_t *p, size_t n, uint64_t host_us) {
+    _ingest_cur_t c = {(const char *)p, (const char *)p + n};
+    while (c.p < c.end) {
+        // each record starts with a "CSI_DATA" line
+        if (c.end - c.p < 8 || memcmp(c.p, "CSI_DATA", 8) != 0 || !_ingest_text_record(in, &c)) {
+            in->counters.errors++;
+            return;
+        }
+        in->counters.text_frames++;
+        _ingest_publish(in, in->rec, host_us);
+    }
+}
+
+/* Decode one datagram, as received at host_us. */
+void ingest_datagram(csi_ingest_t *in, const uint8_t *p, size_t n, uint64_t host_us) {
+    in->counters.datagrams++;
+    in->counters.bytes += n;
+    if (n > 0 && p[0] == CSI_RECORD_MAGIC) {
+        _ingest_binary(in, p, n, host_us);
+    } else {
+        _ingest_text(in, p, n, host_us);
+    }
+}
+
+static uint64_t _ingest_msg_time(struct msghdr *h, uint64_t fallback) {
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(h); cm != NULL; cm = CMSG_NXTHDR(h, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+            return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+        }
+    }
+    return fallback;
+}
+
+/*
+ * Receive and decode up to INGEST_BATCH datagrams with one system call.
+ * flags are passed to recvmmsg(), MSG_DONTWAIT to poll. Returns the number of datagrams, -1 on error.
+ */
+int ingest_poll(csi_ingest_t *in, int flags) {
+    for (int i = 0; i < INGEST_BATCH; i++) {
+        in->msgs[i].msg_hdr.msg_control = in->control[i];
+        in->msgs[i].msg_hdr.msg_controllen = sizeof(in->control[i]);
+        in->msgs[i].msg_hdr.msg_flags = 0;
+    }
+    int n = recvmmsg(in->sock, in->msgs, INGEST_BATCH, flags, NULL);
+    in->counters.recv_calls++;
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    }
+    uint64_t now = ingest_now_us();
+    for (int i = 0; i < n; i++) {
+        struct msghdr *h = &in->msgs[i].msg_hdr;
+        if (h->msg_flags & MSG_TRUNC) {
+            in->counters.errors++;
+            continue;
+        }
+        ingest_datagram(in, in->bufs[i], in->msgs[i].msg_len, _ingest_msg_time(h, now));
+    }
+    return n;
+}
+
+static speed_t _ingest_baud(int baud) {
+    switch (baud) {
+        case 115200: return B115200;
+        case 230400: return B230400;
+        case 460800: return B460800;
+        case 921600: return B921600;
+        case 1000000: return B1000000;
+        case 1500000: return B1500000;
+        case 2000000: return B2000000;
+        case 3000000: return B3000000;
+        case 4000000: return B4000000;
+        default: return 0;
+    }
+}
+
+/*
+ * Open a serial port raw at baud, reads return after 100 ms without bytes. Anything that is not a
+ * tty, such as a file the port was copied into, is opened as it is.
+ * Returns the descriptor, or -1 (errno EINVAL for a baud rate termios has no constant for).
+ */
+int ingest_open_serial(const char *path, int baud) {
+    speed_t speed = _ingest_baud(baud);
+    if (speed == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    int fd = open(path, O_RDWR | O_NOCTTY);
+    if (fd < 0 && errno == EACCES) {
+        fd = open(path, O_RDONLY | O_NOCTTY);
+    }
+    if (fd < 0 || !isatty(fd)) {
+        return fd;
+    }
+    struct termios t;
+    if (tcgetattr(fd, &t) < 0) {
+        close(fd);
+        return -1;
+    }
+    cfmakeraw(&t);
+    cfsetispeed(&t, speed);
+    cfsetospeed(&t, speed);
+    t.c_cflag |= CLOCAL | CREAD;
+    t.c_cc[VMIN] = 0;
+    t.c_cc[VTIME] = 1;
+    if (tcsetattr(fd, TCSANOW, &t) < 0) {
+        close(fd);
+        return -1;
+    }
+    tcflush(fd, TCIFLUSH);
+    return fd;
+}
+
+static void _ingest_serial_record(void *ctx, const uint8_t *rec, size_t len) {
+    csi_ingest_t *in = ctx;
+    ingest_datagram(in, rec, len, in->serial_us);
+}
+
+/*
+ * Read what the serial port fd has, up to a buffer of INGEST_BATCH datagrams, and decode the framed
+ * records in it. Every record is decoded as a datagram of its own, stamped with the time of the read.
+ * Returns the number of bytes read, 0 when there were none, -1 on error or, with errno 0, at the end of a file.
+ */
+int ingest_read_serial(csi_ingest_t *in, int fd) {
+    ssize_t n = read(fd, in->bufs, sizeof(in->bufs));
+    in->counters.recv_calls++;
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    }
+    if (n == 0) {
+        // a tty with VTIME set times out like this, a pipe or file has ended
+        if (isatty(fd)) {
+            return 0;
+        }
+        errno = 0;
+        return -1;
+    }
+    in->serial_us = ingest_now_us();
+    serial_decode(&in->serial, (const uint8_t *)in->bufs, n, _ingest_serial_record, in);
+    uint64_t errors = in->serial.crc_errors + in->serial.cobs_errors + in->serial.overflows;
+    in->counters.errors += errors - in->serial_errors;
+    in->serial_errors = errors;
+    return n;
+}
+
+#endif //ESP32_CSI_INGEST_H
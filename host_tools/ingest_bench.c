@@ -0,0 +1,328 @@
+/*
+ * Throughput of the host ingest path in ingest.h, fed over loopback UDP with the datagrams of
+ * many boards replayed from memory.
+ * For text and for delta coded binary records it reports
+ *   - drain: receive and decode cost per frame of bursts queued on the socket, with recvmmsg()
+ *     (ingest_poll()) and with one recv() per datagram as host_processing_pyqt.py does
+ *     On loopback the two come out the same within a few percent either way: decoding takes
+ *     most of the time, recvmmsg() saves the system calls (64 datagrams per call) but not more.
+ *   - flood: frames/s while a sender thread floods the socket, and the share of datagrams that
+ *     got through, the rest the kernel dropped because the receiver fell behind
+ * Every decoded frame is checked against the frame that was sent.
+ *
+ *   make ingest_bench && ./ingest_bench [boards] [seconds]
+ */
+#include <pthread.h>
+
+#include "esp_shim.h"
+#include "csi_component.h"
+#include "ingest.h"
+#include "bench_common.h"
+
+#define CSI_BUF_LEN         384
+#define FRAMES_PER_BOARD    128     // replayed in a loop
+#define MAX_BOARDS          INGEST_MAX_NODES
+#define SEND_BATCH          32      // datagrams per sendmmsg()
+#define DRAIN_BURST         64      // datagrams queued at once, well within the default receive buffer
+#define DRAIN_REPS          5       // drain runs of each kind, taking turns, the fastest counts
+
+typedef struct {
+    uint8_t (*dgrams)[INGEST_DGRAM_MAX];
+    uint16_t *lens;
+    int n;
+} bench_stream_t;
+
+typedef struct {
+    int sock;
+    const bench_stream_t *stream;
+    double seconds;
+    uint64_t sent;
+} bench_sender_t;
+
+// what every frame must decode to, by board and seq
+static uint32_t expect_hash[MAX_BOARDS][FRAMES_PER_BOARD];
+static int8_t expect_rssi[MAX_BOARDS][FRAMES_PER_BOARD];
+static uint64_t mismatches;
+
+static uint32_t fnv1a(const uint8_t *p, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; i++) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
+
+static int noise(int amp) {
+    return (int)(bench_rand() % (2 * amp + 1)) - amp;
+}
+
+/*
+ * FRAMES_PER_BOARD frames of each board, interleaved as they would arrive: receiver noise around
+ * a static channel per board. Text records go one per datagram, binary ones are delta coded and
+ * batched into datagrams of up to 2 KB like csi_handler_task does.
+ */
+static void make_stream(int boards, bool binary, bench_stream_t *s) {
+    static int8_t base[MAX_BOARDS][CSI_BUF_LEN];
+    static int8_t buf[CSI_BUF_LEN];
+    static csi_delta_t enc;
+    static uint8_t rec[sizeof(csi_record_hdr_t) + CSI_BUF_LEN];
+
+    bench_rand_state = 0x12345678;
+    for (int b = 0; b < boards; b++) {
+        for (int i = 0; i < CSI_BUF_LEN; i++) {
+            base[b][i] = noise(40);
+        }
+    }
+    delta_init(&enc, CSI_DELTA_KEYFRAME_INTERVAL);
+    s->n = 0;
+    size_t fill = 0;
+    for (int k = 0; k < FRAMES_PER_BOARD; k++) {
+        for (int b = 0; b < boards; b++) {
+            wifi_csi_info_t d;
+            memset(&d, 0, sizeof(d));
+            uint8_t mac[6] = {0x3c, 0x61, 0x05, 0x4c, 0x36, (uint8_t)b};
+            memcpy(d.mac, mac, 6);
+            d.rx_ctrl.rssi = -45 + noise(3);
+            d.rx_ctrl.sig_mode = 1;
+            d.rx_ctrl.cwb = 1;
+            d.rx_ctrl.channel = 1;
+            d.rx_ctrl.secondary_channel = 1;
+            d.rx_ctrl.noise_floor = -93;
+            d.rx_ctrl.timestamp = k * 10000;
+            for (int i = 0; i < CSI_BUF_LEN; i++) {
+                buf[i] = base[b][i] + noise(1);
+            }
+            d.buf = buf;
+            d.len = CSI_BUF_LEN;
+            expect_hash[b][k] = fnv1a((const uint8_t *)buf, CSI_BUF_LEN);
+            expect_rssi[b][k] = d.rx_ctrl.rssi;
+            uint64_t rx_us = (uint64_t)k * 10000 + b;
+
+            if (!binary) {
+                s->lens[s->n] = parse_csi(&d, k, rx_us, rx_us + 300, (char *)s->dgrams[s->n], INGEST_DGRAM_MAX);
+                s->n++;
+                continue;
+            }
+            size_t len = csi_record_pack(&d, rec, sizeof(rec));
+            csi_record_stamp(rec, k, rx_us, rx_us + 300);
+            len = delta_encode_record(&enc, rec, len);
+            if (fill + len > INGEST_DGRAM_MAX) {
+                s->lens[s->n++] = fill;
+                fill = 0;
+            }
+            memcpy(s->dgrams[s->n] + fill, rec, len);
+            fill += len;
+        }
+    }
+    if (binary && fill > 0) {
+        s->lens[s->n++] = fill;
+    }
+}
+
+static void *sender_task(void *arg) {
+    bench_sender_t *snd = arg;
+    const bench_stream_t *s = snd->stream;
+    struct mmsghdr msgs[SEND_BATCH];
+    struct iovec iovs[SEND_BATCH];
+    memset(msgs, 0, sizeof(msgs));
+    double end = bench_now() + snd->seconds;
+    int next = 0;
+    while (bench_now() < end) {
+        for (int i = 0; i < SEND_BATCH; i++) {
+            int k = (next + i) % s->n;
+            iovs[i].iov_base = s->dgrams[k];
+            iovs[i].iov_len = s->lens[k];
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int n = sendmmsg(snd->sock, msgs, SEND_BATCH, 0);
+        if (n > 0) {
+            next = (next + n) % s->n;
+            snd->sent += n;
+        }
+    }
+    return NULL;
+}
+
+static void check_frame(void *ctx, const csi_frame_t *f) {
+    int board = f->hdr.mac[5];
+    int k = f->hdr.seq;
+    if (board >= MAX_BOARDS || k >= FRAMES_PER_BOARD || f->hdr.csi_len != CSI_BUF_LEN ||
+        f->hdr.rssi != expect_rssi[board][k] || fnv1a(f->csi, f->hdr.csi_len) != expect_hash[board][k] ||
+        f->hdr.rx_us != (uint64_t)k * 10000 + board) {
+        mismatches++;
+    }
+}
+
+static double thread_cpu(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* A bound ingest socket and a sender connected to it over loopback. */
+static int open_pair(csi_ingest_t *in, int *sender) {
+    int sock = ingest_open_socket(0, 4 << 20);
+    if (sock < 0) {
+        perror("socket");
+        exit(1);
+    }
+    struct timeval tv = {.tv_sec = 0, .tv_usec = 100000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    getsockname(sock, (struct sockaddr *)&addr, &addr_len);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    *sender = socket(AF_INET, SOCK_DGRAM, 0);
+    connect(*sender, (struct sockaddr *)&addr, sizeof(addr));
+    ingest_init(in, sock, check_frame, NULL);
+    mismatches = 0;
+    return sock;
+}
+
+static int check_run(const csi_ingest_t *in, int boards) {
+    const ingest_counters_t *c = &in->counters;
+    // a delta chain broken by a dropped datagram is skipped up to its keyframe, never decoded wrong
+    if (mismatches != 0 || c->errors != 0 || c->frames == 0 || in->n_nodes != boards) {
+        printf("  %lu frames decoded wrong, %lu errors, %d of %d nodes seen\n", mismatches, c->errors, in->n_nodes, boards);
+        return 1;
+    }
+    return 0;
+}
+
+typedef struct {
+    double busy;                    // seconds spent draining
+    uint64_t frames, datagrams, recv_calls, sent;
+} drain_result_t;
+
+/*
+ * Receive cost without the sender competing for the core: bursts of DRAIN_BURST datagrams are
+ * queued on the socket, then drained and decoded with recvmmsg() or one recv() per datagram.
+ * Only the draining is timed.
+ */
+static int run_drain(const bench_stream_t *s, int boards, int bursts, bool batched, drain_result_t *res) {
+    static csi_ingest_t in;
+    static uint8_t buf[INGEST_DGRAM_MAX];
+    int sender;
+    int sock = open_pair(&in, &sender);
+    struct mmsghdr msgs[DRAIN_BURST];
+    struct iovec iovs[DRAIN_BURST];
+    memset(msgs, 0, sizeof(msgs));
+    uint64_t sent = 0;
+    int next = 0;
+    double busy = 0;
+    for (int b = 0; b < bursts; b++) {
+        for (int i = 0; i < DRAIN_BURST; i++) {
+            int k = (next + i) % s->n;
+            iovs[i].iov_base = s->dgrams[k];
+            iovs[i].iov_len = s->lens[k];
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int n = sendmmsg(sender, msgs, DRAIN_BURST, 0);
+        next = (next + n) % s->n;
+        sent += n;
+        double t0 = bench_now();
+        while (in.counters.datagrams < sent) {
+            if (batched) {
+                if (ingest_poll(&in, MSG_DONTWAIT) <= 0) {
+                    break;
+                }
+            } else {
+                ssize_t len = recv(sock, buf, sizeof(buf), MSG_DONTWAIT);
+                in.counters.recv_calls++;
+                if (len < 0) {
+                    break;
+                }
+                ingest_datagram(&in, buf, len, ingest_now_us());
+            }
+        }
+        busy += bench_now() - t0;
+    }
+    close(sender);
+    close(sock);
+
+    const ingest_counters_t *c = &in.counters;
+    *res = (drain_result_t){busy, c->frames, c->datagrams, c->recv_calls, sent};
+    return check_run(&in, boards);
+}
+
+/*
+ * Both ways of draining, DRAIN_REPS runs each taking turns after one run each that is not
+ * counted, so neither gets the page faults of the first touch of csi_ingest_t or a different
+ * share of frequency scaling and noise. The fastest run of each is reported.
+ */
+static int compare_drain(const bench_stream_t *s, int boards, int bursts) {
+    static const char *names[2] = {"recv per datagram", "recvmmsg"};
+    drain_result_t best[2], res;
+    int err = 0;
+    for (int rep = 0; rep <= DRAIN_REPS; rep++) {
+        for (int batched = 0; batched < 2; batched++) {
+            err |= run_drain(s, boards, bursts, batched, &res);
+            if (rep == 1 || (rep > 1 && res.busy / res.frames < best[batched].busy / best[batched].frames)) {
+                best[batched] = res;
+            }
+        }
+    }
+    for (int batched = 1; batched >= 0; batched--) {
+        const drain_result_t *r = &best[batched];
+        printf("  %-18s %8.0f frames/s, %5.2f us per frame, %4.1f datagrams per call, %lu of %lu datagrams\n",
+               names[batched], r->frames / r->busy, r->busy * 1e6 / r->frames, (double)r->datagrams / r->recv_calls,
+               r->datagrams, r->sent);
+    }
+    return err;
+}
+
+/* Sustained rate: the sender thread floods the socket for seconds while this thread drains it. */
+static int run_flood(const bench_stream_t *s, int boards, double seconds) {
+    static csi_ingest_t in;
+    bench_sender_t snd = {.stream = s, .seconds = seconds};
+    open_pair(&in, &snd.sock);
+
+    pthread_t thread;
+    double t0 = bench_now(), cpu0 = thread_cpu();
+    pthread_create(&thread, NULL, sender_task, &snd);
+    while (bench_now() < t0 + seconds) {
+        ingest_poll(&in, MSG_WAITFORONE);
+    }
+    pthread_join(thread, NULL);
+    // what is still queued, until the socket stays empty for a timeout
+    while (ingest_poll(&in, MSG_WAITFORONE) > 0) {
+    }
+    double wall = bench_now() - t0, cpu = thread_cpu() - cpu0;
+    close(snd.sock);
+    close(in.sock);
+
+    const ingest_counters_t *c = &in.counters;
+    printf("  %-18s %8.0f frames/s, receiver busy %3.0f%%, %5.1f%% of %lu datagrams received\n",
+           "flood", c->frames / wall, 100 * cpu / wall, 100.0 * c->datagrams / snd.sent, snd.sent);
+    return check_run(&in, boards);
+}
+
+int main(int argc, char **argv) {
+    int boards = argc > 1 ? atoi(argv[1]) : 32;
+    double seconds = argc > 2 ? atof(argv[2]) : 1.0;
+    if (boards < 1 || boards > MAX_BOARDS) {
+        fprintf(stderr, "1 to %d boards\n", MAX_BOARDS);
+        return 1;
+    }
+    static uint8_t dgrams[MAX_BOARDS * FRAMES_PER_BOARD][INGEST_DGRAM_MAX];
+    static uint16_t lens[MAX_BOARDS * FRAMES_PER_BOARD];
+    bench_stream_t s = {dgrams, lens, 0};
+
+    int err = 0;
+    for (int binary = 0; binary < 2; binary++) {
+        make_stream(boards, binary, &s);
+        size_t bytes = 0;
+        for (int i = 0; i < s.n; i++) {
+            bytes += s.lens[i];
+        }
+        printf("%s, %d boards, %d frames in %d datagrams of %zu bytes on average:\n", binary ? "binary delta coded" : "text",
+               boards, boards * FRAMES_PER_BOARD, s.n, bytes / s.n);
+        // as many bursts as it takes to cycle through the stream a few times
+        int bursts = 4 * s.n / DRAIN_BURST + 1;
+        err |= compare_drain(&s, boards, bursts);
+        err |= run_flood(&s, boards, seconds);
+    }
+    return err;
+}
@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+# Checks link_stats.LinkStats on synthetic record streams with known losses, swapped and duplicated
+# records, a sequence wrap and a device restart:
+#   ./link_stats_check.py [records per node]
+# The counts must come out exactly, the jitter near zero for a constant delay and near the expected
+# value for a random one.
+import os
+import random
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "active_ap"))
+import link_stats
+
+INTERVAL_US = 10000
+
+# returns the arrivals (seq, handler_us, arrival_s) and the expected counts
+def make_stream (rng, n, first_seq, delay_us, restart_at=None) :
+    sent = []
+    seq = first_seq
+    for i in range(n):
+        if i == restart_at:
+            seq = 0
+        sent.append((seq, (i * INTERVAL_US) % (1 << 32)))
+        seq = (seq + 1) % link_stats.SEQ_MOD
+
+    arrivals = []
+    expected = {"lost": 0, "reordered": 0, "duplicates": 0}
+    i = 0
+    while i < n:
+        (seq, handler_us) = sent[i]
+        arrival_s = (i * INTERVAL_US + delay_us(rng)) / 1e6
+        r = rng.random()
+        # never right before or at the restart, the swap would cross it
+        near_restart = restart_at is not None and restart_at - 2 <= i <= restart_at
+        if r < 0.01 and 0 < i < n - 1 and not near_restart:
+            expected["lost"] += 1
+        elif r < 0.015 and i < n - 2 and not near_restart:
+            # the next record overtakes this one
+            (seq2, handler_us2) = sent[i + 1]
+            arrivals.append((seq2, handler_us2, arrival_s))
+            arrivals.append((seq, handler_us, arrival_s + 1e-4))
+            expected["reordered"] += 1
+            i += 1
+        elif r < 0.017:
+            arrivals.append((seq, handler_us, arrival_s))
+            arrivals.append((seq, handler_us, arrival_s + 1e-4))
+            expected["duplicates"] += 1
+        else:
+            arrivals.append((seq, handler_us, arrival_s))
+        i += 1
+    return (arrivals, expected)
+
+def main () :
+    n = int(sys.argv[1]) if len(sys.argv) > 1 else 20000
+    rng = random.Random(1234)
+    streams = {
+        # constant delay, starts close to the wrap of seq
+        "aa:00:00:00:00:01": make_stream(rng, n, 60000, lambda rng: 2000),
+        # up to 1 ms of random delay, restarts half way
+        "aa:00:00:00:00:02": make_stream(rng, n, 0, lambda rng: 2000 + rng.uniform(0, 1000), n // 2),
+    }
+    stats = link_stats.LinkStats()
+    # interleave the nodes as they would arrive
+    merged = sorted((a[2], mac, a) for (mac, (arrivals, _)) in streams.items() for a in arrivals)
+    for (_, mac, (seq, handler_us, arrival_s)) in merged:
+        stats.update(mac, seq, handler_us, arrival_s)
+
+    err = 0
+    for (mac, (arrivals, expected)) in streams.items():
+        node = stats.nodes[mac]
+        got = {"lost": node.lost, "reordered": node.reordered, "duplicates": node.duplicates}
+        if got != expected:
+            print("{}: expected {}, got {}".format(mac, expected, got))
+            err = 1
+        print(stats.summary(mac) + ", {} restarts".format(node.restarts))
+    constant = stats.nodes["aa:00:00:00:00:01"]
+    noisy = stats.nodes["aa:00:00:00:00:02"]
+    # |D| of two uniform delays on [0, 1000] averages 333 us
+    if constant.jitter_us > 1 or not 200 < noisy.jitter_us < 500 or noisy.restarts != 1:
+        print("jitter or restart detection off")
+        err = 1
+    if err == 0:
+        print("loss, reordering and duplicates counted exactly")
+    return err
+
+if __name__ == "__main__":
+    sys.exit(main())
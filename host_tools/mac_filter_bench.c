@@ -0,0 +1,204 @@
+/*
+ * Check and cost per callback of the peer mac filter in ../_components/mac_filter_component.h,
+ * against the sprintf + strcmp is_peer_node() it replaced.
+ *
+ * The check runs random add/remove sequences and compares every lookup with a plain list,
+ * and the slots of ../_components/peer_component.h with a least recently used list.
+ * The benchmark feeds a stream where most frames come from unrelated devices, as in a busy RF environment.
+ *
+ *   make mac_filter_bench && ./mac_filter_bench [lookups]
+ */
+#include "esp_shim.h"
+#include "mac_filter_component.h"
+#include "bench_common.h"
+
+#define STREAM_LEN  4096
+#define HIT_PERCENT 10
+
+/* is_peer_node() as it was in active_ap/main/main.c */
+static char old_peer_mac_list[MAC_FILTER_MAX_PEERS][20];
+static int old_peer_num;
+
+int is_peer_node (uint8_t mac[6]) {
+    char mac_str[20] = {0};
+    sprintf(mac_str, "%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    for (int p = 0; p < old_peer_num; p++) {
+        if ( strcmp(mac_str, old_peer_mac_list[p])==0 )
+            return 1;
+    }
+    return 0;
+}
+
+static void random_mac(uint8_t mac[6]) {
+    // a few vendor prefixes, random device part
+    static const uint8_t oui[3][3] = {{0x3c, 0x61, 0x05}, {0x08, 0x3a, 0xf2}, {0xa4, 0xcf, 0x12}};
+    const uint8_t *o = oui[bench_rand() % 3];
+    mac[0] = o[0]; mac[1] = o[1]; mac[2] = o[2];
+    mac[3] = bench_rand(); mac[4] = bench_rand(); mac[5] = bench_rand();
+}
+
+static int ref_find(uint8_t (*ref)[6], int n, const uint8_t mac[6]) {
+    for (int i = 0; i < n; i++) {
+        if (memcmp(ref[i], mac, 6) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int check(void) {
+    static mac_filter_t f;
+    uint8_t ref[MAC_FILTER_MAX_PEERS][6];
+    uint8_t pool[MAC_FILTER_MAX_PEERS * 2][6];
+    int n = 0;
+
+    for (int i = 0; i < MAC_FILTER_MAX_PEERS * 2; i++) {
+        random_mac(pool[i]);
+    }
+    mac_filter_init(&f);
+    for (int step = 0; step < 200000; step++) {
+        uint8_t *mac = pool[bench_rand() % (MAC_FILTER_MAX_PEERS * 2)];
+        int pos = ref_find(ref, n, mac);
+        if (bench_rand() % 2) {
+            bool ok = mac_filter_add(&f, mac);
+            bool expected = pos >= 0 || n < MAC_FILTER_MAX_PEERS;
+            if (pos < 0 && n < MAC_FILTER_MAX_PEERS) {
+                memcpy(ref[n++], mac, 6);
+            }
+            if (ok != expected) {
+                fprintf(stderr, "add result mismatch at step %d\n", step);
+                return 1;
+            }
+        } else {
+            bool ok = mac_filter_remove(&f, mac);
+            if (ok != (pos >= 0)) {
+                fprintf(stderr, "remove result mismatch at step %d\n", step);
+                return 1;
+            }
+            if (pos >= 0) {
+                memcpy(ref[pos], ref[--n], 6);
+            }
+        }
+        if (mac_filter_count(&f) != n) {
+            fprintf(stderr, "count mismatch at step %d: %d vs %d\n", step, mac_filter_count(&f), n);
+            return 1;
+        }
+        for (int i = 0; i < MAC_FILTER_MAX_PEERS * 2; i++) {
+            if (mac_filter_contains(&f, pool[i]) != (ref_find(ref, n, pool[i]) >= 0)) {
+                fprintf(stderr, "lookup mismatch at step %d\n", step);
+                return 1;
+            }
+        }
+    }
+    printf("check: 200000 random add/remove steps match the reference list\n");
+    return 0;
+}
+
+// the slot of every lookup as a linear LRU list would give it
+static int check_peers(void) {
+    static csi_peers_t t;
+    uint8_t pool[PEER_MAX_PEERS * 2][6];
+    uint64_t ref_keys[PEER_MAX_PEERS];
+    uint32_t ref_last[PEER_MAX_PEERS];
+    uint32_t ref_evictions = 0;
+    int n = 0;
+
+    for (int i = 0; i < PEER_MAX_PEERS * 2; i++) {
+        random_mac(pool[i]);
+    }
+    peers_init(&t);
+    for (uint32_t step = 1; step <= 400000; step++) {
+        // the first half only the filter peers, then strangers as well
+        int range = step <= 200000 ? PEER_MAX_PEERS : PEER_MAX_PEERS * 2;
+        const uint8_t *mac = pool[bench_rand() % range];
+        uint64_t key = mac_to_key(mac);
+        int want = -1;
+        bool want_fresh = false;
+        for (int i = 0; i < n; i++) {
+            if (ref_keys[i] == key) {
+                want = i;
+            }
+        }
+        if (want < 0) {
+            want_fresh = true;
+            if (n < PEER_MAX_PEERS) {
+                want = n++;
+            } else {
+                want = 0;
+                for (int i = 1; i < PEER_MAX_PEERS; i++) {
+                    if (ref_last[i] < ref_last[want]) {
+                        want = i;
+                    }
+                }
+                ref_evictions++;
+            }
+            ref_keys[want] = key;
+        }
+        ref_last[want] = step;
+
+        bool fresh;
+        int slot = peers_slot(&t, mac, &fresh);
+        if (slot != want || fresh != want_fresh || t.evictions != ref_evictions) {
+            fprintf(stderr, "peer slot %d%s at step %u, expected %d%s\n", slot, fresh ? " (fresh)" : "", step,
+                    want, want_fresh ? " (fresh)" : "");
+            return 1;
+        }
+        if (step == 200000 && t.evictions != 0) {
+            fprintf(stderr, "%u evictions among %d peers\n", t.evictions, PEER_MAX_PEERS);
+            return 1;
+        }
+    }
+    printf("check: 400000 peer slots match the LRU list, %d peers keep theirs, %u evictions with %d sources\n",
+           PEER_MAX_PEERS, t.evictions, PEER_MAX_PEERS * 2);
+    return 0;
+}
+
+static void bench(int peers, long lookups) {
+    static mac_filter_t f;
+    static uint8_t stream[STREAM_LEN][6];
+    uint8_t macs[MAC_FILTER_MAX_PEERS][6];
+
+    mac_filter_init(&f);
+    old_peer_num = peers;
+    for (int i = 0; i < peers; i++) {
+        random_mac(macs[i]);
+        mac_filter_add(&f, macs[i]);
+        sprintf(old_peer_mac_list[i], "%02x:%02x:%02x:%02x:%02x:%02x", MAC2STR(macs[i]));
+    }
+    for (int i = 0; i < STREAM_LEN; i++) {
+        if (bench_rand() % 100 < HIT_PERCENT) {
+            memcpy(stream[i], macs[bench_rand() % peers], 6);
+        } else {
+            random_mac(stream[i]);
+        }
+    }
+
+    long hits_old = 0, hits_new = 0;
+    double t0 = bench_now();
+    for (long i = 0; i < lookups; i++) {
+        hits_old += is_peer_node(stream[i % STREAM_LEN]);
+    }
+    double t1 = bench_now();
+    for (long i = 0; i < lookups; i++) {
+        hits_new += mac_filter_contains(&f, stream[i % STREAM_LEN]);
+    }
+    double t2 = bench_now();
+
+    if (hits_old != hits_new) {
+        fprintf(stderr, "hit count mismatch %ld vs %ld\n", hits_old, hits_new);
+        exit(1);
+    }
+    printf("%2d peers, %d%% hits: sprintf + strcmp %7.1f ns/call, hash set %5.1f ns/call\n",
+           peers, HIT_PERCENT, (t1 - t0) * 1e9 / lookups, (t2 - t1) * 1e9 / lookups);
+}
+
+int main(int argc, char **argv) {
+    long lookups = argc > 1 ? atol(argv[1]) : 2000000;
+    if (check() || check_peers()) {
+        return 1;
+    }
+    bench(4, lookups);
+    bench(16, lookups);
+    bench(MAC_FILTER_MAX_PEERS, lookups);
+    return 0;
+}
@@ -0,0 +1,274 @@
+/*
+ * Check of the stimulus pacer in ../_components/pacer_component.h.
+ * A simulated sender, with the wake up latency of an esp_timer callback and a task switch, now
+ * and then a late wake up behind the wifi task, send calls that take time and sometimes fail for
+ * want of a buffer, and a 50 ms stall, is paced at 10 to 1000 Hz for a minute of device time,
+ * with and without dither. Checks that the achieved rate is the target, that the sends leave on
+ * time once the lead has settled, that dithered sends stay within their window, that failed sends
+ * are tried again and a stall is not made up with a burst. The same sender is then run with the
+ * delays the firmware used before: vTaskDelay(2), vTaskDelay(floor(1000 / rate)) and ets_delay_us()
+ * of sockets_component.h, and vTaskDelay(100 ms) of udp_client.c, at CONFIG_FREERTOS_HZ 1000.
+ * Last the pacer sends UDP datagrams on this host for real, sleeping with clock_nanosleep().
+ *
+ *   make pacer_check && ./pacer_check [seconds of device time, 30 or more]
+ */
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "esp_shim.h"
+#include "pacer_component.h"
+#include "bench_common.h"
+
+#define TICK_US         1000    // CONFIG_FREERTOS_HZ 1000
+#define STALL_AT_US     20000000
+#define STALL_US        50000
+
+typedef struct {
+    int64_t now;                // simulated device time
+    bool stalled;
+} sim_t;
+
+// timer dispatch and task switch, 1 in 100 behind the wifi task for up to 2 ms
+static int64_t wake_latency(void) {
+    int64_t us = 30 + bench_rand() % 40;
+    if (bench_rand() % 100 == 0) {
+        us += bench_rand() % 2000;
+    }
+    return us;
+}
+
+// a send call, 1 in 200 starts a run of up to 4 failing for want of a buffer
+static bool send_call(sim_t *s) {
+    static int failing = 0;
+    s->now += 40 + bench_rand() % 40;
+    if (failing > 0) {
+        failing--;
+        return false;
+    }
+    if (bench_rand() % 200 == 0) {
+        failing = bench_rand() % 4;
+        return false;
+    }
+    return true;
+}
+
+// the stall once, a higher priority task holds the core
+static void maybe_stall(sim_t *s) {
+    if (!s->stalled && s->now >= STALL_AT_US) {
+        s->stalled = true;
+        s->now += STALL_US;
+    }
+}
+
+typedef struct {
+    pacer_report_t settled;     // after the first second
+    int burst;                  // sends within two periods after the stall
+    int64_t dither_out;         // most a send left before its window
+} sim_result_t;
+
+static sim_result_t run_pacer(uint32_t rate, uint32_t dither, int seconds) {
+    sim_t s = {1000000, false};
+    csi_pacer_t p;
+    pacer_init(&p, rate, dither, s.now, 0x9e3779b9);
+    int64_t end = s.now + (int64_t)seconds * 1000000;
+    int64_t period = 1000000 / rate;
+    sim_result_t r;
+    memset(&r, 0, sizeof(r));
+    pacer_report_t warmup;
+    bool settled = false;
+    int64_t stall_end = STALL_AT_US + STALL_US;
+    int after_stall = 0;
+    while (s.now < end) {
+        int64_t wake = pacer_wake_us(&p);
+        if (wake > s.now) {
+            s.now = wake;
+        }
+        s.now += wake_latency();
+        maybe_stall(&s);
+        // with no delay at all a send before its window would show here
+        int64_t early = (p.due_us - p.dither_us) - s.now;
+        if (p.retry_us == 0 && early > (int64_t)(p.lead_acc >> PACER_LEAD_SHIFT) + 100 && early > r.dither_out) {
+            r.dither_out = early;
+        }
+        bool ok = send_call(&s);
+        pacer_result(&p, s.now, ok);
+        if (ok && s.now >= stall_end && s.now < stall_end + 2 * period) {
+            after_stall++;
+        }
+        if (!settled && s.now >= 2000000) {
+            pacer_report(&p, s.now, &warmup);
+            settled = true;
+        }
+    }
+    pacer_report(&p, s.now, &r.settled);
+    r.burst = after_stall;
+    return r;
+}
+
+/* sockets_component.h before: vTaskDelay(2), vTaskDelay(floor(1000 / rate)) and a busy wait for the rest. */
+static double run_ticks(uint32_t rate, int seconds, double *jitter) {
+    sim_t s = {1000000, true};
+    int64_t end = s.now + (int64_t)seconds * 1000000;
+    int sent = 0;
+    int64_t last = 0;
+    double sum = 0, sq = 0;
+    int n = 0;
+    while (s.now < end) {
+        if (!send_call(&s)) {
+            // vTaskDelay(1) and try again
+            s.now = (s.now / TICK_US + 1) * TICK_US + wake_latency();
+            continue;
+        }
+        sent++;
+        if (last != 0) {
+            double i = s.now - last;
+            sum += i;
+            sq += i * i;
+            n++;
+        }
+        last = s.now;
+        // vTaskDelay(n) wakes at the nth tick interrupt from now
+        s.now = (s.now / TICK_US + 2) * TICK_US + wake_latency();
+        s.now = (s.now / TICK_US + 1000 / rate) * TICK_US + wake_latency();
+        s.now += (int64_t)((1000.0 / rate - 1000 / rate) * 1000);
+    }
+    double mean = sum / n;
+    *jitter = sqrt(sq / n - mean * mean);
+    return sent / (double)seconds;
+}
+
+/* udp_client.c before: vTaskDelay(100 / portTICK_PERIOD_MS) after every send. */
+static double run_delay(int seconds, double *jitter) {
+    sim_t s = {1000000, true};
+    int64_t end = s.now + (int64_t)seconds * 1000000;
+    int sent = 0;
+    int64_t last = 0;
+    double sum = 0, sq = 0;
+    int n = 0;
+    while (s.now < end) {
+        sent += send_call(&s);
+        if (last != 0) {
+            double i = s.now - last;
+            sum += i;
+            sq += i * i;
+            n++;
+        }
+        last = s.now;
+        s.now = (s.now / TICK_US + 100) * TICK_US + wake_latency();
+    }
+    double mean = sum / n;
+    *jitter = sqrt(sq / n - mean * mean);
+    return sent / (double)seconds;
+}
+
+static int64_t mono_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* pacer_wait() of the firmware with clock_nanosleep() for the esp_timer, UDP datagrams to localhost. */
+static int run_real(uint32_t rate, double seconds) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(9); // discard
+    csi_pacer_t p;
+    pacer_init(&p, rate, 0, mono_us(), 1);
+    int64_t end = mono_us() + (int64_t)(seconds * 1e6);
+    int64_t now = mono_us();
+    pacer_report_t r;
+    bool first = true;
+    while (now < end) {
+        int64_t wake = pacer_wake_us(&p);
+        if (wake > now) {
+            struct timespec ts = {wake / 1000000, (wake % 1000000) * 1000};
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        }
+        // nothing listens on the port, a send that fails is still on time
+        sendto(sock, "1\n", 2, 0, (struct sockaddr *)&addr, sizeof(addr));
+        now = mono_us();
+        pacer_result(&p, now, true);
+        if (first) {
+            // the window from the first send, a second holds a send per period
+            pacer_report(&p, now, &r);
+            first = false;
+        }
+    }
+    close(sock);
+    pacer_report(&p, now, &r);
+    printf("this host %4u Hz      %8.2f Hz, interval %7.1f us, jitter %6.1f us, %+6.1f us late (max %5d), lead %d us, "
+           "%u skipped\n", rate, r.rate_hz, r.interval_us, r.jitter_us, r.late_us, r.late_max_us, r.lead_us, r.skipped);
+    // a shared machine preempts the process now and then, what it misses is skipped and the rest on the grid
+    double slots = r.rate_hz + r.skipped / seconds;
+    if (slots < rate * 0.99 || slots > rate * 1.01) {
+        printf("%.2f sends and skips per second instead of %u on this host\n", slots, rate);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int seconds = argc > 1 ? atoi(argv[1]) : 60;
+    // the stall at 20 s, and at 10 Hz enough sends for the lead to settle
+    if (seconds < 30) {
+        seconds = 30;
+    }
+    static const uint32_t rates[] = {10, 100, 350, 1000};
+    int err = 0;
+    for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        for (int d = 0; d < 2; d++) {
+            uint32_t rate = rates[i];
+            uint32_t dither = d ? 1000000 / rate / 8 : 0;
+            sim_result_t r = run_pacer(rate, dither, seconds);
+            pacer_report_t *s = &r.settled;
+            printf("pacer %4u Hz, dither %5u us: %8.3f Hz, jitter %6.1f us, %+5.1f us late (max %5d), lead %3d us, "
+                   "%u failed, %u given up, %u skipped, %d in 2 periods after the stall\n",
+                   rate, dither, s->rate_hz, s->jitter_us, s->late_us, s->late_max_us, s->lead_us,
+                   s->failed, s->given_up, s->skipped, r.burst);
+            // sends given up are missing from the rate, the rest must hold it
+            double expect = rate * (1.0 - (double)(s->given_up + s->skipped) / (s->sent + s->given_up + s->skipped));
+            if (fabs(s->rate_hz - expect) > expect * 0.002) {
+                printf("%.3f Hz, expected %.3f\n", s->rate_hz, expect);
+                err = 1;
+            }
+            // most wake ups are 30 to 70 us late and the send takes 40 to 80, the lead takes that out
+            if (fabs(s->late_us) > 30) {
+                printf("sends leave %.1f us off their due time on average\n", s->late_us);
+                err = 1;
+            }
+            if (r.dither_out > 0) {
+                printf("a send left %ld us before its window\n", r.dither_out);
+                err = 1;
+            }
+            // the send due last in the stall goes late, then the grid goes on: 3 at most in two periods
+            if (r.burst > 3 || (rate >= 100 && s->skipped < STALL_US * rate / 1000000 - 2)) {
+                printf("%d sends in two periods after a stall, %u skipped\n", r.burst, s->skipped);
+                err = 1;
+            }
+            if (s->failed > 0 && s->given_up * 2 > s->failed) {
+                printf("%u of %u failed sends given up\n", s->given_up, s->failed);
+                err = 1;
+            }
+        }
+    }
+    for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        double jitter;
+        double rate = run_ticks(rates[i], seconds, &jitter);
+        printf("tick delays %4u Hz       %8.3f Hz, jitter %6.1f us (sockets_component.h before)\n", rates[i], rate,
+               jitter);
+    }
+    double jitter;
+    double rate = run_delay(seconds, &jitter);
+    printf("vTaskDelay(100 ms) 10 Hz   %8.3f Hz, jitter %6.1f us (udp_client.c before)\n", rate, jitter);
+
+    err |= run_real(100, 1);
+    err |= run_real(1000, 1);
+    if (err == 0) {
+        printf("pacer checked\n");
+    }
+    return err;
+}
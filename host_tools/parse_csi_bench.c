@@ -0,0 +1,99 @@
+/*
+ * Frames/second of the text CSI serializer, the sprintf based parse_csi() it replaced versus
+ * the cursor writer in ../_components/csi_component.h, on identical input.
+ * Both outputs are compared byte for byte before timing.
+ *
+ *   make parse_csi_bench && ./parse_csi_bench [frames]
+ */
+#include "esp_shim.h"
+#include "csi_component.h"
+#include "bench_common.h"
+
+#define CSI_BUF_LEN 384
+
+/* parse_csi() as it was in active_ap/main/main.c, kept here as the baseline, with the seq fields added to the mac line since. */
+void parse_csi_sprintf (wifi_csi_info_t *data, uint16_t seq, uint64_t rx_us, uint32_t handler_us, char* payload) {
+    wifi_csi_info_t d = *data;
+    char mac[20] = {0};
+
+    sprintf(payload + strlen(payload), "CSI_DATA from Soft-AP\n");
+    sprintf(mac, "%02x:%02x:%02x:%02x:%02x:%02x", d.mac[0], d.mac[1], d.mac[2], d.mac[3], d.mac[4], d.mac[5]);
+    sprintf(payload + strlen(payload), "src mac = %s, seq = %u, rx_us = %llu, handler_us = %u\n", mac, seq,
+            (unsigned long long)rx_us, handler_us);
+
+    sprintf(payload + strlen(payload), "rx_ctrl info, len = %d\n", 19);
+    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.rssi);
+    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.rate);
+    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.sig_mode);
+    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.mcs);
+    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.cwb);
+    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.smoothing);
+    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.not_sounding);
+    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.aggregation);
+    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.stbc);
+    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.fec_coding);
+    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.sgi);
+    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.noise_floor);
+    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.ampdu_cnt);
+    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.channel);
+    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.secondary_channel);
+    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.timestamp);
+    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.ant);
+    sprintf(payload + strlen(payload), "%d,", d.rx_ctrl.sig_len);
+    sprintf(payload + strlen(payload), "%d,\n", d.rx_ctrl.rx_state);
+
+    int8_t *my_ptr;
+    sprintf(payload + strlen(payload), "RAW, len = %d\n", data->len);
+    my_ptr = data->buf;
+
+    for (int i = 0; i < data->len; i++) {
+        sprintf(payload + strlen(payload), "%d,", my_ptr[i]);
+    }
+    sprintf(payload + strlen(payload), "\n");
+}
+
+int main(int argc, char **argv) {
+    int frames = argc > 1 ? atoi(argv[1]) : 20000;
+    static int8_t bufs[BENCH_CORPUS][CSI_BUF_LEN];
+    wifi_csi_info_t corpus[BENCH_CORPUS];
+    bench_make_corpus(corpus, bufs, CSI_BUF_LEN);
+
+    char *old_payload = malloc(CSI_PAYLOAD_BENCH_SIZE);
+    char *new_payload = malloc(CSI_PAYLOAD_BENCH_SIZE);
+
+    // identical output first
+    for (int i = 0; i < BENCH_CORPUS; i++) {
+        memset(old_payload, 0, CSI_PAYLOAD_BENCH_SIZE);
+        // rx_us from 0 to past the 32-bit range, to check the 64-bit digits
+        uint64_t rx_us = i == 0 ? 0 : (1ull << (i % 64)) + i * 1000000007ull;
+        parse_csi_sprintf(&corpus[i], i * 1000, rx_us, 4000000000u + i, old_payload);
+        int len = parse_csi(&corpus[i], i * 1000, rx_us, 4000000000u + i, new_payload, CSI_PAYLOAD_BENCH_SIZE);
+        if (len != (int)strlen(old_payload) || memcmp(old_payload, new_payload, len) != 0) {
+            fprintf(stderr, "output mismatch on frame %d\n--- sprintf\n%s\n--- writer\n%s\n", i, old_payload, new_payload);
+            return 1;
+        }
+    }
+
+    size_t sink = 0;
+    double t0 = bench_now();
+    for (int i = 0; i < frames; i++) {
+        memset(old_payload, 0, CSI_PAYLOAD_BENCH_SIZE);
+        parse_csi_sprintf(&corpus[i % BENCH_CORPUS], i, i * 10000ull, i * 10000, old_payload);
+        sink += old_payload[0];
+    }
+    double t1 = bench_now();
+    for (int i = 0; i < frames; i++) {
+        sink += parse_csi(&corpus[i % BENCH_CORPUS], i, i * 10000ull, i * 10000, new_payload, CSI_PAYLOAD_BENCH_SIZE);
+    }
+    double t2 = bench_now();
+
+    double old_fps = frames / (t1 - t0);
+    double new_fps = frames / (t2 - t1);
+    printf("parse_csi, %d frames of %d CSI bytes (sink %zu)\n", frames, CSI_BUF_LEN, sink);
+    printf("  sprintf + strlen : %10.0f frames/s\n", old_fps);
+    printf("  cursor writer    : %10.0f frames/s  (%.1fx)\n", new_fps, new_fps / old_fps);
+
+    free(old_payload);
+    free(new_payload);
+    return 0;
+}
@@ -0,0 +1,422 @@
+#ifndef ESP32_CSI_REPLAY_H
+#define ESP32_CSI_REPLAY_H
+
+/*
+ * Stands in for a fleet of boards, include after esp_shim.h, ingest.h and capture.h.
+ * Every virtual node is a board of its own: it has a UDP socket, a source mac its frames carry,
+ * a device clock, sequence numbers and a batch, and serializes frames exactly as csi_handler_task
+ * of active_ap does: parse_csi() text or binary records of any payload type, optionally delta coded,
+ * one per datagram or batched up to an MTU and deadline (batch_component.h).
+ *
+ * Frames are sent on a schedule: each frame has a time t_us in the stream and goes out at
+ * t_us / speed after the start, or the schedule is ignored and frames go out at a fixed rate,
+ * or as fast as possible. How late each frame went out against its slot is kept in a histogram.
+ *
+ * Used by csi_replay (the tool) and replay_check.
+ */
+#include <arpa/inet.h>
+#include <signal.h>
+#include <time.h>
+
+#include "csi_component.h"
+#include "seq_component.h"
+#include "batch_component.h"
+
+#define REPLAY_MAX_NODES        INGEST_MAX_NODES
+#define REPLAY_PAYLOAD_SIZE     2048    // CSI_PAYLOAD_SIZE of the firmware
+#define REPLAY_LATE_BUCKETS     100000  // lateness histogram in us, the last bucket holds everything later
+#define REPLAY_SPIN_NS          20000   // closer than this to a slot, spin instead of sleeping
+
+/* What csi_handler_task sends, the menuconfig options of active_ap. */
+typedef struct {
+    bool binary;                    // CONFIG_CSI_OUTPUT_BINARY, text otherwise
+    uint8_t payload_type;           // CSI_RECORD_TYPE_*, binary only
+    bool delta;                     // CONFIG_CSI_DELTA_ENABLE
+    int keyframe_interval;
+    size_t batch_mtu;               // CONFIG_CSI_BATCH_MTU, 0 sends every record on its own
+    int64_t batch_deadline_us;
+} replay_format_t;
+
+typedef struct {
+    int sock;
+    uint8_t mac[6];
+    int64_t clock_offset_us;        // device time at the start of the replay
+    csi_seq_t seq;
+    csi_batch_t batch;
+    char payload[REPLAY_PAYLOAD_SIZE];
+} replay_node_t;
+
+typedef struct {
+    uint64_t frames;
+    uint64_t datagrams;
+    uint64_t bytes;
+    uint64_t send_errors;
+    uint64_t skipped;               // records the format can not carry, preprocessed ones as text
+} replay_counters_t;
+
+typedef struct {
+    replay_format_t fmt;
+    double speed;                   // > 0: frame at t_us goes out at t_us / speed
+    double rate;                    // > 0: frames/s regardless of t_us. Both 0: as fast as possible
+    struct sockaddr_in dest;
+    replay_node_t nodes[REPLAY_MAX_NODES];
+    int n_nodes;
+    csi_delta_t delta;              // keyed by mac, so one for all nodes like on a board with many peers
+    uint64_t start_ns;
+    uint64_t slots;                 // frames scheduled so far
+    replay_counters_t counters;
+    uint64_t late_sum_us;
+    uint64_t late_max_us;
+    uint32_t late[REPLAY_LATE_BUCKETS + 1];
+    void (*tick)(const replay_counters_t *c);   // called after every frame if set
+    int8_t buf[CSI_FRAME_MAX_CSI];
+} csi_replay_t;
+
+static inline uint64_t replay_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Set up n_nodes virtual nodes sending to host:port, node i with mac base_mac + i (in the last
+ * three bytes). Returns false if the address is invalid or a socket can not be opened.
+ */
+bool replay_init(csi_replay_t *r, const replay_format_t *fmt, const char *host, int port, int n_nodes,
+                 const uint8_t base_mac[6]) {
+    memset(r, 0, sizeof(*r));
+    r->fmt = *fmt;
+    r->dest.sin_family = AF_INET;
+    r->dest.sin_port = htons(port);
+    if (n_nodes < 1 || n_nodes > REPLAY_MAX_NODES || inet_pton(AF_INET, host, &r->dest.sin_addr) != 1) {
+        return false;
+    }
+    delta_init(&r->delta, fmt->keyframe_interval);
+    uint32_t base = (base_mac[3] << 16) | (base_mac[4] << 8) | base_mac[5];
+    for (int i = 0; i < n_nodes; i++) {
+        replay_node_t *node = &r->nodes[i];
+        node->sock = socket(AF_INET, SOCK_DGRAM, 0);
+        if (node->sock < 0) {
+            return false;
+        }
+        r->n_nodes++;
+        memcpy(node->mac, base_mac, 3);
+        node->mac[3] = (base + i) >> 16;
+        node->mac[4] = (base + i) >> 8;
+        node->mac[5] = base + i;
+        // boards boot at different times, so their clocks disagree by seconds
+        node->clock_offset_us = 5000000 + (int64_t)i * 1234567;
+        seq_init(&node->seq);
+        batch_init(&node->batch, node->payload, REPLAY_PAYLOAD_SIZE, fmt->batch_mtu);
+    }
+    return true;
+}
+
+/* Time since replay_start() in us, the clock of the device handlers. */
+static inline int64_t replay_elapsed_us(const csi_replay_t *r) {
+    return (int64_t)(replay_now_ns() - r->start_ns) / 1000;
+}
+
+void replay_start(csi_replay_t *r) {
+    r->start_ns = replay_now_ns();
+    r->slots = 0;
+}
+
+static void _replay_send_batch(csi_replay_t *r, replay_node_t *node) {
+    ssize_t n = sendto(node->sock, node->batch.buf, node->batch.len, 0, (struct sockaddr *)&r->dest, sizeof(r->dest));
+    if (n < 0) {
+        r->counters.send_errors++;
+    } else {
+        r->counters.datagrams++;
+        r->counters.bytes += n;
+    }
+    batch_reset(&node->batch);
+}
+
+/* serialize_csi() of _components/handler_component.h */
+static int _replay_serialize(csi_replay_t *r, const wifi_csi_info_t *d, uint16_t seq, uint64_t rx_us,
+                             uint32_t handler_us, char *out, size_t cap) {
+    if (!r->fmt.binary) {
+        return parse_csi((wifi_csi_info_t *)d, seq, rx_us, handler_us, out, cap);
+    }
+    size_t len = csi_record_pack_type(d, r->fmt.payload_type, (uint8_t *)out, cap);
+    if (len > 0) {
+        csi_record_stamp((uint8_t *)out, seq, rx_us, handler_us);
+        if (r->fmt.delta) {
+            len = delta_encode_record(&r->delta, (uint8_t *)out, len);
+        }
+    }
+    return len;
+}
+
+/* A record copied as it is, for preprocessed payloads that can not be serialized again. */
+static int _replay_copy_record(csi_replay_t *r, const csi_record_hdr_t *hdr, const uint8_t *csi, const uint8_t mac[6],
+                               uint16_t seq, uint64_t rx_us, uint32_t handler_us, char *out, size_t cap) {
+    size_t len = sizeof(*hdr) + hdr->csi_len;
+    if (len > cap) {
+        return 0;
+    }
+    csi_record_hdr_t h = *hdr;
+    h.flags = 0;
+    h.delta_seq = 0;
+    h.len = len;
+    memcpy(h.mac, mac, 6);
+    memcpy(out, &h, sizeof(h));
+    memcpy(out + sizeof(h), csi, hdr->csi_len);
+    csi_record_stamp((uint8_t *)out, seq, rx_us, handler_us);
+    if (r->fmt.delta) {
+        len = delta_encode_record(&r->delta, (uint8_t *)out, len);
+    }
+    return len;
+}
+
+/*
+ * The csi_handler_task loop for one frame of node i: serialize it behind the batch, send the
+ * batch first if it does not fit, and send it once full. Either d is set, or hdr and csi of a
+ * recorded record with a preprocessed payload.
+ */
+static void _replay_handle(csi_replay_t *r, int i, const wifi_csi_info_t *d, const csi_record_hdr_t *hdr,
+                           const uint8_t *csi, uint64_t slot_us) {
+    replay_node_t *node = &r->nodes[i];
+    int64_t now = node->clock_offset_us + replay_elapsed_us(r);
+    uint64_t rx_us = node->clock_offset_us + slot_us;
+    uint16_t seq = seq_next(&node->seq, node->mac);
+    int len;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        char *out = batch_tail(&node->batch);
+        size_t cap = batch_room(&node->batch);
+        len = d != NULL ? _replay_serialize(r, d, seq, rx_us, now, out, cap)
+                        : _replay_copy_record(r, hdr, csi, node->mac, seq, rx_us, now, out, cap);
+        if (len > 0 || node->batch.count == 0) {
+            break;
+        }
+        _replay_send_batch(r, node);
+    }
+    if (len <= 0) {
+        r->counters.skipped++;
+        return;
+    }
+    batch_add(&node->batch, len, now);
+    r->counters.frames++;
+    if (batch_full(&node->batch)) {
+        _replay_send_batch(r, node);
+    }
+}
+
+/* Send the batches whose deadline has passed, returns the device time of the next deadline or INT64_MAX. */
+static int64_t _replay_flush_due(csi_replay_t *r) {
+    int64_t next = INT64_MAX;
+    int64_t elapsed = replay_elapsed_us(r);
+    for (int i = 0; i < r->n_nodes; i++) {
+        replay_node_t *node = &r->nodes[i];
+        if (node->batch.count == 0) {
+            continue;
+        }
+        int64_t left = batch_time_left(&node->batch, node->clock_offset_us + elapsed, r->fmt.batch_deadline_us);
+        if (left == 0) {
+            _replay_send_batch(r, node);
+        } else if (elapsed + left < next) {
+            next = elapsed + left;
+        }
+    }
+    return next;
+}
+
+/* Sleep until start_ns + ns, serving batch deadlines on the way. */
+static void _replay_wait(csi_replay_t *r, uint64_t ns) {
+    while (1) {
+        int64_t deadline_us = r->fmt.batch_mtu > 0 ? _replay_flush_due(r) : INT64_MAX;
+        uint64_t until = r->start_ns + ns;
+        if (deadline_us != INT64_MAX && r->start_ns + (uint64_t)deadline_us * 1000 < until) {
+            until = r->start_ns + (uint64_t)deadline_us * 1000;
+        }
+        uint64_t now = replay_now_ns();
+        if (now >= until) {
+            if (until == r->start_ns + ns) {
+                return;
+            }
+            continue;
+        }
+        if (until - now > REPLAY_SPIN_NS) {
+            struct timespec ts = {.tv_sec = (until - REPLAY_SPIN_NS / 2) / 1000000000,
+                                  .tv_nsec = (until - REPLAY_SPIN_NS / 2) % 1000000000};
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        }
+    }
+}
+
+/* Wait for the slot of the next frame at t_us of the stream, returns the slot in us since the start. */
+static uint64_t _replay_slot(csi_replay_t *r, uint64_t t_us) {
+    uint64_t ns;
+    if (r->rate > 0) {
+        ns = (uint64_t)(r->slots * 1e9 / r->rate);
+    } else if (r->speed > 0) {
+        ns = (uint64_t)(t_us * 1000 / r->speed);
+    } else {
+        ns = replay_now_ns() - r->start_ns;
+    }
+    r->slots++;
+    _replay_wait(r, ns);
+    uint64_t late = (replay_now_ns() - r->start_ns - ns) / 1000;
+    r->late_sum_us += late;
+    if (late > r->late_max_us) {
+        r->late_max_us = late;
+    }
+    r->late[late < REPLAY_LATE_BUCKETS ? late : REPLAY_LATE_BUCKETS]++;
+    return ns / 1000;
+}
+
+/* Send a frame as the wifi driver delivers it, at t_us of the stream, from node i. Its mac is replaced. */
+void replay_send_info(csi_replay_t *r, int i, const wifi_csi_info_t *d, uint64_t t_us) {
+    uint64_t slot_us = _replay_slot(r, t_us);
+    wifi_csi_info_t info = *d;
+    memcpy(info.mac, r->nodes[i].mac, 6);
+    _replay_handle(r, i, &info, NULL, NULL, slot_us);
+    if (r->tick != NULL) {
+        r->tick(&r->counters);
+    }
+}
+
+/* wifi_csi_info_t of a CSI_RECORD_TYPE_RAW record, d->buf points into buf. */
+void replay_info_from_record(const csi_record_hdr_t *hdr, const uint8_t *csi, wifi_csi_info_t *d, int8_t *buf) {
+    memset(d, 0, sizeof(*d));
+    memcpy(d->mac, hdr->mac, 6);
+    d->rx_ctrl.rssi = hdr->rssi;
+    d->rx_ctrl.rate = hdr->rate;
+    d->rx_ctrl.sig_mode = hdr->sig_mode;
+    d->rx_ctrl.mcs = hdr->mcs;
+    d->rx_ctrl.cwb = hdr->cwb;
+    d->rx_ctrl.smoothing = hdr->smoothing;
+    d->rx_ctrl.not_sounding = hdr->not_sounding;
+    d->rx_ctrl.aggregation = hdr->aggregation;
+    d->rx_ctrl.stbc = hdr->stbc;
+    d->rx_ctrl.fec_coding = hdr->fec_coding;
+    d->rx_ctrl.sgi = hdr->sgi;
+    d->rx_ctrl.noise_floor = hdr->noise_floor;
+    d->rx_ctrl.ampdu_cnt = hdr->ampdu_cnt;
+    d->rx_ctrl.channel = hdr->channel;
+    d->rx_ctrl.secondary_channel = hdr->secondary_channel;
+    d->rx_ctrl.timestamp = hdr->timestamp;
+    d->rx_ctrl.ant = hdr->ant;
+    d->rx_ctrl.sig_len = hdr->sig_len;
+    d->rx_ctrl.rx_state = hdr->rx_state;
+    memcpy(buf, csi, hdr->csi_len);
+    d->buf = buf;
+    d->len = hdr->csi_len;
+}
+
+/*
+ * Send a recorded frame (decoded, as in csi_frame_t) at t_us of the stream, from node i.
+ * Raw records are serialized again in the configured format; preprocessed ones can only go out
+ * as binary records of their own type and are skipped in text mode.
+ */
+void replay_send_record(csi_replay_t *r, int i, const csi_record_hdr_t *hdr, const uint8_t *csi, uint64_t t_us) {
+    if (hdr->type != CSI_RECORD_TYPE_RAW && !r->fmt.binary) {
+        r->counters.skipped++;
+        return;
+    }
+    uint64_t slot_us = _replay_slot(r, t_us);
+    if (hdr->type == CSI_RECORD_TYPE_RAW && hdr->csi_len <= CSI_FRAME_MAX_CSI) {
+        wifi_csi_info_t d;
+        replay_info_from_record(hdr, csi, &d, r->buf);
+        memcpy(d.mac, r->nodes[i].mac, 6);
+        _replay_handle(r, i, &d, NULL, NULL, slot_us);
+    } else {
+        _replay_handle(r, i, NULL, hdr, csi, slot_us);
+    }
+    if (r->tick != NULL) {
+        r->tick(&r->counters);
+    }
+}
+
+/*
+ * Play the frames of all nodes of a capture in the order they were received, node n of the
+ * capture from virtual node n, loops times in a row or until *stop is set.
+ */
+void replay_capture(csi_replay_t *r, const capture_reader_t *cap, int loops, const volatile sig_atomic_t *stop) {
+    capture_span_t *spans[REPLAY_MAX_NODES];
+    int n_spans[REPLAY_MAX_NODES];
+    int nodes = cap->n_nodes < (uint32_t)r->n_nodes ? (int)cap->n_nodes : r->n_nodes;
+    uint64_t t_first = UINT64_MAX, t_last = 0;
+    for (int n = 0; n < nodes; n++) {
+        int need = -capture_window(cap, n, 0, UINT64_MAX, NULL, 0);
+        spans[n] = calloc(need + 1, sizeof(capture_span_t));
+        n_spans[n] = capture_window(cap, n, 0, UINT64_MAX, spans[n], need);
+        if (n_spans[n] > 0) {
+            const capture_span_t *first = &spans[n][0], *end = &spans[n][n_spans[n] - 1];
+            t_first = first->host_us[first->first] < t_first ? first->host_us[first->first] : t_first;
+            t_last = end->host_us[end->end - 1] > t_last ? end->host_us[end->end - 1] : t_last;
+        }
+    }
+    // a loop lasts from the first to the last frame, plus the mean interval between frames
+    uint64_t loop_us = t_last > t_first ? t_last - t_first + (t_last - t_first) / (cap->frames - 1) : 0;
+    for (int loop = 0; loop < loops && t_first <= t_last && !(stop != NULL && *stop); loop++) {
+        int span[REPLAY_MAX_NODES];
+        uint32_t pos[REPLAY_MAX_NODES];
+        for (int n = 0; n < nodes; n++) {
+            span[n] = 0;
+            pos[n] = n_spans[n] > 0 ? spans[n][0].first : 0;
+        }
+        while (!(stop != NULL && *stop)) {
+            // the node with the earliest next frame
+            int next = -1;
+            uint64_t t = UINT64_MAX;
+            for (int n = 0; n < nodes; n++) {
+                if (span[n] < n_spans[n] && spans[n][span[n]].host_us[pos[n]] < t) {
+                    t = spans[n][span[n]].host_us[pos[n]];
+                    next = n;
+                }
+            }
+            if (next < 0) {
+                break;
+            }
+            const capture_span_t *s = &spans[next][span[next]];
+            csi_record_hdr_t hdr = s->hdr[pos[next]];
+            if (hdr.csi_len > s->chunk->csi_width) {
+                hdr.csi_len = s->chunk->csi_width;
+            }
+            replay_send_record(r, next, &hdr, s->csi + (size_t)pos[next] * s->chunk->csi_width,
+                               loop * loop_us + t - t_first);
+            if (++pos[next] == s->end && ++span[next] < n_spans[next]) {
+                pos[next] = spans[next][span[next]].first;
+            }
+        }
+    }
+    for (int n = 0; n < nodes; n++) {
+        free(spans[n]);
+    }
+}
+
+/* Send what is left in the batches. */
+void replay_finish(csi_replay_t *r) {
+    for (int i = 0; i < r->n_nodes; i++) {
+        if (r->nodes[i].batch.count > 0) {
+            _replay_send_batch(r, &r->nodes[i]);
+        }
+    }
+}
+
+/* Lateness in us of the frames against their slots at quantile q (0..1). */
+uint64_t replay_late_quantile(const csi_replay_t *r, double q) {
+    uint64_t total = 0;
+    for (int i = 0; i <= REPLAY_LATE_BUCKETS; i++) {
+        total += r->late[i];
+    }
+    uint64_t want = (uint64_t)(q * total), seen = 0;
+    for (int i = 0; i <= REPLAY_LATE_BUCKETS; i++) {
+        seen += r->late[i];
+        if (seen > want) {
+            return i;
+        }
+    }
+    return REPLAY_LATE_BUCKETS;
+}
+
+void replay_close(csi_replay_t *r) {
+    for (int i = 0; i < r->n_nodes; i++) {
+        close(r->nodes[i].sock);
+    }
+    r->n_nodes = 0;
+}
+
+#endif //ESP32_CSI_REPLAY_H
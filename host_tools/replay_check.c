@@ -0,0 +1,288 @@
+/*
+ * Check of the fleet stand-in in replay.h against the host decoder in ingest.h, over loopback.
+ * A sender thread replays while this thread receives with ingest_poll():
+ *   - in every output format of csi_handler_task (text, binary raw and preprocessed payloads,
+ *     delta coded, batched) every frame must arrive once and in order per node, with its mac,
+ *     seq and the rx_us of its slot, and decode to what csi_record_pack_type() makes of it
+ *   - a capture replayed at 10x must keep the spacing of every node, divided by 10
+ *   - the rate achieved against a fixed target, and how late the frames went out
+ *
+ *   make replay_check && ./replay_check
+ */
+#include <pthread.h>
+
+#include "esp_shim.h"
+#include "ingest.h"
+#include "capture.h"
+#include "replay.h"
+#include "bench_common.h"
+
+#define CHECK_NODES     8
+#define CHECK_FRAMES    1000            // per node
+#define CSI_BUF_LEN     384
+#define INTERVAL_US     10000           // of each node
+#define RATE            20000           // frames/s of the fixed rate runs
+#define SPEED           10
+
+static const uint8_t base_mac[6] = {0x3c, 0x61, 0x05, 0x4c, 0x36, 0x00};
+
+static wifi_csi_info_t frames[CHECK_NODES][CHECK_FRAMES];
+static int8_t bufs[CHECK_NODES][CHECK_FRAMES][CSI_BUF_LEN];
+// what a board would send of each frame: payload hash and length, and the slot it goes out in
+static uint32_t expect_hash[CHECK_NODES][CHECK_FRAMES];
+static uint16_t expect_len[CHECK_NODES][CHECK_FRAMES];
+static uint64_t expect_slot[CHECK_NODES][CHECK_FRAMES];
+static int8_t expect_rssi[CHECK_NODES][CHECK_FRAMES];
+
+typedef struct {
+    csi_replay_t *r;
+    const capture_reader_t *cap;    // replayed if set, frames[] otherwise
+    double seconds;                 // from the first slot to the last datagram sent
+    volatile bool done;
+} check_job_t;
+
+static uint32_t got[CHECK_NODES];
+static uint64_t mismatches;
+
+static uint32_t fnv1a(const uint8_t *p, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; i++) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
+
+/* HT40 frames of a static channel per node with receiver noise. */
+static void make_frames(void) {
+    bench_rand_state = 0x12345678;
+    for (int n = 0; n < CHECK_NODES; n++) {
+        int8_t base[CSI_BUF_LEN];
+        for (int i = 0; i < CSI_BUF_LEN; i++) {
+            base[i] = (int8_t)(bench_rand() % 81) - 40;
+        }
+        for (int k = 0; k < CHECK_FRAMES; k++) {
+            wifi_csi_info_t *d = &frames[n][k];
+            memset(d, 0, sizeof(*d));
+            d->rx_ctrl.rssi = -40 - (int)(bench_rand() % 20);
+            d->rx_ctrl.sig_mode = 1;
+            d->rx_ctrl.cwb = 1;
+            d->rx_ctrl.channel = 6;
+            d->rx_ctrl.secondary_channel = 1;
+            d->rx_ctrl.noise_floor = -93;
+            d->rx_ctrl.timestamp = k * INTERVAL_US;
+            for (int i = 0; i < CSI_BUF_LEN; i++) {
+                bufs[n][k][i] = base[i] + (int)(bench_rand() % 3) - 1;
+            }
+            d->buf = bufs[n][k];
+            d->len = CSI_BUF_LEN;
+        }
+    }
+}
+
+/* Expected payloads of type, and slots: frame k of node n is the (k * CHECK_NODES + n)th frame of the stream. */
+static void expect_frames(const csi_replay_t *r, uint8_t type) {
+    static uint8_t rec[sizeof(csi_record_hdr_t) + 2 * CSI_BUF_LEN];
+    for (int n = 0; n < CHECK_NODES; n++) {
+        for (int k = 0; k < CHECK_FRAMES; k++) {
+            wifi_csi_info_t d = frames[n][k];
+            memcpy(d.mac, r->nodes[n].mac, 6);
+            size_t len = csi_record_pack_type(&d, type, rec, sizeof(rec));
+            const csi_record_hdr_t *h = (const csi_record_hdr_t *)rec;
+            expect_len[n][k] = h->csi_len;
+            expect_hash[n][k] = fnv1a(rec + sizeof(*h), len - sizeof(*h));
+            expect_rssi[n][k] = d.rx_ctrl.rssi;
+            uint64_t g = (uint64_t)k * CHECK_NODES + n;
+            uint64_t ns = r->rate > 0 ? (uint64_t)(g * 1e9 / r->rate) : (uint64_t)(g * (INTERVAL_US / CHECK_NODES) * 1000 / r->speed);
+            expect_slot[n][k] = r->nodes[n].clock_offset_us + ns / 1000;
+        }
+    }
+}
+
+static void check_frame(void *ctx, const csi_frame_t *f) {
+    const csi_replay_t *r = ctx;
+    int n = f->hdr.mac[5] - base_mac[5];
+    if (n < 0 || n >= CHECK_NODES || memcmp(f->hdr.mac, r->nodes[n].mac, 6) != 0 || got[n] >= CHECK_FRAMES) {
+        mismatches++;
+        return;
+    }
+    uint32_t k = got[n]++;
+    if (f->hdr.seq != k || f->hdr.rssi != expect_rssi[n][k] || f->hdr.csi_len != expect_len[n][k] ||
+        fnv1a(f->csi, f->hdr.csi_len) != expect_hash[n][k] || f->hdr.rx_us != expect_slot[n][k]) {
+        mismatches++;
+    }
+}
+
+static void *sender_task(void *arg) {
+    check_job_t *job = arg;
+    replay_start(job->r);
+    if (job->cap != NULL) {
+        replay_capture(job->r, job->cap, 1, NULL);
+    } else {
+        for (int k = 0; k < CHECK_FRAMES; k++) {
+            for (int n = 0; n < CHECK_NODES; n++) {
+                replay_send_info(job->r, n, &frames[n][k], ((uint64_t)k * CHECK_NODES + n) * (INTERVAL_US / CHECK_NODES));
+            }
+        }
+    }
+    replay_finish(job->r);
+    job->seconds = (replay_now_ns() - job->r->start_ns) * 1e-9;
+    job->done = true;
+    return NULL;
+}
+
+/* Replay job into a fresh ingest socket and receive until the sender is done and the socket empty. */
+static void run(check_job_t *job, csi_ingest_t *in, int sock) {
+    memset(got, 0, sizeof(got));
+    mismatches = 0;
+    ingest_init(in, sock, check_frame, job->r);
+    pthread_t thread;
+    pthread_create(&thread, NULL, sender_task, job);
+    while (!job->done) {
+        ingest_poll(in, MSG_WAITFORONE);
+    }
+    pthread_join(thread, NULL);
+    while (ingest_poll(in, MSG_WAITFORONE) > 0) {
+    }
+}
+
+static int open_receiver(int *port) {
+    int sock = ingest_open_socket(0, 8 << 20);
+    if (sock < 0) {
+        perror("socket");
+        exit(1);
+    }
+    struct timeval tv = {.tv_sec = 0, .tv_usec = 100000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    getsockname(sock, (struct sockaddr *)&addr, &addr_len);
+    *port = ntohs(addr.sin_port);
+    return sock;
+}
+
+static int check_received(const char *name, const csi_replay_t *r, const csi_ingest_t *in, double seconds) {
+    uint32_t total = 0;
+    for (int n = 0; n < CHECK_NODES; n++) {
+        total += got[n];
+    }
+    const ingest_counters_t *c = &in->counters;
+    printf("  %-23s %5u frames in %5lu datagrams, %7.0f frames/s, late p99 %5lu us, max %5lu us\n", name, total,
+           c->datagrams, r->counters.frames / seconds, replay_late_quantile(r, 0.99), r->late_max_us);
+    if (total != CHECK_NODES * CHECK_FRAMES || mismatches != 0 || c->errors != 0 || c->delta_gaps != 0 ||
+        r->counters.send_errors != 0 || r->counters.skipped != 0) {
+        printf("  %u of %d frames, %lu wrong, %lu errors, %lu delta gaps\n", total, CHECK_NODES * CHECK_FRAMES,
+               mismatches, c->errors, c->delta_gaps);
+        return 1;
+    }
+    return 0;
+}
+
+/* Every format at a fixed rate. */
+static int check_formats(void) {
+    static const struct {
+        const char *name;
+        replay_format_t fmt;
+    } formats[] = {
+        {"text", {false, CSI_RECORD_TYPE_RAW, false, 16, 0, 0}},
+        {"binary raw", {true, CSI_RECORD_TYPE_RAW, false, 16, 0, 0}},
+        {"binary raw delta", {true, CSI_RECORD_TYPE_RAW, true, 16, 0, 0}},
+        {"binary sub batched", {true, CSI_RECORD_TYPE_SUBCARRIERS, false, 16, 1400, 10000}},
+        {"amp+phase delta batched", {true, CSI_RECORD_TYPE_AMP_PHASE, true, 16, 1400, 10000}},
+        {"text batched", {false, CSI_RECORD_TYPE_RAW, false, 16, 1400, 10000}},
+    };
+    static csi_replay_t r;
+    static csi_ingest_t in;
+    int err = 0;
+    printf("%d nodes, %d frames each, at %d frames/s:\n", CHECK_NODES, CHECK_FRAMES, RATE);
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        int port;
+        int sock = open_receiver(&port);
+        if (!replay_init(&r, &formats[i].fmt, "127.0.0.1", port, CHECK_NODES, base_mac)) {
+            perror("replay_init");
+            return 1;
+        }
+        r.rate = RATE;
+        expect_frames(&r, formats[i].fmt.binary ? formats[i].fmt.payload_type : CSI_RECORD_TYPE_RAW);
+        check_job_t job = {.r = &r};
+        run(&job, &in, sock);
+        err |= check_received(formats[i].name, &r, &in, job.seconds);
+        // the slots are exact, only a late last frame or batch deadline stretches the run
+        if (r.counters.frames / job.seconds < 0.95 * RATE) {
+            printf("  %.0f frames/s against %d\n", r.counters.frames / job.seconds, RATE);
+            err = 1;
+        }
+        replay_close(&r);
+        close(sock);
+    }
+    return err;
+}
+
+/* A capture of the frames with jittered arrival times, replayed at SPEED. */
+static int check_capture(void) {
+    const char *path = "/tmp/replay_check.csic";
+    static capture_writer_t w;
+    static csi_frame_t f;
+    static uint64_t host_us[CHECK_NODES][CHECK_FRAMES];
+    if (!capture_open(&w, path, CAPTURE_CSI_WIDTH, CAPTURE_CHUNK_FRAMES, CAPTURE_FLUSH_US)) {
+        perror(path);
+        return 1;
+    }
+    bench_rand_state = 0xabcdef;
+    for (int k = 0; k < CHECK_FRAMES; k++) {
+        for (int n = 0; n < CHECK_NODES; n++) {
+            wifi_csi_info_t d = frames[n][k];
+            uint8_t mac[6] = {0x24, 0x0a, 0xc4, 0x00, 0x00, (uint8_t)n};
+            memcpy(d.mac, mac, 6);
+            uint8_t rec[sizeof(csi_record_hdr_t) + CSI_BUF_LEN];
+            csi_record_pack(&d, rec, sizeof(rec));
+            memcpy(&f.hdr, rec, sizeof(f.hdr));
+            memcpy(f.csi, rec + sizeof(f.hdr), CSI_BUF_LEN);
+            f.node = n;
+            // one node after the other, each 1 to 2 ms after the previous
+            f.host_us = host_us[n][k] = 1700000000000000ull + (uint64_t)(k * CHECK_NODES + n) * 1250 + bench_rand() % 1000;
+            capture_add(&w, &f);
+        }
+    }
+    if (!capture_close(&w)) {
+        perror(path);
+        return 1;
+    }
+    static capture_reader_t cap;
+    static csi_replay_t r;
+    static csi_ingest_t in;
+    if (!capture_map(&cap, path)) {
+        perror(path);
+        return 1;
+    }
+    int port;
+    int sock = open_receiver(&port);
+    replay_format_t fmt = {true, CSI_RECORD_TYPE_RAW, true, 16, 0, 0};
+    replay_init(&r, &fmt, "127.0.0.1", port, CHECK_NODES, base_mac);
+    r.speed = SPEED;
+    expect_frames(&r, CSI_RECORD_TYPE_RAW);
+    uint64_t t_first = host_us[0][0];
+    for (int n = 0; n < CHECK_NODES; n++) {
+        for (int k = 0; k < CHECK_FRAMES; k++) {
+            expect_slot[n][k] = r.nodes[n].clock_offset_us + (uint64_t)((host_us[n][k] - t_first) * 1000 / SPEED) / 1000;
+        }
+    }
+    check_job_t job = {.r = &r, .cap = &cap};
+    run(&job, &in, sock);
+    printf("capture of %lu frames at %dx:\n", cap.frames, SPEED);
+    int err = check_received("binary raw delta", &r, &in, job.seconds);
+    replay_close(&r);
+    close(sock);
+    capture_unmap(&cap);
+    unlink(path);
+    return err;
+}
+
+int main(void) {
+    make_frames();
+    int err = check_formats();
+    err |= check_capture();
+    if (err == 0) {
+        printf("replay checked\n");
+    }
+    return err;
+}
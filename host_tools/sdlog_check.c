@@ -0,0 +1,455 @@
+/*
+ * Check of the SD card logger in ../_components/sdlog_component.h, with a directory standing in
+ * for the card.
+ * The main thread serializes frames and stats records into the two buffers as csi_handler_task
+ * does, a writer thread writes them out as sd_writer_task does. Checks that every record read back
+ * from the files is intact and in order, that the ones missing are exactly the ones counted as
+ * dropped, that the files are whole 16 KB units and start new at the size and at the time limit,
+ * that partly filled buffers are padded so the records behind them are found, and that a restart
+ * at an index that is already taken (the NVS save lost to a reset) leaves the files there alone.
+ * Then frames/s of the handler side and MB/s written, the records lost while the card stalls for
+ * 100 ms, and frames/s of the text path it replaces (fprintf, then fclose and fopen per flush).
+ *
+ *   make sdlog_check && ./sdlog_check [frames]
+ *   ./sdlog_check --dump dir     leaves the files of the size and time limit runs in dir, with
+ *                                dir/expected.txt listing their records, for sdlog_check.py
+ */
+#include <dirent.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/stat.h>
+
+#include "esp_shim.h"
+#include "csi_component.h"
+#include "record_component.h"
+#include "stats_component.h"
+#include "sdlog_component.h"
+#include "bench_common.h"
+
+#define FRAME_US        500     // device time between frames, 2000 frames/s
+#define STATS_EVERY     1000    // frames per stats record
+#define STATS_LEN       sizeof(csi_stats_record_t)
+
+typedef struct {
+    int64_t rotate_bytes;
+    int64_t rotate_us;
+    int64_t flush_us;
+    int frame_us;               // device time between frames
+    double real_fps;            // frames/s offered in real time, 0 for as fast as possible
+    int stall_every;            // buffers between two stalls of the card, 0 for none
+    int stall_us;
+    bool lockstep;              // wait for a free buffer instead of dropping, the device never does
+} run_cfg_t;
+
+typedef struct {
+    uint32_t first;             // index of the first file
+    uint32_t records;
+    uint32_t dropped;
+    uint32_t files;
+    uint64_t bytes;             // written, padding included
+    uint64_t record_bytes;
+    double seconds;
+    double max_log_us;          // longest a single record took on the handler side
+} run_result_t;
+
+static wifi_csi_info_t corpus[BENCH_CORPUS];
+static int8_t bufs[BENCH_CORPUS][384];
+static uint8_t mem[SDLOG_BUFS * SDLOG_BUF_SIZE] __attribute__((aligned(4)));
+static csi_sdlog_t sdlog;
+static sem_t wake;
+static volatile bool quit;
+static uint64_t record_bytes;
+static const run_cfg_t *writer_cfg;
+
+/* Frame f: a corpus frame of one of three lengths, rx_us makes it unique. */
+static size_t pack_frame(int f, int frame_us, uint8_t *out, size_t cap) {
+    wifi_csi_info_t d = corpus[f % BENCH_CORPUS];
+    d.len = f % 7 == 0 ? 128 : (f % 7 == 1 ? 256 : 384);
+    size_t len = csi_record_pack_type(&d, CSI_RECORD_PAYLOAD_TYPE, out, cap);
+    if (len > 0) {
+        csi_record_stamp(out, f & 0xFFFF, (uint64_t)f * frame_us, f);
+    }
+    return len;
+}
+
+/* A stand-in for the stats record sent after frame f: the header, then bytes made from f. */
+static void make_stats(int f, uint8_t *rec) {
+    memset(rec, 0, STATS_LEN);
+    rec[0] = CSI_RECORD_MAGIC;
+    rec[1] = CSI_RECORD_VERSION;
+    rec[2] = CSI_RECORD_TYPE_STATS;
+    rec[4] = STATS_LEN;
+    uint32_t cb_calls = f;
+    memcpy(rec + 16, &cb_calls, 4);
+    for (int i = 20; i < (int)STATS_LEN; i++) {
+        rec[i] = (uint8_t)(f * 31 + i);
+    }
+}
+
+static void *writer(void *arg) {
+    int buffers = 0;
+    while (1) {
+        sem_wait(&wake);
+        if (quit) {
+            break;
+        }
+        // a card busy with its own housekeeping keeps the buffer for a while
+        if (writer_cfg->stall_every > 0 && ++buffers % writer_cfg->stall_every == 0) {
+            usleep(writer_cfg->stall_us);
+        }
+        sdlog_write_ready(&sdlog);
+    }
+    sdlog_write_ready(&sdlog);
+    sdlog_close(&sdlog);
+    return NULL;
+}
+
+static void send_buffer(int64_t now_us, bool sync) {
+    if (sdlog_handoff(&sdlog, now_us, sync)) {
+        sem_post(&wake);
+    }
+    // the writer thread may not get a core of its own here
+    while (writer_cfg->lockstep && sdlog_tail(&sdlog) == NULL) {
+        sched_yield();
+    }
+}
+
+/* log_csi() of _components/handler_component.h */
+static void log_csi(int f, const run_cfg_t *cfg, int64_t now_us) {
+    uint8_t *tail = sdlog_tail(&sdlog);
+    size_t len = tail == NULL ? 0 : pack_frame(f, cfg->frame_us, tail, sdlog_room(&sdlog));
+    if (len == 0 && tail != NULL) {
+        send_buffer(now_us, false);
+        tail = sdlog_tail(&sdlog);
+        len = tail == NULL ? 0 : pack_frame(f, cfg->frame_us, tail, sdlog_room(&sdlog));
+    }
+    if (len == 0) {
+        sdlog.dropped++;
+        return;
+    }
+    sdlog_add(&sdlog, len, now_us);
+    record_bytes += len;
+}
+
+/* sdlog_record() of sdlog_component.h */
+static void log_record(const uint8_t *rec, size_t len, int64_t now_us) {
+    if (sdlog_room(&sdlog) < len) {
+        send_buffer(now_us, false);
+    }
+    uint8_t *tail = sdlog_tail(&sdlog);
+    if (tail == NULL || sdlog_room(&sdlog) < len) {
+        sdlog.dropped++;
+        return;
+    }
+    memcpy(tail, rec, len);
+    sdlog_add(&sdlog, len, now_us);
+    record_bytes += len;
+}
+
+/* Log frames [0, frames) into dir starting at file index, a stats record after every STATS_EVERY. */
+static run_result_t run(const char *dir, uint32_t index, int frames, const run_cfg_t *cfg) {
+    run_result_t r = {.first = index};
+    sdlog_init(&sdlog, mem, SDLOG_BUF_SIZE, dir, index, cfg->rotate_bytes, cfg->rotate_us);
+    sem_init(&wake, 0, 0);
+    quit = false;
+    writer_cfg = cfg;
+    record_bytes = 0;
+    pthread_t thread;
+    pthread_create(&thread, NULL, writer, NULL);
+
+    double start = bench_now();
+    for (int f = 0; f < frames; f++) {
+        if (cfg->real_fps > 0) {
+            double ahead = start + f / cfg->real_fps - bench_now();
+            if (ahead > 0) {
+                usleep(ahead * 1e6);
+            }
+        }
+        int64_t now_us = (int64_t)f * cfg->frame_us;
+        double t = bench_now();
+        log_csi(f, cfg, now_us);
+        if ((f + 1) % STATS_EVERY == 0) {
+            uint8_t rec[STATS_LEN];
+            make_stats(f, rec);
+            log_record(rec, sizeof(rec), now_us);
+        }
+        if (sdlog_due(&sdlog, now_us, cfg->flush_us)) {
+            send_buffer(now_us, true);
+        }
+        t = (bench_now() - t) * 1e6;
+        if (t > r.max_log_us) {
+            r.max_log_us = t;
+        }
+    }
+    send_buffer((int64_t)frames * cfg->frame_us, true);
+    quit = true;
+    sem_post(&wake);
+    pthread_join(thread, NULL);
+    sem_destroy(&wake);
+
+    r.seconds = bench_now() - start;
+    r.records = sdlog.records;
+    r.dropped = sdlog.dropped;
+    r.files = sdlog.files;
+    // files already there were skipped, the ones written follow each other from here
+    r.first = sdlog.index - sdlog.files;
+    r.bytes = sdlog.bytes;
+    r.record_bytes = record_bytes;
+    if (sdlog.write_errors > 0) {
+        printf("%u write errors\n", sdlog.write_errors);
+    }
+    return r;
+}
+
+static uint8_t *read_file(const char *dir, uint32_t index, size_t *len) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%u.bin", dir, index);
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    *len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    uint8_t *data = malloc(*len + 1);
+    if (fread(data, 1, *len, fp) != *len) {
+        *len = 0;
+    }
+    fclose(fp);
+    return data;
+}
+
+/*
+ * Read the files of a run back and check them against the frames and stats records logged.
+ * expected, if not NULL, gets a line per record for sdlog_check.py.
+ */
+static int verify(const char *dir, const run_result_t *r, int frames, const run_cfg_t *cfg, FILE *expected) {
+    int err = 0;
+    int next = 0;               // frames before this one are found or missing
+    uint32_t found = 0;
+    uint8_t want[2048];
+    for (uint32_t i = r->first; i < r->first + r->files && err == 0; i++) {
+        size_t len;
+        uint8_t *data = read_file(dir, i, &len);
+        if (data == NULL) {
+            printf("%u.bin missing\n", i);
+            return 1;
+        }
+        if (len % SDLOG_UNIT != 0 || (int64_t)len > cfg->rotate_bytes) {
+            printf("%u.bin is %zu bytes, not whole units up to %lld\n", i, len, (long long)cfg->rotate_bytes);
+            err = 1;
+        }
+        int64_t first_us = -1, last_us = 0;
+        size_t off = 0;
+        while (off < len && err == 0) {
+            if (data[off] == 0) {
+                // padding behind a partly filled buffer
+                size_t end = (off / SDLOG_UNIT + 1) * SDLOG_UNIT;
+                for (size_t k = off; k < end; k++) {
+                    if (data[k] != 0) {
+                        printf("%u.bin: padding at %zu is not zero\n", i, k);
+                        err = 1;
+                        break;
+                    }
+                }
+                off = end;
+                continue;
+            }
+            uint16_t rec_len;
+            memcpy(&rec_len, data + off + 4, 2);
+            if (data[off] != CSI_RECORD_MAGIC || rec_len < 6 || off + rec_len > len) {
+                printf("%u.bin: no record at %zu\n", i, off);
+                err = 1;
+                break;
+            }
+            if (data[off + 2] == CSI_RECORD_TYPE_STATS) {
+                uint32_t cb_calls;
+                memcpy(&cb_calls, data + off + 16, 4);
+                make_stats(cb_calls, want);
+                if ((int)cb_calls < next - 1 || rec_len != STATS_LEN || memcmp(want, data + off, STATS_LEN) != 0) {
+                    printf("%u.bin: stats record at %zu differs\n", i, off);
+                    err = 1;
+                }
+                if (expected != NULL) {
+                    fprintf(expected, "stats %u %zu %u\n", i, off, cb_calls);
+                }
+            } else {
+                csi_record_hdr_t hdr;
+                memcpy(&hdr, data + off, sizeof(hdr));
+                int f = hdr.rx_us / cfg->frame_us;
+                size_t want_len = pack_frame(f, cfg->frame_us, want, sizeof(want));
+                if (f < next || want_len != rec_len || memcmp(want, data + off, rec_len) != 0) {
+                    printf("%u.bin: frame %d at %zu out of order or differs\n", i, f, off);
+                    err = 1;
+                }
+                next = f + 1;
+                if (first_us < 0) {
+                    first_us = hdr.rx_us;
+                }
+                last_us = hdr.rx_us;
+                if (expected != NULL) {
+                    fprintf(expected, "csi %u %zu %02x:%02x:%02x:%02x:%02x:%02x %u %llu %u\n", i, off,
+                            hdr.mac[0], hdr.mac[1], hdr.mac[2], hdr.mac[3], hdr.mac[4], hdr.mac[5], hdr.seq,
+                            (unsigned long long)hdr.rx_us, hdr.csi_len);
+                }
+            }
+            found++;
+            off += rec_len;
+        }
+        // a file is closed at the first buffer past its time, that buffer waited at most the flush time
+        if (err == 0 && cfg->rotate_us > 0 && last_us - first_us > cfg->rotate_us + cfg->flush_us) {
+            printf("%u.bin spans %lld us, more than the time limit\n", i, (long long)(last_us - first_us));
+            err = 1;
+        }
+        // and not closed early: it is near the size limit or as old as the time limit
+        bool last = i + 1 == r->first + r->files;
+        if (err == 0 && !last && (int64_t)len + SDLOG_BUF_SIZE <= cfg->rotate_bytes &&
+                (cfg->rotate_us == 0 || last_us - first_us < cfg->rotate_us - 2 * cfg->frame_us)) {
+            printf("%u.bin closed early at %zu bytes, spans %lld us\n", i, len, (long long)(last_us - first_us));
+            err = 1;
+        }
+        free(data);
+    }
+    uint32_t logged = frames + frames / STATS_EVERY;
+    if (err == 0 && (found != r->records || found + r->dropped != logged)) {
+        printf("%u records read back, %u logged and %u dropped of %u\n", found, r->records, r->dropped, logged);
+        err = 1;
+    }
+    return err;
+}
+
+static void clean_dir(const char *dir) {
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    char path[512];
+    while (d != NULL && (e = readdir(d)) != NULL) {
+        if (e->d_name[0] != '.') {
+            snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+            unlink(path);
+        }
+    }
+    if (d != NULL) {
+        closedir(d);
+    }
+}
+
+/* The text path of sd_component.h: outprintf() of the frame, sd_flush() after it. */
+static double old_path_fps(const char *dir, int frames) {
+    char path[256], payload[2048];
+    snprintf(path, sizeof(path), "%s/0.csv", dir);
+    FILE *fp = fopen(path, "a");
+    double start = bench_now();
+    for (int f = 0; f < frames; f++) {
+        wifi_csi_info_t d = corpus[f % BENCH_CORPUS];
+        parse_csi(&d, f & 0xFFFF, (uint64_t)f * FRAME_US, f, payload, sizeof(payload));
+        fputs(payload, fp);
+        fflush(fp);
+        fclose(fp);
+        fp = fopen(path, "a");
+    }
+    double fps = frames / (bench_now() - start);
+    fclose(fp);
+    unlink(path);
+    return fps;
+}
+
+int main(int argc, char **argv) {
+    int frames = 200000;
+    const char *dump = NULL;
+    if (argc > 2 && strcmp(argv[1], "--dump") == 0) {
+        dump = argv[2];
+    } else if (argc > 1) {
+        frames = atoi(argv[1]);
+    }
+    char tmp[] = "/tmp/sdlog_checkXXXXXX";
+    const char *dir = dump;
+    if (dir == NULL) {
+        dir = mkdtemp(tmp);
+    } else {
+        mkdir(dir, 0755);
+    }
+    if (dir == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    bench_make_corpus(corpus, bufs, 384);
+    int err = 0;
+
+    // small files by size, then by time at a low frame rate that leaves buffers partly filled
+    run_cfg_t by_size = {.rotate_bytes = 256 << 10, .rotate_us = 0, .flush_us = 1000000, .frame_us = FRAME_US,
+                         .lockstep = true};
+    run_result_t r = run(dir, 7, frames / 4, &by_size);
+    FILE *expected = NULL;
+    if (dump != NULL) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/expected.txt", dir);
+        expected = fopen(path, "w");
+    }
+    err |= verify(dir, &r, frames / 4, &by_size, expected);
+    printf("size limit %lld KB: %u records in %u files %u..%u, %u dropped\n", (long long)by_size.rotate_bytes >> 10,
+           r.records, r.files, r.first, r.first + r.files - 1, r.dropped);
+    if (r.dropped != 0 || r.files < 2) {
+        printf("%u files, with the writer keeping up nothing is dropped\n", r.files);
+        err = 1;
+    }
+
+    // a reset before the index was saved: the next boot starts at the first of these files again,
+    // skips them and leaves them alone
+    run_result_t before = r;
+    run_cfg_t by_time = {.rotate_bytes = 64 << 20, .rotate_us = 10000000, .flush_us = 1000000, .frame_us = 20000,
+                         .lockstep = true};
+    r = run(dir, before.first, 3000, &by_time);
+    if (r.first != before.first + before.files) {
+        printf("restart at a taken index wrote file %u, the first free one is %u\n", r.first, before.first + before.files);
+        err = 1;
+    }
+    err |= verify(dir, &r, 3000, &by_time, expected);
+    if (expected != NULL) {
+        fclose(expected);
+    }
+    err |= verify(dir, &before, frames / 4, &by_size, NULL);
+    printf("time limit 10 s at 50 frames/s: %u records in %u files %u..%u, %.0f%% of the bytes are padding\n",
+           r.records, r.files, r.first, r.first + r.files - 1,
+           100.0 * (1.0 - (double)r.record_bytes / r.bytes));
+    if (r.files != 6) {
+        printf("60 s of frames in %u files, not 6\n", r.files);
+        err = 1;
+    }
+    if (dump != NULL) {
+        if (err == 0) {
+            printf("files and expected.txt in %s\n", dir);
+        }
+        return err;
+    }
+    clean_dir(dir);
+
+    // as fast as handler and writer go together
+    run_cfg_t fast = {.rotate_bytes = 64 << 20, .flush_us = 1000000, .frame_us = FRAME_US, .lockstep = true};
+    r = run(dir, 0, frames, &fast);
+    err |= verify(dir, &r, frames, &fast, NULL);
+    printf("full speed: %.0f frames/s logged, %.1f MB/s in %d KB writes, %u dropped\n", frames / r.seconds,
+           r.bytes / r.seconds / 1e6, SDLOG_BUF_SIZE / 1024, r.dropped);
+    clean_dir(dir);
+
+    // 2000 frames/s with a card that stalls for 100 ms every 20 buffers: records are dropped and
+    // counted, the handler does not wait
+    run_cfg_t stall = {.rotate_bytes = 64 << 20, .flush_us = 1000000, .frame_us = FRAME_US, .real_fps = 2000,
+                       .stall_every = 20, .stall_us = 100000};
+    int stall_frames = frames < 20000 ? frames : 20000;
+    r = run(dir, 0, stall_frames, &stall);
+    err |= verify(dir, &r, stall_frames, &stall, NULL);
+    printf("card stalling 100 ms every 20 buffers at 2000 frames/s: %u of %u records dropped, "
+           "at most %.0f us per record in the handler\n", r.dropped, r.records + r.dropped, r.max_log_us);
+    if (r.dropped == 0) {
+        printf("the stalls should have dropped records\n");
+        err = 1;
+    }
+    clean_dir(dir);
+
+    printf("text path, reopened per flush: %.0f frames/s\n", old_path_fps(dir, frames / 20));
+    rmdir(dir);
+    if (err == 0) {
+        printf("sd log checked\n");
+    }
+    return err;
+}
@@ -0,0 +1,55 @@
+#!/usr/bin/env python3
+# Reads the SD card log files of sdlog_check with csi_record.log_records:
+#   ./sdlog_check --dump /tmp/sdlog && ./sdlog_check.py /tmp/sdlog
+# expected.txt lists every record as the C side found it. Every file is decoded with
+# parse_record and parse_stats, then a file cut short in the middle of a record.
+import os
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "active_ap"))
+import csi_record
+
+def main () :
+    dirname = sys.argv[1]
+    with open(os.path.join(dirname, "expected.txt")) as f:
+        expected = [line.split() for line in f]
+    files = sorted(int(name[:-4]) for name in os.listdir(dirname) if name.endswith(".bin"))
+    got = []
+    last = None
+    for index in files:
+        with open(os.path.join(dirname, "{}.bin".format(index)), "rb") as f:
+            data = f.read()
+        if len(data) % csi_record.SDLOG_UNIT != 0:
+            print("{}.bin is not whole units".format(index))
+            return 1
+        for (offset, rec_type) in csi_record.log_records(data):
+            if rec_type == csi_record.CSI_RECORD_TYPE_STATS:
+                (mac_addr, stats, end) = csi_record.parse_stats(data, offset)
+                got.append(["stats", str(index), str(offset), str(stats["cb_calls"])])
+            else:
+                (mac_addr, rx_ctrl, rec_type, csi_data, stamp, end) = csi_record.parse_record(data, offset)
+                values = len(csi_data) * (2 if rec_type == csi_record.CSI_RECORD_TYPE_SUBCARRIERS else 1)
+                got.append(["csi", str(index), str(offset), mac_addr, str(stamp.seq), str(stamp.rx_us),
+                            str(values * csi_record.value_size(rec_type))])
+            last = (index, data, end)
+    for (i, (g, e)) in enumerate(zip(got, expected)):
+        if g != e:
+            print("record {}: {}, expected {}".format(i, " ".join(g), " ".join(e)))
+            return 1
+    if len(got) != len(expected):
+        print("{} records read, {} expected".format(len(got), len(expected)))
+        return 1
+    print("{} records in {} files decoded as sdlog_check found them".format(len(got), len(files)))
+
+    # the last file as if the power went in the middle of its last record
+    (index, data, end) = last
+    cut = data[:end - 10]
+    n = sum(1 for _ in csi_record.log_records(data))
+    if sum(1 for _ in csi_record.log_records(cut)) != n - 1:
+        print("{}.bin cut short: not all records before the cut read".format(index))
+        return 1
+    print("sd log files checked")
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,485 @@
+/*
+ * Check of the framed serial output in ../_components/serial_component.h.
+ * COBS frames of records at the edges of the 254 byte blocks round trip. Then a stream of frames
+ * and stats records as csi_handler_task sends them, with console text, line noise, flipped bits,
+ * lost bytes and frames cut short in it, is decoded in pieces of random size: every frame that
+ * went through intact comes out, in order, and none of the broken ones does. The same stream goes
+ * through a pseudo terminal into ingest_read_serial(), as csi_ingest -t reads a serial port.
+ * Then bytes per frame and frames/s on the wire against the text line of the default callback,
+ * and the time to frame and to decode a record.
+ *
+ *   make serial_check && ./serial_check [frames]
+ *   ./serial_check --dump dir    leaves the stream in dir/serial.bin, with dir/expected.txt listing
+ *                                the records that are intact, for serial_check.py
+ */
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "esp_shim.h"
+#include "csi_component.h"
+#include "record_component.h"
+#include "stats_component.h"
+#include "serial_component.h"
+#include "ingest.h"
+#include "bench_common.h"
+
+#define FRAME_US        500     // device time between frames
+#define STATS_EVERY     100     // frames per stats record
+#define STATS_LEN       sizeof(csi_stats_record_t)
+#define BAUD_FRAMED     2000000
+#define BAUD_TEXT       115200
+#define BYTES_PER_S(b)  ((b) / 10) // 8N1: a start and a stop bit per byte
+
+enum { INTACT, FLIP, LOSE, CUT };
+
+static wifi_csi_info_t corpus[BENCH_CORPUS];
+static int8_t bufs[BENCH_CORPUS][384];
+
+typedef struct {
+    uint8_t *p;
+    size_t len;
+    size_t cap;
+} stream_t;
+
+// a record sent, and whether its frame is intact in the stream
+typedef struct {
+    uint32_t offset;            // in records
+    uint16_t len;
+    uint8_t intact;
+} sent_t;
+
+static uint8_t *records;        // all records back to back
+static size_t records_len;
+static sent_t *sent;
+static int n_sent;
+
+static void put(stream_t *s, const void *p, size_t n) {
+    if (s->len + n > s->cap) {
+        s->cap = (s->len + n) * 2;
+        s->p = realloc(s->p, s->cap);
+    }
+    memcpy(s->p + s->len, p, n);
+    s->len += n;
+}
+
+/* Frame f: a corpus frame of one of three lengths, rx_us makes it unique. */
+static size_t pack_frame(int f, uint8_t *out, size_t cap) {
+    wifi_csi_info_t d = corpus[f % BENCH_CORPUS];
+    d.len = f % 7 == 0 ? 128 : (f % 7 == 1 ? 256 : 384);
+    size_t len = csi_record_pack_type(&d, CSI_RECORD_PAYLOAD_TYPE, out, cap);
+    if (len > 0) {
+        csi_record_stamp(out, f & 0xFFFF, (uint64_t)f * FRAME_US, f);
+    }
+    return len;
+}
+
+/* A stand-in for the stats record sent after frame f: the header, then bytes made from f. */
+static size_t make_stats(int f, uint8_t *rec) {
+    memset(rec, 0, STATS_LEN);
+    rec[0] = CSI_RECORD_MAGIC;
+    rec[1] = CSI_RECORD_VERSION;
+    rec[2] = CSI_RECORD_TYPE_STATS;
+    rec[4] = STATS_LEN;
+    uint32_t cb_calls = f;
+    memcpy(rec + 16, &cb_calls, 4);
+    for (int i = 20; i < (int)STATS_LEN; i++) {
+        rec[i] = (uint8_t)(f * 31 + i);
+    }
+    return STATS_LEN;
+}
+
+/* Frame rec into the stream, damaged the way kind says. */
+static void put_frame(stream_t *s, const uint8_t *rec, size_t len, int kind) {
+    uint8_t frame[SERIAL_FRAME_MAX];
+    size_t n = serial_frame(rec, len, frame, sizeof(frame));
+    size_t at = 1 + bench_rand() % (n - 2);     // a byte between the delimiters
+    switch (kind) {
+        case FLIP:
+            frame[at] ^= 1 << (bench_rand() % 8);
+            break;
+        case LOSE: {
+            // a run of bytes lost in the UART FIFO, maybe with the zero at the end
+            size_t run = 1 + bench_rand() % 16;
+            if (at + run > n) {
+                run = n - at;
+            }
+            memmove(frame + at, frame + at + run, n - at - run);
+            n -= run;
+            break;
+        }
+        case CUT:
+            // the device reset in the middle of the frame
+            n = at;
+            break;
+    }
+    put(s, frame, n);
+}
+
+static void add_record(const uint8_t *rec, size_t len, bool intact) {
+    sent[n_sent].offset = records_len;
+    sent[n_sent].len = len;
+    sent[n_sent].intact = intact;
+    memcpy(records + records_len, rec, len);
+    records_len += len;
+    n_sent++;
+}
+
+/*
+ * The stream of frame records and the stats records between them. About one frame in 20 is
+ * damaged, one in 50 followed by a log line and one in 200 by line noise, zero bytes included.
+ * Returns the console text bytes that are between two intact frames.
+ */
+static uint64_t make_stream(stream_t *s, int frames, bool damage) {
+    static const char *log_lines[] = {
+        "\x1b[0;33mW (12345) CSI collection (AP): CSI ring full, 17 frames dropped so far\x1b[0m\r\n",
+        "I (678) wifi:station: 3c:61:05:4c:36:c1 join, AID=1, bgn, 40U\r\n",
+        "Setting local time to 1665400000.123\r\n",
+    };
+    records = malloc((size_t)frames * 2 * 512);
+    sent = malloc(sizeof(sent_t) * (frames + frames / STATS_EVERY + 1));
+    records_len = 0;
+    n_sent = 0;
+    uint64_t text = 0;
+    // boot log at another baud rate first: noise to the decoder
+    for (int i = 0; i < 300; i++) {
+        uint8_t b = bench_rand();
+        put(s, &b, 1);
+    }
+    for (int f = 0; f < frames; f++) {
+        uint8_t rec[CSI_PAYLOAD_BENCH_SIZE];
+        bool stats = f % STATS_EVERY == STATS_EVERY - 1;
+        size_t len = stats ? make_stats(f, rec) : pack_frame(f, rec, sizeof(rec));
+        uint32_t r = bench_rand() % 1000;
+        int kind = !damage || r >= 50 ? INTACT : (r < 20 ? FLIP : (r < 35 ? LOSE : CUT));
+        add_record(rec, len, kind == INTACT);
+        put_frame(s, rec, len, kind);
+        r = bench_rand() % 1000;
+        if (damage && r < 20) {
+            const char *line = log_lines[r % 3];
+            put(s, line, strlen(line));
+            // its chunk ends at the zero of the next frame, and starts at the zero of this one
+            if (kind == INTACT || kind == FLIP) {
+                text += strlen(line);
+            }
+        } else if (damage && r < 25) {
+            for (int i = 0; i < 40; i++) {
+                uint8_t b = bench_rand();
+                put(s, &b, 1);
+            }
+        }
+    }
+    return text;
+}
+
+typedef struct {
+    int next;                   // index into sent of the next intact record
+    int mismatches;
+} expect_t;
+
+static int next_intact(int i) {
+    while (i < n_sent && !sent[i].intact) {
+        i++;
+    }
+    return i;
+}
+
+static void check_record(void *ctx, const uint8_t *rec, size_t len) {
+    expect_t *e = ctx;
+    e->next = next_intact(e->next);
+    if (e->next >= n_sent || sent[e->next].len != len || memcmp(records + sent[e->next].offset, rec, len) != 0) {
+        e->mismatches++;
+        return;
+    }
+    e->next++;
+}
+
+/* The stream decoded in pieces of 1 to max bytes. */
+static int check_decode(const stream_t *s, size_t max, uint64_t text, const char *what) {
+    serial_decoder_t d;
+    serial_decoder_init(&d);
+    expect_t e = {0, 0};
+    size_t at = 0;
+    while (at < s->len) {
+        size_t n = 1 + bench_rand() % max;
+        if (n > s->len - at) {
+            n = s->len - at;
+        }
+        serial_decode(&d, s->p + at, n, check_record, &e);
+        at += n;
+    }
+    int intact = 0;
+    for (int i = 0; i < n_sent; i++) {
+        intact += sent[i].intact;
+    }
+    printf("%-22s %lu of %d records, %d intact, %lu CRC and %lu COBS errors, %lu text bytes, %lu overflows\n",
+           what, d.frames, n_sent, intact, d.crc_errors, d.cobs_errors, d.text_bytes, d.overflows);
+    if (e.mismatches > 0 || (int)d.frames != intact || next_intact(e.next) != n_sent) {
+        printf("%d records decoded wrong or out of order, %d missing\n", e.mismatches, intact - (int)d.frames);
+        return 1;
+    }
+    if (d.text_bytes < text) {
+        printf("%lu bytes of console text found, %lu between intact frames\n", d.text_bytes, text);
+        return 1;
+    }
+    return 0;
+}
+
+/* Records at the block boundaries of COBS and of the decoder. */
+static int check_edges(void) {
+    static const size_t lens[] = {0, 1, 2, 249, 250, 251, 252, 253, 254, 255, 500, 504, 505, 508, 509, 1000,
+                                  SERIAL_MAX_RECORD - 1, SERIAL_MAX_RECORD};
+    static uint8_t rec[SERIAL_MAX_RECORD];
+    static uint8_t frame[SERIAL_FRAME_MAX];
+    int err = 0;
+    // the CRC of zlib, and of the check value of the catalogue
+    if (serial_crc32(0, (const uint8_t *)"123456789", 9) != 0xCBF43926) {
+        printf("CRC-32 of \"123456789\" is %08x\n", serial_crc32(0, (const uint8_t *)"123456789", 9));
+        err = 1;
+    }
+    for (int fill = 0; fill < 4; fill++) {
+        for (size_t k = 0; k < sizeof(lens) / sizeof(lens[0]); k++) {
+            size_t len = lens[k];
+            for (size_t i = 0; i < len; i++) {
+                // no zeros, all zeros, a zero every 254 bytes, random
+                rec[i] = fill == 0 ? 0x5A : (fill == 1 ? 0 : (fill == 2 ? (i % 254 == 253 ? 0 : 1) : bench_rand()));
+            }
+            size_t n = serial_frame(rec, len, frame, sizeof(frame));
+            bool zero_inside = n > 2 && memchr(frame + 1, 0, n - 2) != NULL;
+            if (n == 0 || n > SERIAL_FRAME_LEN(len) || frame[0] != 0 || frame[n - 1] != 0 || zero_inside ||
+                serial_frame(rec, len, frame, SERIAL_FRAME_LEN(len) - 1) != 0) {
+                printf("frame of %zu bytes (fill %d): %zu bytes, bound %zu\n", len, fill, n,
+                       (size_t)SERIAL_FRAME_LEN(len));
+                err = 1;
+                continue;
+            }
+            n_sent = 0;
+            records_len = 0;
+            add_record(rec, len, true);
+            serial_decoder_t d;
+            serial_decoder_init(&d);
+            expect_t e = {0, 0};
+            serial_decode(&d, frame, n, check_record, &e);
+            if (e.mismatches > 0 || d.frames != 1) {
+                printf("record of %zu bytes (fill %d) does not round trip\n", len, fill);
+                err = 1;
+            }
+        }
+    }
+    // a run without zeros longer than any frame is dropped up to the next zero, the frame after it is found
+    n_sent = 0;
+    records_len = 0;
+    serial_decoder_t d;
+    serial_decoder_init(&d);
+    memset(frame, 0x41, sizeof(frame));
+    serial_decode(&d, frame, sizeof(frame), check_record, NULL);
+    serial_decode(&d, frame, sizeof(frame), check_record, NULL);
+    memset(rec, 0x77, 64);
+    add_record(rec, 64, true);
+    size_t n = serial_frame(rec, 64, frame, sizeof(frame));
+    expect_t e = {0, 0};
+    serial_decode(&d, frame, n, check_record, &e);
+    if (d.overflows != 1 || d.frames != 1 || e.mismatches > 0) {
+        printf("after a run of %zu bytes: %lu overflows, %lu frames\n", 2 * sizeof(frame), d.overflows, d.frames);
+        err = 1;
+    }
+    return err;
+}
+
+typedef struct {
+    int fd;
+    const stream_t *s;
+} feed_t;
+
+static void *feed_pty(void *arg) {
+    feed_t *f = arg;
+    size_t at = 0;
+    while (at < f->s->len) {
+        size_t n = f->s->len - at < 4096 ? f->s->len - at : 4096;
+        ssize_t w = write(f->fd, f->s->p + at, n);
+        if (w <= 0) {
+            break;
+        }
+        at += w;
+    }
+    return NULL;
+}
+
+typedef struct {
+    int frames;
+    int mismatches;
+} ingest_check_t;
+
+static void check_ingest_frame(void *ctx, const csi_frame_t *fr) {
+    ingest_check_t *c = ctx;
+    uint8_t rec[CSI_PAYLOAD_BENCH_SIZE];
+    int f = fr->hdr.rx_us / FRAME_US;
+    size_t len = pack_frame(f, rec, sizeof(rec));
+    if (fr->hdr.rx_us != (uint64_t)f * FRAME_US || len != sizeof(csi_record_hdr_t) + fr->hdr.csi_len ||
+        memcmp(rec + sizeof(csi_record_hdr_t), fr->csi, fr->hdr.csi_len) != 0 || fr->hdr.seq != (f & 0xFFFF)) {
+        c->mismatches++;
+    }
+    c->frames++;
+}
+
+/* The stream written into a pseudo terminal, read from its other end with ingest_read_serial(). */
+static int check_pty(const stream_t *s) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+        perror("posix_openpt");
+        return 1;
+    }
+    int fd = ingest_open_serial(ptsname(master), BAUD_FRAMED);
+    if (fd < 0) {
+        perror("ingest_open_serial");
+        return 1;
+    }
+    static csi_ingest_t in;
+    ingest_check_t c = {0, 0};
+    ingest_init(&in, fd, check_ingest_frame, &c);
+    feed_t feed = {master, s};
+    pthread_t writer;
+    pthread_create(&writer, NULL, feed_pty, &feed);
+    int frames = 0;
+    int stats = 0;
+    for (int i = 0; i < n_sent; i++) {
+        if (sent[i].intact) {
+            frames += records[sent[i].offset + 2] != CSI_RECORD_TYPE_STATS;
+            stats += records[sent[i].offset + 2] == CSI_RECORD_TYPE_STATS;
+        }
+    }
+    double start = bench_now();
+    // a read that times out after the last byte ends it
+    uint64_t read = 0;
+    while (read < s->len && bench_now() - start < 30) {
+        int n = ingest_read_serial(&in, fd);
+        if (n < 0) {
+            perror("ingest_read_serial");
+            break;
+        }
+        read += n;
+    }
+    double seconds = bench_now() - start;
+    pthread_join(writer, NULL);
+    close(fd);
+    close(master);
+    printf("%-22s %d frames and %lu stats records of %d and %d, %lu errors, %.1f MB/s in %lu reads\n",
+           "through a pty", c.frames, in.counters.stats_records, frames, stats, in.counters.errors,
+           read / seconds / 1e6, in.counters.recv_calls);
+    if (c.mismatches > 0 || c.frames != frames || (int)in.counters.stats_records != stats) {
+        printf("%d frames decoded wrong\n", c.mismatches);
+        return 1;
+    }
+    return 0;
+}
+
+static void no_record(void *ctx, const uint8_t *rec, size_t len) {
+    (*(int *)ctx)++;
+}
+
+/* Bytes and frames/s on the wire, and the time to frame and to decode. */
+static int bench(int frames) {
+    project_type = "AP";
+    static char line[CSI_LINE_BUF_SIZE];
+    static uint8_t rec[CSI_PAYLOAD_BENCH_SIZE];
+    static uint8_t frame[SERIAL_FRAME_MAX];
+    uint64_t line_bytes = 0;
+    uint64_t frame_bytes = 0;
+    uint64_t record_bytes = 0;
+    stream_t s = {NULL, 0, 0};
+    double start = bench_now();
+    for (int f = 0; f < frames; f++) {
+        // the default callback: a raw record of the whole buffer, the text line has its first 128 values
+        wifi_csi_info_t *d = &corpus[f % BENCH_CORPUS];
+        size_t len = csi_record_pack(d, rec, sizeof(rec));
+        csi_record_stamp(rec, f & 0xFFFF, (uint64_t)f * FRAME_US, f);
+        size_t n = serial_frame(rec, len, frame, sizeof(frame));
+        record_bytes += len;
+        frame_bytes += n;
+        put(&s, frame, n);
+    }
+    double framed = bench_now() - start;
+    for (int f = 0; f < frames; f++) {
+        line_bytes += csi_line(&corpus[f % BENCH_CORPUS], line, sizeof(line));
+    }
+    serial_decoder_t d;
+    serial_decoder_init(&d);
+    int got = 0;
+    start = bench_now();
+    serial_decode(&d, s.p, s.len, no_record, &got);
+    double decoded = bench_now() - start;
+    free(s.p);
+
+    double per_frame = (double)frame_bytes / frames;
+    double per_line = (double)line_bytes / frames;
+    double fps_framed = BYTES_PER_S(BAUD_FRAMED) / per_frame;
+    printf("raw HT40 record        %.0f bytes, framed %.0f (%.1f%% over), text line %.0f bytes with 128 of its 384 values\n",
+           (double)record_bytes / frames, per_frame, (per_frame * frames / record_bytes - 1) * 100, per_line);
+    printf("on the wire            framed at %d baud %.0f frames/s, text line at %d baud %.0f, at %d baud %.0f\n",
+           BAUD_FRAMED, fps_framed, BAUD_TEXT, BYTES_PER_S(BAUD_TEXT) / per_line, BAUD_FRAMED,
+           BYTES_PER_S(BAUD_FRAMED) / per_line);
+    printf("host                   %.2f us to frame a record, decoded at %.0f MB/s, %d records\n",
+           framed / frames * 1e6, frame_bytes / decoded / 1e6, got);
+    if (got != frames || fps_framed < 400) {
+        printf("%d of %d records decoded, %.0f frames/s at %d baud\n", got, frames, fps_framed, BAUD_FRAMED);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int frames = 20000;
+    const char *dump = NULL;
+    if (argc > 2 && strcmp(argv[1], "--dump") == 0) {
+        dump = argv[2];
+    } else if (argc > 1) {
+        frames = atoi(argv[1]);
+    }
+    bench_make_corpus(corpus, bufs, 384);
+    records = malloc(SERIAL_MAX_RECORD);
+    sent = malloc(sizeof(sent_t));
+    int err = check_edges();
+    free(records);
+    free(sent);
+
+    stream_t clean = {NULL, 0, 0};
+    make_stream(&clean, frames, false);
+    err |= check_decode(&clean, 4096, 0, "clean stream");
+    err |= check_pty(&clean);
+    free(records);
+    free(sent);
+    free(clean.p);
+
+    stream_t s = {NULL, 0, 0};
+    uint64_t text = make_stream(&s, frames, true);
+    err |= check_decode(&s, 4096, text, "damaged stream");
+    err |= check_decode(&s, 7, text, "damaged, 1-7 B reads");
+    err |= check_pty(&s);
+    if (dump != NULL) {
+        mkdir(dump, 0755);
+        char path[512];
+        snprintf(path, sizeof(path), "%s/serial.bin", dump);
+        FILE *out = fopen(path, "wb");
+        snprintf(path, sizeof(path), "%s/expected.txt", dump);
+        FILE *expected = fopen(path, "w");
+        if (out == NULL || expected == NULL) {
+            perror(dump);
+            return 1;
+        }
+        fwrite(s.p, 1, s.len, out);
+        for (int i = 0; i < n_sent; i++) {
+            if (sent[i].intact) {
+                const uint8_t *rec = records + sent[i].offset;
+                fprintf(expected, "%u %u %08x\n", rec[2], sent[i].len, serial_crc32(0, rec, sent[i].len));
+            }
+        }
+        fclose(out);
+        fclose(expected);
+    }
+    free(s.p);
+
+    err |= bench(frames);
+    if (err == 0) {
+        printf("serial framing checked\n");
+    }
+    return err;
+}
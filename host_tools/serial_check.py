@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+# Reads the damaged serial stream of serial_check with csi_serial.Decoder:
+#   ./serial_check --dump /tmp/serial && ./serial_check.py /tmp/serial
+# expected.txt lists the type, length and CRC-32 of every record that went through intact, as
+# the C side framed it. The stream is fed in pieces of random size, then through SerialReader
+# from the file, and records/s of the decoder are printed.
+import os
+import random
+import sys
+import time
+import zlib
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "active_ap"))
+import csi_record
+import csi_serial
+
+def check (records, expected, what) :
+    got = [[str(rec[2]), str(len(rec)), "{:08x}".format(zlib.crc32(rec))] for rec in records]
+    for (i, (g, e)) in enumerate(zip(got, expected)):
+        if g != e:
+            print("{}: record {}: {}, expected {}".format(what, i, " ".join(g), " ".join(e)))
+            return 1
+    if len(got) != len(expected):
+        print("{}: {} records read, {} expected".format(what, len(got), len(expected)))
+        return 1
+    return 0
+
+def main () :
+    dirname = sys.argv[1]
+    with open(os.path.join(dirname, "expected.txt")) as f:
+        expected = [line.split() for line in f]
+    with open(os.path.join(dirname, "serial.bin"), "rb") as f:
+        data = f.read()
+    err = 0
+
+    decoder = csi_serial.Decoder()
+    records = []
+    rng = random.Random(1)
+    at = 0
+    start = time.perf_counter()
+    while at < len(data):
+        n = rng.randint(1, 4096)
+        records += decoder.feed(data[at:at + n])
+        at += n
+    seconds = time.perf_counter() - start
+    err |= check(records, expected, "pieces")
+    print("{} of {} records, {} CRC and {} COBS errors, {} text bytes, {:.0f} records/s".format(
+          decoder.frames, len(expected), decoder.crc_errors, decoder.cobs_errors, decoder.text_bytes,
+          len(records) / seconds))
+    for rec in records:
+        if rec[2] == csi_record.CSI_RECORD_TYPE_STATS:
+            csi_record.parse_stats(rec)
+        else:
+            csi_record.parse_record(rec)
+
+    reader = csi_serial.SerialReader(os.path.join(dirname, "serial.bin"))
+    records = []
+    while True:
+        got = reader.read()
+        if reader.decoder.bytes == len(data) and len(got) == 0:
+            break
+        records += got
+    reader.close()
+    err |= check(records, expected, "SerialReader")
+
+    # the stream cut in the middle of a frame: the records before it, that one stays pending
+    records = csi_serial.Decoder().feed(data[:len(data) // 2 + 7])
+    err |= check(records, expected[:len(records)], "half")
+    if len(records) == 0 or len(records) >= len(expected):
+        print("{} records from the first half".format(len(records)))
+        err = 1
+    if err == 0:
+        print("serial decoder checked")
+    return err
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,213 @@
+#ifndef ESP32_CSI_SHM_RING_H
+#define ESP32_CSI_SHM_RING_H
+
+/*
+ * Shared memory ring of decoded csi_frame_t (ingest.h), one writer and any number of readers in
+ * other processes, include after ingest.h.
+ * The writer (csi_ingest -s) never waits for readers. Each reader keeps its own cursor; one that
+ * falls more than a ring behind skips to the oldest frame still in the ring and counts the frames
+ * it missed as overruns, so a slow consumer only loses frames itself.
+ *
+ * Each slot is a seqlock: the writer marks it odd while copying a frame in and then stores
+ * 2 * (frame number + 1). A reader checks the stamp before and after using the slot in place,
+ * so frames are read where the writer put them, without copies, and a frame overwritten under
+ * the reader is detected instead of returned torn.
+ *
+ * The Python reader is active_ap/csi_shm.py, keep the layout in sync.
+ */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SHM_RING_MAGIC      0x52495343  // "CSIR"
+#define SHM_RING_VERSION    1
+#define SHM_RING_NAME       "/esp32_csi" // /dev/shm/esp32_csi on Linux
+#define SHM_RING_SLOTS      4096        // about 40 s of 10 nodes at 10 frames/s, 3 MB
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t slot_size;             // sizeof(shm_slot_t)
+    uint32_t slots;                 // power of two
+    uint32_t writer_pid;
+    uint64_t head;                  // frames published so far, the next one goes to slot head % slots
+    uint8_t pad[40];
+} shm_ring_hdr_t;
+
+typedef struct {
+    uint64_t stamp;                 // 2 * (frame number + 1) when valid, odd while being written
+    csi_frame_t frame;
+} shm_slot_t;
+
+_Static_assert(sizeof(shm_ring_hdr_t) == 64, "shm_ring_hdr_t layout changed, update csi_shm.py");
+_Static_assert(sizeof(shm_slot_t) == 728, "shm_slot_t layout changed, update csi_shm.py");
+
+typedef struct {
+    shm_ring_hdr_t *hdr;
+    shm_slot_t *slots;
+    uint64_t mask;
+    size_t map_len;
+} shm_ring_t;
+
+typedef struct {
+    shm_ring_t ring;
+    uint64_t cursor;                // number of the next frame to read
+    uint64_t frames;                // frames read
+    uint64_t overruns;              // frames the writer overwrote before they were read
+} shm_reader_t;
+
+static inline size_t shm_ring_size(uint32_t slots) {
+    return sizeof(shm_ring_hdr_t) + (size_t)slots * sizeof(shm_slot_t);
+}
+
+static bool _shm_ring_map(shm_ring_t *r, int fd, size_t len, int prot) {
+    void *p = mmap(NULL, len, prot, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return false;
+    }
+    r->hdr = p;
+    r->slots = (shm_slot_t *)((uint8_t *)p + sizeof(shm_ring_hdr_t));
+    r->mask = r->hdr->slots - 1;
+    r->map_len = len;
+    return true;
+}
+
+/*
+ * Create the ring, or take over the one a previous writer left with the same geometry, so attached
+ * readers go on where it stopped. slots is rounded up to a power of two. Returns false with errno set.
+ */
+bool shm_ring_create(shm_ring_t *r, const char *name, uint32_t slots) {
+    uint32_t n = 1;
+    while (n < slots) {
+        n <<= 1;
+    }
+    size_t len = shm_ring_size(n);
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return false;
+    }
+    bool reuse = false;
+    if ((size_t)st.st_size == len) {
+        shm_ring_hdr_t old;
+        reuse = pread(fd, &old, sizeof(old), 0) == sizeof(old) && old.magic == SHM_RING_MAGIC &&
+                old.version == SHM_RING_VERSION && old.slot_size == sizeof(shm_slot_t) && old.slots == n;
+    }
+    if (!reuse && (ftruncate(fd, 0) < 0 || ftruncate(fd, len) < 0)) {
+        close(fd);
+        return false;
+    }
+    if (!_shm_ring_map(r, fd, len, PROT_READ | PROT_WRITE)) {
+        return false;
+    }
+    if (!reuse) {
+        // readers check the magic last
+        r->hdr->version = SHM_RING_VERSION;
+        r->hdr->slot_size = sizeof(shm_slot_t);
+        r->hdr->slots = n;
+        r->mask = n - 1;
+        __atomic_store_n(&r->hdr->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+    }
+    r->hdr->writer_pid = getpid();
+    return true;
+}
+
+/* Copy a frame into the next slot, overwriting the oldest one. */
+void shm_ring_publish(shm_ring_t *r, const csi_frame_t *frame) {
+    uint64_t n = r->hdr->head;
+    shm_slot_t *s = &r->slots[n & r->mask];
+    __atomic_store_n(&s->stamp, 2 * n + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&s->frame, frame, sizeof(*frame));
+    __atomic_store_n(&s->stamp, 2 * n + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&r->hdr->head, n + 1, __ATOMIC_RELEASE);
+}
+
+/* Attach read only to the ring of a running writer, from the next frame it publishes. */
+bool shm_reader_attach(shm_reader_t *rd, const char *name) {
+    memset(rd, 0, sizeof(*rd));
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    shm_ring_hdr_t hdr;
+    if (fstat(fd, &st) < 0 || pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || hdr.magic != SHM_RING_MAGIC ||
+        hdr.version != SHM_RING_VERSION || hdr.slot_size != sizeof(shm_slot_t) ||
+        (size_t)st.st_size != shm_ring_size(hdr.slots)) {
+        close(fd);
+        errno = EINVAL;
+        return false;
+    }
+    if (!_shm_ring_map(&rd->ring, fd, st.st_size, PROT_READ)) {
+        return false;
+    }
+    rd->cursor = __atomic_load_n(&rd->ring.hdr->head, __ATOMIC_ACQUIRE);
+    return true;
+}
+
+/*
+ * The next frame, in place in shared memory, or NULL if there is none yet. Frames lost to the
+ * writer lapping this reader are added to overruns. Call shm_reader_release() when done with it.
+ */
+const csi_frame_t *shm_reader_peek(shm_reader_t *rd) {
+    shm_ring_t *r = &rd->ring;
+    for (;;) {
+        uint64_t head = __atomic_load_n(&r->hdr->head, __ATOMIC_ACQUIRE);
+        if (rd->cursor >= head) {
+            return NULL;
+        }
+        if (head - rd->cursor > r->mask + 1) {
+            // lapped, go on with the oldest frame still in the ring
+            rd->overruns += head - (r->mask + 1) - rd->cursor;
+            rd->cursor = head - (r->mask + 1);
+        }
+        const shm_slot_t *s = &r->slots[rd->cursor & r->mask];
+        if (__atomic_load_n(&s->stamp, __ATOMIC_ACQUIRE) == 2 * rd->cursor + 2) {
+            return &s->frame;
+        }
+        // overwritten since head was read
+        rd->overruns++;
+        rd->cursor++;
+    }
+}
+
+/*
+ * Done with the frame of shm_reader_peek(), go to the next one.
+ * Returns false if the writer overwrote it meanwhile, the reader must then discard what it took from it.
+ */
+bool shm_reader_release(shm_reader_t *rd) {
+    const shm_slot_t *s = &rd->ring.slots[rd->cursor & rd->ring.mask];
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    bool valid = __atomic_load_n(&s->stamp, __ATOMIC_RELAXED) == 2 * rd->cursor + 2;
+    rd->cursor++;
+    if (valid) {
+        rd->frames++;
+    } else {
+        rd->overruns++;
+    }
+    return valid;
+}
+
+/* Copy the next frame out. Returns false if there is none yet. */
+bool shm_reader_read(shm_reader_t *rd, csi_frame_t *out) {
+    const csi_frame_t *f;
+    while ((f = shm_reader_peek(rd)) != NULL) {
+        memcpy(out, f, sizeof(*out));
+        if (shm_reader_release(rd)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void shm_ring_close(shm_ring_t *r) {
+    munmap(r->hdr, r->map_len);
+}
+
+#endif //ESP32_CSI_SHM_RING_H
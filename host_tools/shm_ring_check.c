@@ -0,0 +1,216 @@
+/*
+ * Check of the shared memory frame ring in shm_ring.h with one writer thread and readers of
+ * different speed, each attached by name like a separate process would:
+ *   - a zero-copy reader working on the frames in place, a copying one, and a slow one that
+ *     sleeps every few frames and so gets lapped by the writer
+ *   - every frame a reader accepts must be intact, and frames read + overruns must add up to
+ *     all frames published, for every reader
+ *   - with the writer paced at CHECK_RATE, far above what the boards send, the two fast readers
+ *     must not miss a frame while the slow one is lapped
+ * Unpaced, it prints the CPU time per published frame of the writer with and without readers attached.
+ *
+ *   make shm_ring_check && ./shm_ring_check [frames]
+ *   ./shm_ring_check --writer /name frames rate   only publish frames at rate per second into
+ *                                                  the ring /name, for shm_ring_check.py
+ */
+#include <pthread.h>
+#include <sched.h>
+
+#include "esp_shim.h"
+#include "ingest.h"
+#include "shm_ring.h"
+#include "bench_common.h"
+
+#define CHECK_SLOTS     1024
+#define CHECK_CSI_LEN   384
+#define CHECK_RATE      20000   // frames/s of the paced run
+
+typedef struct {
+    const char *name;
+    int mode;                       // READ_*
+    uint64_t total;                 // frames the writer publishes
+    shm_reader_t rd;
+    uint64_t torn;
+} check_reader_t;
+
+enum {
+    READ_PEEK,
+    READ_COPY,
+    READ_SLOW,
+};
+
+static volatile int readers_attached;
+
+/* Frame number n, as written by the writer and checked by the readers. */
+static void fill_frame(csi_frame_t *f, uint64_t n) {
+    f->host_us = n;
+    f->node = n % 32;
+    f->hdr.magic = CSI_RECORD_MAGIC;
+    f->hdr.version = CSI_RECORD_VERSION;
+    f->hdr.type = CSI_RECORD_TYPE_RAW;
+    f->hdr.seq = n;
+    f->hdr.rx_us = n * 10000;
+    f->hdr.csi_len = CHECK_CSI_LEN;
+    f->hdr.len = sizeof(f->hdr) + CHECK_CSI_LEN;
+    memset(f->csi, (uint8_t)n, CHECK_CSI_LEN);
+    memcpy(f->csi, &n, sizeof(n));
+}
+
+static bool frame_ok(const csi_frame_t *f, uint64_t n) {
+    uint64_t head;
+    memcpy(&head, f->csi, sizeof(head));
+    if (f->host_us != n || head != n || f->hdr.seq != (uint16_t)n || f->hdr.rx_us != n * 10000 ||
+        f->hdr.csi_len != CHECK_CSI_LEN) {
+        return false;
+    }
+    for (int i = sizeof(n); i < CHECK_CSI_LEN; i++) {
+        if (f->csi[i] != (uint8_t)n) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void *reader_task(void *arg) {
+    check_reader_t *c = arg;
+    if (!shm_reader_attach(&c->rd, c->name)) {
+        perror("attach");
+        exit(1);
+    }
+    __atomic_add_fetch(&readers_attached, 1, __ATOMIC_SEQ_CST);
+    static __thread csi_frame_t copy;
+    while (c->rd.cursor < c->total) {
+        uint64_t n = c->rd.cursor;
+        bool ok;
+        if (c->mode == READ_COPY) {
+            if (!shm_reader_read(&c->rd, &copy)) {
+                sched_yield();
+                continue;
+            }
+            // the frame read is the one before the new cursor, after any overruns skipped
+            ok = frame_ok(&copy, c->rd.cursor - 1);
+        } else {
+            const csi_frame_t *f = shm_reader_peek(&c->rd);
+            if (f == NULL) {
+                sched_yield();
+                continue;
+            }
+            n = c->rd.cursor;
+            ok = frame_ok(f, n);
+            if (c->mode == READ_SLOW && n % 16 == 0) {
+                usleep(1000);
+            }
+            // a frame overwritten while it was checked is discarded, not torn
+            if (!shm_reader_release(&c->rd)) {
+                continue;
+            }
+        }
+        if (!ok) {
+            c->torn++;
+        }
+    }
+    return NULL;
+}
+
+static double thread_cpu(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Publish frames into the ring, at rate per second if rate > 0. Returns the writer CPU seconds. */
+static double write_frames(shm_ring_t *ring, uint64_t frames, double rate) {
+    static csi_frame_t f;
+    memset(&f, 0, sizeof(f));
+    double t0 = bench_now(), cpu0 = thread_cpu();
+    for (uint64_t n = ring->hdr->head; n < frames; n++) {
+        if (rate > 0) {
+            while (bench_now() < t0 + n / rate) {
+                usleep(100);
+            }
+        }
+        fill_frame(&f, n);
+        shm_ring_publish(ring, &f);
+    }
+    return thread_cpu() - cpu0;
+}
+
+static int run_writer(const char *name, uint64_t frames, double rate) {
+    shm_ring_t ring;
+    shm_unlink(name);
+    if (!shm_ring_create(&ring, name, CHECK_SLOTS)) {
+        perror(name);
+        return 1;
+    }
+    write_frames(&ring, frames, rate);
+    shm_ring_close(&ring);
+    return 0;
+}
+
+/* CPU ns per frame of the writer with n_readers readers attached, publishing at rate if rate > 0. */
+static int run(uint64_t frames, int n_readers, double rate, double *ns_per_frame) {
+    char name[64];
+    snprintf(name, sizeof(name), "/esp32_csi_check_%d", (int)getpid());
+    shm_unlink(name);
+    shm_ring_t ring;
+    if (!shm_ring_create(&ring, name, CHECK_SLOTS)) {
+        perror(name);
+        return 1;
+    }
+    static check_reader_t readers[3];
+    pthread_t threads[3];
+    readers_attached = 0;
+    for (int i = 0; i < n_readers; i++) {
+        readers[i] = (check_reader_t){.name = name, .mode = i, .total = frames};
+        pthread_create(&threads[i], NULL, reader_task, &readers[i]);
+    }
+    while (__atomic_load_n(&readers_attached, __ATOMIC_SEQ_CST) < n_readers) {
+        sched_yield();
+    }
+    double cpu = write_frames(&ring, frames, rate);
+    *ns_per_frame = cpu * 1e9 / frames;
+
+    int err = 0;
+    static const char *names[] = {"zero-copy", "copying", "slow"};
+    for (int i = 0; i < n_readers; i++) {
+        pthread_join(threads[i], NULL);
+        shm_reader_t *rd = &readers[i].rd;
+        printf("  %-10s reader: %9lu frames, %9lu overruns, %lu torn\n", names[i], rd->frames, rd->overruns,
+               readers[i].torn);
+        if (readers[i].torn != 0 || rd->frames + rd->overruns != frames) {
+            printf("  frames not accounted for\n");
+            err = 1;
+        }
+        if (rate > 0 && i != READ_SLOW && rd->overruns != 0) {
+            printf("  a fast reader fell behind the paced writer\n");
+            err = 1;
+        }
+        shm_ring_close(&rd->ring);
+    }
+    if (n_readers > READ_SLOW && readers[READ_SLOW].rd.overruns == 0) {
+        printf("  the slow reader was never lapped\n");
+        err = 1;
+    }
+    shm_ring_close(&ring);
+    shm_unlink(name);
+    return err;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 5 && strcmp(argv[1], "--writer") == 0) {
+        return run_writer(argv[2], strtoull(argv[3], NULL, 10), atof(argv[4]));
+    }
+    uint64_t frames = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+    double alone, shared, paced;
+    int err = 0;
+    printf("%lu frames through a ring of %d slots as fast as the writer goes:\n", frames, CHECK_SLOTS);
+    err |= run(frames, 0, 0, &alone);
+    err |= run(frames, 3, 0, &shared);
+    printf("%d frames at %d frames/s:\n", 2 * CHECK_RATE, CHECK_RATE);
+    err |= run(2 * CHECK_RATE, 3, CHECK_RATE, &paced);
+    printf("writer cpu per frame: %.0f ns alone, %.0f ns with 3 readers attached\n", alone, shared);
+    if (err == 0) {
+        printf("every frame read intact or counted as overrun\n");
+    }
+    return err;
+}
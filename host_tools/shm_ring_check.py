@@ -0,0 +1,53 @@
+#!/usr/bin/env python3
+# Reads the shared memory frame ring with csi_shm.RingReader while shm_ring_check --writer fills it:
+#   ./shm_ring_check.py [frames] [frames/s]
+# Every frame must decode with csi_record.parse_record() to what the writer put in, and none may be
+# missed at a rate the boards never reach.
+import os
+import subprocess
+import sys
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "active_ap"))
+import csi_record
+import csi_shm
+
+def main () :
+    frames = int(sys.argv[1]) if len(sys.argv) > 1 else 10000
+    rate = float(sys.argv[2]) if len(sys.argv) > 2 else 5000
+    name = "/esp32_csi_pycheck_{}".format(os.getpid())
+    writer = subprocess.Popen([os.path.join(os.path.dirname(os.path.abspath(__file__)), "shm_ring_check"),
+                               "--writer", name, str(frames), str(rate)])
+    reader = None
+    while reader is None:
+        try:
+            reader = csi_shm.RingReader(name)
+        except (OSError, ValueError):
+            time.sleep(0.001)
+    first = reader.cursor
+
+    err = 0
+    while reader.cursor < frames:
+        for frame in reader.read():
+            n = frame.host_us
+            (mac_addr, rx_ctrl_data, rec_type, csi_data, stamp, _) = csi_record.parse_record(frame.record)
+            payload = bytes(b & 0xFF for b in csi_data)
+            if (stamp.seq != n & 0xFFFF or stamp.rx_us != n * 10000 or frame.node != n % 32 or
+                    int.from_bytes(payload[0:8], "little") != n or payload[8:] != bytes([n & 0xFF]) * (len(payload) - 8)):
+                print("frame {} decoded wrong".format(n))
+                err = 1
+        time.sleep(0.002)
+    writer.wait()
+    reader.close()
+    os.unlink("/dev/shm/" + name.lstrip("/"))
+
+    print("{} frames read, {} overruns, of {} published after attaching".format(reader.frames, reader.overruns, frames - first))
+    if reader.frames + reader.overruns != frames - first or reader.overruns != 0:
+        print("frames missed")
+        err = 1
+    if writer.returncode != 0:
+        err = 1
+    return err
+
+if __name__ == "__main__":
+    sys.exit(main())
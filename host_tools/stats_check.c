@@ -0,0 +1,346 @@
+/*
+ * Check of the pipeline counters in ../_components/stats_component.h.
+ * Runs the firmware's callback -> ring -> handler -> batch path on the host with a frame mix that
+ * hits every drop reason (non-peer, non-HT, no host yet, oversized, ring full in bursts, the guard
+ * window and rate limit of guard_component.h, records too large for the payload buffer), and checks that every frame is accounted for exactly
+ * once in the stats records. For a while there is no host but local output (SD card or serial
+ * port) is on, those frames are handled and counted as local_only, not as dropped. Then prints the cost of the counting per callback.
+ * The task records of task_component.h are checked on made up run time counters of a dual core
+ * device: CPU shares of every task, a counter wrap, a task started between two records.
+ *
+ *   make stats_check && ./stats_check [frames]
+ *   ./stats_check --dump stats    writes stats.bin (the stats records) and stats.txt (their fields),
+ *                                 stats.tasks.bin and stats.tasks.txt of the task records, for
+ *                                 stats_roundtrip.py
+ */
+#include "esp_shim.h"
+#include "record_component.h"
+#include "pool_component.h"
+#include "batch_component.h"
+#include "stats_component.h"
+#include "guard_component.h"
+#include "task_component.h"
+#include "bench_common.h"
+
+#define RING_SIZE       16
+#define PAYLOAD_SIZE    2048
+#define BATCH_MTU       1472
+#define STATS_EVERY     1000    // frames per stats record
+#define FRAME_US        100     // device time between two callbacks
+
+static csi_slot_t slots[RING_SIZE];
+static csi_ring_t ring;
+static csi_stats_t stats;
+static csi_batch_t batch;
+static csi_guard_t guard;
+static int64_t now_us;          // device time
+static char payload[PAYLOAD_SIZE];
+static bool host_ready;
+static bool local_output;       // frames are logged without a host, local_output() of handler_component.h
+static uint32_t records_lost;   // in datagrams sendto() failed on, the device only counts the datagrams
+
+/* Same checks as queue_csi() in _components/handler_component.h, with the filter decided by the test. */
+static void queue_csi(wifi_csi_info_t *data, bool peer) {
+    stats.cb_calls++;
+    if (!peer) {
+        stats.drop_filter++;
+        return;
+    }
+    if (data->rx_ctrl.sig_mode == 0) {
+        stats.drop_non_ht++;
+        return;
+    }
+    if (!host_ready && !local_output) {
+        stats.drop_no_host++;
+        return;
+    }
+    csi_ring_push(&ring, data, now_us);
+}
+
+static void csi_cb(wifi_csi_info_t *data, bool peer) {
+    uint32_t start = stats_ccount();
+    queue_csi(data, peer);
+    stats_cb_done(&stats, start);
+}
+
+static void send_batch(void) {
+    bool ok = bench_rand() % 50 != 0;
+    records_lost += ok ? 0 : batch.count;
+    stats_sent(&stats, batch.count, batch.len, ok);
+    guard_sent(&guard, now_us, batch.len);
+    batch_reset(&batch);
+}
+
+/* csi_handler_task() of active_client: guards, serializes and batches everything in the ring. */
+static void drain(void) {
+    csi_slot_t *slot;
+    while ((slot = csi_ring_peek(&ring)) != NULL) {
+        uint32_t start = stats_ccount();
+        guard_verdict_t v = guard_check(&guard, slot->info.mac, slot->push_us, slot->info.rx_ctrl.sig_len);
+        if (v != GUARD_KEEP) {
+            csi_ring_release(&ring);
+            if (v == GUARD_SELF) {
+                stats.drop_self++;
+            } else {
+                stats.drop_rate++;
+            }
+            continue;
+        }
+        // a record never fits behind the record limit, which stands in for CSI_PAYLOAD_SIZE
+        size_t limit = slot->info.len > 300 ? 200 : batch_room(&batch);
+        size_t len = csi_record_pack(&slot->info, (uint8_t *)batch_tail(&batch), limit);
+        if (len == 0 && batch.count > 0 && slot->info.len <= 300) {
+            send_batch();
+            len = csi_record_pack(&slot->info, (uint8_t *)batch_tail(&batch), batch_room(&batch));
+        }
+        int64_t queued_us = now_us - slot->push_us;
+        csi_ring_release(&ring);
+        stats_handled(&stats, stats_ccount() - start, queued_us);
+        if (!host_ready) {
+            // logged or framed only, not serialized for the host
+            stats.local_only++;
+            continue;
+        }
+        if (len == 0) {
+            stats.drop_serialize++;
+            continue;
+        }
+        batch_add(&batch, len, 0);
+        if (batch_full(&batch)) {
+            send_batch();
+        }
+    }
+}
+
+static int check_record(const csi_stats_record_t *r, uint32_t uptime_ms) {
+    int err = 0;
+#define EXPECT(cond) do { if (!(cond)) { fprintf(stderr, "record at %u ms: %s\n", uptime_ms, #cond); err = 1; } } while (0)
+    EXPECT(r->magic == CSI_RECORD_MAGIC && r->type == CSI_RECORD_TYPE_STATS && r->len == sizeof(*r));
+    EXPECT(r->drop_thinned == r->drop_self + r->drop_rate);
+    // every callback ends in exactly one drop counter, in the ring, or handled
+    EXPECT(r->cb_calls == r->drop_filter + r->drop_non_ht + r->drop_no_host + r->drop_ring_full +
+                          r->drop_oversized + r->drop_thinned + stats.handled + csi_ring_count(&ring));
+    // every handled frame is dropped, sent, waiting in the batch, or only went to the local output
+    EXPECT(stats.handled == r->drop_serialize + r->records_sent + records_lost + batch.count + r->local_only);
+    EXPECT(r->ring_size == RING_SIZE && r->ring_high_water <= RING_SIZE);
+    EXPECT(r->cb_cycles_avg <= r->cb_cycles_max && r->handler_cycles_avg <= r->handler_cycles_max);
+    EXPECT(r->queue_us_avg <= r->queue_us_max);
+#undef EXPECT
+    return err;
+}
+
+#define TASK_INTERVAL   5000000 // run time counter ticks between two task records, 5 s in us
+#define TASK_RECORDS    8
+
+/*
+ * Task records of a dual core device with known shares per interval, in permille of a core.
+ * The first record covers the time since boot and is only the baseline.
+ */
+static int check_tasks(FILE *bin_out, FILE *txt_out) {
+    static const struct { const char *name; uint8_t core; uint8_t priority; } layout[] = {
+        {"IDLE", 0, 0}, {"IDLE", 1, 0}, {"wifi", 0, 23}, {"tiT", 0, 18}, {"csi_handler_tas", 1, 4}, {"mdns", 0, 1},
+        {"input_task", 0, 1},
+    };
+    enum { N_TASKS = sizeof(layout) / sizeof(layout[0]), INPUT = N_TASKS - 1, FIRST_INPUT = 3 };
+    task_sample_t samples[TASK_STATS_MAX + 6];
+    uint32_t share[N_TASKS];
+    csi_task_stats_t t;
+    task_stats_init(&t);
+    uint8_t mac[6] = {0x3c, 0x61, 0x05, 0x4c, 0x36, 0x01};
+    uint8_t rec[TASK_RECORD_MAX_LEN];
+    // close to the wrap of the 32 bit counters
+    uint32_t total = 0xFFFFFFFFu - 3 * TASK_INTERVAL;
+    for (int i = 0; i < N_TASKS; i++) {
+        samples[i].number = i + 1;
+        strncpy(samples[i].name, layout[i].name, TASK_NAME_LEN);
+        samples[i].core = layout[i].core;
+        samples[i].priority = layout[i].priority;
+        samples[i].runtime = i == INPUT ? 0 : 0xFFFFFFFFu - 1000000 * i;
+        samples[i].stack_free = i == 2 ? 70000 : 1000 + i;
+    }
+    int err = 0;
+    for (int r = 0; r <= TASK_RECORDS; r++) {
+        int n = r >= FIRST_INPUT ? N_TASKS : N_TASKS - 1;
+        if (r > 0) {
+            share[2] = 300;
+            share[3] = 100 + 10 * r;
+            share[4] = 200 + 50 * r;
+            share[5] = 10;
+            share[INPUT] = 5;
+            share[0] = 1000 - share[2] - share[3] - share[5] - (n == N_TASKS ? share[INPUT] : 0);
+            share[1] = 1000 - share[4];
+            total += TASK_INTERVAL;
+            for (int i = 0; i < n; i++) {
+                samples[i].runtime += share[i] * (TASK_INTERVAL / 1000);
+            }
+        }
+        size_t len = task_stats_pack(&t, samples, n, total, 2, mac, r * 5000, rec, sizeof(rec));
+        task_record_t *h = (task_record_t *)rec;
+        if (len != sizeof(task_record_t) + n * sizeof(task_record_entry_t) || h->type != CSI_RECORD_TYPE_TASKS ||
+                h->len != len || h->count != n || h->cores != 2) {
+            fprintf(stderr, "task record %d: length %zu, %d tasks\n", r, len, h->count);
+            return 1;
+        }
+        if (r == 0) {
+            continue;
+        }
+        if (h->interval != TASK_INTERVAL) {
+            fprintf(stderr, "task record %d: interval %u\n", r, h->interval);
+            err = 1;
+        }
+        uint32_t core_sum[2] = {0, 0};
+        for (int i = 0; i < n; i++) {
+            task_record_entry_t e;
+            memcpy(&e, &h->tasks[i], sizeof(e));
+            core_sum[e.core] += e.cpu_permille;
+            uint16_t stack = samples[i].stack_free > 0xFFFF ? 0xFFFF : samples[i].stack_free;
+            if (e.cpu_permille != share[i] || strncmp(e.name, layout[i].name, TASK_NAME_LEN) != 0 ||
+                    e.core != layout[i].core || e.priority != layout[i].priority || e.stack_free != stack) {
+                fprintf(stderr, "task record %d: %.16s %u permille on %u, expected %u\n", r, e.name, e.cpu_permille,
+                        e.core, share[i]);
+                err = 1;
+            }
+        }
+        if (core_sum[0] != 1000 || core_sum[1] != 1000) {
+            fprintf(stderr, "task record %d: cores add up to %u and %u permille\n", r, core_sum[0], core_sum[1]);
+            err = 1;
+        }
+        if (bin_out != NULL) {
+            fwrite(rec, 1, len, bin_out);
+            fprintf(txt_out, "%u %d", h->uptime_ms, n);
+            for (int i = 0; i < n; i++) {
+                task_record_entry_t e;
+                memcpy(&e, &h->tasks[i], sizeof(e));
+                fprintf(txt_out, " %.16s %u %u %u %u", e.name, e.core, e.priority, e.cpu_permille, e.stack_free);
+            }
+            fprintf(txt_out, "\n");
+        }
+    }
+    // more tasks than fit: the first TASK_STATS_MAX go out
+    for (int i = N_TASKS; i < TASK_STATS_MAX + 6; i++) {
+        samples[i] = samples[5];
+        samples[i].number = i + 1;
+    }
+    size_t len = task_stats_pack(&t, samples, TASK_STATS_MAX + 6, total, 2, mac, 0, rec, sizeof(rec));
+    if (len != TASK_RECORD_MAX_LEN || ((task_record_t *)rec)->count != TASK_STATS_MAX) {
+        fprintf(stderr, "%d tasks: record of %zu bytes\n", TASK_STATS_MAX + 6, len);
+        err = 1;
+    }
+    return err;
+}
+
+int main(int argc, char **argv) {
+    FILE *bin_out = NULL, *txt_out = NULL;
+    int frames = 20000;
+    if (argc > 2 && strcmp(argv[1], "--dump") == 0) {
+        char path[256];
+        snprintf(path, sizeof(path), "%s.bin", argv[2]);
+        bin_out = fopen(path, "wb");
+        snprintf(path, sizeof(path), "%s.txt", argv[2]);
+        txt_out = fopen(path, "w");
+        if (bin_out == NULL || txt_out == NULL) {
+            perror("fopen");
+            return 1;
+        }
+    } else if (argc > 1) {
+        frames = atoi(argv[1]);
+    }
+
+    static wifi_csi_info_t corpus[BENCH_CORPUS];
+    static int8_t bufs[BENCH_CORPUS][384];
+    bench_make_corpus(corpus, bufs, 384);
+    csi_ring_init(&ring, slots, RING_SIZE);
+    batch_init(&batch, payload, PAYLOAD_SIZE, BATCH_MTU);
+
+    static csi_stats_t prev;
+    uint8_t mac[6] = {0x3c, 0x61, 0x05, 0x4c, 0x36, 0x01};
+    // 2500 frames/s from each of the 4 macs of the corpus against 2000 allowed
+    guard_init(&guard, 300, 2000, 8);
+    int n_records = 0, err = 0;
+    for (int f = 0; f < frames; f++) {
+        now_us = (int64_t)(f + 1) * FRAME_US;
+        // no host and no local output, then the SD card is mounted, then the host is found
+        local_output = f >= 100;
+        host_ready = f >= 2000;
+        wifi_csi_info_t d = corpus[f % BENCH_CORPUS];
+        uint32_t r = bench_rand() % 100;
+        d.rx_ctrl.sig_mode = r < 5 ? 0 : 1;
+        d.len = r < 7 ? 384 : (r < 9 ? 700 : 128);
+        csi_cb(&d, r % 10 != 9);
+        // the handler runs after every few frames, in bursts the ring fills up
+        bool burst = (f / 200) % 5 == 4;
+        if (!burst && bench_rand() % 3 == 0) {
+            drain();
+        }
+        if ((f + 1) % STATS_EVERY == 0) {
+            uint8_t rec[sizeof(csi_stats_record_t)];
+            uint32_t uptime_ms = (f + 1) / 10;
+            size_t len = stats_pack(&stats, &prev, &ring, mac, uptime_ms, rec, sizeof(rec));
+            csi_stats_record_t parsed;
+            memcpy(&parsed, rec, sizeof(parsed));
+            err |= len != sizeof(rec) || check_record(&parsed, uptime_ms);
+            n_records++;
+            if (bin_out != NULL) {
+                fwrite(rec, 1, len, bin_out);
+                fprintf(txt_out, "%u %u %u %u %u %u %u %u %u %u %u %u %u %u %u %u %u %u %u\n", parsed.uptime_ms,
+                        parsed.cb_calls, parsed.drop_filter, parsed.drop_non_ht, parsed.drop_no_host,
+                        parsed.drop_ring_full, parsed.drop_oversized, parsed.drop_thinned, parsed.drop_serialize,
+                        parsed.records_sent, parsed.datagrams_sent, parsed.bytes_sent, parsed.send_errors,
+                        parsed.drop_self, parsed.drop_rate, parsed.peer_evictions, parsed.local_only, parsed.ring_size, parsed.ring_high_water);
+            }
+        }
+    }
+    if (bin_out != NULL) {
+        fclose(bin_out);
+        fclose(txt_out);
+        char path[256];
+        snprintf(path, sizeof(path), "%s.tasks.bin", argv[2]);
+        bin_out = fopen(path, "wb");
+        snprintf(path, sizeof(path), "%s.tasks.txt", argv[2]);
+        txt_out = fopen(path, "w");
+        if (bin_out == NULL || txt_out == NULL) {
+            perror("fopen");
+            return 1;
+        }
+        err |= check_tasks(bin_out, txt_out);
+        fclose(bin_out);
+        fclose(txt_out);
+        return err;
+    }
+    if (err) {
+        return 1;
+    }
+    printf("%d frames, %d stats records, every frame accounted for\n", frames, n_records);
+    printf("  callbacks %u: filtered %u, non-HT %u, no host %u, ring full %u, oversized %u\n",
+           stats.cb_calls, stats.drop_filter, stats.drop_non_ht, stats.drop_no_host, ring.dropped, ring.oversized);
+    if (stats.drop_no_host == 0 || stats.local_only == 0) {
+        printf("no host: %u dropped, %u only logged, expected both\n", stats.drop_no_host, stats.local_only);
+        return 1;
+    }
+    printf("  guard: own reports %u, over the rate %u; handled %u: too large %u, sent %u records in %u datagrams, "
+           "%u send errors, only logged %u\n", stats.drop_self, stats.drop_rate, stats.handled, stats.drop_serialize, stats.records_sent, stats.datagrams_sent,
+           stats.send_errors, stats.local_only);
+    if (check_tasks(NULL, NULL)) {
+        return 1;
+    }
+    printf("%d task records, CPU share of every task as run\n", TASK_RECORDS);
+
+    // cost of the counting: the callback path with and without the cycle count around it
+    static wifi_csi_info_t d;
+    d = corpus[0];
+    host_ready = false;
+    local_output = false;
+    int n = 10000000;
+    double t0 = bench_now();
+    for (int i = 0; i < n; i++) {
+        queue_csi(&d, true);
+    }
+    double t1 = bench_now();
+    for (int i = 0; i < n; i++) {
+        csi_cb(&d, true);
+    }
+    double t2 = bench_now();
+    printf("callback counters: %.1f ns, with cycle count: %.1f ns (host, clock_gettime stands in for the ccount register)\n",
+           (t1 - t0) / n * 1e9, (t2 - t1) / n * 1e9);
+    return 0;
+}
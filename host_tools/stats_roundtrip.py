@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+# Checks csi_record.parse_stats and parse_tasks against the C structs on the records of stats_check:
+#   ./stats_check --dump /tmp/stats && ./stats_roundtrip.py /tmp/stats
+# stats.txt and stats.tasks.txt hold the fields of every record as the C side sees them.
+import os
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "active_ap"))
+import csi_record
+
+TXT_FIELDS = ("uptime_ms",) + csi_record.STATS_COUNTERS + ("ring_size", "ring_high_water")
+
+def main () :
+    prefix = sys.argv[1]
+    with open(prefix + ".bin", "rb") as f:
+        data = f.read()
+    with open(prefix + ".txt") as f:
+        expected = [dict(zip(TXT_FIELDS, map(int, line.split()))) for line in f]
+
+    offset = 0
+    prev = None
+    for i in range(len(expected)):
+        if not csi_record.is_stats_record(data, offset):
+            print("record {} is not a stats record".format(i))
+            return 1
+        (mac_addr, stats, offset) = csi_record.parse_stats(data, offset)
+        for k in TXT_FIELDS:
+            if stats[k] != expected[i][k]:
+                print("record {}: {} is {}, expected {}".format(i, k, stats[k], expected[i][k]))
+                return 1
+        if prev is not None and csi_record.stats_rates(prev, stats) is None:
+            print("record {}: no rates".format(i))
+            return 1
+        prev = stats
+    if offset != len(data):
+        print("{} bytes left over".format(len(data) - offset))
+        return 1
+    print("{} stats records decoded identically".format(len(expected)))
+    # records of older firmware end before drop_self and drop_rate, before peer_evictions or before local_only
+    for n_ext in range(len(csi_record.STATS_EXT_FIELDS)):
+        size = csi_record.STATS_RECORD.size + n_ext * 4
+        old = bytearray(data[0:size])
+        old[4:6] = size.to_bytes(2, "little")
+        (_, stats, offset) = csi_record.parse_stats(bytes(old))
+        if offset != len(old) or any(stats[k] != 0 for k in csi_record.STATS_EXT_FIELDS[n_ext:]) or \
+                any(stats[k] != expected[0][k] for k in ("cb_calls",) + csi_record.STATS_EXT_FIELDS[0:n_ext]):
+            print("record of {} bytes: {}".format(size, stats))
+            return 1
+    return check_tasks(prefix)
+
+def check_tasks (prefix) :
+    with open(prefix + ".tasks.bin", "rb") as f:
+        data = f.read()
+    with open(prefix + ".tasks.txt") as f:
+        expected = [line.split() for line in f]
+    offset = 0
+    for (i, fields) in enumerate(expected):
+        if not csi_record.is_tasks_record(data, offset):
+            print("record {} is not a task record".format(i))
+            return 1
+        (mac_addr, uptime_ms, cores, tasks, offset) = csi_record.parse_tasks(data, offset)
+        want = [csi_record.TaskShare(fields[k], int(fields[k + 1]), int(fields[k + 2]), int(fields[k + 3]) / 1000.0,
+                                     int(fields[k + 4])) for k in range(2, len(fields), 5)]
+        if uptime_ms != int(fields[0]) or len(tasks) != int(fields[1]) or tasks != want:
+            print("task record {}: {}, expected {}".format(i, tasks, want))
+            return 1
+        load = csi_record.core_load(cores, tasks)
+        if cores != 2 or any(abs(l - (1.0 - t.cpu)) > 1e-9 for (l, t) in zip(load, tasks[0:2])):
+            print("task record {}: core load {}".format(i, load))
+            return 1
+    if offset != len(data):
+        print("{} bytes left over".format(len(data) - offset))
+        return 1
+    print("{} task records decoded identically".format(len(expected)))
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+# Checks the frames of csi_synth against the channel it was told to model, through a capture read
+# with csi_capture.Capture:
+#   ./synth_check.py [seconds]
+# Unused subcarriers must be zero, rssi - noise_floor and the noise measured between the LLTF and
+# HT-LTF of a frame must match the SNR, the delay spread must follow -d, a plain amplitude variance
+# must tell the labelled motion apart from quiet, and the same seed must give the same frames.
+import csv
+import os
+import subprocess
+import sys
+
+import numpy as np
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, "..", "active_ap"))
+import csi_capture
+
+LINKS = 8
+HZ = 100
+SNR_DB = 25
+
+def synth (path, seconds, *args) :
+    labels = path + ".csv"
+    subprocess.check_call([os.path.join(HERE, "csi_synth"), "-o", path, "-L", labels, "-N", str(LINKS),
+                           "-f", str(HZ), "-t", str(seconds), "-S", str(SNR_DB)] + [str(a) for a in args],
+                          stdout=subprocess.DEVNULL)
+    events = {}
+    with open(labels) as f:
+        for row in csv.DictReader(f):
+            events.setdefault(int(row["link"]), []).append((int(row["start_us"]), int(row["end_us"])))
+    os.unlink(labels)
+    capture = csi_capture.Capture(path)
+    os.unlink(path)
+    return (capture, events)
+
+# complex (frames, 64) LLTF m = -32..31 and (frames, 128) HT-LTF k = -64..63 of raw HT40 records
+def split (csi) :
+    iq = csi.view(np.int8).astype(np.float32)
+    h = iq[:, 1::2] + 1j * iq[:, 0::2]
+    return (np.fft.fftshift(h[:, :64], axes=1), np.fft.fftshift(h[:, 64:192], axes=1))
+
+def moving_mask (host_us, spans) :
+    m = np.zeros(len(host_us), bool)
+    for (t0, t1) in spans:
+        m |= (host_us >= t0) & (host_us < t1)
+    return m
+
+def check_nulls (capture) :
+    f = capture.read(0, 2 ** 64 - 1)
+    (lltf, ht) = split(f["csi"])
+    k = np.arange(-64, 64)
+    m = np.arange(-32, 32)
+    ht_null = (np.abs(k) > 58) | (np.abs(k) <= 1)
+    lltf_null = (np.abs(m) > 26) | (m == 0)
+    if (np.any(f["hdr"]["csi_len"] != 384) or np.any(ht[:, ht_null] != 0) or np.any(lltf[:, lltf_null] != 0) or
+            np.mean(ht[:, ~ht_null] == 0) > 0.01):
+        print("unused subcarriers not zero, or used ones empty")
+        return 1
+    print("{} frames, unused subcarriers zero".format(len(f["csi"])))
+    return 0
+
+def check_snr (capture, events) :
+    err = 0
+    for node in range(LINKS):
+        f = capture.read(0, 2 ** 64 - 1, node)
+        quiet = ~moving_mask(f["host_us"], events.get(node, []))
+        snr = np.mean(f["rssi"][quiet].astype(float) - f["noise_floor"][quiet])
+        # the LLTF of the primary 20 MHz is the HT-LTF k = m - 32 with noise of its own
+        (lltf, ht) = split(f["csi"][quiet])
+        m = np.r_[-26:0, 1:27]
+        a = lltf[:, m + 32]
+        b = ht[:, m - 32 + 64]
+        noise = np.mean(np.abs(a - b) ** 2) / 2
+        measured = 10 * np.log10(np.mean(np.abs(b) ** 2) / noise - 1)
+        # int8 quantization adds a little noise of its own
+        if abs(snr - SNR_DB) > 3 or measured - snr > 1 or measured - snr < -4:
+            print("link {}: rssi - noise_floor {:.1f} dB, measured SNR {:.1f} dB, configured {} dB".format(
+                node, snr, measured, SNR_DB))
+            err = 1
+    if err == 0:
+        print("rssi - noise_floor and the measured SNR match {} dB".format(SNR_DB))
+    return err
+
+# rms delay spread of the power delay profile, each frame aligned on its strongest tap
+def delay_spread_ns (capture) :
+    f = capture.read(0, 2 ** 64 - 1)
+    (_, ht) = split(f["csi"][::7])
+    h = np.fft.ifft(np.fft.ifftshift(ht, axes=1), axis=1)
+    p = np.abs(h) ** 2
+    peak = np.argmax(p, axis=1)
+    aligned = p[np.arange(len(p))[:, None], (peak[:, None] - 8 + np.arange(48)[None, :]) % 128]
+    pdp = np.mean(aligned, axis=0)
+    pdp = np.maximum(pdp - np.median(pdp[-16:]), 0)
+    t = np.arange(len(pdp)) * 25.0
+    mean = np.sum(pdp * t) / np.sum(pdp)
+    return np.sqrt(np.sum(pdp * (t - mean) ** 2) / np.sum(pdp))
+
+def check_delay_spread () :
+    spreads = [delay_spread_ns(synth("/tmp/synth_check_{}.csic".format(os.getpid()), 20, "-d", d, "-q", 1000)[0])
+               for d in (15, 50, 150)]
+    print("delay spread {:.0f}, {:.0f}, {:.0f} ns measured for 15, 50, 150 ns".format(*spreads))
+    if not (spreads[0] < spreads[1] < spreads[2] and spreads[2] > 2 * spreads[0]):
+        print("delay spread does not follow the configuration")
+        return 1
+    return 0
+
+def auc (pos, neg) :
+    ranks = np.argsort(np.argsort(np.r_[pos, neg])) + 1
+    return (np.sum(ranks[:len(pos)]) - len(pos) * (len(pos) + 1) / 2) / (len(pos) * len(neg))
+
+def check_motion (capture, events) :
+    pos = []
+    neg = []
+    for node in range(LINKS):
+        f = capture.read(0, 2 ** 64 - 1, node)
+        (_, ht) = split(f["csi"])
+        amp = np.abs(ht[:, np.r_[6:63, 66:123]])
+        # relative amplitudes, the AGC gain of each frame divided out
+        amp /= np.mean(amp, axis=1, keepdims=True)
+        moving = moving_mask(f["host_us"], events.get(node, []))
+        for w in range(len(amp) // HZ):
+            s = slice(w * HZ, (w + 1) * HZ)
+            if moving[s].all():
+                pos.append(np.mean(np.var(amp[s], axis=0)))
+            elif not moving[s].any():
+                neg.append(np.mean(np.var(amp[s], axis=0)))
+    a = auc(np.array(pos), np.array(neg))
+    print("motion: {} windows moving, {} quiet, AUC {:.3f} of the amplitude variance".format(len(pos), len(neg), a))
+    if len(pos) < 20 or a < 0.95:
+        print("motion not separable from quiet")
+        return 1
+    return 0
+
+def main () :
+    seconds = int(sys.argv[1]) if len(sys.argv) > 1 else 300
+    path = "/tmp/synth_check_{}.csic".format(os.getpid())
+    (capture, events) = synth(path, seconds)
+    if capture.frames < LINKS * HZ * seconds * 0.99:
+        print("{} frames, expected about {}".format(capture.frames, LINKS * HZ * seconds))
+        return 1
+    err = check_nulls(capture)
+    err |= check_snr(capture, events)
+    err |= check_motion(capture, events)
+    err |= check_delay_spread()
+    (again, _) = synth(path, seconds)
+    (other, _) = synth(path, seconds, "-s", 2)
+    a = capture.read(0, 2 ** 64 - 1)
+    if not np.array_equal(a["csi"], again.read(0, 2 ** 64 - 1)["csi"]) or np.array_equal(a["csi"], other.read(0, 2 ** 64 - 1)["csi"]):
+        print("the same seed does not give the same frames, or another seed does")
+        err = 1
+    if err == 0:
+        print("synthetic CSI checked")
+    return err
+
+if __name__ == "__main__":
+    sys.exit(main())
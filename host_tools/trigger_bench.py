@@ -0,0 +1,186 @@
+#!/usr/bin/env python3
+# Trigger to first frame latency of camera_trigger.CameraTrigger against a stand-in of the
+# ESP32 camera web server on localhost (/control, /status, /capture on one port, a multipart
+# JPEG /stream on the next), and of what it replaces: a new interpreter per trigger that sets the
+# frame size and opens the stream, as camera_streaming.py does.
+#   ./trigger_bench.py [triggers]
+# Checks that the kept connection is used for all triggers, that trigger() returns in
+# microseconds while streaming and with the camera down, and that a burst of triggers makes one
+# stream and triggers in the cooldown are dropped.
+import http.server
+import os
+import socket
+import subprocess
+import sys
+import threading
+import time
+
+import numpy as np
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "active_ap"))
+import camera_trigger
+
+FPS = 25
+JPEG = b'\xff\xd8' + bytes((i * 7) % 251 for i in range(20000)) + b'\xff\xd9'
+
+connections = [0, 0]    # accepted by the control and the stream port
+
+class CameraHandler (http.server.BaseHTTPRequestHandler) :
+    protocol_version = "HTTP/1.1"
+
+    def setup (self) :
+        super().setup()
+        # headers and body go out as separate writes, do not let Nagle hold the body for an ack
+        self.connection.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        connections[self.server.index] += 1
+
+    def log_message (self, *args) :
+        pass
+
+    def _send (self, ctype, body) :
+        self.send_response(200)
+        self.send_header("Content-Type", ctype)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def do_GET (self) :
+        if self.path.startswith("/control"):
+            self._send("text/plain", b"")
+        elif self.path == "/status":
+            self._send("application/json", b'{"framesize":8}')
+        elif self.path == "/capture":
+            self._send("image/jpeg", JPEG)
+        elif self.path == "/stream":
+            self.send_response(200)
+            self.send_header("Content-Type", "multipart/x-mixed-replace;boundary=frame")
+            self.send_header("Connection", "close")
+            self.end_headers()
+            self.close_connection = True
+            try:
+                while True:
+                    self.wfile.write(b"--frame\r\nContent-Type: image/jpeg\r\nContent-Length: %d\r\n\r\n" % len(JPEG))
+                    self.wfile.write(JPEG + b"\r\n")
+                    time.sleep(1.0 / FPS)
+            except OSError:
+                pass
+        else:
+            self.send_error(404)
+
+def serve (port, index) :
+    server = http.server.ThreadingHTTPServer(("127.0.0.1", port), CameraHandler)
+    server.daemon_threads = True
+    server.index = index
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    return server
+
+# camera_streaming.py without the window: a new interpreter, the frame size, then the stream
+# until its first frame
+SPAWN = """
+import http.client, sys
+host, port = "127.0.0.1", int(sys.argv[1])
+conn = http.client.HTTPConnection(host, port)
+conn.request("GET", "/control?var=framesize&val=8")
+conn.getresponse().read()
+stream = http.client.HTTPConnection(host, port + 1)
+stream.request("GET", "/stream")
+resp = stream.getresponse()
+buf = bytes()
+while buf.find(b'\\xff\\xd9') == -1:
+    buf += resp.read1(65536)
+print("frame", flush=True)
+"""
+
+def spawn_latency (port) :
+    start = time.monotonic()
+    p = subprocess.Popen([sys.executable, "-c", SPAWN, str(port)], stdout=subprocess.PIPE)
+    p.stdout.readline()
+    latency = time.monotonic() - start
+    p.kill()
+    p.wait()
+    return latency
+
+def main () :
+    triggers = int(sys.argv[1]) if len(sys.argv) > 1 else 20
+    control = serve(0, 0)
+    port = control.server_address[1]
+    try:
+        stream = serve(port + 1, 1)
+    except OSError:
+        print("port {} busy, run again".format(port + 1))
+        return 1
+    err = 0
+
+    spawned = [spawn_latency(port) for _ in range(min(triggers, 10))]
+
+    first = threading.Event()
+    cam = camera_trigger.CameraTrigger("127.0.0.1", port, port + 1, hold_s=0.2, cooldown_s=0.1, keepalive_s=0.5,
+                                       on_frame=lambda jpeg, t: first.set())
+    cam.start()
+    time.sleep(0.3)
+    warm = []
+    for _ in range(triggers):
+        first.clear()
+        cam.trigger()
+        first.wait(2)
+        warm.append(cam.latency_s if cam.latency_s is not None else float("inf"))
+        # let the stream and the cooldown run out
+        while cam.state != camera_trigger.COOLDOWN or time.monotonic() < cam.cooldown_until:
+            time.sleep(0.01)
+    print("new interpreter per trigger: {:.1f} ms median, {:.1f} ms max to the first frame".format(
+          np.median(spawned) * 1e3, max(spawned) * 1e3))
+    print("CameraTrigger:               {:.2f} ms median, {:.2f} ms max to the first frame, {} triggers".format(
+          np.median(warm) * 1e3, max(warm) * 1e3, triggers))
+    if connections[0] != len(spawned) + 1 or cam.streams != triggers:
+        print("{} connections to the camera for {} triggers and {} spawns, {} streams".format(
+              connections[0], triggers, len(spawned), cam.streams))
+        err = 1
+    if max(warm) > 1:
+        print("a trigger got no frame")
+        err = 1
+
+    # a burst while streaming: one stream, then the cooldown drops triggers
+    cam.hold_s = 0.3
+    cam.cooldown_s = 0.5
+    streams = cam.streams
+    n = 0
+    busy = 0.0
+    start = time.monotonic()
+    while time.monotonic() - start < 0.5:
+        t = time.perf_counter()
+        cam.trigger()
+        busy += time.perf_counter() - t
+        n += 1
+        time.sleep(0.0005)
+    while cam.state != camera_trigger.COOLDOWN:
+        time.sleep(0.01)
+    suppressed = cam.suppressed
+    cam.trigger()
+    print("burst of {} triggers in 0.5 s: {} stream, {:.1f} us per trigger() while streaming, {} frames".format(
+          n, cam.streams - streams, busy / n * 1e6, cam.frames))
+    if cam.streams - streams != 1 or cam.suppressed != suppressed + 1:
+        print("burst made {} streams, {} triggers dropped in the cooldown".format(cam.streams - streams,
+              cam.suppressed - suppressed))
+        err = 1
+
+    # the camera gone: trigger() still returns at once
+    control.shutdown()
+    control.server_close()
+    stream.shutdown()
+    stream.server_close()
+    time.sleep(0.6)
+    t = time.perf_counter()
+    for _ in range(1000):
+        cam.trigger()
+    down = (time.perf_counter() - t) * 1e3
+    print("camera down: {:.1f} us per trigger()".format(down))
+    if down > 100:
+        print("trigger() blocks with the camera down")
+        err = 1
+    cam.stop()
+    if err == 0:
+        print("camera trigger checked")
+    return err
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -15,6 +15,7 @@
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 #include "esp_netif.h"
 #include "protocol_examples_common.h"
@@ -25,6 +26,8 @@
 #include <lwip/netdb.h>
 #include "addr_from_stdin.h"
 
+#include "../../_components/pacer_component.h"
+
 #if defined(CONFIG_EXAMPLE_IPV4)
 #define HOST_IP_ADDR CONFIG_EXAMPLE_IPV4_ADDR // this is set to 192.168.4.1, i.e. the soft-ap
 #elif defined(CONFIG_EXAMPLE_IPV6)
@@ -34,6 +37,7 @@
 #endif
 
 #define PORT CONFIG_EXAMPLE_PORT
+#define REPORT_US 5000000
 
 static const char *TAG = "example";
 static const char *payload = "Message from ESP32 ";
@@ -46,6 +50,11 @@ static void udp_client_task(void *pvParameters)
     int addr_family = 0;
     int ip_protocol = 0;
 
+    // CONFIG_EXAMPLE_PACKET_RATE frames per second, kept across socket restarts
+    csi_pacer_t pacer;
+    pacer_start(&pacer, CONFIG_EXAMPLE_PACKET_RATE, CONFIG_EXAMPLE_PACKET_DITHER_US);
+    int64_t next_report_us = esp_timer_get_time() + REPORT_US;
+
     while (1) {
 
 #if defined(CONFIG_EXAMPLE_IPV4)
@@ -77,13 +86,24 @@ static void udp_client_task(void *pvParameters)
 
         while (1) {
 
+            pacer_wait(&pacer);
             int err = sendto(sock, payload, strlen(payload), 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
-            if (err < 0) {
+            int64_t now = esp_timer_get_time();
+            pacer_result(&pacer, now, err >= 0);
+            // out of buffers the pacer tries again, anything else restarts the socket
+            if (err < 0 && errno != ENOMEM) {
                 ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
                 vTaskDelay(2000 / portTICK_PERIOD_MS);
                 break;
             }
-            ESP_LOGI(TAG, "Message sent");
+
+            if (now >= next_report_us) {
+                pacer_report_t r;
+                pacer_report(&pacer, now, &r);
+                ESP_LOGI(TAG, "%.2f frames/s of %d, jitter %.0f us, %+.0f us late, %u failed, %u skipped",
+                         r.rate_hz, CONFIG_EXAMPLE_PACKET_RATE, r.jitter_us, r.late_us, r.failed, r.skipped);
+                next_report_us = now + REPORT_US;
+            }
 
             // For now, we do not need clients to recv any data.
             // struct sockaddr_in source_addr; // Large enough for both IPv4 or IPv6
@@ -105,9 +125,6 @@ static void udp_client_task(void *pvParameters)
             //         break;
             //     }
             // }
-
-            // 100 ms to provide 10 frames per second
-            vTaskDelay(100 / portTICK_PERIOD_MS);
         }
 
         if (sock != -1) {